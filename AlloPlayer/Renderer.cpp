@@ -1,5 +1,14 @@
 #include "Renderer.hpp"
 
+const int     PIXEL_UNPACK_BUFFERS_COUNT = 3;         // per face
+const GLuint64 FENCE_TIMEOUT             = 100000000; // ns; a buffer is reused at the latest after this
+
+static bool hasExtension(const char* name)
+{
+    const char* extensions = (const char*)glGetString(GL_EXTENSIONS);
+    return extensions && strstr(extensions, name);
+}
+
 static const char* defaultVertShader = AL_STRINGIFY
 (
     void main(void)
@@ -43,15 +52,11 @@ Renderer::Renderer()
     :
     al::OmniApp("AlloPlayer", false, 2048), gammaMin(0.0f), gammaMax(1.0f), gammaPow(1.0f),
     forRotation(0, 0, 0), forAngle(M_PI*2.0), rotation(0, 0, 0), rotationSpeed(0.5),
-    forceMono(false)
+    forceMono(false), pixelUnpackBufferStreaming(true), usePixelUnpackBuffers(false), uploadingCubemap(nullptr),
+    isReleaseRequested(false)
 {
     nav().smooth(0.8);
     
-    for (int i = 0; i < 1; i++)
-    {
-        cubemapPool.push(nullptr);
-    }
-    
     for (int i = 0; i < StereoCubemap::MAX_EYES_COUNT * Cubemap::MAX_FACES_COUNT; i++)
     {
         textures.push_back(YUV420PTexture());
@@ -60,6 +65,11 @@ Renderer::Renderer()
 
 Renderer::~Renderer()
 {
+    copyFaceUploads.close();
+    if (copyThread.joinable())
+    {
+        copyThread.join();
+    }
 }
 
 bool Renderer::onCreate()
@@ -75,6 +85,24 @@ bool Renderer::onCreate()
     yuvGammaShader.attach(vert).attach(frag).link();
     yuvGammaShader.printLog();
     
+    // Pixel buffer objects, map_buffer_range and sync objects are all in OpenGL 3.2 and Mesa's software renderers
+    if (pixelUnpackBufferStreaming)
+    {
+        usePixelUnpackBuffers = hasExtension("GL_ARB_pixel_buffer_object") &&
+                                hasExtension("GL_ARB_map_buffer_range") &&
+                                hasExtension("GL_ARB_sync");
+        if (!usePixelUnpackBuffers)
+        {
+            std::cout << "Pixel unpack buffers are not supported. Textures are uploaded synchronously." << std::endl;
+        }
+    }
+    if (usePixelUnpackBuffers)
+    {
+        pixelUnpackBuffers.resize(textures.size(), std::vector<PixelUnpackBuffer>(PIXEL_UNPACK_BUFFERS_COUNT));
+        nextPixelUnpackBuffers.resize(textures.size(), 0);
+        copyThread = boost::thread(boost::bind(&Renderer::copyLoop, this));
+    }
+    
     return OmniApp::onCreate();
 }
 
@@ -84,119 +112,60 @@ bool Renderer::onFrame()
     
     boost::mutex::scoped_lock(uniformsMutex);
     
-    StereoCubemap* cubemap;
-    if (cubemapBuffer.tryPop(cubemap))
     {
-        for (int j = 0; j < cubemap->getEyesCount(); j++)
+        boost::mutex::scoped_lock lock(releaseMutex);
+        if (isReleaseRequested)
         {
-            Cubemap* eye;
-            if (forceMono && j == 1)
+            if (uploadingCubemap)
             {
-                eye = cubemap->getEye(0);
+                // The copy thread may still read the cubemap's pixels
+                std::vector<FaceUpload>* copiedUploads;
+                if (usePixelUnpackBuffers) copiedFaceUploads.waitAndPop(copiedUploads);
+                finishFaceUploads();
             }
-            else
-            {
-                eye = cubemap->getEye(j);
-            }
-            
-            for (int i = 0; i < eye->getFacesCount(); i++)
+            cubemapMailbox.reset();
+            isReleaseRequested = false;
+            releaseCondition.notify_all();
+        }
+    }
+    
+    boost::chrono::steady_clock::time_point uploadStart = boost::chrono::steady_clock::now();
+    bool hasUploaded = false;
+    if (usePixelUnpackBuffers)
+    {
+        // The copy thread is done with the last cubemap -> only the GPU-side copies are left
+        std::vector<FaceUpload>* copiedUploads;
+        if (copiedFaceUploads.tryPop(copiedUploads))
+        {
+            finishFaceUploads();
+            hasUploaded = true;
+        }
+        
+        // Only the faces that changed since the last cubemap are uploaded
+        if (!uploadingCubemap)
+        {
+            uploadingCubemap = cubemapMailbox.take();
+            if (uploadingCubemap)
             {
-                CubemapFace* face = eye->getFace(i);
-                
-                // Reorder faces so that they are displayed correctly in the AlloSphere
-                int texI;
-                if (i == 0)
-                {
-                    texI = 1;
-                }
-                else if (i == 1)
-                {
-                    texI = 0;
-                }
-                else if (i == 2)
-                {
-                    texI = 4;
-                }
-                else if (i == 3)
-                {
-                    texI = 5;
-                }
-                else if (i == 4)
-                {
-                    texI = 2;
-                }
-                else if (i == 5)
-                {
-                    texI = 3;
-                }
-                else
-                {
-                    texI = i;
-                }
-                YUV420PTexture& tex = textures[texI + j * Cubemap::MAX_FACES_COUNT];
-                
-                if (face)
-                {
-                    // create texture if not already created
-                    if (!tex.yTexture)
-                    {
-                        tex.yTexture = new al::Texture(face->getContent()->getWidth(),
-                                                       face->getContent()->getHeight(),
-                                                       al::Graphics::LUMINANCE,
-                                                       al::Graphics::UBYTE);
-                        tex.uTexture = new al::Texture(face->getContent()->getWidth()/2,
-                                                       face->getContent()->getHeight()/2,
-                                                       al::Graphics::LUMINANCE,
-                                                       al::Graphics::UBYTE);
-                        tex.vTexture = new al::Texture(face->getContent()->getWidth()/2,
-                                                       face->getContent()->getHeight()/2,
-                                                       al::Graphics::LUMINANCE,
-                                                       al::Graphics::UBYTE);
-                        textures[texI + j * Cubemap::MAX_FACES_COUNT] = tex;
-                        
-                        // In case a face is mono use the same the texture for left and right.
-                        // By doing so, image will become twice as bright in the AlloSphere.
-                        if (j == 0 && cubemap->getEyesCount() > 1 && cubemap->getEye(1)->getFacesCount() <= i)
-                        {
-                            textures[texI + Cubemap::MAX_FACES_COUNT] = tex;
-                        }
-                    }
-                    
-                    tex.yTexture->bind();
-                    glTexSubImage2D(tex.yTexture->target(), 0,
-                                    0, 0,
-                                    tex.yTexture->width(),
-                                    tex.yTexture->height(),
-                                    tex.yTexture->format(),
-                                    tex.yTexture->type(),
-                                    face->getContent()->getPixels());
-                    tex.vTexture->bind();
-                    glTexSubImage2D(tex.vTexture->target(), 0,
-                                    0, 0,
-                                    tex.vTexture->width(),
-                                    tex.vTexture->height(),
-                                    tex.vTexture->format(),
-                                    tex.vTexture->type(),
-                                    (char*)face->getContent()->getPixels() +
-                                        face->getContent()->getWidth() * face->getContent()->getHeight());
-                    tex.uTexture->bind();
-                    glTexSubImage2D(tex.uTexture->target(), 0,
-                                    0, 0,
-                                    tex.uTexture->width(),
-                                    tex.uTexture->height(),
-                                    tex.uTexture->format(),
-                                    tex.uTexture->type(),
-                                    (char*)face->getContent()->getPixels() +
-                                        face->getContent()->getWidth() * face->getContent()->getHeight() +
-                                        (face->getContent()->getWidth()/2) * (face->getContent()->getHeight()/2));
-                    tex.uTexture->unbind();
-                    
-                    if (onDisplayedCubemapFace) onDisplayedCubemapFace(this, i + j * Cubemap::MAX_FACES_COUNT);
-                }
+                startFaceUploads(uploadingCubemap);
+                hasUploaded = true;
             }
         }
-        
-        cubemapPool.push(cubemap);
+    }
+    else
+    {
+        uploadingCubemap = cubemapMailbox.take();
+        if (uploadingCubemap)
+        {
+            collectFaceUploads(uploadingCubemap);
+            finishFaceUploads();
+            hasUploaded = true;
+        }
+    }
+    
+    if (hasUploaded && onUploadedCubemap)
+    {
+        onUploadedCubemap(this, boost::chrono::duration_cast<boost::chrono::microseconds>(boost::chrono::steady_clock::now() - uploadStart));
     }
     
     // Set uniforms
@@ -220,21 +189,248 @@ bool Renderer::onFrame()
 
 StereoCubemap* Renderer::onNextCubemap(CubemapSource* source, StereoCubemap* cubemap)
 {
-    StereoCubemap* oldCubemap;
-    if (!cubemapPool.tryPop(oldCubemap))
+    return cubemapMailbox.publish(cubemap);
+}
+
+void Renderer::releaseCubemaps()
+{
+    boost::mutex::scoped_lock lock(releaseMutex);
+    isReleaseRequested = true;
+    while (isReleaseRequested)
     {
-        if (cubemapPool.isClosed())
+        releaseCondition.wait(lock);
+    }
+}
+
+void Renderer::collectFaceUploads(StereoCubemap* cubemap)
+{
+    faceUploads.clear();
+    for (int j = 0; j < cubemap->getEyesCount(); j++)
+    {
+        Cubemap* eye;
+        if (forceMono && j == 1)
         {
-            abort();
+            eye = cubemap->getEye(0);
         }
         else
         {
-            return cubemap;
+            eye = cubemap->getEye(j);
+        }
+        
+        for (int i = 0; i < eye->getFacesCount(); i++)
+        {
+            CubemapFace* face = eye->getFace(i);
+            if (!face)
+            {
+                continue;
+            }
+            
+            // Reorder faces so that they are displayed correctly in the AlloSphere
+            int texI;
+            if (i == 0)
+            {
+                texI = 1;
+            }
+            else if (i == 1)
+            {
+                texI = 0;
+            }
+            else if (i == 2)
+            {
+                texI = 4;
+            }
+            else if (i == 3)
+            {
+                texI = 5;
+            }
+            else if (i == 4)
+            {
+                texI = 2;
+            }
+            else if (i == 5)
+            {
+                texI = 3;
+            }
+            else
+            {
+                texI = i;
+            }
+            YUV420PTexture& tex = textures[texI + j * Cubemap::MAX_FACES_COUNT];
+            
+            // create texture if not already created
+            if (!tex.yTexture)
+            {
+                tex.yTexture = new al::Texture(face->getContent()->getWidth(),
+                                               face->getContent()->getHeight(),
+                                               al::Graphics::LUMINANCE,
+                                               al::Graphics::UBYTE);
+                tex.uTexture = new al::Texture(face->getContent()->getWidth()/2,
+                                               face->getContent()->getHeight()/2,
+                                               al::Graphics::LUMINANCE,
+                                               al::Graphics::UBYTE);
+                tex.vTexture = new al::Texture(face->getContent()->getWidth()/2,
+                                               face->getContent()->getHeight()/2,
+                                               al::Graphics::LUMINANCE,
+                                               al::Graphics::UBYTE);
+                textures[texI + j * Cubemap::MAX_FACES_COUNT] = tex;
+                
+                // In case a face is mono use the same the texture for left and right.
+                // By doing so, image will become twice as bright in the AlloSphere.
+                if (j == 0 && cubemap->getEyesCount() > 1 && cubemap->getEye(1)->getFacesCount() <= i)
+                {
+                    textures[texI + Cubemap::MAX_FACES_COUNT] = tex;
+                }
+            }
+            
+            // Planes come straight from the decoder and may have padded lines
+            FaceUpload upload;
+            upload.textureIndex     = texI + j * Cubemap::MAX_FACES_COUNT;
+            upload.displayedFace    = i + j * Cubemap::MAX_FACES_COUNT;
+            upload.content          = face->getContent();
+            upload.buffer           = nullptr;
+            upload.planeTextures[0] = tex.yTexture;
+            upload.planeTextures[1] = tex.vTexture;
+            upload.planeTextures[2] = tex.uTexture;
+            size_t offset = 0;
+            for (int p = 0; p < 3; p++)
+            {
+                upload.planeOffsets[p] = offset;
+                upload.planeSizes[p]   = upload.content->getLineSize(p) * upload.planeTextures[p]->height();
+                upload.mappedPlanes[p] = nullptr;
+                offset += upload.planeSizes[p];
+            }
+            faceUploads.push_back(upload);
+        }
+    }
+}
+
+void Renderer::startFaceUploads(StereoCubemap* cubemap)
+{
+    collectFaceUploads(cubemap);
+    
+    for (FaceUpload& upload : faceUploads)
+    {
+        PixelUnpackBuffer& buffer = pixelUnpackBuffers[upload.textureIndex][nextPixelUnpackBuffers[upload.textureIndex]];
+        nextPixelUnpackBuffers[upload.textureIndex] = (nextPixelUnpackBuffers[upload.textureIndex] + 1) % PIXEL_UNPACK_BUFFERS_COUNT;
+        
+        // The GPU may still be reading what the buffer got the last time
+        if (buffer.fence)
+        {
+            glClientWaitSync(buffer.fence, GL_SYNC_FLUSH_COMMANDS_BIT, FENCE_TIMEOUT);
+            glDeleteSync(buffer.fence);
+            buffer.fence = 0;
+        }
+        if (!buffer.id)
+        {
+            glGenBuffers(1, &buffer.id);
+        }
+        
+        size_t size = upload.planeOffsets[2] + upload.planeSizes[2];
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.id);
+        if (buffer.size < size)
+        {
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+            buffer.size = size;
+        }
+        unsigned char* mapped = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER,
+                                                                 0,
+                                                                 size,
+                                                                 GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        
+        // Without a mapping the face is uploaded straight from the cubemap
+        if (mapped)
+        {
+            upload.buffer = &buffer;
+            for (int p = 0; p < 3; p++)
+            {
+                upload.mappedPlanes[p] = mapped + upload.planeOffsets[p];
+            }
+        }
+    }
+    
+    copyFaceUploads.push(&faceUploads);
+}
+
+void Renderer::finishFaceUploads()
+{
+    for (FaceUpload& upload : faceUploads)
+    {
+        if (upload.buffer)
+        {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, upload.buffer->id);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        }
+        
+        for (int p = 0; p < 3; p++)
+        {
+            al::Texture* texture = upload.planeTextures[p];
+            
+            // Binding may allocate the texture -> not while the buffer is bound
+            texture->bind();
+            const GLvoid* pixels;
+            if (upload.buffer)
+            {
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, upload.buffer->id);
+                pixels = (const GLvoid*)upload.planeOffsets[p];
+            }
+            else
+            {
+                pixels = upload.content->getPlane(p);
+            }
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, upload.content->getLineSize(p));
+            glTexSubImage2D(texture->target(), 0,
+                            0, 0,
+                            texture->width(),
+                            texture->height(),
+                            texture->format(),
+                            texture->type(),
+                            pixels);
+            if (upload.buffer)
+            {
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            }
+            texture->unbind();
+        }
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        
+        if (upload.buffer)
+        {
+            // The buffer may be refilled once the GPU has copied it into the textures
+            upload.buffer->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
         }
+        
+        if (onDisplayedCubemapFace) onDisplayedCubemapFace(this, upload.displayedFace);
     }
     
-    cubemapBuffer.push(cubemap);
-    return oldCubemap;
+    // Not before all eyes are done since forceMono shows the left faces twice
+    for (int j = 0; j < uploadingCubemap->getEyesCount(); j++)
+    {
+        Cubemap* eye = uploadingCubemap->getEye(j);
+        for (int i = 0; i < eye->getFacesCount(); i++)
+        {
+            eye->getFace(i, true)->setNewFaceFlag(false);
+        }
+    }
+    faceUploads.clear();
+    uploadingCubemap = nullptr;
+}
+
+void Renderer::copyLoop()
+{
+    std::vector<FaceUpload>* uploads;
+    while (copyFaceUploads.waitAndPop(uploads))
+    {
+        for (FaceUpload& upload : *uploads)
+        {
+            for (int p = 0; p < 3 && upload.buffer; p++)
+            {
+                memcpy(upload.mappedPlanes[p], upload.content->getPlane(p), upload.planeSizes[p]);
+            }
+        }
+        copiedFaceUploads.push(uploads);
+    }
 }
 
 void Renderer::onDraw(al::Graphics& gl)
@@ -362,6 +558,16 @@ void Renderer::setForceMono(bool forceMono)
     this->forceMono = forceMono;
 }
 
+void Renderer::setPixelUnpackBufferStreaming(bool enabled)
+{
+    pixelUnpackBufferStreaming = enabled;
+}
+
+void Renderer::setOnUploadedCubemap(const std::function<void (Renderer*, boost::chrono::microseconds)>& callback)
+{
+    onUploadedCubemap = callback;
+}
+
 void Renderer::setCubemapSource(CubemapSource* cubemapSource)
 {
     cubemapSource->setOnNextCubemap(boost::bind(&Renderer::onNextCubemap,
@@ -418,6 +624,11 @@ bool Renderer::getForceMono()
     return forceMono;
 }
 
+bool Renderer::getPixelUnpackBufferStreaming()
+{
+    return pixelUnpackBufferStreaming;
+}
+
 std::vector<std::pair<int, int>> Renderer::getFaceResolutions()
 {
     boost::mutex::scoped_lock(uniformsMutex);
@@ -2,6 +2,7 @@
 
 #include <alloutil/al_OmniApp.hpp>
 #include <boost/thread.hpp>
+#include "AlloShared/CubemapMailbox.hpp"
 #include "AlloShared/ConcurrentQueue.hpp"
 #include "AlloReceiver/AlloReceiver.h"
 
@@ -21,6 +22,8 @@ public:
     
     void setOnDisplayedFrame(const std::function<void (Renderer*)>& callback);
     void setOnDisplayedCubemapFace(const std::function<void (Renderer*, int)>& callback);
+    // Called with the time the render thread spent uploading faces in a frame
+    void setOnUploadedCubemap(const std::function<void (Renderer*, boost::chrono::microseconds)>& callback);
     
     void setGammaMin(float gammaMin);
     void setGammaMax(float gammaMax);
@@ -30,7 +33,14 @@ public:
     void setRotation(const al::Vec3f& rotation);
     void setRotationSpeed(float speed);
     void setForceMono(bool forceMono);
+    // Copy the faces into pixel unpack buffers on a separate thread so that the render thread
+    // only issues GPU-side copies. Falls back to synchronous uploads if not supported.
+    // Must be set before the renderer starts.
+    void setPixelUnpackBufferStreaming(bool enabled);
     void setCubemapSource(CubemapSource* source);
+    // Stops using the cubemaps of the current source, e.g. before it is destroyed.
+    // The source must not hand out cubemaps anymore. Waits for the next frame.
+    void releaseCubemaps();
     
     float                            getGammaMin();
     float                            getGammaMax();
@@ -41,10 +51,12 @@ public:
     float                            getRotationSpeed();
     std::vector<std::pair<int, int>> getFaceResolutions();
     bool                             getForceMono();
+    bool                             getPixelUnpackBufferStreaming();
     
 protected:
     std::function<void (Renderer*)> onDisplayedFrame;
     std::function<void (Renderer*, int)> onDisplayedCubemapFace;
+    std::function<void (Renderer*, boost::chrono::microseconds)> onUploadedCubemap;
     
 private:
     struct YUV420PTexture
@@ -55,8 +67,36 @@ private:
         YUV420PTexture() : yTexture(nullptr), uTexture(nullptr), vTexture(nullptr) {}
     };
     
-    ConcurrentQueue<StereoCubemap*> cubemapBuffer;
-    ConcurrentQueue<StereoCubemap*> cubemapPool;
+    struct PixelUnpackBuffer
+    {
+        GLuint id;
+        size_t size;
+        GLsync fence; // set when the GPU got the copies out of it
+        PixelUnpackBuffer() : id(0), size(0), fence(0) {}
+    };
+    
+    // One face of a cubemap on its way to the textures
+    struct FaceUpload
+    {
+        int                textureIndex;
+        int                displayedFace;
+        Frame*             content;
+        al::Texture*       planeTextures[3];
+        size_t             planeOffsets[3];  // in the buffer
+        size_t             planeSizes[3];
+        PixelUnpackBuffer* buffer;           // nullptr if the face is uploaded straight from the cubemap
+        unsigned char*     mappedPlanes[3];
+    };
+    
+    // Collects the changed faces of the cubemap and creates their textures
+    void collectFaceUploads(StereoCubemap* cubemap);
+    // Maps a buffer for each changed face and lets the copy thread fill them
+    void startFaceUploads(StereoCubemap* cubemap);
+    // Issues the copies into the textures and hands the cubemap back
+    void finishFaceUploads();
+    void copyLoop();
+    
+    CubemapMailbox                   cubemapMailbox;
     std::vector<YUV420PTexture>      textures;
     al_sec                           now;
     al::ShaderProgram                yuvGammaShader;
@@ -69,4 +109,19 @@ private:
     al::Vec3f                        rotation;
     float                            rotationSpeed;
     bool                             forceMono;
+    
+    // Texture streaming
+    bool                                        pixelUnpackBufferStreaming;
+    bool                                        usePixelUnpackBuffers;
+    std::vector<std::vector<PixelUnpackBuffer>> pixelUnpackBuffers; // ring per texture
+    std::vector<int>                            nextPixelUnpackBuffers;
+    StereoCubemap*                              uploadingCubemap;
+    std::vector<FaceUpload>                     faceUploads;
+    ConcurrentQueue<std::vector<FaceUpload>*>   copyFaceUploads;
+    ConcurrentQueue<std::vector<FaceUpload>*>   copiedFaceUploads;
+    boost::thread                               copyThread;
+    
+    boost::mutex                                releaseMutex;
+    boost::condition_variable                   releaseCondition;
+    bool                                        isReleaseRequested;
 };
@@ -15,11 +15,17 @@
 #include "AlloReceiver/AlloReceiver.h"
 #include "AlloReceiver/Stats.hpp"
 #include "AlloReceiver/H264CubemapSource.h"
+#include "AlloReceiver/FaceSelection.hpp"
 
 #define DEG_DIV_RAD 57.29577951308233
 #define RAD_DIV_DEG  0.01745329251994
 
-const unsigned int DEFAULT_SINK_BUFFER_SIZE = 2000000000;
+static RTSPCubemapSourceClient::Options defaultReceiverOptions()
+{
+    RTSPCubemapSourceClient::Options options;
+    options.format = NATIVE_PIX_FMT; // the renderer converts YUV420P itself
+    return options;
+}
 
 static Stats         stats;
 static Renderer      renderer;
@@ -27,14 +33,36 @@ static auto          lastStatsTime    = boost::chrono::steady_clock::now();
 static std::string   statsFormat      = AlloReceiver::formatStringMaker();
 static bool          noDisplay        = false;
 static std::string   url              = "";
-static std::string   interfaceAddress = "0.0.0.0";
-static unsigned long bufferSize       = DEFAULT_SINK_BUFFER_SIZE;
-static bool          matchStereoPairs = false;
+static std::vector<std::pair<std::string, std::vector<int>>> servers; // more servers with the cubemap faces they send
+static RTSPCubemapSourceClient::Options receiverOptions = defaultReceiverOptions();
 static boost::filesystem::path configFilePath;
-static bool          robustSyncing    = false;
-static size_t        maxFrameMapSize  = 2;
+static std::vector<FaceSelection::Frustum> projectorFrusta; // the faces they overlap are received unless faces are given
+static bool          adaptiveDegradation  = true;
+static std::vector<int> lowPriorityFaces  = {4, 5, 10, 11}; // top and bottom
+static boost::chrono::microseconds presentationLatency(0); // 0 means show cubemaps as soon as they are complete
+static boost::chrono::microseconds clockOffset(0);         // how far the server's clock is ahead of ours
+static bool estimateClockOffset = true;                     // from the server's RTCP sender reports instead of clockOffset
 static std::string   logPath          = ".";
 
+// Comma-separated indices of cubemap faces (0-11)
+static std::vector<int> parseFaceIndices(const std::string& value)
+{
+    std::vector<std::string> indices;
+    boost::split(indices, value, boost::is_any_of(","));
+    std::vector<int> faces;
+    for (const std::string& index : indices)
+    {
+        int face = boost::lexical_cast<int>(index);
+        if (face < 0 || face >= StereoCubemap::MAX_EYES_COUNT * Cubemap::MAX_FACES_COUNT)
+        {
+            throw std::invalid_argument("Face indices must be between 0 and " +
+                                        std::to_string(StereoCubemap::MAX_EYES_COUNT * Cubemap::MAX_FACES_COUNT - 1));
+        }
+        faces.push_back(face);
+    }
+    return faces;
+}
+
 StereoCubemap* onNextCubemap(CubemapSource* source, StereoCubemap* cubemap)
 {
     for (int i = 0; i < cubemap->getEye(0)->getFacesCount(); i++)
@@ -75,6 +103,61 @@ void setOnScheduledFrameInCubemap(CubemapSource* source, int face)
     stats.store(StatsUtils::CubemapFace(face, StatsUtils::CubemapFace::SCHEDULED));
 }
 
+void onCollectedFrame(CubemapSource* source, int face, boost::chrono::microseconds latency)
+{
+    stats.store(StatsUtils::CollectedFrame(face, latency));
+}
+
+void onCollectorIdle(CubemapSource* source, boost::chrono::microseconds duration)
+{
+    stats.store(StatsUtils::CollectorIdle(duration));
+}
+
+void onReleasedCubemap(CubemapSource* source, H264CubemapSource::ReleaseStatus status)
+{
+    stats.store(StatsUtils::ReleasedCubemap((StatsUtils::ReleasedCubemap::Status)status));
+}
+
+void onLateFrame(CubemapSource* source, int face)
+{
+    stats.store(StatsUtils::LateFrame(face));
+}
+
+void onDroppedFrame(CubemapSource* source, int face)
+{
+    stats.store(StatsUtils::DroppedFrame(face));
+}
+
+void onDecodingTime(CubemapSource* source, int face, boost::chrono::microseconds duration)
+{
+    stats.store(StatsUtils::DecodingTime(face, duration));
+}
+
+void onDegradationLevelChanged(CubemapSource* source, DecodeOverloadController::Level oldLevel, DecodeOverloadController::Level newLevel)
+{
+    stats.store(StatsUtils::DegradationLevelChange(oldLevel, newLevel));
+}
+
+void onRecovered(CubemapSource* source, boost::chrono::microseconds timeToPicture)
+{
+    stats.store(StatsUtils::Recovery(timeToPicture));
+}
+
+void onPresentationSkew(CubemapSource* source, boost::chrono::microseconds skew)
+{
+    stats.store(StatsUtils::PresentationSkew(skew));
+}
+
+void onCubemapLatency(CubemapSource* source, boost::chrono::microseconds latency)
+{
+    stats.store(StatsUtils::CubemapLatency(latency));
+}
+
+void onServerSkew(CubemapSource* source, int server, boost::chrono::microseconds skew)
+{
+    stats.store(StatsUtils::ServerSkew(server, skew));
+}
+
 void onDisplayedCubemapFace(Renderer* renderer, int face)
 {
     stats.store(StatsUtils::CubemapFace(face, StatsUtils::CubemapFace::DISPLAYED));
@@ -85,6 +168,19 @@ void onDisplayedFrame(Renderer* renderer)
     stats.store(StatsUtils::Cubemap());
 }
 
+void onUploadedCubemap(Renderer* renderer, boost::chrono::microseconds duration)
+{
+    stats.store(StatsUtils::TextureUpload(duration));
+}
+
+void onWillDestroyCubemapSource(RTSPCubemapSourceClient* client, CubemapSource* cubemapSource)
+{
+    if (!noDisplay)
+    {
+        renderer.releaseCubemaps();
+    }
+}
+
 void onDidConnect(RTSPCubemapSourceClient* client, CubemapSource* cubemapSource)
 {
     H264CubemapSource* h264CubemapSource = dynamic_cast<H264CubemapSource*>(cubemapSource);
@@ -96,6 +192,28 @@ void onDidConnect(RTSPCubemapSourceClient* client, CubemapSource* cubemapSource)
         h264CubemapSource->setOnColorConvertedFrame    (boost::bind(&onColorConvertedFrame,        _1, _2, _3, _4));
         h264CubemapSource->setOnAddedFrameToCubemap    (boost::bind(&onAddedFrameToCubemap,        _1, _2));
         h264CubemapSource->setOnScheduledFrameInCubemap(boost::bind(&setOnScheduledFrameInCubemap, _1, _2));
+        h264CubemapSource->setOnCollectedFrame         (boost::bind(&onCollectedFrame,             _1, _2, _3));
+        h264CubemapSource->setOnCollectorIdle          (boost::bind(&onCollectorIdle,              _1, _2));
+        h264CubemapSource->setOnReleasedCubemap        (boost::bind(&onReleasedCubemap,            _1, _2));
+        h264CubemapSource->setOnLateFrame              (boost::bind(&onLateFrame,                  _1, _2));
+        h264CubemapSource->setOnDroppedFrame           (boost::bind(&onDroppedFrame,               _1, _2));
+        h264CubemapSource->setOnDecodingTime           (boost::bind(&onDecodingTime,               _1, _2, _3));
+        h264CubemapSource->setOnDegradationLevelChanged(boost::bind(&onDegradationLevelChanged,    _1, _2, _3));
+        h264CubemapSource->setOnRecovered              (boost::bind(&onRecovered,                  _1, _2));
+        h264CubemapSource->setOnPresentationSkew       (boost::bind(&onPresentationSkew,           _1, _2));
+        h264CubemapSource->setOnCubemapLatency         (boost::bind(&onCubemapLatency,             _1, _2));
+        h264CubemapSource->setOnServerSkew             (boost::bind(&onServerSkew,                 _1, _2, _3));
+        h264CubemapSource->setAdaptiveDegradation(adaptiveDegradation);
+        h264CubemapSource->setLowPriorityFaces(lowPriorityFaces);
+        h264CubemapSource->setPresentationLatency(presentationLatency);
+        if (estimateClockOffset)
+        {
+            h264CubemapSource->setClockOffsetEstimator(client->getClockOffsetEstimator());
+        }
+        else
+        {
+            h264CubemapSource->setClockOffset(clockOffset);
+        }
     }
     
     if (noDisplay)
@@ -232,12 +350,21 @@ int main(int argc, char* argv[])
                 url = values[0];
             }
         },
+        {
+            "server",
+            {"rtsp_url", "i,j,..."},
+            [](const std::vector<std::string>& values)
+            {
+                // The server's faces in the order of its SDP become these cubemap faces
+                servers.push_back(std::make_pair(values[0], parseFaceIndices(values[1])));
+            }
+        },
         {
             "interface-address",
-            {"ip"},
+            {"ip[,ip,...]"},
             [](const std::vector<std::string>& values)
             {
-                interfaceAddress = values[0];
+                receiverOptions.interfaceAddress = values[0];
             }
         },
         {
@@ -245,7 +372,7 @@ int main(int argc, char* argv[])
             {"bytes"},
             [](const std::vector<std::string>& values)
             {
-                bufferSize = boost::lexical_cast<unsigned long>(values[0]);
+                receiverOptions.socketBufferSize = boost::lexical_cast<unsigned long>(values[0]);
             }
         },
         {
@@ -253,7 +380,7 @@ int main(int argc, char* argv[])
             {},
             [](const std::vector<std::string>& values)
             {
-                matchStereoPairs = true;
+                receiverOptions.matchStereoPairs = true;
             }
         },
         {
@@ -261,7 +388,7 @@ int main(int argc, char* argv[])
             {},
             [](const std::vector<std::string>& values)
             {
-                robustSyncing = true;
+                receiverOptions.robustSyncing = true;
             }
         },
         {
@@ -269,7 +396,222 @@ int main(int argc, char* argv[])
             {"size"},
             [](const std::vector<std::string>& values)
             {
-                maxFrameMapSize = boost::lexical_cast<size_t>(values[0]);
+                receiverOptions.maxFrameMapSize = boost::lexical_cast<size_t>(values[0]);
+            }
+        },
+        {
+            "faces",
+            {"i,j,..."},
+            [](const std::vector<std::string>& values)
+            {
+                receiverOptions.faces = parseFaceIndices(values[0]);
+            }
+        },
+        {
+            "projector",
+            {"yaw,pitch,hfov,vfov"},
+            [](const std::vector<std::string>& values)
+            {
+                std::vector<std::string> angles;
+                boost::split(angles, values[0], boost::is_any_of(","));
+                if (angles.size() != 4)
+                {
+                    throw std::invalid_argument("A projector is given by yaw, pitch, horizontal and vertical FOV in degrees");
+                }
+                
+                FaceSelection::Frustum frustum;
+                frustum.yaw           = boost::lexical_cast<double>(angles[0]);
+                frustum.pitch         = boost::lexical_cast<double>(angles[1]);
+                frustum.horizontalFOV = boost::lexical_cast<double>(angles[2]);
+                frustum.verticalFOV   = boost::lexical_cast<double>(angles[3]);
+                if (frustum.horizontalFOV <= 0.0 || frustum.horizontalFOV >= 180.0 ||
+                    frustum.verticalFOV   <= 0.0 || frustum.verticalFOV   >= 180.0)
+                {
+                    throw std::invalid_argument("FOVs must be between 0 and 180 degrees");
+                }
+                projectorFrusta.push_back(frustum);
+            }
+        },
+        {
+            "jitter-budget",
+            {"ms"},
+            [](const std::vector<std::string>& values)
+            {
+                receiverOptions.jitterBudget = boost::chrono::microseconds((long)(boost::lexical_cast<double>(values[0]) * 1000.0));
+            }
+        },
+        {
+            "partial-cubemaps",
+            {"reuse|drop|wait"},
+            [](const std::vector<std::string>& values)
+            {
+                if (values[0] == "reuse")
+                {
+                    receiverOptions.partialCubemapPolicy = H264CubemapSource::REUSE_PREVIOUS_FACES;
+                }
+                else if (values[0] == "drop")
+                {
+                    receiverOptions.partialCubemapPolicy = H264CubemapSource::DROP_PARTIAL;
+                }
+                else if (values[0] == "wait")
+                {
+                    receiverOptions.partialCubemapPolicy = H264CubemapSource::WAIT_FOR_ALL_FACES;
+                }
+                else
+                {
+                    throw std::invalid_argument("Only reuse, drop or wait are valid values");
+                }
+            }
+        },
+        {
+            "frames-memory-budget",
+            {"MB"},
+            [](const std::vector<std::string>& values)
+            {
+                receiverOptions.framesMemoryBudget = boost::lexical_cast<size_t>(values[0]) * 1024 * 1024;
+            }
+        },
+        {
+            "sink-frames",
+            {"count"},
+            [](const std::vector<std::string>& values)
+            {
+                receiverOptions.sinkFramesCount = boost::lexical_cast<size_t>(values[0]);
+            }
+        },
+        {
+            "backpressure",
+            {"drop|block"},
+            [](const std::vector<std::string>& values)
+            {
+                if (values[0] == "drop")
+                {
+                    receiverOptions.backpressurePolicy = H264NALUSink::DROP_OLDEST;
+                }
+                else if (values[0] == "block")
+                {
+                    receiverOptions.backpressurePolicy = H264NALUSink::BLOCK_DECODER;
+                }
+                else
+                {
+                    throw std::invalid_argument("Only drop or block are valid values");
+                }
+            }
+        },
+        {
+            "decoder-threading",
+            {"slice|frame|both"},
+            [](const std::vector<std::string>& values)
+            {
+                if (values[0] == "slice")
+                {
+                    receiverOptions.decoderThreading = H264NALUSink::SLICE_THREADING;
+                }
+                else if (values[0] == "frame")
+                {
+                    receiverOptions.decoderThreading = H264NALUSink::FRAME_THREADING;
+                }
+                else if (values[0] == "both")
+                {
+                    receiverOptions.decoderThreading = H264NALUSink::SLICE_AND_FRAME_THREADING;
+                }
+                else
+                {
+                    throw std::invalid_argument("Only slice, frame or both are valid values");
+                }
+            }
+        },
+        {
+            "decoder-threads",
+            {"count"},
+            [](const std::vector<std::string>& values)
+            {
+                receiverOptions.decoderThreadsBudget = boost::lexical_cast<int>(values[0]);
+            }
+        },
+        {
+            "adaptive-degradation",
+            {"yes|no"},
+            [](const std::vector<std::string>& values)
+            {
+                if (values[0] == "yes")
+                {
+                    adaptiveDegradation = true;
+                }
+                else if (values[0] == "no")
+                {
+                    adaptiveDegradation = false;
+                }
+                else
+                {
+                    throw std::invalid_argument("Only yes or no are valid values");
+                }
+            }
+        },
+        {
+            "low-priority-faces",
+            {"i,j,...|none"},
+            [](const std::vector<std::string>& values)
+            {
+                if (values[0] == "none")
+                {
+                    lowPriorityFaces.clear();
+                }
+                else
+                {
+                    lowPriorityFaces = parseFaceIndices(values[0]);
+                }
+            }
+        },
+        {
+            "batched-ingest",
+            {"threads"},
+            [](const std::vector<std::string>& values)
+            {
+                receiverOptions.batchedIngestThreads = boost::lexical_cast<int>(values[0]);
+            }
+        },
+        {
+            "presentation-latency",
+            {"ms"},
+            [](const std::vector<std::string>& values)
+            {
+                presentationLatency = boost::chrono::microseconds((long)(boost::lexical_cast<double>(values[0]) * 1000.0));
+            }
+        },
+        {
+            "clock-offset",
+            {"ms|auto"},
+            [](const std::vector<std::string>& values)
+            {
+                if (values[0] == "auto")
+                {
+                    estimateClockOffset = true;
+                }
+                else
+                {
+                    estimateClockOffset = false;
+                    clockOffset = boost::chrono::microseconds((long)(boost::lexical_cast<double>(values[0]) * 1000.0));
+                }
+            }
+        },
+        {
+            "texture-upload",
+            {"pbo|sync"},
+            [](const std::vector<std::string>& values)
+            {
+                if (values[0] == "pbo")
+                {
+                    renderer.setPixelUnpackBufferStreaming(true);
+                }
+                else if (values[0] == "sync")
+                {
+                    renderer.setPixelUnpackBufferStreaming(false);
+                }
+                else
+                {
+                    throw std::invalid_argument("Only pbo or sync are valid values");
+                }
             }
         }
     };
@@ -308,9 +650,18 @@ int main(int argc, char* argv[])
                 std::cout << std::setiosflags(std::ios::fixed) << std::setprecision(1);
                 std::cout << "Display:            " << ((noDisplay) ? "no" : "yes") << std::endl;
                 std::cout << "RTSP URL:           " << url << std::endl;
-                std::cout << "Interface address:  " << interfaceAddress << std::endl;
-                std::cout << "Buffer size:        " << to_human_readable_byte_count(bufferSize, false, false) << std::endl;
-                std::cout << "Match stereo pairs: " << ((matchStereoPairs) ? "yes" : "no") << std::endl;
+                for (auto& server : servers)
+                {
+                    std::cout << "More faces from:    " << server.first << " (";
+                    for (int face : server.second)
+                    {
+                        std::cout << " " << face;
+                    }
+                    std::cout << " )" << std::endl;
+                }
+                std::cout << "Interface address:  " << receiverOptions.interfaceAddress << std::endl;
+                std::cout << "Socket buffer size: " << to_human_readable_byte_count(receiverOptions.socketBufferSize, false, false) << std::endl;
+                std::cout << "Match stereo pairs: " << ((receiverOptions.matchStereoPairs) ? "yes" : "no") << std::endl;
                 std::cout << "Gamma min:          " << renderer.getGammaMin() << std::endl;
                 std::cout << "Gamma max:          " << renderer.getGammaMax() << std::endl;
                 std::cout << "Gamma pow:          " << renderer.getGammaPow() << std::endl;
@@ -335,9 +686,78 @@ int main(int argc, char* argv[])
                     std::cout << std::endl << "                    ";
                 }
                 std::cout << std::endl;
-                std::cout << "Robust syncing:     " << ((robustSyncing) ? "yes" : "no") << std::endl;
-                std::cout << "Cubemap queue size: " << maxFrameMapSize << std::endl;
+                std::cout << "Robust syncing:     " << ((receiverOptions.robustSyncing) ? "yes" : "no") << std::endl;
+                std::cout << "Cubemap queue size: " << receiverOptions.maxFrameMapSize << std::endl;
+                std::cout << "Faces:              ";
+                if (receiverOptions.faces.empty())
+                {
+                    std::cout << "all";
+                }
+                for (int face : receiverOptions.faces)
+                {
+                    std::cout << face << " ";
+                }
+                std::cout << std::endl;
+                std::cout << "Projectors:         " << projectorFrusta.size() << std::endl;
+                std::cout << "Jitter budget:      " << receiverOptions.jitterBudget.count() / 1000.0 << " ms" << std::endl;
+                std::cout << "Partial cubemaps:   " << ((receiverOptions.partialCubemapPolicy == H264CubemapSource::REUSE_PREVIOUS_FACES) ? "reuse" :
+                                                        (receiverOptions.partialCubemapPolicy == H264CubemapSource::DROP_PARTIAL)         ? "drop"  : "wait") << std::endl;
+                std::cout << "Frame budget:       " << ((receiverOptions.framesMemoryBudget > 0) ? to_human_readable_byte_count(receiverOptions.framesMemoryBudget, false, false) : "unlimited") << std::endl;
+                std::cout << "Sink frames:        " << receiverOptions.sinkFramesCount << std::endl;
+                std::cout << "Backpressure:       " << ((receiverOptions.backpressurePolicy == H264NALUSink::DROP_OLDEST) ? "drop" : "block") << std::endl;
+                std::cout << "Decoder threading:  " << ((receiverOptions.decoderThreading == H264NALUSink::SLICE_THREADING) ? "slice" :
+                                                        (receiverOptions.decoderThreading == H264NALUSink::FRAME_THREADING) ? "frame" : "both") << std::endl;
+                std::cout << "Decoder threads:    ";
+                if (receiverOptions.decoderThreadsBudget > 0)
+                {
+                    std::cout << receiverOptions.decoderThreadsBudget;
+                }
+                else
+                {
+                    std::cout << "one per CPU core";
+                }
+                std::cout << " (shared by all faces)" << std::endl;
+                std::cout << "Adaptive degrad.:   " << ((adaptiveDegradation) ? "yes" : "no") << std::endl;
+                std::cout << "Batched ingest:     ";
+                if (receiverOptions.batchedIngestThreads > 0)
+                {
+                    std::cout << receiverOptions.batchedIngestThreads << " thread(s)";
+                }
+                else
+                {
+                    std::cout << "no";
+                }
+                std::cout << std::endl;
+                std::cout << "Presentation:       ";
+                if (presentationLatency.count() > 0)
+                {
+                    std::cout << presentationLatency.count() / 1000.0 << " ms after pts; clock offset ";
+                    if (estimateClockOffset)
+                    {
+                        std::cout << "from sender reports";
+                    }
+                    else
+                    {
+                        std::cout << clockOffset.count() / 1000.0 << " ms";
+                    }
+                }
+                else
+                {
+                    std::cout << "as soon as complete";
+                }
+                std::cout << std::endl;
+                std::cout << "Low priority faces: ";
+                if (lowPriorityFaces.empty())
+                {
+                    std::cout << "none";
+                }
+                for (int face : lowPriorityFaces)
+                {
+                    std::cout << face << " ";
+                }
+                std::cout << std::endl;
                 std::cout << "Force mono:         " << ((renderer.getForceMono()) ? "yes" : "no") << std::endl;
+                std::cout << "Texture upload:     " << ((renderer.getPixelUnpackBufferStreaming()) ? "pbo" : "sync") << std::endl;
             }
         }
     };
@@ -362,18 +782,29 @@ int main(int argc, char* argv[])
         abort();
     }
     
+    if (receiverOptions.faces.empty() && !projectorFrusta.empty())
+    {
+        // Only receive what this node's projectors show
+        receiverOptions.faces = FaceSelection::facesInFrusta(projectorFrusta, StereoCubemap::MAX_EYES_COUNT);
+        std::cout << "Faces for " << projectorFrusta.size() << " projector(s):";
+        for (int face : receiverOptions.faces)
+        {
+            std::cout << " " << face;
+        }
+        std::cout << std::endl;
+    }
+    
     Console console(consoleCommandHandler);
     console.start();
     
     
-    RTSPCubemapSourceClient* rtspClient = RTSPCubemapSourceClient::create(url.c_str(),
-                                                                          bufferSize,
-                                                                          AV_PIX_FMT_YUV420P,
-                                                                          matchStereoPairs,
-                                                                          robustSyncing,
-                                                                          maxFrameMapSize,
-                                                                          interfaceAddress.c_str());
+    RTSPCubemapSourceClient* rtspClient = RTSPCubemapSourceClient::create(url.c_str(), receiverOptions);
+    for (auto& server : servers)
+    {
+        rtspClient->addServer(server.first.c_str(), server.second);
+    }
     rtspClient->setOnDidConnect(boost::bind(&onDidConnect, _1, _2));
+    rtspClient->setOnWillDestroyCubemapSource(boost::bind(&onWillDestroyCubemapSource, _1, _2));
     rtspClient->connect();
     
     
@@ -390,6 +821,7 @@ int main(int argc, char* argv[])
     {
         renderer.setOnDisplayedCubemapFace(boost::bind(&onDisplayedCubemapFace, _1, _2));
         renderer.setOnDisplayedFrame(boost::bind(&onDisplayedFrame, _1));
+        renderer.setOnUploadedCubemap(boost::bind(&onUploadedCubemap, _1, _2));
         renderer.start(); // does not return
     }
 }
@@ -0,0 +1,174 @@
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include "BatchedRTPReceiver.hpp"
+
+const size_t MAX_RTP_PACKET_SIZE = 65536;
+const int    BATCH_SIZE          = 32;  // packets per recvmmsg call
+const int    EPOLL_TIMEOUT       = 100; // ms; how quickly the threads notice that they should stop
+const int    MAX_EPOLL_EVENTS    = 16;
+
+bool BatchedRTPReceiver::isSupported()
+{
+#ifdef __linux__
+    return true;
+#else
+    return false;
+#endif
+}
+
+BatchedRTPReceiver::BatchedRTPReceiver(int threadsCount)
+    :
+    threadsCount((std::max)(1, threadsCount)), isStopped(false), batchesCount(0)
+{
+}
+
+BatchedRTPReceiver::Stream::Stream(MediaSubsession*            subsession,
+                                   H264NALUSink*               sink,
+                                   RTPRetransmissionRequester* requester)
+    :
+    subsession(subsession), requester(requester), socketNum(subsession->rtpSource()->RTPgs()->socketNum()),
+    ssrc(0), depacketizer(sink, subsession->rtpTimestampFrequency())
+{
+}
+
+BatchedRTPReceiver::~BatchedRTPReceiver()
+{
+    isStopped = true;
+    for (auto thread : threads)
+    {
+        thread->join();
+    }
+#ifdef __linux__
+    for (int epollFD : epollFDs)
+    {
+        close(epollFD);
+    }
+#endif
+    for (Stream* stream : streams)
+    {
+        delete stream;
+    }
+}
+
+void BatchedRTPReceiver::addSubsession(MediaSubsession*            subsession,
+                                       H264NALUSink*               sink,
+                                       RTPRetransmissionRequester* requester)
+{
+    streams.push_back(new Stream(subsession, sink, requester));
+}
+
+void BatchedRTPReceiver::start()
+{
+#ifdef __linux__
+    for (int i = 0; i < threadsCount; i++)
+    {
+        int epollFD = epoll_create1(0);
+        if (epollFD < 0)
+        {
+            perror("epoll_create1");
+            abort();
+        }
+        epollFDs.push_back(epollFD);
+    }
+
+    for (int i = 0; i < streams.size(); i++)
+    {
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events   = EPOLLIN;
+        event.data.ptr = streams[i];
+        if (epoll_ctl(epollFDs[i % threadsCount], EPOLL_CTL_ADD, streams[i]->socketNum, &event) < 0)
+        {
+            perror("epoll_ctl");
+            abort();
+        }
+    }
+
+    for (int epollFD : epollFDs)
+    {
+        threads.push_back(boost::shared_ptr<boost::thread>(new boost::thread(boost::bind(&BatchedRTPReceiver::receiveLoop,
+                                                                                         this,
+                                                                                         epollFD))));
+    }
+#endif
+}
+
+BatchedRTPReceiver::Statistics BatchedRTPReceiver::getStatistics()
+{
+    Statistics statistics = {0, 0, batchesCount, 0, 0, 0};
+    for (Stream* stream : streams)
+    {
+        H264RTPDepacketizer::Statistics streamStatistics = stream->depacketizer.getStatistics();
+        statistics.packetsCount      += streamStatistics.packetsCount;
+        statistics.bytesCount        += streamStatistics.bytesCount;
+        statistics.lostPacketsCount  += streamStatistics.lostPacketsCount;
+        statistics.latePacketsCount  += streamStatistics.latePacketsCount;
+        statistics.abortedNALUsCount += streamStatistics.abortedNALUsCount;
+    }
+    return statistics;
+}
+
+void BatchedRTPReceiver::receiveLoop(int epollFD)
+{
+#ifdef __linux__
+    std::vector<unsigned char> buffers(BATCH_SIZE * MAX_RTP_PACKET_SIZE);
+    struct mmsghdr messages[BATCH_SIZE];
+    struct iovec   iovecs[BATCH_SIZE];
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+
+    while (!isStopped)
+    {
+        int eventsCount = epoll_wait(epollFD, events, MAX_EPOLL_EVENTS, EPOLL_TIMEOUT);
+        for (int i = 0; i < eventsCount; i++)
+        {
+            Stream* stream = (Stream*)events[i].data.ptr;
+
+            // Drain the socket batch by batch
+            int messagesCount;
+            do
+            {
+                memset(messages, 0, sizeof(messages));
+                for (int j = 0; j < BATCH_SIZE; j++)
+                {
+                    iovecs[j].iov_base            = buffers.data() + j * MAX_RTP_PACKET_SIZE;
+                    iovecs[j].iov_len             = MAX_RTP_PACKET_SIZE;
+                    messages[j].msg_hdr.msg_iov    = &iovecs[j];
+                    messages[j].msg_hdr.msg_iovlen = 1;
+                }
+
+                messagesCount = recvmmsg(stream->socketNum, messages, BATCH_SIZE, MSG_DONTWAIT, NULL);
+                if (messagesCount <= 0)
+                {
+                    break;
+                }
+
+                batchesCount++;
+                for (int j = 0; j < messagesCount; j++)
+                {
+                    if (messages[j].msg_hdr.msg_flags & MSG_TRUNC)
+                    {
+                        continue;
+                    }
+                    handlePacket(stream, (unsigned char*)iovecs[j].iov_base, messages[j].msg_len);
+                }
+            }
+            while (messagesCount == BATCH_SIZE);
+        }
+    }
+#endif
+}
+
+void BatchedRTPReceiver::handlePacket(Stream* stream, unsigned char* packet, size_t packetSize)
+{
+    if (stream->depacketizer.handlePacket(packet, packetSize) &&
+        stream->depacketizer.getSSRC() != stream->ssrc)
+    {
+        // first packet of the stream
+        stream->ssrc = stream->depacketizer.getSSRC();
+        if (stream->requester) stream->requester->setMediaSSRC(stream->ssrc);
+    }
+}
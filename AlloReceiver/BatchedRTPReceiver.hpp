@@ -0,0 +1,76 @@
+#pragma once
+
+#include <liveMedia.hh>
+#include <vector>
+#include <atomic>
+#include <boost/thread.hpp>
+
+#include "AlloReceiver.h"
+#include "H264NALUSink.hpp"
+#include "RTPRetransmissionRequester.hpp"
+#include "H264RTPDepacketizer.hpp"
+
+// Reads the RTP packets of many subsessions on a few threads with recvmmsg
+// and reassembles their NALUs (see H264RTPDepacketizer) straight into
+// the pkts of the subsessions' sinks.
+//
+// Replaces the subsessions' RTP sources and their event loops for the media data.
+// RTSP and RTCP stay with live555. There is no reordering buffer: late packets
+// are dropped and NALUs with lost fragments are skipped. Without the RTP sources
+// there are no retransmission requests, the RTCP receiver reports carry no
+// reception statistics and presentation times come from the RTP timestamps
+// (use robust syncing to align the faces).
+// Only available on Linux.
+class ALLORECEIVER_API BatchedRTPReceiver
+{
+public:
+    struct Statistics
+    {
+        uint64_t packetsCount;      // RTP packets handed to the sinks
+        uint64_t bytesCount;
+        uint64_t batchesCount;      // recvmmsg calls that returned packets
+        uint64_t lostPacketsCount;  // gaps in the sequence numbers
+        uint64_t latePacketsCount;  // arrived after a newer packet; dropped
+        uint64_t abortedNALUsCount; // fragmented NALUs that lost a fragment
+    };
+
+    static bool isSupported();
+
+    // Subsessions are spread evenly over threadsCount threads
+    BatchedRTPReceiver(int threadsCount);
+    ~BatchedRTPReceiver();
+
+    // Must be called before start(). requester may be NULL.
+    void addSubsession(MediaSubsession*            subsession,
+                       H264NALUSink*               sink,
+                       RTPRetransmissionRequester* requester);
+    void start();
+
+    // May be called from any thread
+    Statistics getStatistics();
+
+private:
+    struct Stream
+    {
+        Stream(MediaSubsession*            subsession,
+               H264NALUSink*               sink,
+               RTPRetransmissionRequester* requester);
+
+        MediaSubsession*            subsession;
+        RTPRetransmissionRequester* requester;
+        int                         socketNum;
+        u_int32_t                   ssrc; // told to the requester
+        H264RTPDepacketizer         depacketizer;
+    };
+
+    void receiveLoop(int epollFD);
+    void handlePacket(Stream* stream, unsigned char* packet, size_t packetSize);
+
+    int                                           threadsCount;
+    std::vector<Stream*>                          streams;
+    std::vector<int>                              epollFDs;
+    std::vector<boost::shared_ptr<boost::thread>> threads;
+    std::atomic<bool>                             isStopped;
+
+    std::atomic<uint64_t> batchesCount;
+};
@@ -0,0 +1,132 @@
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include "ClockOffsetEstimator.hpp"
+
+const int64_t WINDOW_DURATION      = 5000000; // microseconds; a few sender reports of every face
+const size_t  MAX_WINDOWS_COUNT    = 24;      // the drift is fitted over the last two minutes
+const size_t  MIN_WINDOWS_TO_FIT   = 3;       // fewer windows only give the offset
+const int64_t CLOCK_STEP_THRESHOLD = 100000;  // microseconds; a sample this far off means that a clock was set
+
+ClockOffsetEstimator::ClockOffsetEstimator()
+    :
+    currentWindowStart(0), currentWindowSamplesCount(0), samplesCount(0)
+{
+}
+
+void ClockOffsetEstimator::addSample(int64_t serverTime, int64_t localTime)
+{
+    boost::mutex::scoped_lock lock(mutex);
+
+    Sample sample;
+    sample.localTime = localTime;
+    sample.offset    = serverTime - localTime;
+
+    if (samplesCount > 0 && std::abs(sample.offset - estimate(localTime).offset.count()) > CLOCK_STEP_THRESHOLD)
+    {
+        // The old samples don't tell anything about the new clock
+        windowMaxima.clear();
+        currentWindowSamplesCount = 0;
+        samplesCount              = 0;
+    }
+
+    if (currentWindowSamplesCount > 0 && localTime - currentWindowStart >= WINDOW_DURATION)
+    {
+        windowMaxima.push_back(currentMaximum);
+        while (windowMaxima.size() > MAX_WINDOWS_COUNT)
+        {
+            windowMaxima.pop_front();
+        }
+        currentWindowSamplesCount = 0;
+    }
+
+    if (currentWindowSamplesCount == 0)
+    {
+        currentWindowStart = localTime;
+        currentMaximum     = sample;
+    }
+    else if (sample.offset > currentMaximum.offset)
+    {
+        currentMaximum = sample;
+    }
+    currentWindowSamplesCount++;
+    samplesCount++;
+}
+
+ClockOffsetEstimator::Estimate ClockOffsetEstimator::getEstimate(boost::chrono::system_clock::time_point localTime)
+{
+    boost::mutex::scoped_lock lock(mutex);
+    return estimate(boost::chrono::duration_cast<boost::chrono::microseconds>(localTime.time_since_epoch()).count());
+}
+
+boost::chrono::system_clock::time_point ClockOffsetEstimator::toLocalTime(int64_t serverTime)
+{
+    Estimate estimate = getEstimate(boost::chrono::system_clock::now());
+    return boost::chrono::system_clock::time_point(boost::chrono::microseconds(serverTime) - estimate.offset);
+}
+
+ClockOffsetEstimator::Estimate ClockOffsetEstimator::estimate(int64_t localTime)
+{
+    Estimate estimate;
+    estimate.isValid       = samplesCount > 0;
+    estimate.offset        = boost::chrono::microseconds(0);
+    estimate.drift         = 0.0;
+    estimate.residualError = boost::chrono::microseconds(0);
+    estimate.samplesCount  = samplesCount;
+    if (!estimate.isValid)
+    {
+        return estimate;
+    }
+
+    std::vector<Sample> maxima(windowMaxima.begin(), windowMaxima.end());
+    if (currentWindowSamplesCount > 0)
+    {
+        maxima.push_back(currentMaximum);
+    }
+
+    if (maxima.size() < MIN_WINDOWS_TO_FIT)
+    {
+        // Not enough to see a drift yet
+        int64_t offset = maxima.front().offset;
+        for (const Sample& maximum : maxima)
+        {
+            offset = (std::max)(offset, maximum.offset);
+        }
+        estimate.offset = boost::chrono::microseconds(offset);
+        return estimate;
+    }
+
+    // Least squares line through the maxima. Times relative to the first one
+    // so that the squares don't lose precision.
+    int64_t origin = maxima.front().localTime;
+    double meanX = 0.0, meanY = 0.0;
+    for (const Sample& maximum : maxima)
+    {
+        meanX += (maximum.localTime - origin) / 1000000.0;
+        meanY += maximum.offset;
+    }
+    meanX /= maxima.size();
+    meanY /= maxima.size();
+
+    double covariance = 0.0, variance = 0.0;
+    for (const Sample& maximum : maxima)
+    {
+        double x = (maximum.localTime - origin) / 1000000.0 - meanX;
+        covariance += x * (maximum.offset - meanY);
+        variance   += x * x;
+    }
+    double slope = (variance > 0.0) ? covariance / variance : 0.0; // microseconds per second = ppm
+
+    double squaredErrorsSum = 0.0;
+    for (const Sample& maximum : maxima)
+    {
+        double error = maximum.offset - (meanY + slope * ((maximum.localTime - origin) / 1000000.0 - meanX));
+        squaredErrorsSum += error * error;
+    }
+
+    estimate.offset        = boost::chrono::microseconds((int64_t)(meanY + slope * ((localTime - origin) / 1000000.0 - meanX)));
+    estimate.drift         = slope;
+    estimate.residualError = boost::chrono::microseconds((int64_t)std::sqrt(squaredErrorsSum / maxima.size()));
+    return estimate;
+}
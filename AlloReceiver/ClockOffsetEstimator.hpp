@@ -0,0 +1,56 @@
+#pragma once
+
+#include <deque>
+#include <boost/chrono/system_clocks.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "AlloReceiver.h"
+
+// Estimates how far the server's clock is ahead of ours and how fast that changes.
+//
+// Fed with the NTP timestamps of the server's RTCP sender reports and the local times
+// at which they arrived. Each sample is the true offset minus the report's one-way delay.
+// The largest sample of a window is the one that was delayed the least, so a line fitted
+// through the largest samples of the last windows gives the offset and the drift.
+// The minimum one-way delay remains in the offset since it can't be told apart from it
+// without a round trip. On the cluster's LAN it is well below a millisecond.
+class ALLORECEIVER_API ClockOffsetEstimator
+{
+public:
+    struct Estimate
+    {
+        bool                        isValid;       // false until the first sample
+        boost::chrono::microseconds offset;        // server's clock minus ours
+        double                      drift;         // ppm; positive if the server's clock is faster
+        boost::chrono::microseconds residualError; // RMS distance of the windows' largest samples from the fitted line
+        size_t                      samplesCount;
+    };
+
+    ClockOffsetEstimator();
+
+    // Times in microseconds since the epoch. May be called from any thread.
+    void addSample(int64_t serverTime, int64_t localTime);
+
+    // Offset at localTime. May be called from any thread.
+    Estimate getEstimate(boost::chrono::system_clock::time_point localTime);
+
+    // Converts a time on the server's clock (e.g. a pts) to our clock.
+    // Unchanged as long as there are no samples. May be called from any thread.
+    boost::chrono::system_clock::time_point toLocalTime(int64_t serverTime);
+
+private:
+    struct Sample
+    {
+        int64_t localTime;
+        int64_t offset;
+    };
+
+    Estimate estimate(int64_t localTime);
+
+    boost::mutex       mutex;
+    std::deque<Sample> windowMaxima; // largest sample of each closed window
+    Sample             currentMaximum;
+    int64_t            currentWindowStart;
+    size_t             currentWindowSamplesCount;
+    size_t             samplesCount;
+};
@@ -2,5 +2,5 @@
 
 void CubemapSource::destroy(CubemapSource *cubemapSource)
 {
-    // to be implemented
+    delete cubemapSource;
 }
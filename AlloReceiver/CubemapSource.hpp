@@ -6,11 +6,18 @@
 class ALLORECEIVER_API CubemapSource
 {
 public:
+    // Returns a cubemap the source may fill next; nullptr makes the source create one.
+    // Faces keep their new face flag until the consumer clears it after showing them,
+    // so that a cubemap handed back unseen still delivers the faces nobody has shown yet.
     typedef std::function<StereoCubemap* (CubemapSource*, StereoCubemap*)> OnNextCubemap;
     
 	virtual void setOnNextCubemap(const OnNextCubemap& callback) = 0;
     //virtual void setOnDroppedNALU(std::function<void (CubemapSource*, int, uint8_t, size_t)>&   callback) = 0;
     //virtual void setOnAddedNALU  (std::function<void (CubemapSource*, int, uint8_t, size_t)>&   callback) = 0;
     
+    // The consumer must not use the source's cubemaps anymore
     static void destroy(CubemapSource* cubemapSource);
+    
+protected:
+    virtual ~CubemapSource() {}
 };
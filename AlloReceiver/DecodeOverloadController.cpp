@@ -0,0 +1,50 @@
+#include "DecodeOverloadController.hpp"
+
+const double OVERLOAD_DECODING_LOAD  = 0.8; // fraction of the frame interval spent decoding above which we are overloaded
+const double CALM_DECODING_LOAD      = 0.5; // fraction below which we may have recovered
+const int    CALM_UPDATES_TO_RESTORE = 4;   // calm updates in a row before a step is restored
+
+DecodeOverloadController::DecodeOverloadController(boost::chrono::microseconds frameInterval,
+                                                   size_t                      maxQueueDepth)
+    :
+    level(FULL_QUALITY), frameInterval(frameInterval), maxQueueDepth(maxQueueDepth), calmUpdatesCount(0)
+{
+}
+
+DecodeOverloadController::Level DecodeOverloadController::update(boost::chrono::microseconds decodingTime,
+                                                                 size_t                      queueDepth)
+{
+    double load = (double)decodingTime.count() / frameInterval.count();
+
+    if (load > OVERLOAD_DECODING_LOAD || queueDepth >= maxQueueDepth)
+    {
+        // Decoders fall behind -> give up some more quality
+        calmUpdatesCount = 0;
+        if (level < MAX_LEVEL)
+        {
+            level = (Level)(level + 1);
+        }
+    }
+    else if (load < CALM_DECODING_LOAD && queueDepth <= 1)
+    {
+        // Decoders have enough headroom -> restore quality step by step
+        calmUpdatesCount++;
+        if (calmUpdatesCount >= CALM_UPDATES_TO_RESTORE && level > FULL_QUALITY)
+        {
+            level = (Level)(level - 1);
+            calmUpdatesCount = 0;
+        }
+    }
+    else
+    {
+        // Decoders just keep up -> hold
+        calmUpdatesCount = 0;
+    }
+
+    return level;
+}
+
+DecodeOverloadController::Level DecodeOverloadController::getLevel()
+{
+    return level;
+}
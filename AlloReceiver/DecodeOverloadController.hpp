@@ -0,0 +1,44 @@
+#pragma once
+
+#include <boost/chrono/system_clocks.hpp>
+
+#include "AlloReceiver.h"
+
+// Decides how much decoding quality the receiver gives up when the CPU can't keep up.
+//
+// Fed once per control interval with the decoding time of the slowest face
+// and the depth of the playout buffer. Frames that come too late are no sign of
+// overload since network jitter causes them just as well.
+// Every overloaded interval degrades one step further, starting with the step
+// that costs the least quality. A step is only restored after several calm
+// intervals in a row so that the level doesn't oscillate.
+//
+// Our servers encode with x264's zerolatency and fastdecode tunings, i.e. without
+// B-frames and deblocking. Every frame is a reference frame and there is no loop filter,
+// so skipping either saves nothing; dropping the frames of whole faces is what helps.
+class ALLORECEIVER_API DecodeOverloadController
+{
+public:
+    enum Level
+    {
+        FULL_QUALITY,
+        DROP_LOW_PRIORITY_FACES, // low priority faces only decode keyframes
+        MAX_LEVEL = DROP_LOW_PRIORITY_FACES
+    };
+
+    // frameInterval: time a decoder has for one frame
+    DecodeOverloadController(boost::chrono::microseconds frameInterval,
+                             size_t                      maxQueueDepth);
+
+    // Returns the new level
+    Level update(boost::chrono::microseconds decodingTime,
+                 size_t                      queueDepth);
+
+    Level getLevel();
+
+private:
+    Level                       level;
+    boost::chrono::microseconds frameInterval;
+    size_t                      maxQueueDepth;
+    int                         calmUpdatesCount;
+};
@@ -0,0 +1,153 @@
+extern "C"
+{
+    #include <libavutil/imgutils.h>
+    #include <libavutil/mem.h>
+}
+
+#include "FaceBufferPool.hpp"
+
+// libavcodec reads a little beyond the end of the planes in its optimized routines
+const int BUFFER_PADDING_SIZE = 64;
+
+FaceBufferPool::FaceBufferPool()
+    :
+    state(new State)
+{
+    state->bufferSize     = 0;
+    state->allocatedBytes = 0;
+    state->isClosed       = false;
+}
+
+FaceBufferPool::~FaceBufferPool()
+{
+    bool isUnused;
+    {
+        boost::mutex::scoped_lock lock(state->mutex);
+        for (uint8_t* data : state->freeBuffers)
+        {
+            freeBuffer(state, data);
+        }
+        state->freeBuffers.clear();
+        state->isClosed = true;
+        isUnused = state->bufferSizes.empty();
+    }
+    
+    // Otherwise the last released buffer deletes the state
+    if (isUnused)
+    {
+        delete state;
+    }
+}
+
+bool FaceBufferPool::getBuffer(AVFrame* frame, int lineSizeAlign, int paddingHeight)
+{
+    AVPixelFormat format = (AVPixelFormat)frame->format;
+    int alignedWidth = (frame->width + lineSizeAlign - 1) / lineSizeAlign * lineSizeAlign;
+    
+    if (av_image_fill_linesizes(frame->linesize, format, alignedWidth) < 0)
+    {
+        return false;
+    }
+    for (int i = 0; i < AV_NUM_DATA_POINTERS && frame->linesize[i]; i++)
+    {
+        frame->linesize[i] = (frame->linesize[i] + lineSizeAlign - 1) / lineSizeAlign * lineSizeAlign;
+    }
+    
+    int size = av_image_fill_pointers(frame->data, format, frame->height + paddingHeight, NULL, frame->linesize);
+    if (size < 0)
+    {
+        return false;
+    }
+    
+    uint8_t* data;
+    size_t   bufferSize;
+    {
+        boost::mutex::scoped_lock lock(state->mutex);
+        if (state->bufferSize < size + BUFFER_PADDING_SIZE)
+        {
+            // Buffers that are too small are of no use anymore
+            for (uint8_t* buffer : state->freeBuffers)
+            {
+                freeBuffer(state, buffer);
+            }
+            state->freeBuffers.clear();
+            state->bufferSize = size + BUFFER_PADDING_SIZE;
+        }
+        
+        if (!state->freeBuffers.empty())
+        {
+            data = state->freeBuffers.back();
+            state->freeBuffers.pop_back();
+        }
+        else
+        {
+            data = (uint8_t*)av_mallocz(state->bufferSize);
+            if (!data)
+            {
+                return false;
+            }
+            state->bufferSizes[data] = state->bufferSize;
+            state->allocatedBytes   += state->bufferSize;
+        }
+        bufferSize = state->bufferSize;
+    }
+    
+    frame->buf[0] = av_buffer_create(data, bufferSize, &FaceBufferPool::releaseBuffer, state, 0);
+    if (!frame->buf[0])
+    {
+        releaseBuffer(state, data);
+        return false;
+    }
+    
+    av_image_fill_pointers(frame->data, format, frame->height + paddingHeight, frame->buf[0]->data, frame->linesize);
+    frame->extended_data = frame->data;
+    return true;
+}
+
+void FaceBufferPool::releaseBuffer(void* opaque, uint8_t* data)
+{
+    State* state = (State*)opaque;
+    bool isUnused;
+    {
+        boost::mutex::scoped_lock lock(state->mutex);
+        if (state->isClosed || state->bufferSizes[data] != state->bufferSize)
+        {
+            freeBuffer(state, data);
+        }
+        else
+        {
+            state->freeBuffers.push_back(data);
+        }
+        isUnused = state->isClosed && state->bufferSizes.empty();
+    }
+    
+    if (isUnused)
+    {
+        delete state;
+    }
+}
+
+void FaceBufferPool::freeBuffer(State* state, uint8_t* data)
+{
+    state->allocatedBytes -= state->bufferSizes[data];
+    state->bufferSizes.erase(data);
+    av_free(data);
+}
+
+size_t FaceBufferPool::getBufferSize()
+{
+    boost::mutex::scoped_lock lock(state->mutex);
+    return state->bufferSize;
+}
+
+size_t FaceBufferPool::getBuffersCount()
+{
+    boost::mutex::scoped_lock lock(state->mutex);
+    return state->bufferSizes.size();
+}
+
+size_t FaceBufferPool::getAllocatedBytes()
+{
+    boost::mutex::scoped_lock lock(state->mutex);
+    return state->allocatedBytes;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+extern "C"
+{
+    #include <libavutil/buffer.h>
+    #include <libavutil/frame.h>
+}
+#include <vector>
+#include <unordered_map>
+#include <boost/thread/mutex.hpp>
+
+#include "AlloReceiver.h"
+
+// Refcounted pixel buffers for the faces of a stream.
+//
+// A buffer returns to the pool as soon as its last reference is released,
+// i.e. when the last AVFrame referencing it has been unreferenced.
+// Allocation happens only when all buffers are in use. All buffers have the same size;
+// when a bigger one is requested (e.g. after a change of resolution) the smaller
+// buffers are freed instead of being reused once they are released.
+// Buffers may outlive the pool.
+// Thread-safe.
+class ALLORECEIVER_API FaceBufferPool
+{
+public:
+    FaceBufferPool();
+    ~FaceBufferPool();
+    
+    // Attaches a pooled buffer to an unreferenced frame and points the frame's planes into it.
+    // frame->format, frame->width and frame->height must be set.
+    // Line sizes are padded to a multiple of lineSizeAlign (pass 1 for tightly packed planes)
+    // and the planes have paddingHeight rows more than the frame.
+    // Returns false if the buffer could not be allocated.
+    bool getBuffer(AVFrame* frame, int lineSizeAlign = 1, int paddingHeight = 0);
+    
+    size_t getBufferSize();
+    // Buffers that are allocated, whether in use or not
+    size_t getBuffersCount();
+    size_t getAllocatedBytes();
+    
+private:
+    // Shared with the released buffers so that they can be returned after the pool is gone
+    struct State
+    {
+        boost::mutex                         mutex;
+        std::vector<uint8_t*>                freeBuffers;
+        std::unordered_map<uint8_t*, size_t> bufferSizes; // all allocated buffers
+        size_t                               bufferSize;
+        size_t                               allocatedBytes;
+        bool                                 isClosed;
+    };
+    
+    static void releaseBuffer(void* opaque, uint8_t* data);
+    // state->mutex must be locked
+    static void freeBuffer(State* state, uint8_t* data);
+    
+    State* state;
+};
@@ -0,0 +1,68 @@
+#include <cmath>
+#include <algorithm>
+
+#include "AlloShared/Cubemap.hpp"
+#include "FaceSelection.hpp"
+
+const int    SAMPLES_PER_AXIS = 32; // directions sampled across each frustum's image plane
+const double EDGE_TOLERANCE   = 1e-6; // a frustum that only touches a face with its edge doesn't need it
+const double DEG_TO_RAD       = 0.01745329251994;
+
+// Index of the face a direction points to
+static int faceForDirection(double x, double y, double z)
+{
+    if (std::abs(x) >= std::abs(y) && std::abs(x) >= std::abs(z))
+    {
+        return (x >= 0.0) ? 0 : 1;
+    }
+    else if (std::abs(z) >= std::abs(y))
+    {
+        return (z >= 0.0) ? 2 : 3;
+    }
+    else
+    {
+        return (y >= 0.0) ? 4 : 5;
+    }
+}
+
+std::vector<int> FaceSelection::facesInFrusta(const std::vector<Frustum>& frusta, int eyesCount)
+{
+    std::vector<bool> isFaceNeeded(Cubemap::MAX_FACES_COUNT, false);
+    
+    for (const Frustum& frustum : frusta)
+    {
+        double yaw   = frustum.yaw   * DEG_TO_RAD;
+        double pitch = frustum.pitch * DEG_TO_RAD;
+        double halfWidth  = std::tan(frustum.horizontalFOV * DEG_TO_RAD / 2.0) * (1.0 - EDGE_TOLERANCE);
+        double halfHeight = std::tan(frustum.verticalFOV   * DEG_TO_RAD / 2.0) * (1.0 - EDGE_TOLERANCE);
+        
+        double forward[3] = { std::sin(yaw) * std::cos(pitch),  std::sin(pitch), std::cos(yaw) * std::cos(pitch) };
+        double right[3]   = { std::cos(yaw),                    0.0,             -std::sin(yaw) };
+        double up[3]      = { -std::sin(yaw) * std::sin(pitch), std::cos(pitch), -std::cos(yaw) * std::sin(pitch) };
+        
+        for (int i = 0; i <= SAMPLES_PER_AXIS; i++)
+        {
+            double u = (2.0 * i / SAMPLES_PER_AXIS - 1.0) * halfWidth;
+            for (int j = 0; j <= SAMPLES_PER_AXIS; j++)
+            {
+                double v = (2.0 * j / SAMPLES_PER_AXIS - 1.0) * halfHeight;
+                isFaceNeeded[faceForDirection(forward[0] + u * right[0] + v * up[0],
+                                              forward[1] + u * right[1] + v * up[1],
+                                              forward[2] + u * right[2] + v * up[2])] = true;
+            }
+        }
+    }
+    
+    std::vector<int> faces;
+    for (int eye = 0; eye < (std::min)(eyesCount, (int)StereoCubemap::MAX_EYES_COUNT); eye++)
+    {
+        for (int face = 0; face < Cubemap::MAX_FACES_COUNT; face++)
+        {
+            if (isFaceNeeded[face])
+            {
+                faces.push_back(eye * Cubemap::MAX_FACES_COUNT + face);
+            }
+        }
+    }
+    return faces;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <vector>
+
+#include "AlloReceiver.h"
+
+// Picks the cubemap faces a render node needs for its projectors
+// so that the node only receives and decodes those.
+//
+// Directions are in the coordinate system of the streamed cubemap:
+// face 0 is +X (right), 1 is -X, 2 is +Z (forward), 3 is -Z, 4 is +Y (up) and 5 is -Y.
+class ALLORECEIVER_API FaceSelection
+{
+public:
+    // All angles in degrees
+    struct Frustum
+    {
+        double yaw;           // 0 looks forward, positive turns right
+        double pitch;         // positive looks up
+        double horizontalFOV; // less than 180
+        double verticalFOV;   // less than 180
+    };
+    
+    // Returns the indices (0-11) of the faces that any of the frusta overlap, for each eye
+    static std::vector<int> facesInFrusta(const std::vector<Frustum>& frusta, int eyesCount);
+};
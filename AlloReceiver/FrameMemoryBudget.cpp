@@ -0,0 +1,54 @@
+#include "FrameMemoryBudget.hpp"
+
+FrameMemoryBudget::FrameMemoryBudget(size_t limit)
+    :
+    limit(limit), reservedSize(0)
+{
+}
+
+bool FrameMemoryBudget::reserve(const void* frame, size_t size, bool wait)
+{
+    boost::mutex::scoped_lock lock(mutex);
+    while (reservedSize > 0 && reservedSize + size > limit)
+    {
+        if (!wait)
+        {
+            return false;
+        }
+        condition.wait(lock);
+    }
+    reservedSize += size;
+    reservations[frame] = size;
+    return true;
+}
+
+void FrameMemoryBudget::keep(const void* frame)
+{
+    release(frame);
+}
+
+void FrameMemoryBudget::release(const void* frame)
+{
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        auto reservation = reservations.find(frame);
+        if (reservation == reservations.end())
+        {
+            return;
+        }
+        reservedSize -= reservation->second;
+        reservations.erase(reservation);
+    }
+    condition.notify_all();
+}
+
+size_t FrameMemoryBudget::getLimit()
+{
+    return limit;
+}
+
+size_t FrameMemoryBudget::getReservedSize()
+{
+    boost::mutex::scoped_lock lock(mutex);
+    return reservedSize;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <map>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include "AlloReceiver.h"
+
+// Limits the memory of the frames that all sinks of a client hand out together.
+//
+// A sink reserves a frame's size when it makes the frame available
+// and releases it when the frame is returned or dropped. So frames waiting
+// for the consumer stay within the budget no matter how many faces are received.
+// A frame that is bigger than the whole budget is still granted when nothing else is reserved.
+//
+// Frames that the consumer keeps for display don't count. A cubemap face holds on to its frame
+// until a newer frame of the face replaces it, so those frames are bounded by the consumer's
+// cubemaps anyway. Counting them would let a few cubemaps fill the budget for good:
+// no frame would get through to replace theirs.
+// Thread-safe.
+class ALLORECEIVER_API FrameMemoryBudget
+{
+public:
+    FrameMemoryBudget(size_t limit);
+
+    // Returns false if the frame doesn't fit into the budget right now
+    // unless wait is true. Then waits until enough frames have been released or kept.
+    bool reserve(const void* frame, size_t size, bool wait);
+    // The consumer keeps the frame for display
+    void keep(const void* frame);
+    // The frame was returned or dropped. Does nothing if it was kept.
+    void release(const void* frame);
+
+    size_t getLimit();
+    size_t getReservedSize();
+
+private:
+    boost::mutex                  mutex;
+    boost::condition_variable     condition;
+    size_t                        limit;
+    size_t                        reservedSize;
+    std::map<const void*, size_t> reservations; // size of each frame that counts
+};
@@ -10,6 +10,9 @@ extern "C"
 
 #include "H264CubemapSource.h"
 
+const boost::chrono::microseconds DECODING_FRAME_INTERVAL(1000000 / 60); // the server encodes at 60 fps
+const boost::chrono::milliseconds OVERLOAD_CONTROL_INTERVAL(500);
+
 void H264CubemapSource::setOnReceivedNALU(const OnReceivedNALU& callback)
 {
     onReceivedNALU = callback;
@@ -45,106 +48,352 @@ void H264CubemapSource::setOnScheduledFrameInCubemap(const OnScheduledFrameInCub
     onScheduledFrameInCubemap = callback;
 }
 
+void H264CubemapSource::setOnCollectedFrame(const OnCollectedFrame& callback)
+{
+    onCollectedFrame = callback;
+}
+
+void H264CubemapSource::setOnCollectorIdle(const OnCollectorIdle& callback)
+{
+    onCollectorIdle = callback;
+}
+
+void H264CubemapSource::setOnReleasedCubemap(const OnReleasedCubemap& callback)
+{
+    onReleasedCubemap = callback;
+}
+
+void H264CubemapSource::setOnLateFrame(const OnLateFrame& callback)
+{
+    onLateFrame = callback;
+}
+
+void H264CubemapSource::setOnDroppedFrame(const OnDroppedFrame& callback)
+{
+    onDroppedFrame = callback;
+}
+
+void H264CubemapSource::setOnDecodingTime(const OnDecodingTime& callback)
+{
+    onDecodingTime = callback;
+}
+
+void H264CubemapSource::setOnDegradationLevelChanged(const OnDegradationLevelChanged& callback)
+{
+    onDegradationLevelChanged = callback;
+}
+
+void H264CubemapSource::setOnRecovered(const OnRecovered& callback)
+{
+    onRecovered = callback;
+}
+
+void H264CubemapSource::setOnPresentationSkew(const OnPresentationSkew& callback)
+{
+    onPresentationSkew = callback;
+}
+
+void H264CubemapSource::setOnCubemapLatency(const OnCubemapLatency& callback)
+{
+    onCubemapLatency = callback;
+}
+
+void H264CubemapSource::setOnServerSkew(const OnServerSkew& callback)
+{
+    onServerSkew = callback;
+}
+
+void H264CubemapSource::setPresentationLatency(boost::chrono::microseconds presentationLatency)
+{
+    presentationScheduler.setLatencyBudget(presentationLatency);
+}
+
+void H264CubemapSource::setClockOffset(boost::chrono::microseconds clockOffset)
+{
+    presentationScheduler.setClockOffset(clockOffset);
+}
+
+void H264CubemapSource::setClockOffsetEstimator(ClockOffsetEstimator* clockOffsetEstimator)
+{
+    presentationScheduler.setClockOffsetEstimator(clockOffsetEstimator);
+}
+
+void H264CubemapSource::restart(boost::chrono::steady_clock::time_point outageStart)
+{
+    boost::mutex::scoped_lock lock(frameMapMutex);
+    
+    for (auto& bucket : frameMap)
+    {
+        for (int i = 0; i < bucket.second.frames.size(); i++)
+        {
+            if (bucket.second.frames[i]) sinks[i]->returnFrame(bucket.second.frames[i]);
+        }
+    }
+    frameMap.clear();
+    
+    // The new stream's frames must not count as late
+    lastFrameSeqNum   = 0;
+    this->outageStart = outageStart;
+}
+
+void H264CubemapSource::setAdaptiveDegradation(bool enabled)
+{
+    boost::mutex::scoped_lock lock(overloadControlMutex);
+    
+    adaptiveDegradation = enabled;
+    if (!enabled)
+    {
+        overloadController = DecodeOverloadController(DECODING_FRAME_INTERVAL, maxFrameMapSize);
+        applyDegradationLevel(DecodeOverloadController::FULL_QUALITY);
+    }
+}
+
+void H264CubemapSource::setLowPriorityFaces(const std::vector<int>& faces)
+{
+    boost::mutex::scoped_lock lock(overloadControlMutex);
+    
+    std::fill(lowPriorityFaces.begin(), lowPriorityFaces.end(), false);
+    for (int face : faces)
+    {
+        if (face >= 0 && face < lowPriorityFaces.size())
+        {
+            lowPriorityFaces[face] = true;
+        }
+    }
+    applyDegradationLevel(overloadController.getLevel());
+}
+
+void H264CubemapSource::applyDegradationLevel(DecodeOverloadController::Level level)
+{
+    for (int i = 0; i < sinks.size(); i++)
+    {
+        if (!sinks[i])
+        {
+            continue;
+        }
+        
+        // Our streams are not deblocked and have no B-frames
+        // -> only skipping whole frames saves decoding time
+        AVDiscard skipFrame = AVDISCARD_DEFAULT;
+        if (level >= DecodeOverloadController::DROP_LOW_PRIORITY_FACES && lowPriorityFaces[i])
+        {
+            skipFrame = AVDISCARD_NONKEY;
+        }
+        sinks[i]->setDecodingQuality(AVDISCARD_DEFAULT, skipFrame);
+    }
+}
+
 void H264CubemapSource::getNextFramesLoop()
 {
-	std::vector<AVFrame*> frames(sinks.size(), nullptr);
+    while (true)
+    {
+        // Sleep until a sink has a frame for us
+        std::deque<AvailableFrame> frames;
+        boost::chrono::steady_clock::time_point idleStart = boost::chrono::steady_clock::now();
+        {
+            boost::mutex::scoped_lock lock(availableFramesMutex);
+            while (availableFrames.empty() && !isStopped)
+            {
+                availableFramesCondition.wait(lock);
+            }
+            if (isStopped)
+            {
+                return;
+            }
+            frames.swap(availableFrames);
+        }
+        
+        boost::chrono::steady_clock::time_point now = boost::chrono::steady_clock::now();
+        if (onCollectorIdle) onCollectorIdle(this, boost::chrono::duration_cast<boost::chrono::microseconds>(now - idleStart));
+        
+        for (const AvailableFrame& availableFrame : frames)
+        {
+            AVFrame* frame = sinks[availableFrame.face]->getNextFrame();
+            if (frame)
+            {
+                if (onCollectedFrame) onCollectedFrame(this, availableFrame.face, boost::chrono::duration_cast<boost::chrono::microseconds>(now - availableFrame.time));
+                addFrameToMap(availableFrame.face, frame, availableFrame.time);
+            }
+        }
+    }
+}
 
+void H264CubemapSource::addFrameToMap(int face, AVFrame* frame, boost::chrono::steady_clock::time_point availableTime)
+{
+    boost::mutex::scoped_lock lock(frameMapMutex);
+    
+    int64_t key;
+    if (robustSyncing)
+    {
+        key = frame->pts;
+    }
+    else
+    {
+        key = frame->coded_picture_number;
+    }
+    
+    if (key <= lastFrameSeqNum)
+    {
+        // Its cubemap has already been released
+        std::cout << "frame comes too late (" << lastFrameSeqNum-key+1 << " frame/s)" << std::endl;
+        sinks[face]->returnFrame(frame);
+        if (onLateFrame) onLateFrame(this, face);
+        return;
+    }
+    
+    bool notify = false;
+    
+    auto bucketIter = frameMap.find(key);
+    if (bucketIter == frameMap.end())
+    {
+        // First face of this cubemap -> its deadline starts now
+        FrameBucket bucket;
+        bucket.frames.resize(sinks.size());
+        bucket.framesCount = 0;
+        bucket.deadline    = playoutDeadline.getDeadline(boost::chrono::steady_clock::now());
+        bucket.serverArrivalTimes.resize(serversCount);
+        bucketIter = frameMap.insert(std::make_pair(key, bucket)).first;
+        
+        // The releasing thread may have to wait for an earlier deadline now
+        // or the playout buffer may be full
+        notify = true;
+    }
+    
+    FrameBucket& bucket = bucketIter->second;
+    if (bucket.frames[face])
+    {
+        // Matches should not happen here.
+        // If it happens give back frame immediately
+        std::cout << "match!? (" << face << ", " << key << ")" << std::endl;
+        sinks[face]->returnFrame(frame);
+    }
+    else
+    {
+        bucket.frames[face] = frame;
+        bucket.framesCount++;
+        
+        boost::chrono::steady_clock::time_point& serverArrivalTime = bucket.serverArrivalTimes[sinkServers[face]];
+        if (serverArrivalTime == boost::chrono::steady_clock::time_point() || availableTime < serverArrivalTime)
+        {
+            serverArrivalTime = availableTime;
+        }
+        if (onAddedFrameToCubemap) onAddedFrameToCubemap(this, face);
+        
+        if (bucket.framesCount >= receivedFacesCount)
+        {
+            notify = true;
+        }
+    }
+    
+    if (notify)
+    {
+        frameMapCondition.notify_all();
+    }
+}
+
+void H264CubemapSource::getNextCubemapLoop()
+{
     while (true)
     {
-        // Get all the decoded frames
-        for (int i = 0; i < sinks.size(); i++)
+        ReleaseStatus status;
+        boost::chrono::steady_clock::time_point outageStart;
+        // Get frames with the oldest frame seq # and remove the associated bucket
+        // as soon as the bucket is complete or its deadline has passed
+        std::vector<AVFrame*> frames;
+        std::vector<boost::chrono::steady_clock::time_point> serverArrivalTimes;
         {
+            boost::mutex::scoped_lock lock(frameMapMutex);
             
-			frames[i] = sinks[i]->getNextFrame();
-            
-            if (frames[i])
+            while (true)
             {
-                boost::mutex::scoped_lock lock(frameMapMutex);
-                
-                int64_t key;
-                if (robustSyncing)
+                if (isStopped)
                 {
-                    key = frames[i]->pts;
-                }
-                else
-                {
-                    key = frames[i]->coded_picture_number;
+                    return;
                 }
                 
-                if (key <= lastFrameSeqNum)
+                if (frameMap.empty())
                 {
-                    std::cout << "frame comes too late (" << lastFrameSeqNum-key+1 << " frame/s)" << std::endl;
-                    sinks[i]->returnFrame(frames[i]);
+                    frameMapCondition.wait(lock);
                     continue;
                 }
                 
-                if (frameMap.find(key) == frameMap.end())
+                const FrameBucket& oldestBucket = frameMap.begin()->second;
+                boost::chrono::steady_clock::time_point wakeTime;
+                if (playoutDeadline.isDue(oldestBucket.framesCount,
+                                          receivedFacesCount,
+                                          oldestBucket.deadline,
+                                          frameMap.size(),
+                                          boost::chrono::steady_clock::now(),
+                                          wakeTime))
                 {
-                    frameMap[key].resize(sinks.size());
+                    break;
                 }
                 
-                std::vector<AVFrame*>& bucketFrames = frameMap[key];
-                if (bucketFrames[i])
+                if (wakeTime == boost::chrono::steady_clock::time_point::max())
                 {
-                    // Matches should not happen here.
-                    // If it happens give back frame immediately
-                    std::cout << "match!? (" << i << ", " << key << ")" << std::endl;
-                    sinks[i]->returnFrame(frames[i]);
+                    frameMapCondition.wait(lock);
                 }
                 else
                 {
-                    bucketFrames[i] = frames[i];
-                    if (onAddedFrameToCubemap) onAddedFrameToCubemap(this, i);
-                }
-                
-                if (frameMap.size() >= maxFrameMapSize)
-                {
-                    frameMapCondition.notify_all();
+                    frameMapCondition.wait_until(lock, wakeTime);
                 }
             }
+            
+            auto it = frameMap.begin();
+            lastFrameSeqNum = it->first;
+            frames = it->second.frames;
+            serverArrivalTimes = it->second.serverArrivalTimes;
+            status = (it->second.framesCount >= receivedFacesCount) ? COMPLETE : PARTIAL;
+            frameMap.erase(it);
+            outageStart = this->outageStart;
         }
-    }
-}
-
-void H264CubemapSource::getNextCubemapLoop()
-{
-    int64_t lastPTS = 0;
-    boost::chrono::system_clock::time_point lastDisplayTime(boost::chrono::microseconds(0));
-    
-    while (true)
-    {
-        size_t pendingCubemaps;
-        int frameSeqNum;
-        // Get frames with the oldest frame seq # and remove the associated bucket
-        std::vector<AVFrame*> frames;
+        
+        reportServerSkew(serverArrivalTimes);
+        
+        if (status == PARTIAL && partialCubemapPolicy == DROP_PARTIAL)
         {
-            boost::mutex::scoped_lock lock(frameMapMutex);
-            
-            if (frameMap.size() < maxFrameMapSize)
+            for (int i = 0; i < frames.size(); i++)
             {
-                frameMapCondition.wait(lock);
+                if (frames[i]) sinks[i]->returnFrame(frames[i]);
             }
-            pendingCubemaps = frameMap.size();
-            
-            auto it = frameMap.begin();
-            frameSeqNum = it->first;
-            lastFrameSeqNum = frameSeqNum;
-            frames = it->second;
-            frameMap.erase(it);
+            if (onReleasedCubemap) onReleasedCubemap(this, DROPPED);
+            continue;
         }
+        if (onReleasedCubemap) onReleasedCubemap(this, status);
         
+        if (outageStart != boost::chrono::steady_clock::time_point())
+        {
+            // First picture after a restart
+            {
+                boost::mutex::scoped_lock lock(frameMapMutex);
+                if (this->outageStart == outageStart)
+                {
+                    this->outageStart = boost::chrono::steady_clock::time_point();
+                }
+            }
+            boost::chrono::microseconds timeToPicture =
+                boost::chrono::duration_cast<boost::chrono::microseconds>(boost::chrono::steady_clock::now() - outageStart);
+            std::cout << "stream recovered; time to picture: " << timeToPicture.count() / 1000.0 << "ms" << std::endl;
+            if (onRecovered) onRecovered(this, timeToPicture);
+        }
+
         StereoCubemap* cubemap;
         
         // Allocate cubemap if necessary
         if (!oldCubemap)
         {
             int width, height;
+            AVPixelFormat faceFormat = format;
             for (AVFrame* frame : frames)
             {
                 if (frame)
                 {
                     width  = frame->width;
                     height = frame->height;
+                    if (format == NATIVE_PIX_FMT)
+                    {
+                        faceFormat = (AVPixelFormat)frame->format;
+                    }
                     break;
                 }
             }
@@ -155,11 +404,13 @@ void H264CubemapSource::getNextCubemapLoop()
                 std::vector<CubemapFace*> faces;
                 for (int i = 0; i < Cubemap::MAX_FACES_COUNT && faceIndex < sinks.size(); i++, faceIndex++)
                 {
+                    // Pixels are referenced from the sinks' frames
                     Frame* content = Frame::create(width,
                                                    height,
-                                                   format,
+                                                   faceFormat,
                                                    boost::chrono::system_clock::time_point(),
-                                                   heapAllocator);
+                                                   heapAllocator,
+                                                   false);
                     
                     CubemapFace* face = CubemapFace::create(content,
                                                             i,
@@ -172,12 +423,24 @@ void H264CubemapSource::getNextCubemapLoop()
             }
             
             cubemap = StereoCubemap::create(eyes, heapAllocator);
+            cubemaps.push_back(cubemap);
         }
         else
         {
             cubemap = oldCubemap;
         }
         
+        // calculate PTS for the cubemap (median of the individual faces' PTS)
+        boost::accumulators::accumulator_set<int64_t, boost::accumulators::features<boost::accumulators::tag::median> > acc;
+        for (AVFrame* frame : frames)
+        {
+            if (frame)
+            {
+                acc(frame->pts);
+            }
+        }
+        int64_t pts = boost::accumulators::median(acc);
+        
         size_t count = 0;
         // Fill cubemap making sure stereo pairs match
         for (int i = 0; i < (std::min)(frames.size(), (size_t)CUBEMAP_MAX_FACES_COUNT); i++)
@@ -194,31 +457,32 @@ void H264CubemapSource::getNextCubemapLoop()
                 rightFace  = cubemap->getEye(1)->getFace(i, true);
             }
             
-            if (matchStereoPairs && frames.size() > i + CUBEMAP_MAX_FACES_COUNT)
+            // A face whose other eye is not received has nothing to match
+            if (matchStereoPairs && frames.size() > i + CUBEMAP_MAX_FACES_COUNT &&
+                sinks[i] && sinks[i + CUBEMAP_MAX_FACES_COUNT])
             {
                 // check if matched
                 if (!leftFrame || !rightFrame)
                 {
                     // if they don't match give them back and forget about them
-                    sinks[i]->returnFrame(leftFrame);
-                    sinks[i + CUBEMAP_MAX_FACES_COUNT]->returnFrame(rightFrame);
+                    if (leftFrame)  sinks[i]->returnFrame(leftFrame);
+                    if (rightFrame) sinks[i + CUBEMAP_MAX_FACES_COUNT]->returnFrame(rightFrame);
                     leftFrame  = nullptr;
                     rightFrame = nullptr;
                 }
             }
             
-            // Fill the cubemapfaces with pixels if pixels are available
+            // Fill the cubemapfaces with pixels if pixels are available.
+            // The consumer clears the flag of a face once it has shown it. A face without a new frame
+            // stays flagged if this cubemap got handed back unseen and still holds the face's newest frame.
             if (leftFrame)
             {
                 count++;
-                leftFace->setNewFaceFlag(true);
-                avpicture_layout((AVPicture*)leftFrame, (AVPixelFormat)leftFrame->format,
-                                 leftFrame->width, leftFrame->height,
-                                 (unsigned char*)leftFace->getContent()->getPixels(), leftFace->getContent()->getWidth() * leftFace->getContent()->getHeight() * 4);
-                sinks[i]->returnFrame(leftFrame);
+                setFaceFrame(leftFace, i, leftFrame);
+                latestFaceCubemaps[i] = cubemap;
                 if (onScheduledFrameInCubemap) onScheduledFrameInCubemap(this, i);
             }
-            else
+            else if (latestFaceCubemaps[i] != cubemap)
             {
                 leftFace->setNewFaceFlag(false);
             }
@@ -226,14 +490,11 @@ void H264CubemapSource::getNextCubemapLoop()
             if (rightFrame)
             {
                 count++;
-                rightFace->setNewFaceFlag(true);
-                avpicture_layout((AVPicture*)rightFrame, (AVPixelFormat)rightFrame->format,
-                                 rightFrame->width, rightFrame->height,
-                                 (unsigned char*)rightFace->getContent()->getPixels(), rightFace->getContent()->getWidth() * rightFace->getContent()->getHeight() * 4);
-                sinks[i + CUBEMAP_MAX_FACES_COUNT]->returnFrame(rightFrame);
+                setFaceFrame(rightFace, i + CUBEMAP_MAX_FACES_COUNT, rightFrame);
+                latestFaceCubemaps[i + CUBEMAP_MAX_FACES_COUNT] = cubemap;
                 if (onScheduledFrameInCubemap) onScheduledFrameInCubemap(this, i+CUBEMAP_MAX_FACES_COUNT);
             }
-            else if (rightFace)
+            else if (rightFace && latestFaceCubemaps[i + CUBEMAP_MAX_FACES_COUNT] != cubemap)
             {
                 rightFace->setNewFaceFlag(false);
             }
@@ -242,40 +503,150 @@ void H264CubemapSource::getNextCubemapLoop()
         // Give it to the user of this library (AlloPlayer etc.)
         if (onNextCubemap)
         {
-            // calculate PTS for the cubemap (median of the individual faces' PTS)
-            boost::accumulators::accumulator_set<int64_t, boost::accumulators::features<boost::accumulators::tag::median> > acc;
-            for (AVFrame* frame : frames)
-            {
-                if (frame)
-                {
-                    acc(frame->pts);
-                }
-            }
-            int64_t pts = boost::accumulators::median(acc);
-            
-            // Calculate time interval from until this cubemap should be displayed
-            if (lastPTS == 0)
+            // Wait until the cubemap should be displayed
+            boost::chrono::system_clock::time_point targetTime;
+            if (presentationScheduler.getTargetTime(pts, boost::chrono::system_clock::now(), targetTime))
             {
-                lastPTS = pts;
+                boost::this_thread::sleep_until(targetTime);
+                
+                // A cubemap that is already late is handed out right away
+                boost::chrono::microseconds skew =
+                    boost::chrono::duration_cast<boost::chrono::microseconds>(boost::chrono::system_clock::now() - targetTime);
+                if (onPresentationSkew) onPresentationSkew(this, skew);
             }
             
-            if (lastDisplayTime.time_since_epoch().count() == 0)
+            if (onCubemapLatency)
             {
-                lastDisplayTime = boost::chrono::system_clock::now();
-                lastDisplayTime += boost::chrono::seconds(5);
+                // The pts is on the server's clock
+                boost::chrono::microseconds latency = boost::chrono::duration_cast<boost::chrono::microseconds>(
+                    boost::chrono::system_clock::now().time_since_epoch()) -
+                    (boost::chrono::microseconds(pts) - presentationScheduler.getClockOffset());
+                onCubemapLatency(this, latency);
             }
-            uint64_t ptsDiff = pts - lastPTS;
-            lastDisplayTime += boost::chrono::microseconds(ptsDiff);
-            lastPTS = pts;
-            
-            boost::chrono::milliseconds sleepDuration = boost::chrono::duration_cast<boost::chrono::milliseconds>(lastDisplayTime - boost::chrono::system_clock::now());
-            
-            // Wait until frame should be displayed
-            //boost::this_thread::sleep_for(sleepDuration);
             
             // Display frame
             oldCubemap = onNextCubemap(this, cubemap);
 		}
+        else
+        {
+            // Nobody took the cubemap -> its frames can be replaced right away
+            oldCubemap = cubemap;
+        }
+    }
+}
+
+void H264CubemapSource::reportServerSkew(const std::vector<boost::chrono::steady_clock::time_point>& serverArrivalTimes)
+{
+    if (serversCount < 2 || !onServerSkew)
+    {
+        return;
+    }
+    
+    boost::chrono::steady_clock::time_point firstArrivalTime = boost::chrono::steady_clock::time_point::max();
+    for (boost::chrono::steady_clock::time_point arrivalTime : serverArrivalTimes)
+    {
+        if (arrivalTime != boost::chrono::steady_clock::time_point())
+        {
+            firstArrivalTime = (std::min)(firstArrivalTime, arrivalTime);
+        }
+    }
+    
+    // Servers none of whose faces made it into the cubemap have no skew
+    for (int server = 0; server < serverArrivalTimes.size(); server++)
+    {
+        if (serverArrivalTimes[server] != boost::chrono::steady_clock::time_point())
+        {
+            onServerSkew(this, server, boost::chrono::duration_cast<boost::chrono::microseconds>(serverArrivalTimes[server] - firstArrivalTime));
+        }
+    }
+}
+
+void H264CubemapSource::setFaceFrame(CubemapFace* face, int sinkIndex, AVFrame* frame)
+{
+    // The consumer has given this cubemap back
+    // -> the frame the face showed before is not needed anymore
+    auto faceFrameIter = faceFrames.find(face);
+    if (faceFrameIter != faceFrames.end())
+    {
+        sinks[sinkIndex]->returnFrame(faceFrameIter->second.second);
+    }
+    faceFrames[face] = std::make_pair(sinkIndex, frame);
+    sinks[sinkIndex]->keepFrame(frame);
+    
+    face->getContent()->setPixels(frame->data, frame->linesize);
+    face->setNewFaceFlag(true);
+}
+
+void H264CubemapSource::stop()
+{
+    // Waits for the sinks' calls in progress
+    for (H264NALUSink* sink : sinks)
+    {
+        if (!sink)
+        {
+            continue;
+        }
+        
+        sink->setOnReceivedNALU       (nullptr);
+        sink->setOnReceivedFrame      (nullptr);
+        sink->setOnDecodedFrame       (nullptr);
+        sink->setOnColorConvertedFrame(nullptr);
+        sink->setOnNextFrameAvailable (nullptr);
+        sink->setOnDroppedFrame       (nullptr);
+        sink->setOnDecodingTime       (nullptr);
+    }
+    
+    if (isStopped.exchange(true))
+    {
+        return;
+    }
+    
+    {
+        boost::mutex::scoped_lock lock(availableFramesMutex);
+        availableFramesCondition.notify_all();
+    }
+    {
+        boost::mutex::scoped_lock lock(frameMapMutex);
+        frameMapCondition.notify_all();
+    }
+    // Wakes a cubemap waiting for its presentation time
+    getNextCubemapThread.interrupt();
+    
+    if (getNextFramesThread.joinable())  getNextFramesThread.join();
+    if (getNextCubemapThread.joinable()) getNextCubemapThread.join();
+}
+
+H264CubemapSource::~H264CubemapSource()
+{
+    stop();
+    
+    for (auto& bucket : frameMap)
+    {
+        for (int i = 0; i < bucket.second.frames.size(); i++)
+        {
+            if (bucket.second.frames[i]) sinks[i]->returnFrame(bucket.second.frames[i]);
+        }
+    }
+    for (auto& faceFrame : faceFrames)
+    {
+        sinks[faceFrame.second.first]->returnFrame(faceFrame.second.second);
+    }
+    // Frames we have been told about but not collected yet would be out of order for the next source
+    for (H264NALUSink* sink : sinks)
+    {
+        if (!sink)
+        {
+            continue;
+        }
+        while (AVFrame* frame = sink->getNextFrame())
+        {
+            sink->returnFrame(frame);
+        }
+    }
+    
+    for (StereoCubemap* cubemap : cubemaps)
+    {
+        StereoCubemap::destroy(cubemap);
     }
 }
 
@@ -283,21 +654,77 @@ H264CubemapSource::H264CubemapSource(std::vector<H264NALUSink*>& sinks,
                                      AVPixelFormat               format,
                                      bool                        matchStereoPairs,
                                      bool                        robustSyncing,
-                                     size_t                      maxFrameMapSize)
+                                     size_t                      maxFrameMapSize,
+                                     boost::chrono::microseconds jitterBudget,
+                                     PartialCubemapPolicy        partialCubemapPolicy,
+                                     const std::vector<int>&     sinkServers)
     :
-    sinks(sinks), format(format), oldCubemap(nullptr), lastFrameSeqNum(0), matchStereoPairs(matchStereoPairs),
-    robustSyncing(robustSyncing), maxFrameMapSize(maxFrameMapSize)
+    sinks(sinks), sinkServers(sinkServers), serversCount(1), format(format), isStopped(false), oldCubemap(nullptr), latestFaceCubemaps(sinks.size(), nullptr), lastFrameSeqNum(0), matchStereoPairs(matchStereoPairs),
+    robustSyncing(robustSyncing), maxFrameMapSize(maxFrameMapSize),
+    playoutDeadline(jitterBudget, maxFrameMapSize, partialCubemapPolicy == WAIT_FOR_ALL_FACES),
+    partialCubemapPolicy(partialCubemapPolicy), receivedFacesCount(0),
+    presentationScheduler(boost::chrono::microseconds(0), boost::chrono::microseconds(0)),
+    overloadController(DECODING_FRAME_INTERVAL, maxFrameMapSize), adaptiveDegradation(true),
+    lowPriorityFaces(sinks.size(), false), decodingTimeSums(sinks.size(), boost::chrono::microseconds(0)),
+    decodingTimeCounts(sinks.size(), 0), lastOverloadControlTime(boost::chrono::steady_clock::now())
 {
+    // Top and bottom are the faces looked at the least
+    for (int i = 0; i < lowPriorityFaces.size(); i++)
+    {
+        int cubemapFace = i % CUBEMAP_MAX_FACES_COUNT;
+        lowPriorityFaces[i] = (cubemapFace == 4 || cubemapFace == 5);
+    }
+    
+    this->sinkServers.resize(sinks.size(), 0);
+    for (int server : this->sinkServers)
+    {
+        serversCount = (std::max)(serversCount, (size_t)server + 1);
+    }
+    
+
     int i = 0;
     for (H264NALUSink* sink : sinks)
     {
+        if (!sink)
+        {
+            // face is not received
+            i++;
+            continue;
+        }
+        
+        sinksFaceMap[sink] = i;
+        receivedFacesCount++;
+        i++;
+    }
+    
+    // The sinks of a server whose stream didn't change are still playing
+    // -> they may call us as soon as they are bound
+    for (auto& sinkFace : sinksFaceMap)
+    {
+        H264NALUSink* sink = sinkFace.first;
         sink->setOnReceivedNALU       (boost::bind(&H264CubemapSource::sinkOnReceivedNALU,        this, _1, _2, _3));
         sink->setOnReceivedFrame      (boost::bind(&H264CubemapSource::sinkOnReceivedFrame,       this, _1, _2, _3));
         sink->setOnDecodedFrame       (boost::bind(&H264CubemapSource::sinkOnDecodedFrame,        this, _1, _2, _3));
         sink->setOnColorConvertedFrame(boost::bind(&H264CubemapSource::sinkOnColorConvertedFrame, this, _1, _2, _3));
-        
-        sinksFaceMap[sink] = i;
-        i++;
+        sink->setOnNextFrameAvailable (boost::bind(&H264CubemapSource::sinkOnNextFrameAvailable,  this, _1));
+        sink->setOnDroppedFrame       (boost::bind(&H264CubemapSource::sinkOnDroppedFrame,        this, _1));
+        sink->setOnDecodingTime       (boost::bind(&H264CubemapSource::sinkOnDecodingTime,        this, _1, _2));
+    }
+    
+    // Frames they made available while no source was bound would never be collected,
+    // which stalls a sink that blocks its decoder. A frame counted twice is harmless.
+    for (auto& sinkFace : sinksFaceMap)
+    {
+        size_t queuedFramesCount = sinkFace.first->getMemoryReport().queuedFramesCount;
+        for (size_t j = 0; j < queuedFramesCount; j++)
+        {
+            AvailableFrame availableFrame;
+            availableFrame.face = (int)sinkFace.second;
+            availableFrame.time = boost::chrono::steady_clock::now();
+            
+            boost::mutex::scoped_lock lock(availableFramesMutex);
+            availableFrames.push_back(availableFrame);
+        }
     }
     getNextFramesThread  = boost::thread(boost::bind(&H264CubemapSource::getNextFramesLoop,  this));
     getNextCubemapThread = boost::thread(boost::bind(&H264CubemapSource::getNextCubemapLoop, this));
@@ -327,3 +754,72 @@ void H264CubemapSource::sinkOnColorConvertedFrame(H264NALUSink* sink, u_int8_t t
     if (onColorConvertedFrame) onColorConvertedFrame(this, type, size, face);
 }
 
+void H264CubemapSource::sinkOnDroppedFrame(H264NALUSink* sink)
+{
+    int face = sinksFaceMap[sink];
+    if (onDroppedFrame) onDroppedFrame(this, face);
+}
+
+void H264CubemapSource::sinkOnDecodingTime(H264NALUSink* sink, boost::chrono::microseconds duration)
+{
+    int face = sinksFaceMap[sink];
+    if (onDecodingTime) onDecodingTime(this, face, duration);
+    
+    DecodeOverloadController::Level oldLevel, newLevel;
+    boost::chrono::microseconds decodingTime(0);
+    size_t queueDepth;
+    {
+        boost::mutex::scoped_lock lock(overloadControlMutex);
+        
+        decodingTimeSums[face] += duration;
+        decodingTimeCounts[face]++;
+        
+        boost::chrono::steady_clock::time_point now = boost::chrono::steady_clock::now();
+        if (!adaptiveDegradation || now - lastOverloadControlTime < OVERLOAD_CONTROL_INTERVAL)
+        {
+            return;
+        }
+        lastOverloadControlTime = now;
+        
+        // The slowest decoder determines when cubemaps are complete
+        for (int i = 0; i < decodingTimeSums.size(); i++)
+        {
+            if (decodingTimeCounts[i] > 0)
+            {
+                decodingTime = (std::max)(decodingTime, decodingTimeSums[i] / (int64_t)decodingTimeCounts[i]);
+            }
+            decodingTimeSums[i]   = boost::chrono::microseconds(0);
+            decodingTimeCounts[i] = 0;
+        }
+        
+        {
+            boost::mutex::scoped_lock lock(frameMapMutex);
+            queueDepth = frameMap.size();
+        }
+        
+        oldLevel = overloadController.getLevel();
+        newLevel = overloadController.update(decodingTime, queueDepth);
+        if (newLevel == oldLevel)
+        {
+            return;
+        }
+        applyDegradationLevel(newLevel);
+    }
+    
+    std::cout << "decoding quality " << ((newLevel > oldLevel) ? "degraded" : "restored") << " to level " << newLevel <<
+        " (decoding: " << decodingTime.count() / 1000.0 << "ms, queue: " << queueDepth << ")" << std::endl;
+    if (onDegradationLevelChanged) onDegradationLevelChanged(this, oldLevel, newLevel);
+}
+
+void H264CubemapSource::sinkOnNextFrameAvailable(H264NALUSink* sink)
+{
+    AvailableFrame availableFrame;
+    availableFrame.face = sinksFaceMap[sink];
+    availableFrame.time = boost::chrono::steady_clock::now();
+    
+    {
+        boost::mutex::scoped_lock lock(availableFramesMutex);
+        availableFrames.push_back(availableFrame);
+    }
+    availableFramesCondition.notify_one();
+}
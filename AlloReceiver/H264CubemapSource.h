@@ -5,20 +5,59 @@
 #include <liveMedia.hh>
 #include <boost/filesystem/path.hpp>
 #include <map>
+#include <deque>
+#include <atomic>
+#include <boost/chrono/system_clocks.hpp>
 
 #include "AlloReceiver.h"
 #include "H264NALUSink.hpp"
-#include "RTSPCubemapSourceClient.hpp"
+#include "DecodeOverloadController.hpp"
+#include "PresentationScheduler.hpp"
+#include "PlayoutDeadline.hpp"
 
 class ALLORECEIVER_API H264CubemapSource : public CubemapSource
 {
 public:
+    // What happens to a cubemap whose faces did not all arrive before its deadline
+    enum PartialCubemapPolicy
+    {
+        REUSE_PREVIOUS_FACES, // show it; missing faces keep the content of the previous cubemap
+        DROP_PARTIAL,         // don't show it at all
+        WAIT_FOR_ALL_FACES    // ignore the deadline; only released when the playout buffer is full
+    };
+    
+    enum ReleaseStatus {COMPLETE, PARTIAL, DROPPED};
+    
     typedef std::function<void (H264CubemapSource*, u_int8_t, size_t, int)>     OnReceivedNALU;
     typedef std::function<void (H264CubemapSource*, u_int8_t, size_t, int)>     OnReceivedFrame;
     typedef std::function<void (H264CubemapSource*, u_int8_t, size_t, int)>     OnDecodedFrame;
     typedef std::function<void (H264CubemapSource*, u_int8_t, size_t, int)>     OnColorConvertedFrame;
     typedef std::function<void (H264CubemapSource*, int)>                       OnAddedFrameToCubemap;
     typedef std::function<void (H264CubemapSource*, int)>                       OnScheduledFrameInCubemap;
+    // latency: time between the frame becoming available in the sink and its collection
+    typedef std::function<void (H264CubemapSource*, int, boost::chrono::microseconds)> OnCollectedFrame;
+    // duration: time the frame collector slept while waiting for frames
+    typedef std::function<void (H264CubemapSource*, boost::chrono::microseconds)> OnCollectorIdle;
+    typedef std::function<void (H264CubemapSource*, ReleaseStatus)>             OnReleasedCubemap;
+    // A frame arrived after its cubemap had already been released
+    typedef std::function<void (H264CubemapSource*, int)>                       OnLateFrame;
+    // A sink dropped a decoded frame because we didn't collect it in time
+    typedef std::function<void (H264CubemapSource*, int)>                       OnDroppedFrame;
+    // duration: time a sink's decoder spent on a frame
+    typedef std::function<void (H264CubemapSource*, int, boost::chrono::microseconds)> OnDecodingTime;
+    // The decoders gave up or regained some quality because of their load
+    typedef std::function<void (H264CubemapSource*,
+                                DecodeOverloadController::Level oldLevel,
+                                DecodeOverloadController::Level newLevel)> OnDegradationLevelChanged;
+    // timeToPicture: time from the interruption of the stream until the first cubemap after restart()
+    typedef std::function<void (H264CubemapSource*, boost::chrono::microseconds timeToPicture)> OnRecovered;
+    // skew: how much later than its target time a scheduled cubemap was handed out
+    typedef std::function<void (H264CubemapSource*, boost::chrono::microseconds skew)> OnPresentationSkew;
+    // latency: time from a cubemap's pts until it was handed out, corrected by the clock offset
+    typedef std::function<void (H264CubemapSource*, boost::chrono::microseconds latency)> OnCubemapLatency;
+    // skew: how much later than the cubemap's first face the first face from the server arrived.
+    // Only called when the faces come from several servers.
+    typedef std::function<void (H264CubemapSource*, int server, boost::chrono::microseconds skew)> OnServerSkew;
     
     virtual void setOnReceivedNALU           (const OnReceivedNALU&            callback);
     virtual void setOnReceivedFrame          (const OnReceivedFrame&           callback);
@@ -27,12 +66,57 @@ public:
     virtual void setOnNextCubemap            (const OnNextCubemap&             callback);
     virtual void setOnAddedFrameToCubemap    (const OnAddedFrameToCubemap&     callback);
     virtual void setOnScheduledFrameInCubemap(const OnScheduledFrameInCubemap& callback);
+    virtual void setOnCollectedFrame         (const OnCollectedFrame&          callback);
+    virtual void setOnCollectorIdle          (const OnCollectorIdle&           callback);
+    virtual void setOnReleasedCubemap        (const OnReleasedCubemap&         callback);
+    virtual void setOnLateFrame              (const OnLateFrame&               callback);
+    virtual void setOnDroppedFrame           (const OnDroppedFrame&            callback);
+    virtual void setOnDecodingTime           (const OnDecodingTime&            callback);
+    virtual void setOnDegradationLevelChanged(const OnDegradationLevelChanged& callback);
+    virtual void setOnRecovered              (const OnRecovered&               callback);
+    virtual void setOnPresentationSkew       (const OnPresentationSkew&        callback);
+    virtual void setOnCubemapLatency         (const OnCubemapLatency&          callback);
+    virtual void setOnServerSkew             (const OnServerSkew&              callback);
+    
+    // Whether the decoders may give up quality when they fall behind (default: yes).
+    // Disabling it restores full quality right away.
+    void setAdaptiveDegradation(bool enabled);
+    // Faces (0-11) whose frames are dropped first when the decoders fall behind.
+    // Default: top and bottom of both eyes.
+    void setLowPriorityFaces(const std::vector<int>& faces);
+    
+    // The stream was interrupted at outageStart and starts over with new timestamps,
+    // e.g. because the server restarted. Forgets the buffered cubemaps.
+    // The faces keep showing their last frames until new ones arrive.
+    void restart(boost::chrono::steady_clock::time_point outageStart);
+    
+    // Hands out each cubemap presentationLatency after its pts so that all render nodes
+    // show it at the same time (see PresentationScheduler). 0 (default) hands it out right away.
+    void setPresentationLatency(boost::chrono::microseconds presentationLatency);
+    // How far the server's clock is ahead of ours
+    void setClockOffset(boost::chrono::microseconds clockOffset);
+    // Measures the clock offset instead; may be NULL
+    void setClockOffsetEstimator(ClockOffsetEstimator* clockOffsetEstimator);
     
+    // A cubemap is released as soon as all its faces have arrived or jitterBudget after
+    // its first face has arrived (see PlayoutDeadline). At most maxFrameMapSize cubemaps are buffered.
+    // sinkServers tells for each sink which server its face comes from; empty means all from one.
     H264CubemapSource(std::vector<H264NALUSink*>& sinks,
                       AVPixelFormat               format,
                       bool                        matchStereoPairs,
                       bool                        robustSyncing,
-                      size_t                      maxFrameMapSize);
+                      size_t                      maxFrameMapSize,
+                      boost::chrono::microseconds jitterBudget,
+                      PartialCubemapPolicy        partialCubemapPolicy,
+                      const std::vector<int>&     sinkServers = std::vector<int>());
+    // Gives all frames back to the sinks, which may be used by another source afterwards.
+    // The consumer must not use the cubemaps anymore.
+    virtual ~H264CubemapSource();
+    
+    // Stops collecting frames and handing out cubemaps, e.g. so that the consumer can give back
+    // its cubemaps before the source is destroyed. Waits for a cubemap being handed out.
+    // The sinks don't call the source anymore afterwards.
+    void stop();
 
 protected:
     OnReceivedNALU            onReceivedNALU;
@@ -42,8 +126,33 @@ protected:
     OnNextCubemap             onNextCubemap;
     OnAddedFrameToCubemap     onAddedFrameToCubemap;
     OnScheduledFrameInCubemap onScheduledFrameInCubemap;
+    OnCollectedFrame          onCollectedFrame;
+    OnCollectorIdle           onCollectorIdle;
+    OnReleasedCubemap         onReleasedCubemap;
+    OnLateFrame               onLateFrame;
+    OnDroppedFrame            onDroppedFrame;
+    OnDecodingTime            onDecodingTime;
+    OnDegradationLevelChanged onDegradationLevelChanged;
+    OnRecovered               onRecovered;
+    OnPresentationSkew        onPresentationSkew;
+    OnCubemapLatency          onCubemapLatency;
+    OnServerSkew              onServerSkew;
     
 private:
+    struct FrameBucket
+    {
+        std::vector<AVFrame*>                                frames;
+        size_t                                               framesCount;
+        boost::chrono::steady_clock::time_point              deadline;
+        std::vector<boost::chrono::steady_clock::time_point> serverArrivalTimes; // of the first face from each server
+    };
+    
+    struct AvailableFrame
+    {
+        int                                     face;
+        boost::chrono::steady_clock::time_point time;
+    };
+
     void getNextFramesLoop();
     void getNextCubemapLoop();
     
@@ -51,19 +160,54 @@ private:
     void sinkOnReceivedFrame      (H264NALUSink* sink, u_int8_t type, size_t size);
     void sinkOnDecodedFrame       (H264NALUSink* sink, u_int8_t type, size_t size);
     void sinkOnColorConvertedFrame(H264NALUSink* sink, u_int8_t type, size_t size);
+    void sinkOnNextFrameAvailable (H264NALUSink* sink);
+    void sinkOnDroppedFrame       (H264NALUSink* sink);
+    void sinkOnDecodingTime       (H264NALUSink* sink, boost::chrono::microseconds duration);
+    
+    // availableTime: when the sink made the frame available
+    void addFrameToMap(int face, AVFrame* frame, boost::chrono::steady_clock::time_point availableTime);
+    // Reports how far behind the first face of a cubemap each server's faces arrived
+    void reportServerSkew(const std::vector<boost::chrono::steady_clock::time_point>& serverArrivalTimes);
+    // Tells the sinks how much quality they may give up
+    void applyDegradationLevel(DecodeOverloadController::Level level);
+    // Makes the face show the frame without copying its pixels
+    void setFaceFrame(CubemapFace* face, int sinkIndex, AVFrame* frame);
   
     boost::mutex                              frameMapMutex;
     boost::condition_variable                 frameMapCondition;
-    std::map<int, std::vector<AVFrame*> >     frameMap;
+    std::map<int64_t, FrameBucket>            frameMap; // playout buffer
     std::vector<H264NALUSink*>                sinks;
     std::map<H264NALUSink*, int64_t>          sinksFaceMap;
+    std::vector<int>                          sinkServers;  // server of each sink's face
+    size_t                                    serversCount;
+    boost::mutex                              availableFramesMutex;
+    boost::condition_variable                 availableFramesCondition;
+    std::deque<AvailableFrame>                availableFrames; // one entry per frame made available by a sink
     AVPixelFormat                             format;
     HeapAllocator                             heapAllocator;
     boost::thread                             getNextCubemapThread;
     boost::thread                             getNextFramesThread;
+    std::atomic<bool>                         isStopped;
     StereoCubemap*                            oldCubemap;
+    std::map<CubemapFace*, std::pair<int, AVFrame*>> faceFrames; // sink and its frame whose pixels each face shows
+    std::vector<StereoCubemap*>               cubemaps;   // all we have created
+    std::vector<StereoCubemap*>               latestFaceCubemaps; // per sink: the cubemap that got its newest frame
     int64_t                                   lastFrameSeqNum;
     bool                                      matchStereoPairs;
     bool                                      robustSyncing;
     size_t                                    maxFrameMapSize;
+    PlayoutDeadline                           playoutDeadline;
+    PartialCubemapPolicy                      partialCubemapPolicy;
+    size_t                                    receivedFacesCount; // faces with a sink
+    boost::chrono::steady_clock::time_point   outageStart;        // of the last restart(); reset by the first cubemap after it
+    PresentationScheduler                     presentationScheduler;
+    
+    // Overload control. Fed by the decoding threads.
+    boost::mutex                              overloadControlMutex;
+    DecodeOverloadController                  overloadController;
+    bool                                      adaptiveDegradation;
+    std::vector<bool>                         lowPriorityFaces;
+    std::vector<boost::chrono::microseconds>  decodingTimeSums;   // per face since the last update
+    std::vector<size_t>                       decodingTimeCounts;
+    boost::chrono::steady_clock::time_point   lastOverloadControlTime;
 };
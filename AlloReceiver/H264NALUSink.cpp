@@ -9,90 +9,170 @@
 
 namespace bc = boost::chrono;
 
-const size_t MAX_NALUS_PER_PKT = 30;
+#ifndef AV_INPUT_BUFFER_PADDING_SIZE
+#define AV_INPUT_BUFFER_PADDING_SIZE FF_INPUT_BUFFER_PADDING_SIZE
+#endif
+
 unsigned char const START_CODE[4] = { 0x00, 0x00, 0x00, 0x01 };
-const size_t MAX_NALU_SIZE = 1000000;
-const size_t MAX_PKT_SIZE  = (sizeof(START_CODE) + MAX_NALU_SIZE) * MAX_NALUS_PER_PKT;
+// Initial sizes. The buffers grow when the stream needs more.
+const size_t INITIAL_NALU_BUFFER_SIZE = 100000;
+const size_t INITIAL_PKT_SIZE         = 100000;
+const size_t PKTS_COUNT               = 5;
+const int    DECODER_LINE_SIZE_ALIGN  = 64; // enough for every SIMD flavour of libavcodec
 
-H264NALUSink* H264NALUSink::createNew(UsageEnvironment& env,
-                                      unsigned long     bufferSize,
-                                      AVPixelFormat     format,
-                                      MediaSubsession*  subsession,
-                                      bool              robustSyncing)
+static size_t getFrameMemorySize(const AVFrame* frame)
+{
+    return avpicture_get_size((AVPixelFormat)frame->format, frame->width, frame->height);
+}
+
+H264NALUSink* H264NALUSink::createNew(UsageEnvironment&  env,
+                                      AVPixelFormat      format,
+                                      MediaSubsession*   subsession,
+                                      bool               robustSyncing,
+                                      size_t             framesCount,
+                                      FrameMemoryBudget* memoryBudget,
+                                      BackpressurePolicy backpressurePolicy,
+                                      DecoderThreading   decoderThreading,
+                                      int                decoderThreadsCount)
 {
     av_log_set_level(AV_LOG_FATAL);
     avcodec_register_all();
     avformat_network_init();
-	return new H264NALUSink(env, bufferSize, format, subsession, robustSyncing);
+	return new H264NALUSink(env,
+                            format,
+                            subsession,
+                            robustSyncing,
+                            framesCount,
+                            memoryBudget,
+                            backpressurePolicy,
+                            decoderThreading,
+                            decoderThreadsCount);
 }
 
 void H264NALUSink::setOnReceivedNALU(const OnReceivedNALU& callback)
 {
+    boost::unique_lock<boost::shared_mutex> lock(callbacksMutex);
     onReceivedNALU = callback;
 }
 
 void H264NALUSink::setOnReceivedFrame(const OnReceivedFrame& callback)
 {
+    boost::unique_lock<boost::shared_mutex> lock(callbacksMutex);
     onReceivedFrame = callback;
 }
 
 void H264NALUSink::setOnDecodedFrame(const OnDecodedFrame& callback)
 {
+    boost::unique_lock<boost::shared_mutex> lock(callbacksMutex);
     onDecodedFrame = callback;
 }
 
 void H264NALUSink::setOnColorConvertedFrame(const OnColorConvertedFrame& callback)
 {
+    boost::unique_lock<boost::shared_mutex> lock(callbacksMutex);
     onColorConvertedFrame = callback;
 }
 
-H264NALUSink::H264NALUSink(UsageEnvironment& env,
-                           unsigned int      bufferSize,
-                           AVPixelFormat     format,
-                           MediaSubsession*  subsession,
-                           bool              robustSyncing)
+void H264NALUSink::setOnDecodingError(const OnDecodingError& callback)
+{
+    boost::unique_lock<boost::shared_mutex> lock(callbacksMutex);
+    onDecodingError = callback;
+}
+
+void H264NALUSink::setOnNextFrameAvailable(const OnNextFrameAvailable& callback)
+{
+    boost::unique_lock<boost::shared_mutex> lock(callbacksMutex);
+    onNextFrameAvailable = callback;
+}
+
+void H264NALUSink::setOnDroppedFrame(const OnDroppedFrame& callback)
+{
+    boost::unique_lock<boost::shared_mutex> lock(callbacksMutex);
+    onDroppedFrame = callback;
+}
+
+void H264NALUSink::setOnDecodingTime(const OnDecodingTime& callback)
+{
+    boost::unique_lock<boost::shared_mutex> lock(callbacksMutex);
+    onDecodingTime = callback;
+}
+
+void H264NALUSink::setDecodingQuality(AVDiscard skipLoopFilter, AVDiscard skipFrame)
+{
+    this->skipLoopFilter = skipLoopFilter;
+    this->skipFrame      = skipFrame;
+}
+
+H264NALUSink::H264NALUSink(UsageEnvironment&  env,
+                           AVPixelFormat      format,
+                           MediaSubsession*   subsession,
+                           bool               robustSyncing,
+                           size_t             framesCount,
+                           FrameMemoryBudget* memoryBudget,
+                           BackpressurePolicy backpressurePolicy,
+                           DecoderThreading   decoderThreading,
+                           int                decoderThreadsCount)
     :
-    MediaSink(env), bufferSize(bufferSize), buffer(new unsigned char[bufferSize]),
-    imageConvertCtx(NULL), receivedFirstPriorityPackages(false), format(format),
-    counter(0), sumRelativePresentationTimeMicroSec(0), maxRelativePresentationTimeMicroSec(0), subsession(subsession), lastTotal(0),
-    pts(-1), lastPTS(-1), robustSyncing(robustSyncing)
+    MediaSink(env), bufferSize(INITIAL_NALU_BUFFER_SIZE), buffer(new unsigned char[INITIAL_NALU_BUFFER_SIZE]),
+    spareFrame(NULL), naluSize(0), isCollectingNALU(false), pktBuffersSize(0), largestPktSize(0),
+    pts(-1), lastPTS(-1), robustSyncing(robustSyncing),
+    imageConvertCtx(NULL), receivedFirstPriorityPackages(false), format(format), convertFrames(format != NATIVE_PIX_FMT),
+    hasDecodedFrames(false), flushesCount(0), decoderFlushesCount(0),
+    framesCount(framesCount), memoryBudget(memoryBudget), backpressurePolicy(backpressurePolicy), droppedFramesCount(0),
+    skipLoopFilter(AVDISCARD_DEFAULT), skipFrame(AVDISCARD_DEFAULT),
+    counter(0), sumRelativePresentationTimeMicroSec(0), maxRelativePresentationTimeMicroSec(0), clockOffsetEstimator(nullptr),
+    subsession(subsession), lastTotal(0)
 {
-    for (int i = 0; i < MAX_NALUS_PER_PKT + 1; i++)
-    {
-        naluPool.push(new NALU({new unsigned char[MAX_NALU_SIZE], 0, -1}));
-    }
-    
-    for (int i = 0; i < 5; i++)
+    for (int i = 0; i < PKTS_COUNT; i++)
     {
         AVPacket* pkt = new AVPacket;
-        av_new_packet(pkt, MAX_PKT_SIZE);
+        if (av_new_packet(pkt, INITIAL_PKT_SIZE) < 0)
+        {
+            fprintf(stderr, "Could not allocate pkt\n");
+            abort();
+        }
         pkt->size = 0;
+        pktBuffersSize += INITIAL_PKT_SIZE;
+        pkts.push_back(pkt);
         pktPool.push(pkt);
     }
     pktPool.waitAndPop(currentPkt);
     
-	for (int i = 0; i < 60; i++)
+	for (int i = 0; i < framesCount; i++)
 	{
-        
-        
 		AVFrame* frame = av_frame_alloc();
 		if (!frame)
 		{
 			fprintf(stderr, "Could not allocate video frame\n");
 			abort();
 		}
+        frames.push_back(frame);
 		framePool.push(frame);
         
-        AVFrame* resizedFrame = av_frame_alloc();
-        if (!resizedFrame)
+        if (convertFrames)
         {
-            fprintf(stderr, "Could not allocate video frame\n");
-			abort();
+            AVFrame* resizedFrame = av_frame_alloc();
+            if (!resizedFrame)
+            {
+                fprintf(stderr, "Could not allocate video frame\n");
+                abort();
+            }
+            resizedFrame->format = format;
+            frames.push_back(resizedFrame);
+            convertedFramePool.push(resizedFrame);
         }
-        resizedFrame->format = format;
-        convertedFramePool.push(resizedFrame);
 	}
-
+    
+    if (!convertFrames)
+    {
+        spareFrame = av_frame_alloc();
+        if (!spareFrame)
+        {
+            fprintf(stderr, "Could not allocate video frame\n");
+            abort();
+        }
+        frames.push_back(spareFrame);
+    }
 
 	// Initialize codec and decoder
 	AVCodec* codec = avcodec_find_decoder(AV_CODEC_ID_H264);
@@ -109,6 +189,34 @@ H264NALUSink::H264NALUSink(UsageEnvironment& env,
 		fprintf(stderr, "could not allocate video codec context\n");
 		abort();
 	}
+    
+    // Decode into our refcounted buffers so that decoded frames
+    // can be handed on without copying
+    codecContext->opaque            = this;
+    codecContext->get_buffer2       = &H264NALUSink::getBuffer2;
+    codecContext->refcounted_frames = 1;
+#ifdef CODEC_FLAG_EMU_EDGE
+    codecContext->flags            |= CODEC_FLAG_EMU_EDGE;
+#endif
+    
+    // Our encoder limits the size of slices so that every frame has plenty of them
+    codecContext->thread_count = decoderThreadsCount;
+    switch (decoderThreading)
+    {
+    case SLICE_THREADING:
+        codecContext->thread_type = FF_THREAD_SLICE;
+        break;
+    case FRAME_THREADING:
+        codecContext->thread_type = FF_THREAD_FRAME;
+        break;
+    case SLICE_AND_FRAME_THREADING:
+        codecContext->thread_type = FF_THREAD_SLICE | FF_THREAD_FRAME;
+        break;
+    }
+#if LIBAVCODEC_VERSION_MAJOR < 59
+    // getBuffer2() may be called from the frame threads
+    codecContext->thread_safe_callbacks = 1;
+#endif
 
 	/* open it */
 	if (avcodec_open2(codecContext, codec, NULL) < 0)
@@ -117,26 +225,62 @@ H264NALUSink::H264NALUSink(UsageEnvironment& env,
 		abort();
 	}
 
-    //packageNALUsThread = boost::thread(boost::bind(&H264NALUSink::packageNALUsLoop, this));
 	decodeFrameThread  = boost::thread(boost::bind(&H264NALUSink::decodeFrameLoop,  this));
-    convertFrameThread = boost::thread(boost::bind(&H264NALUSink::convertFrameLoop, this));
+    if (convertFrames)
+    {
+        convertFrameThread = boost::thread(boost::bind(&H264NALUSink::convertFrameLoop, this));
+    }
 }
 
-void H264NALUSink::packageData(AVPacket* pkt, unsigned int frameSize, timeval presentationTime)
+H264NALUSink::~H264NALUSink()
 {
-    unsigned char const start_code[4] = { 0x00, 0x00, 0x00, 0x01 };
-    //unsigned char const start_code[0] = { };
+    // Wake the threads wherever they wait, including for the memory budget
+    decodeFrameThread.interrupt();
+    convertFrameThread.interrupt();
+    pktBuffer.close();
+    framePool.close();
+    frameBuffer.close();
+    convertedFramePool.close();
+    if (decodeFrameThread.joinable())  decodeFrameThread.join();
+    if (convertFrameThread.joinable()) convertFrameThread.join();
+    
+    // The budget may be shared with sinks that live on
+    AVFrame* frame;
+    while (convertedFrameBuffer.tryPop(frame))
+    {
+        returnFrame(frame);
+    }
     
-    av_init_packet(pkt);
+    for (AVFrame* frame : frames)
+    {
+        av_frame_free(&frame);
+    }
+    for (AVPacket* pkt : pkts)
+    {
+        av_free_packet(pkt);
+        delete pkt;
+    }
     
-    AVRational microSecBase = { 1, 1000000 };
+    avcodec_free_context(&codecContext);
+    sws_freeContext(imageConvertCtx);
+    delete[] buffer;
+}
+
+int H264NALUSink::getBuffer2(AVCodecContext* codecContext, AVFrame* frame, int flags)
+{
+    H264NALUSink* self = (H264NALUSink*)codecContext->opaque;
     
-    pkt->size = frameSize + sizeof(start_code);
-    pkt->data = (uint8_t*)new char[frameSize + sizeof(start_code)];
-    pkt->pts = presentationTime.tv_sec * 1000000 + presentationTime.tv_usec;
+    // libavcodec may write up to the aligned height
+    int alignedWidth  = frame->width;
+    int alignedHeight = frame->height;
+    int lineSizeAlign[AV_NUM_DATA_POINTERS];
+    avcodec_align_dimensions2(codecContext, &alignedWidth, &alignedHeight, lineSizeAlign);
     
-    memcpy(pkt->data, start_code, sizeof(start_code));
-    memcpy(pkt->data + sizeof(start_code), buffer, frameSize);
+    if (!self->decodedFrameBuffers.getBuffer(frame, DECODER_LINE_SIZE_ALIGN, alignedHeight - frame->height))
+    {
+        return avcodec_default_get_buffer2(codecContext, frame, flags);
+    }
+    return 0;
 }
 
 void H264NALUSink::afterGettingFrame(unsigned frameSize,
@@ -149,217 +293,244 @@ void H264NALUSink::afterGettingFrame(unsigned frameSize,
     
     //std::cout << this << " " << presentationTime.tv_sec << " " << presentationTime.tv_usec << std::endl;
     
-    u_int8_t nal_unit_type = buffer[0] & 0x1F;
+    if (numTruncatedBytes > 0)
+    {
+        // The NALU didn't fit into our buffer and is lost.
+        // -> Make room for NALUs of this size
+        bufferSize = (frameSize + numTruncatedBytes) * 3 / 2;
+        delete[] buffer;
+        buffer = new unsigned char[bufferSize];
+        
+        continuePlaying();
+        return;
+    }
+    
+    // The marker bit is set on the RTP packet carrying the end of the frame's last NALU
+    startNALU();
+    appendToNALU(buffer, frameSize);
+    finishNALU(presentationTime, subsession->rtpSource()->curPacketMarkerBit());
+    
+    // Then try getting the next frame:
+    continuePlaying();
+}
+
+void H264NALUSink::startNALU()
+{
+    // The NALU is collected right behind the NALUs of the current frame
+    naluSize = 0;
+    isCollectingNALU = reservePkt(currentPkt, currentPkt->size + sizeof(START_CODE));
+    if (!isCollectingNALU)
+    {
+        std::cout << "Could not grow pkt!" << std::endl;
+        return;
+    }
+    memcpy(currentPkt->data + currentPkt->size, START_CODE, sizeof(START_CODE));
+    naluSize = sizeof(START_CODE);
+}
+
+void H264NALUSink::appendToNALU(const unsigned char* data, size_t size)
+{
+    if (!isCollectingNALU)
+    {
+        return;
+    }
+    
+    if (!reservePkt(currentPkt, currentPkt->size + naluSize + size))
+    {
+        std::cout << "Could not grow pkt!" << std::endl;
+        abortNALU();
+        return;
+    }
+    memcpy(currentPkt->data + currentPkt->size + naluSize, data, size);
+    naluSize += size;
+}
 
-	/*if (onDroppedNALU) onDroppedNALU(this, nal_unit_type, frameSize);
+void H264NALUSink::abortNALU()
+{
+    isCollectingNALU = false;
+    naluSize         = 0;
+}
 
-	continuePlaying();
-	return;*/
+void H264NALUSink::flush()
+{
+    abortNALU();
+    currentPkt->size = 0;
+    lastPTS          = -1;
     
-    //std::cout << naluPool.size() << std::endl;
+    // From now on frames decoded before are stale
+    flushesCount++;
+
+    // Pkts the decoder hasn't taken yet. A NULL pkt tells it to flush.
+    AVPacket* pkt;
+    int flushPktsCount = 1;
+    while (pktBuffer.tryPop(pkt))
+    {
+        if (pkt)
+        {
+            pktPool.push(pkt);
+        }
+        else
+        {
+            // of an earlier flush() the decoder hasn't done yet
+            flushPktsCount++;
+        }
+    }
+    for (int i = 0; i < flushPktsCount; i++)
+    {
+        pktBuffer.push(NULL);
+    }
+
+    // Frames waiting for the color conversion
+    AVFrame* frame;
+    while (frameBuffer.tryPop(frame))
+    {
+        av_frame_unref(frame);
+        framePool.push(frame);
+    }
     
-    /*pts = presentationTime.tv_sec * 1000000 + presentationTime.tv_usec;
-    int64_t altPts;
-    for (int i = 0; i < sizeof(int64_t); i++)
+    // Frames the consumer hasn't collected yet
+    while (convertedFrameBuffer.tryPop(frame))
+    {
+        returnFrame(frame);
+    }
+}
+
+bool H264NALUSink::isStale(AVFrame* frame)
+{
+    return (intptr_t)frame->opaque < flushesCount;
+}
+
+void H264NALUSink::setSubsession(MediaSubsession* subsession)
+{
+    this->subsession = subsession;
+}
+
+void H264NALUSink::setClockOffsetEstimator(ClockOffsetEstimator* clockOffsetEstimator)
+{
+    this->clockOffsetEstimator = clockOffsetEstimator;
+}
+
+void H264NALUSink::finishNALU(timeval presentationTime, bool isLastNALUOfFrame)
+{
+    if (!isCollectingNALU || naluSize <= sizeof(START_CODE))
     {
-        ((char*)&altPts)[i] = *(buffer + frameSize - (8-i));
+        abortNALU();
+        return;
     }
-    altPts = *((int64_t*)(buffer + frameSize - sizeof(int64_t)));
-    std::cout << altPts << " " << pts << std::endl;*/
+    isCollectingNALU = false;
     
-    size_t packageSize;
-    if (robustSyncing && frameSize >= sizeof(int64_t))
+    unsigned char* nalu = currentPkt->data + currentPkt->size;
+    if (robustSyncing && naluSize >= sizeof(START_CODE) + sizeof(int64_t))
     {
-        pts = *((int64_t*)(buffer + frameSize - sizeof(int64_t)));
-        packageSize = frameSize - sizeof(int64_t);
+        // The server appends the frame's pts to every NALU
+        naluSize -= sizeof(int64_t);
+        memcpy(&pts, nalu + naluSize, sizeof(int64_t));
     }
     else
     {
         pts = presentationTime.tv_sec * 1000000 + presentationTime.tv_usec;
-        packageSize = frameSize;
     }
     
-    // Check if all NALUs for current frame have arrived
-    if (lastPTS != -1 && lastPTS != pts)
+    // A NALU of the next frame means that the current frame is complete.
+    // Only needed when the RTP packet with the marker bit got lost.
+    if (currentPkt->size > 0 && lastPTS != -1 && lastPTS != pts)
     {
-        if (onReceivedFrame) onReceivedFrame(this, currentPkt->data[4] & 0x1F, currentPkt->size);
-        
-        // make frame available to the decoder
-        // if we currently have the capacities to encode another frame
-        AVPacket* pkt;
-        if (pktPool.tryPop(pkt))
+        // The NALU has to move to the start of the next pkt
+        std::vector<unsigned char> naluCopy(nalu, nalu + naluSize);
+        completeCurrentPkt();
+        if (!reservePkt(currentPkt, naluCopy.size()))
         {
-            pktBuffer.push(currentPkt);
-            currentPkt = pkt;
+            std::cout << "Could not grow pkt!" << std::endl;
+            naluSize = 0;
+            return;
         }
-        
-        // Reset current pkt so that we can fill it with new NALUs
-        currentPkt->size = 0;
+        memcpy(currentPkt->data, naluCopy.data(), naluCopy.size());
     }
     
-    // Add NALU to current frame pkt
-    if (sizeof(START_CODE) + packageSize > MAX_PKT_SIZE)
+    currentPkt->size += naluSize;
+    currentPkt->pts   = pts;
+    naluSize          = 0;
+    lastPTS           = pts;
+    
+    // No need to wait for the next frame
+    if (isLastNALUOfFrame)
     {
-        std::cout << "NALUs are too big for one pkt!" << std::endl;
+        completeCurrentPkt();
     }
-    else
+}
+
+bool H264NALUSink::reservePkt(AVPacket* pkt, size_t size)
+{
+    size_t capacity = pkt->buf->size - AV_INPUT_BUFFER_PADDING_SIZE;
+    if (size <= capacity)
     {
-        memcpy(currentPkt->data + currentPkt->size, START_CODE, sizeof(START_CODE));
-        memcpy(currentPkt->data + currentPkt->size + sizeof(START_CODE), buffer, packageSize);
-        currentPkt->size += sizeof(START_CODE) + packageSize;
-        currentPkt->pts = pts;
+        return true;
     }
     
-    lastPTS = pts;
-    
-//    NALU* nalu;
-//    if (naluPool.tryPop(nalu))
-//    {
-//        size_t size;
-//        if (frameSize > MAX_NALU_SIZE)
-//        {
-//            std::cout << "NALU too big!" << std::endl;
-//            size = MAX_NALU_SIZE;
-//        }
-//        else
-//        {
-//            size = frameSize;
-//        }
-//        memcpy(nalu->buffer, buffer, size);
-//        nalu->size = size;
-//        nalu->pts  = presentationTime.tv_sec * 1000000 + presentationTime.tv_usec;
-//        naluBuffer.push(nalu);
-//        //if (onAddedNALU) onAddedNALU(this, nal_unit_type, frameSize);
-//    }
-//    else
-//    {
-//        if (onDroppedNALU) onDroppedNALU(this, nal_unit_type, frameSize);
-//    }
-    
+    // Make room for the biggest access unit seen so far plus some headroom
+    // so that we don't have to grow again for every slightly bigger one
+    size_t newCapacity = (std::max)(size, largestPktSize.load()) * 3 / 2;
+    if (av_buffer_realloc(&pkt->buf, newCapacity + AV_INPUT_BUFFER_PADDING_SIZE) < 0)
+    {
+        return false;
+    }
+    pkt->data = pkt->buf->data;
+    pktBuffersSize += newCapacity - capacity;
+    return true;
+}
 
-    //std::cout << "type: " << (int)nal_unit_type << " " << frameSize << std::endl;
-    
-//    static uint64_t lastPTS = -1;
-//    static std::deque<std::string> packets;
-//    static size_t frameNALUsSize = 0;
-//    
-//    uint64_t pts = presentationTime.tv_sec * 1000000 + presentationTime.tv_usec;
-//    
-//    if (lastPTS != -1 && pts != lastPTS)
-//    {
-//        unsigned char const start_code[4] = { 0x00, 0x00, 0x00, 0x01 };
-//        size_t size = frameNALUsSize + packets.size() * sizeof(start_code);
-//        
-//        AVPacket* pkt;
-//        
-//        if (pktPool.tryPop(pkt))
-//        {
-//            
-//            av_init_packet(pkt);
-//            
-//            pkt->size = size;
-//            pkt->data = (uint8_t*)new char[pkt->size];
-//            pkt->pts = presentationTime.tv_sec * 1000000 + presentationTime.tv_usec;
-//            
-//            uint8_t* dataPtr = pkt->data;
-//            while (packets.size() > 0)
-//            {
-//                std::string& packet = packets.front();
-//                memcpy(dataPtr, start_code, sizeof(start_code));
-//                memcpy(dataPtr + sizeof(start_code), packet.data(), packet.size());
-//                dataPtr += packet.size() + sizeof(start_code);
-//                packets.pop_front();
-//            }
-//            
-//
-//            pktBuffer.push(pkt);
-//            if (onAddedNALU) onAddedNALU(this, nal_unit_type, size);
-//        }
-//        else
-//        {
-//            if (onDroppedNALU) onDroppedNALU(this, nal_unit_type, size);
-//        }
-//        
-//        frameNALUsSize = 0;
-//        packets.clear();
-//    }
-//    
-//    std::string packet((char*)buffer, frameSize);
-//    packets.push_back(packet);
-//    frameNALUsSize += frameSize;
-//    lastPTS = pts;
-    
+void H264NALUSink::completeCurrentPkt()
+{
+    {
+        boost::shared_lock<boost::shared_mutex> lock(callbacksMutex);
+        if (onReceivedFrame) onReceivedFrame(this, currentPkt->data[4] & 0x1F, currentPkt->size);
+    }
     
+    if (currentPkt->size > largestPktSize)
+    {
+        largestPktSize = currentPkt->size;
+    }
     
-    //std::cout << "type " << (int)nal_unit_type << " " << frameSize << std::endl;
+    // The decoder's bitstream reader may read a little beyond the end of the data
+    memset(currentPkt->data + currentPkt->size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
     
-    // Then try getting the next frame:
-    continuePlaying();
-    return;
+    // make frame available to the decoder
+    // if we currently have the capacities to encode another frame
+    AVPacket* pkt;
+    if (pktPool.tryPop(pkt))
+    {
+        pktBuffer.push(currentPkt);
+        currentPkt = pkt;
+        
+        // A frame thread of the decoder may still reference the pkt's data
+        if (av_buffer_make_writable(&currentPkt->buf) >= 0)
+        {
+            currentPkt->data = currentPkt->buf->data;
+        }
+        
+        // Grow before the next access unit instead of while collecting its NALUs
+        reservePkt(currentPkt, largestPktSize);
+    }
     
-//    if (pkt)
-//    {
-//        // We currently have the capacities to decode the received frame
-//        
-//        if (priorityPackages.size() > 0)
-//        {
-//            // We still have SPS, PPS and/or IDR-slices to process -> do it now
-//            // Don't care about the received frame
-//            pktBuffer.push(priorityPackages.front());
-//            priorityPackages.pop();
-//            receivedFirstPriorityPackages = true;
-//            delete pkt; // avoid memory leak
-//            if (onDroppedNALU) onDroppedNALU(this, nal_unit_type, frameSize);
-//        }
-//        else if (nal_unit_type == 1 && receivedFirstPriorityPackages)
-//        {
-//            // We received a B/P frame
-//            // and have the capacities to decode it -> do it
-//            packageData(pkt, frameSize, presentationTime);
-//            pktBuffer.push(pkt);
-//			if (onAddedNALU) onAddedNALU(this, nal_unit_type, frameSize);
-//        }
-//        else if (nal_unit_type == 7 /* SPS */ ||
-//                 nal_unit_type == 8 /* PPS */ ||
-//                 nal_unit_type == 5 /* IDR-slice */)
-//        {
-//            packageData(pkt, frameSize, presentationTime);
-//            pktBuffer.push(pkt);
-//            receivedFirstPriorityPackages = true;
-//			if (onAddedNALU) onAddedNALU(this, nal_unit_type, frameSize);
-//        }
-//        else
-//        {
-//            pktPool.push(pkt);
-//			if (onDroppedNALU) onDroppedNALU(this, nal_unit_type, frameSize);
-//        }
-//    }
-//    else
-//    {
-//        // We currently don't have the capacities to decode the received frame
-//        
-//        if (nal_unit_type == 7 /* SPS */ ||
-//            nal_unit_type == 8 /* PPS */ ||
-//            nal_unit_type == 5 /* IDR-slice */)
-//        {
-//            // We received a priority NALU but don't have the capacities
-//            // to encode it right now -> safe it for later
-//            AVPacket* priorityNALU = new AVPacket;
-//            packageData(priorityNALU, frameSize, presentationTime);
-//            priorityPackages.push(priorityNALU);
-//        }
-//        else if (nal_unit_type == 1)
-//        {
-//            // We received a B/P frame but don't have the capacities
-//            // to encode it right now.
-//            // We can safely skip it.
-//            
-//            if (onDroppedNALU) onDroppedNALU(this, nal_unit_type, frameSize);
-//        }
-//    }
-//
-//	// Then try getting the next frame:
-//	continuePlaying();
+    // Reset current pkt so that we can fill it with new NALUs
+    currentPkt->size = 0;
+}
+
+H264NALUSink::MemoryReport H264NALUSink::getMemoryReport()
+{
+    MemoryReport report;
+    report.naluBufferSize             = bufferSize;
+    report.pktBuffersSize             = pktBuffersSize;
+    report.pktsCount                  = PKTS_COUNT;
+    report.largestAccessUnitSize      = largestPktSize;
+    report.decodedFrameBuffersSize    = decodedFrameBuffers.getAllocatedBytes();
+    report.decodedFrameBuffersCount   = decodedFrameBuffers.getBuffersCount();
+    report.convertedFrameBuffersSize  = convertedFrameBuffers.getAllocatedBytes();
+    report.convertedFrameBuffersCount = convertedFrameBuffers.getBuffersCount();
+    report.framesCount                = framesCount;
+    report.queuedFramesCount          = convertedFrameBuffer.size();
+    report.droppedFramesCount         = droppedFramesCount;
+    return report;
 }
 
 Boolean H264NALUSink::continuePlaying()
@@ -381,123 +552,6 @@ void H264NALUSink::afterGettingFrame(void*clientData,
 	sink->afterGettingFrame(frameSize, numTruncatedBytes, presentationTime);
 }
 
-void H264NALUSink::packageNALUsLoop()
-{
-    int64_t lastPTS = -1;
-    int64_t pts     = -1;
-    std::queue<NALU*> nalus;
-    
-    /*while (true)
-    {
-        NALU* nalu;
-        if (!naluBuffer.waitAndPop(nalu))
-        {
-            // queue did close
-            return;
-        }
-        naluPool.push(nalu);
-    }*/
-    
-    while (true)
-    {
-        AVPacket* pkt;
-        if (!pktPool.waitAndPop(pkt))
-        {
-            // queue did close
-            return;
-        }
-        
-        do
-        {
-            if (nalus.size() == MAX_NALUS_PER_PKT + 1)
-            {
-                std::cerr << "Too many NALUs per pkt!" << std::endl;
-                abort();
-            }
-            
-            lastPTS = pts;
-            
-            NALU* nalu;
-            if (!naluBuffer.waitAndPop(nalu))
-            {
-                // queue did close
-                return;
-            }
-            nalus.push(nalu);
-            pts = nalu->pts;
-        }
-        while (lastPTS == -1 || pts == lastPTS);
-        
-        pkt->size = 0;
-        
-        while (nalus.size() > 1)
-        {
-            NALU* nalu = nalus.front();
-            nalus.pop();
-            
-            if (sizeof(START_CODE) + nalu->size + pkt->size > MAX_PKT_SIZE)
-            {
-                std::cout << "NALUs are too big for one pkt!" << std::endl;
-            }
-            else
-            {
-                memcpy(pkt->data + pkt->size, START_CODE, sizeof(START_CODE));
-                memcpy(pkt->data + pkt->size + sizeof(START_CODE), nalu->buffer, nalu->size);
-                pkt->size += sizeof(START_CODE) + nalu->size;
-                pkt->pts = lastPTS;
-            }
-            
-            naluPool.push(nalu);
-        }
-        
-        pktBuffer.push(pkt);
-        //pktPool.push(pkt);
-            
-//            if (lastPTS != -1 && nalu->pts != lastPTS)
-//                    {
-//                        unsigned char const start_code[4] = { 0x00, 0x00, 0x00, 0x01 };
-//                        size_t size = frameNALUsSize + packets.size() * sizeof(start_code);
-//                
-//                        AVPacket* pkt;
-//                
-//                        if (pktPool.tryPop(pkt))
-//                        {
-//                
-//                            av_init_packet(pkt);
-//                
-//                            pkt->size = size;
-//                            pkt->data = (uint8_t*)new char[pkt->size];
-//                            pkt->pts = presentationTime.tv_sec * 1000000 + presentationTime.tv_usec;
-//                
-//                            uint8_t* dataPtr = pkt->data;
-//                            while (packets.size() > 0)
-//                            {
-//                                std::string& packet = packets.front();
-//                                memcpy(dataPtr, start_code, sizeof(start_code));
-//                                memcpy(dataPtr + sizeof(start_code), packet.data(), packet.size());
-//                                dataPtr += packet.size() + sizeof(start_code);
-//                                packets.pop_front();
-//                            }
-//                
-//                
-//                            pktBuffer.push(pkt);
-//                            if (onAddedNALU) onAddedNALU(this, nal_unit_type, size);
-//                        }
-//                        else
-//                        {
-//                            if (onDroppedNALU) onDroppedNALU(this, nal_unit_type, size);
-//                        }
-//                        
-//                        frameNALUsSize = 0;
-//                        packets.clear();
-//                    }
-//            
-//        
-//        }
-//        while ();
-    }
-}
-
 void H264NALUSink::decodeFrameLoop()
 {
 	while (true)
@@ -511,36 +565,82 @@ void H264NALUSink::decodeFrameLoop()
 			// queue did close
 			return;
 		}
+        
+        if (!pkt)
+        {
+            // flush() -> forget the reference frames and the delayed frames of the old stream
+            avcodec_flush_buffers(codecContext);
+            hasDecodedFrames = false;
+            decoderFlushesCount++;
+            continue;
+        }
         //std::cout << pktPool.size() << std::endl;
 
-		if (!framePool.waitAndPop(frame))
-		{
-			// queue did close
-			return;
-		}
+        if (!framePool.tryPop(frame))
+        {
+            // Decoded frames go straight to the consumer and it doesn't keep up
+            // -> make room by dropping the oldest one it hasn't collected yet.
+            // If it holds all frames itself, decode into the spare frame and drop the result
+            // so that the decoder still gets the pkt's references.
+            if (!convertFrames && backpressurePolicy == DROP_OLDEST && !dropOldestFrame())
+            {
+                frame = spareFrame;
+            }
+            // Otherwise wait for the color conversion or the consumer
+            else if (!framePool.waitAndPop(frame))
+            {
+                // queue did close
+                return;
+            }
+        }
         //std::cout << framePool.size() << std::endl;
 
 		int got_frame;
+        codecContext->skip_loop_filter = (AVDiscard)skipLoopFilter.load();
+        codecContext->skip_frame       = (AVDiscard)skipFrame.load();
+        bc::steady_clock::time_point decodingStart = bc::steady_clock::now();
 		int len = avcodec_decode_video2(codecContext, frame, &got_frame, pkt);
+        {
+            boost::shared_lock<boost::shared_mutex> lock(callbacksMutex);
+            if (onDecodingTime) onDecodingTime(this, bc::duration_cast<bc::microseconds>(bc::steady_clock::now() - decodingStart));
+        }
         
         //std::cout << "len " << len - pkt->size << std::endl;
         //std::cout << "type: " << int(pkt->data[4] & 0x1F) << std::endl;
         //std::cout << "time " << pkt->pts << std::endl;
         
+        // With frame threading the frame belongs to a pkt given to the decoder earlier
+        int64_t framePts = (got_frame == 1) ? av_frame_get_best_effort_timestamp(frame) : 0;
 		pktPool.push(pkt);
+        
+        if (got_frame == 1)
+        {
+            frame->opaque = (void*)decoderFlushesCount;
+            if (isStale(frame))
+            {
+                // flush() was called while the pkt was decoded
+                av_frame_unref(frame);
+                got_frame = 0;
+            }
+        }
 
         if (got_frame == 1)
         {
-            if (onDecodedFrame) onDecodedFrame(this,
-                                               frame->key_frame,
-                                               avpicture_get_size((AVPixelFormat)frame->format,
-                                                                  frame->width,
-                                                                  frame->height));
+            hasDecodedFrames = true;
+            
+            {
+                boost::shared_lock<boost::shared_mutex> lock(callbacksMutex);
+                if (onDecodedFrame) onDecodedFrame(this,
+                                                   frame->key_frame,
+                                                   avpicture_get_size((AVPixelFormat)frame->format,
+                                                                      frame->width,
+                                                                      frame->height));
+            }
             //std::cout << "got frame" << std::endl;
             
             // We have decoded a frame :) ->
             // Make the frame available to the application
-            frame->pts = pkt->pts;
+            frame->pts = framePts;
             
             static uint64_t last = 0;
             
@@ -551,7 +651,25 @@ void H264NALUSink::decodeFrameLoop()
             
             //std::cout << this << " " << frame->pts << std::endl;
             
-            frameBuffer.push(frame);
+            if (frame == spareFrame)
+            {
+                av_frame_unref(frame);
+                droppedFramesCount++;
+                {
+                    boost::shared_lock<boost::shared_mutex> lock(callbacksMutex);
+                    if (onDroppedFrame) onDroppedFrame(this);
+                }
+            }
+            else if (convertFrames)
+            {
+                frameBuffer.push(frame);
+            }
+            else
+            {
+                // The consumer takes the decoder's format
+                // -> hand the decoded frame on as it is
+                deliverFrame(frame);
+            }
             //framePool.push(frame);
             
             //std::cout << "frame" << std::endl;
@@ -562,11 +680,17 @@ void H264NALUSink::decodeFrameLoop()
             
             // No frame could be decoded :( ->
             // Put frame back to the pool so that the next packet will be read
-            framePool.push(frame);
+            if (frame != spareFrame)
+            {
+                framePool.push(frame);
+            }
             
             if (len < 0)
             {
                 // error decoding frame
+                // -> we will decode garbage until the next IDR frame arrives
+                boost::shared_lock<boost::shared_mutex> lock(callbacksMutex);
+                if (onDecodingError) onDecodingError(this, hasDecodedFrames);
             }
             else if (len == 0)
             {
@@ -577,12 +701,20 @@ void H264NALUSink::decodeFrameLoop()
         }
         
 
+        if (got_frame != 1)
+        {
+            continue;
+        }
+
 		bc::microseconds nowSinceEpoch =
 			bc::duration_cast<bc::microseconds>(bc::system_clock::now().time_since_epoch());
 
-		AVRational microSecBase = { 1, 1000000 };
-		bc::microseconds presentationTimeSinceEpoch =
-			bc::microseconds(av_rescale_q(pkt->pts, codecContext->time_base, microSecBase));
+		// pts are in microseconds on the server's clock
+		bc::microseconds presentationTimeSinceEpoch(framePts);
+		if (clockOffsetEstimator)
+		{
+			presentationTimeSinceEpoch = bc::duration_cast<bc::microseconds>(clockOffsetEstimator->toLocalTime(framePts).time_since_epoch());
+		}
 
 
 		bc::microseconds relativePresentationTime = presentationTimeSinceEpoch - nowSinceEpoch;
@@ -622,27 +754,48 @@ void H264NALUSink::convertFrameLoop()
         }
         //std::cout /*<< this << " "*/ << frameBuffer.size() << std::endl;
         
-        if (!convertedFramePool.waitAndPop(convertedFrame))
+        if (isStale(frame))
         {
-            // queue did close
-            return;
+            av_frame_unref(frame);
+            framePool.push(frame);
+            continue;
         }
         
-        if (!convertedFrame->data[0])
+        if (!convertedFramePool.tryPop(convertedFrame))
         {
-            convertedFrame->width = frame->width;
-            convertedFrame->height = frame->height;
-            if (av_image_alloc(convertedFrame->data, convertedFrame->linesize, convertedFrame->width, convertedFrame->height,
-                               (AVPixelFormat)convertedFrame->format, 32) < 0)
+            // The consumer doesn't keep up
+            if (backpressurePolicy == DROP_OLDEST && !dropOldestFrame())
             {
-                fprintf(stderr, "Could not allocate raw picture buffer\n");
-                abort();
+                // It holds all frames itself -> drop the new one
+                av_frame_unref(frame);
+                framePool.push(frame);
+                droppedFramesCount++;
+                {
+                    boost::shared_lock<boost::shared_mutex> lock(callbacksMutex);
+                    if (onDroppedFrame) onDroppedFrame(this);
+                }
+                continue;
+            }
+            
+            if (!convertedFramePool.waitAndPop(convertedFrame))
+            {
+                // queue did close
+                return;
             }
         }
         
         if (frame->format != format)
         {
-            // We have to convert the color format of this frame
+            // We have to convert the color format of this frame.
+            // The result goes into a pooled buffer with tightly packed planes.
+            convertedFrame->format = format;
+            convertedFrame->width  = frame->width;
+            convertedFrame->height = frame->height;
+            if (!convertedFrameBuffers.getBuffer(convertedFrame))
+            {
+                fprintf(stderr, "Could not allocate raw picture buffer\n");
+                abort();
+            }
             
             if (!imageConvertCtx)
             {
@@ -657,29 +810,33 @@ void H264NALUSink::convertFrameLoop()
             // resize frame
             sws_scale(imageConvertCtx, frame->data, frame->linesize, 0, frame->height,
                       convertedFrame->data, convertedFrame->linesize);
+            
+            convertedFrame->pts = frame->pts;
+            convertedFrame->coded_picture_number = frame->coded_picture_number;
+            convertedFrame->opaque = frame->opaque;
         }
         else
         {
-            // We only have to copy the frame since the color format is already the desired one
-            av_frame_copy(convertedFrame, frame);
+            // The color format is already the desired one
+            // -> reference the decoder's buffer instead of copying it
+            av_frame_ref(convertedFrame, frame);
         }
-            
-        
-        
-        convertedFrame->pts = frame->pts;
-        convertedFrame->coded_picture_number = frame->coded_picture_number;
         
-        if (onColorConvertedFrame) onColorConvertedFrame(this,
-                                                         frame->key_frame,
-                                                         avpicture_get_size((AVPixelFormat)frame->format,
-                                                                            frame->width,
-                                                                            frame->height));
+        {
+            boost::shared_lock<boost::shared_mutex> lock(callbacksMutex);
+            if (onColorConvertedFrame) onColorConvertedFrame(this,
+                                                             frame->key_frame,
+                                                             avpicture_get_size((AVPixelFormat)frame->format,
+                                                                                frame->width,
+                                                                                frame->height));
+        }
         
         // continue decoding
+        av_frame_unref(frame);
         framePool.push(frame);
         
         // make frame available
-        convertedFrameBuffer.push(convertedFrame);
+        deliverFrame(convertedFrame);
 		//convertedFramePool.push(convertedFrame);
     }
 }
@@ -687,20 +844,95 @@ void H264NALUSink::convertFrameLoop()
 AVFrame* H264NALUSink::getNextFrame()
 {
     AVFrame* frame;
-	if (convertedFrameBuffer.tryPop(frame))
+	while (convertedFrameBuffer.tryPop(frame))
 	{
-        return frame;
+        // flush() may have been called while it was decoded or converted
+        if (!isStale(frame))
+        {
+            return frame;
+        }
+        returnFrame(frame);
 	}
-    else
-    {
-        return NULL;
-    }
+    return NULL;
 }
 
 void H264NALUSink::returnFrame(AVFrame* frame)
 {
 	if (frame)
     {
-		convertedFramePool.push(frame);
+        if (memoryBudget)
+        {
+            memoryBudget->release(frame);
+        }
+        recycleFrame(frame);
 	}
+}
+
+void H264NALUSink::keepFrame(AVFrame* frame)
+{
+    if (memoryBudget)
+    {
+        memoryBudget->keep(frame);
+    }
+}
+
+void H264NALUSink::recycleFrame(AVFrame* frame)
+{
+    // Its buffer goes back to the pool once nobody else references it
+    av_frame_unref(frame);
+    if (convertFrames)
+    {
+        convertedFramePool.push(frame);
+    }
+    else
+    {
+        // it's a decoder frame
+        framePool.push(frame);
+    }
+}
+
+void H264NALUSink::deliverFrame(AVFrame* frame)
+{
+    if (memoryBudget)
+    {
+        size_t size = getFrameMemorySize(frame);
+        while (!memoryBudget->reserve(frame, size, backpressurePolicy == BLOCK_DECODER))
+        {
+            // Over budget -> make room by dropping the oldest frame the consumer hasn't collected yet.
+            // If there is none, the other sinks hold the budget -> drop the new frame.
+            if (!dropOldestFrame())
+            {
+                recycleFrame(frame);
+                droppedFramesCount++;
+                {
+                    boost::shared_lock<boost::shared_mutex> lock(callbacksMutex);
+                    if (onDroppedFrame) onDroppedFrame(this);
+                }
+                return;
+            }
+        }
+    }
+    
+    convertedFrameBuffer.push(frame);
+    {
+        boost::shared_lock<boost::shared_mutex> lock(callbacksMutex);
+        if (onNextFrameAvailable) onNextFrameAvailable(this);
+    }
+}
+
+bool H264NALUSink::dropOldestFrame()
+{
+    AVFrame* frame;
+    if (!convertedFrameBuffer.tryPop(frame))
+    {
+        return false;
+    }
+    
+    returnFrame(frame);
+    droppedFramesCount++;
+    {
+        boost::shared_lock<boost::shared_mutex> lock(callbacksMutex);
+        if (onDroppedFrame) onDroppedFrame(this);
+    }
+    return true;
 }
\ No newline at end of file
@@ -13,41 +13,147 @@ extern "C"
 }
 #include <MediaSink.hh>
 #include <MediaSession.hh>
+#include <atomic>
 #include <boost/thread.hpp>
 
 #include "AlloReceiver.h"
 
 #include "AlloShared/ConcurrentQueue.hpp"
 #include "AlloShared/Cubemap.hpp"
+#include "FaceBufferPool.hpp"
+#include "FrameMemoryBudget.hpp"
+#include "ClockOffsetEstimator.hpp"
+#include "H264RTPDepacketizer.hpp"
 
-class ALLORECEIVER_API H264NALUSink : public MediaSink
+// Format for consumers that take frames in whatever format the decoder outputs
+// (YUV420P for our streams). Decoded frames are then handed on as they are;
+// there is no color conversion stage at all.
+const AVPixelFormat NATIVE_PIX_FMT = AV_PIX_FMT_NONE;
+
+// Frames a sink can hand out, including the ones held by the consumer
+const size_t DEFAULT_SINK_FRAMES_COUNT = 4;
+
+class ALLORECEIVER_API H264NALUSink : public MediaSink, public H264RTPDepacketizer::NALUSink
 {
 public:
-	static H264NALUSink* createNew(UsageEnvironment& env,
-                                        unsigned long     bufferSize,
-                                        AVPixelFormat     format,
-                                        MediaSubsession*  subsession,
-                                        bool              robustSyncing);
+    // What a sink does when its consumer doesn't keep up,
+    // i.e. when all its frames are taken or the memory budget is exhausted
+    enum BackpressurePolicy
+    {
+        DROP_OLDEST,  // drop the oldest frame the consumer hasn't collected yet, or the new one
+                      // if the consumer holds all frames; the decoder never waits for the consumer
+        BLOCK_DECODER // wait until the consumer returns a frame; nothing is dropped
+    };
+    
+    // How the decoder spreads its threads
+    enum DecoderThreading
+    {
+        SLICE_THREADING,          // the slices of a frame in parallel; no extra latency
+        FRAME_THREADING,          // consecutive frames in parallel; one frame of latency per extra thread
+        SLICE_AND_FRAME_THREADING // whatever the decoder prefers
+    };
+    
+    // memoryBudget may be shared with other sinks and may be NULL
+	static H264NALUSink* createNew(UsageEnvironment&  env,
+                                        AVPixelFormat      format,
+                                        MediaSubsession*   subsession,
+                                        bool               robustSyncing,
+                                        size_t             framesCount        = DEFAULT_SINK_FRAMES_COUNT,
+                                        FrameMemoryBudget* memoryBudget       = NULL,
+                                        BackpressurePolicy backpressurePolicy = DROP_OLDEST,
+                                        DecoderThreading   decoderThreading   = SLICE_THREADING,
+                                        int                decoderThreadsCount = 1);
 
+	// Frames reference pooled buffers. Their pixels stay valid until they are returned.
 	AVFrame* getNextFrame();
     void returnFrame(AVFrame* usedFrame);
+    // The consumer keeps the frame for display until it returns it.
+    // It doesn't count against the memory budget meanwhile (see FrameMemoryBudget).
+    void keepFrame(AVFrame* frame);
+    
+    // Memory currently held by the sink in bytes
+    struct MemoryReport
+    {
+        size_t naluBufferSize;             // receives one NALU from the RTP source
+        size_t pktBuffersSize;             // collect the NALUs of an access unit for the decoder
+        size_t pktsCount;
+        size_t largestAccessUnitSize;      // the pkts are sized after it
+        size_t decodedFrameBuffersSize;
+        size_t decodedFrameBuffersCount;
+        size_t convertedFrameBuffersSize;
+        size_t convertedFrameBuffersCount;
+        size_t framesCount;
+        size_t queuedFramesCount;          // available, but not collected by the consumer yet
+        size_t droppedFramesCount;         // since the start
+    };
+    // May be called from any thread
+    MemoryReport getMemoryReport();
+    
+    // Lets the decoder skip work when the CPU can't keep up.
+    // Takes effect with the next pkt. May be called from any thread.
+    void setDecodingQuality(AVDiscard skipLoopFilter, AVDiscard skipFrame);
     
+    // For receivers that bypass live555's RTP source and reassemble NALUs themselves.
+    // The NALU is written straight into the pkt that goes to the decoder.
+    // Must be called from one thread only and not while the sink is playing.
+    void startNALU();
+    void appendToNALU(const unsigned char* data, size_t size);
+    // isLastNALUOfFrame: the RTP marker bit was set
+    void finishNALU(timeval presentationTime, bool isLastNALUOfFrame);
+    // A fragment of the NALU got lost
+    void abortNALU();
+
+    // Forgets the NALUs and frames of the current stream, e.g. when the server restarted.
+    // Frames the consumer has collected stay valid; frames decoded from the old stream later
+    // are not handed out. The decoder forgets its reference frames on its own thread before
+    // the next pkt. All buffers are kept. Must not be called while the sink is playing.
+    void flush();
+    // Lets the sink play the subsession of a new RTSP session with unchanged stream parameters
+    void setSubsession(MediaSubsession* subsession);
+    
+    // Corrects the presentation delay for the server's clock. May be NULL.
+    // Must be set before the sink starts playing.
+    void setClockOffsetEstimator(ClockOffsetEstimator* clockOffsetEstimator);
+
     typedef std::function<void (H264NALUSink*, u_int8_t, size_t)> OnReceivedNALU;
     typedef std::function<void (H264NALUSink*, u_int8_t, size_t)> OnReceivedFrame;
     typedef std::function<void (H264NALUSink*, u_int8_t, size_t)> OnDecodedFrame;
     typedef std::function<void (H264NALUSink*, u_int8_t, size_t)> OnColorConvertedFrame;
+    // Called when the decoder fails to decode a frame. hasDecodedFrames is false
+    // as long as no frame has been decoded, e.g. when the stream was joined in the middle of a GOP.
+    typedef std::function<void (H264NALUSink*, bool hasDecodedFrames)> OnDecodingError;
+    // Called after a frame became available through getNextFrame()
+    typedef std::function<void (H264NALUSink*)> OnNextFrameAvailable;
+    // Called when a decoded frame is dropped because the consumer doesn't keep up
+    typedef std::function<void (H264NALUSink*)> OnDroppedFrame;
+    // Called after each pkt with the time spent in the decoder.
+    // With frame threading this is the time until the decoder took the pkt.
+    typedef std::function<void (H264NALUSink*, boost::chrono::microseconds)> OnDecodingTime;
     
+    // May be called from any thread. Waits for a call of the previous callback in progress,
+    // so whatever that one captured may be destroyed afterwards.
     void setOnReceivedNALU       (const OnReceivedNALU&        callback);
     void setOnReceivedFrame      (const OnReceivedFrame&       callback);
     void setOnDecodedFrame       (const OnDecodedFrame&        callback);
     void setOnColorConvertedFrame(const OnColorConvertedFrame& callback);
+    void setOnDecodingError      (const OnDecodingError&       callback);
+    void setOnNextFrameAvailable (const OnNextFrameAvailable&  callback);
+    void setOnDroppedFrame       (const OnDroppedFrame&        callback);
+    void setOnDecodingTime       (const OnDecodingTime&        callback);
 	
 protected:
-	H264NALUSink(UsageEnvironment& env,
-                      unsigned int      bufferSize,
-                      AVPixelFormat     format,
-                      MediaSubsession*  subsession,
-                      bool              robustSyncing);
+	H264NALUSink(UsageEnvironment&  env,
+                      AVPixelFormat      format,
+                      MediaSubsession*   subsession,
+                      bool               robustSyncing,
+                      size_t             framesCount,
+                      FrameMemoryBudget* memoryBudget,
+                      BackpressurePolicy backpressurePolicy,
+                      DecoderThreading   decoderThreading,
+                      int                decoderThreadsCount);
+    // Stops the decoder and frees all frames, so the consumer must have returned them.
+    // Use Medium::close().
+    virtual ~H264NALUSink();
 
 	virtual void afterGettingFrame(unsigned frameSize,
 		unsigned numTruncatedBytes,
@@ -65,28 +171,32 @@ protected:
     OnReceivedFrame       onReceivedFrame;
     OnDecodedFrame        onDecodedFrame;
     OnColorConvertedFrame onColorConvertedFrame;
+    OnDecodingError       onDecodingError;
+    OnNextFrameAvailable  onNextFrameAvailable;
+    OnDroppedFrame        onDroppedFrame;
+    OnDecodingTime        onDecodingTime;
+    boost::shared_mutex   callbacksMutex; // held shared while a callback is called
 
 private:
-    struct NALU
-    {
-        unsigned char* buffer;
-        size_t size;
-        int64_t pts;
-    };
-    
-	unsigned long bufferSize;
+    // Grows when a NALU doesn't fit
+	std::atomic<size_t> bufferSize;
 	unsigned char* buffer;
 	AVCodecContext* codecContext;
-    ConcurrentQueue<NALU*> naluPool;
-    ConcurrentQueue<NALU*> naluBuffer;
     ConcurrentQueue<AVPacket*> pktBuffer;
     ConcurrentQueue<AVPacket*> pktPool;
 	ConcurrentQueue<AVFrame*> frameBuffer;
 	ConcurrentQueue<AVFrame*> framePool;
     ConcurrentQueue<AVFrame*> convertedFrameBuffer;
     ConcurrentQueue<AVFrame*> convertedFramePool;
+    std::vector<AVPacket*>    pkts;   // all we have allocated
+    std::vector<AVFrame*>     frames; // all we have allocated, decoded and converted ones
+    AVFrame*                  spareFrame; // native format only: decoded into and dropped when the consumer holds all other frames
     
     AVPacket* currentPkt;
+    size_t naluSize; // bytes of the NALU being collected behind the end of currentPkt
+    bool isCollectingNALU;
+    std::atomic<size_t> pktBuffersSize;
+    std::atomic<size_t> largestPktSize;
     int64_t pts;
     int64_t lastPTS;
     
@@ -98,21 +208,52 @@ private:
     bool receivedFirstPriorityPackages; // first sequence of SPS, PPS and IDR-slice NALUs has been received
     
     AVPixelFormat format;
+    bool convertFrames; // false if the consumer takes the decoder's format
+    
+    bool hasDecodedFrames;
+    
+    // Each flush() starts a new stream. Decoded frames carry the count of flushes
+    // the decoder had done in their opaque field.
+    std::atomic<intptr_t> flushesCount;
+    intptr_t              decoderFlushesCount; // decoder thread only
+    // Frames of the stream before the last flush()
+    bool isStale(AVFrame* frame);
+    
+    size_t              framesCount;
+    FrameMemoryBudget*  memoryBudget;
+    BackpressurePolicy  backpressurePolicy;
+    std::atomic<size_t> droppedFramesCount;
+    std::atomic<int>    skipLoopFilter; // AVDiscard
+    std::atomic<int>    skipFrame;      // AVDiscard
     
-    void packageNALUsLoop();
 	void decodeFrameLoop();
     void convertFrameLoop();
-    boost::thread packageNALUsThread;
     boost::thread decodeFrameThread;
     boost::thread convertFrameThread;
 
 	int counter;
 	long sumRelativePresentationTimeMicroSec;
 	long maxRelativePresentationTimeMicroSec;
+    ClockOffsetEstimator* clockOffsetEstimator;
     
     MediaSubsession* subsession;
     int lastTotal;
     
-    void packageData(AVPacket* pkt, unsigned int frameSize, timeval presentationTime);
+    FaceBufferPool decodedFrameBuffers;
+    FaceBufferPool convertedFrameBuffers;
+    static int getBuffer2(AVCodecContext* codecContext, AVFrame* frame, int flags);
+    
+    // Grows the pkt's buffer (keeping its contents) so that it can hold size bytes.
+    // Returns false if the buffer could not be grown.
+    bool reservePkt(AVPacket* pkt, size_t size);
+    // Hands the NALUs collected in currentPkt to the decoder
+    void completeCurrentPkt();
+    
+    // Makes the frame available to the consumer unless it has to be dropped
+    void deliverFrame(AVFrame* frame);
+    // Returns false if the consumer has collected all available frames
+    bool dropOldestFrame();
+    // Puts the frame back into its pool without touching the memory budget
+    void recycleFrame(AVFrame* frame);
 };
 
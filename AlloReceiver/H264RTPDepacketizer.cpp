@@ -0,0 +1,180 @@
+#include <algorithm>
+
+#include "AlloShared/RTCPFeedback.hpp"
+#include "H264RTPDepacketizer.hpp"
+
+const uint8_t NALU_TYPE_STAP_A = 24;
+const uint8_t NALU_TYPE_FU_A   = 28;
+
+H264RTPDepacketizer::H264RTPDepacketizer(NALUSink* sink, unsigned int timestampFrequency)
+    :
+    sink(sink), timestampFrequency((std::max)(1u, timestampFrequency)), highestSeqNum(-1), ssrc(0),
+    isInFragmentedNALU(false), lastTimestamp(-1),
+    packetsCount(0), bytesCount(0), lostPacketsCount(0), latePacketsCount(0), abortedNALUsCount(0)
+{
+}
+
+uint32_t H264RTPDepacketizer::getSSRC()
+{
+    return ssrc;
+}
+
+H264RTPDepacketizer::Statistics H264RTPDepacketizer::getStatistics()
+{
+    Statistics statistics;
+    statistics.packetsCount      = packetsCount;
+    statistics.bytesCount        = bytesCount;
+    statistics.lostPacketsCount  = lostPacketsCount;
+    statistics.latePacketsCount  = latePacketsCount;
+    statistics.abortedNALUsCount = abortedNALUsCount;
+    return statistics;
+}
+
+bool H264RTPDepacketizer::handlePacket(unsigned char* packet, size_t packetSize)
+{
+    if (packetSize < RTCPFeedback::RTP_HEADER_SIZE || (packet[0] & 0xC0) != 0x80)
+    {
+        // not a RTP packet
+        return false;
+    }
+
+    // Header: CSRCs, extension and padding
+    size_t headerSize = RTCPFeedback::RTP_HEADER_SIZE + (packet[0] & 0x0F) * 4;
+    if (packet[0] & 0x10)
+    {
+        if (packetSize < headerSize + 4)
+        {
+            return false;
+        }
+        headerSize += 4 + ((packet[headerSize + 2] << 8) | packet[headerSize + 3]) * 4;
+    }
+    if (packet[0] & 0x20)
+    {
+        size_t paddingSize = packet[packetSize - 1];
+        if (paddingSize > packetSize)
+        {
+            return false;
+        }
+        packetSize -= paddingSize;
+    }
+    if (packetSize <= headerSize)
+    {
+        return false;
+    }
+
+    bool     marker    = (packet[1] & 0x80) != 0;
+    uint16_t seqNum    = RTCPFeedback::rtpSeqNum(packet);
+    uint32_t timestamp = (packet[4] << 24) | (packet[5] << 16) | (packet[6] << 8) | packet[7];
+    uint32_t ssrc      = RTCPFeedback::rtpSSRC(packet);
+
+    if (highestSeqNum == -1 || ssrc != this->ssrc)
+    {
+        // first packet of the stream
+        this->ssrc    = ssrc;
+        lastTimestamp = timestamp;
+    }
+    else
+    {
+        int16_t delta = (int16_t)(seqNum - (uint16_t)highestSeqNum);
+        if (delta <= 0)
+        {
+            // Its NALU has already been completed or given up
+            latePacketsCount++;
+            return true;
+        }
+        else if (delta > 1)
+        {
+            lostPacketsCount += delta - 1;
+            if (isInFragmentedNALU)
+            {
+                sink->abortNALU();
+                isInFragmentedNALU = false;
+                abortedNALUsCount++;
+            }
+        }
+
+        lastTimestamp += (int32_t)(timestamp - (uint32_t)lastTimestamp);
+    }
+    highestSeqNum = seqNum;
+
+    packetsCount++;
+    bytesCount += packetSize;
+
+    int64_t microseconds = lastTimestamp * 1000000 / timestampFrequency;
+    timeval presentationTime;
+    presentationTime.tv_sec  = (long)(microseconds / 1000000);
+    presentationTime.tv_usec = (long)(microseconds % 1000000);
+
+    handleNALU(packet + headerSize, packetSize - headerSize, presentationTime, marker);
+    return true;
+}
+
+void H264RTPDepacketizer::handleNALU(unsigned char* payload,
+                                     size_t         payloadSize,
+                                     timeval        presentationTime,
+                                     bool           isLastNALUOfFrame)
+{
+    uint8_t type = payload[0] & 0x1F;
+
+    if (type == NALU_TYPE_STAP_A)
+    {
+        // Several small NALUs, each preceded by its size
+        size_t offset = 1;
+        while (offset + 2 < payloadSize)
+        {
+            size_t naluSize = (payload[offset] << 8) | payload[offset + 1];
+            offset += 2;
+            if (naluSize == 0 || offset + naluSize > payloadSize)
+            {
+                break;
+            }
+            sink->startNALU();
+            sink->appendToNALU(payload + offset, naluSize);
+            offset += naluSize;
+            sink->finishNALU(presentationTime, isLastNALUOfFrame && offset >= payloadSize);
+        }
+    }
+    else if (type == NALU_TYPE_FU_A)
+    {
+        if (payloadSize < 3)
+        {
+            return;
+        }
+
+        bool isStart = (payload[1] & 0x80) != 0;
+        bool isEnd   = (payload[1] & 0x40) != 0;
+        if (isStart)
+        {
+            if (isInFragmentedNALU)
+            {
+                // The end of the previous NALU got lost
+                sink->abortNALU();
+                abortedNALUsCount++;
+            }
+
+            // The NALU header is split between the FU indicator and the FU header
+            uint8_t naluHeader = (payload[0] & 0xE0) | (payload[1] & 0x1F);
+            sink->startNALU();
+            sink->appendToNALU(&naluHeader, 1);
+            isInFragmentedNALU = true;
+        }
+        else if (!isInFragmentedNALU)
+        {
+            // The start of this NALU got lost
+            return;
+        }
+
+        sink->appendToNALU(payload + 2, payloadSize - 2);
+        if (isEnd)
+        {
+            sink->finishNALU(presentationTime, isLastNALUOfFrame);
+            isInFragmentedNALU = false;
+        }
+    }
+    else if (type >= 1 && type <= 23)
+    {
+        sink->startNALU();
+        sink->appendToNALU(payload, payloadSize);
+        sink->finishNALU(presentationTime, isLastNALUOfFrame);
+    }
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <sys/time.h>
+#endif
+
+#include "AlloReceiver.h"
+
+// Reassembles the NALUs (single NALUs, STAP-A, FU-A) of one H.264 RTP stream
+// from its packets as they arrive.
+//
+// There is no reordering buffer: late packets are dropped and NALUs with lost
+// fragments are skipped. Presentation times come from the RTP timestamps.
+// handlePacket() must be called from one thread only.
+class ALLORECEIVER_API H264RTPDepacketizer
+{
+public:
+    // Takes the reassembled NALUs
+    class NALUSink
+    {
+    public:
+        virtual ~NALUSink() {}
+
+        virtual void startNALU() = 0;
+        virtual void appendToNALU(const unsigned char* data, size_t size) = 0;
+        // isLastNALUOfFrame: the RTP marker bit was set
+        virtual void finishNALU(timeval presentationTime, bool isLastNALUOfFrame) = 0;
+        // A fragment of the NALU got lost
+        virtual void abortNALU() = 0;
+    };
+
+    struct Statistics
+    {
+        uint64_t packetsCount;      // RTP packets handed to the sink
+        uint64_t bytesCount;
+        uint64_t lostPacketsCount;  // gaps in the sequence numbers
+        uint64_t latePacketsCount;  // arrived after a newer packet; dropped
+        uint64_t abortedNALUsCount; // fragmented NALUs that lost a fragment
+    };
+
+    H264RTPDepacketizer(NALUSink* sink, unsigned int timestampFrequency);
+
+    // Returns false if the packet is no RTP packet
+    bool handlePacket(unsigned char* packet, size_t packetSize);
+
+    // SSRC of the stream the last packet belonged to
+    uint32_t getSSRC();
+
+    // May be called from any thread
+    Statistics getStatistics();
+
+private:
+    void handleNALU(unsigned char* payload, size_t payloadSize,
+                    timeval presentationTime, bool isLastNALUOfFrame);
+
+    NALUSink*    sink;
+    unsigned int timestampFrequency;
+    int          highestSeqNum; // -1 until the first packet
+    uint32_t     ssrc;
+    bool         isInFragmentedNALU;
+    int64_t      lastTimestamp; // extended (wrap-around free) RTP timestamp
+
+    std::atomic<uint64_t> packetsCount;
+    std::atomic<uint64_t> bytesCount;
+    std::atomic<uint64_t> lostPacketsCount;
+    std::atomic<uint64_t> latePacketsCount;
+    std::atomic<uint64_t> abortedNALUsCount;
+};
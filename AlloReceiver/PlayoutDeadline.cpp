@@ -0,0 +1,40 @@
+#include "PlayoutDeadline.hpp"
+
+PlayoutDeadline::PlayoutDeadline(boost::chrono::microseconds jitterBudget,
+                                 size_t                      maxCubemapsCount,
+                                 bool                        waitForAllFaces)
+    :
+    jitterBudget(jitterBudget), maxCubemapsCount(maxCubemapsCount), waitForAllFaces(waitForAllFaces)
+{
+}
+
+boost::chrono::steady_clock::time_point PlayoutDeadline::getDeadline(boost::chrono::steady_clock::time_point firstFaceTime)
+{
+    return firstFaceTime + jitterBudget;
+}
+
+bool PlayoutDeadline::isDue(size_t                                   facesCount,
+                            size_t                                   expectedFacesCount,
+                            boost::chrono::steady_clock::time_point  deadline,
+                            size_t                                   cubemapsCount,
+                            boost::chrono::steady_clock::time_point  now,
+                            boost::chrono::steady_clock::time_point& wakeTime)
+{
+    if (facesCount >= expectedFacesCount || cubemapsCount > maxCubemapsCount)
+    {
+        return true;
+    }
+
+    if (waitForAllFaces)
+    {
+        wakeTime = boost::chrono::steady_clock::time_point::max();
+        return false;
+    }
+
+    if (now >= deadline)
+    {
+        return true;
+    }
+    wakeTime = deadline;
+    return false;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <boost/chrono/system_clocks.hpp>
+
+#include "AlloReceiver.h"
+
+// Decides when the playout buffer releases its oldest cubemap.
+//
+// A cubemap is released as soon as all its faces have arrived. A lost or late face
+// must not hold up the whole stream though, so a cubemap is also released with the faces
+// it has jitterBudget after its first face arrived. Unless partial cubemaps wait for all
+// faces: then only a full buffer (more than maxCubemapsCount cubemaps) releases it early.
+class ALLORECEIVER_API PlayoutDeadline
+{
+public:
+    PlayoutDeadline(boost::chrono::microseconds jitterBudget,
+                    size_t                      maxCubemapsCount,
+                    bool                        waitForAllFaces);
+
+    // Deadline of a cubemap whose first face arrived at firstFaceTime
+    boost::chrono::steady_clock::time_point getDeadline(boost::chrono::steady_clock::time_point firstFaceTime);
+
+    // Whether the oldest of cubemapsCount buffered cubemaps is released at now.
+    // Otherwise wakeTime tells when to decide again unless another face arrives before;
+    // time_point::max() if only another face can release the cubemap.
+    bool isDue(size_t                                   facesCount,
+               size_t                                   expectedFacesCount,
+               boost::chrono::steady_clock::time_point  deadline,
+               size_t                                   cubemapsCount,
+               boost::chrono::steady_clock::time_point  now,
+               boost::chrono::steady_clock::time_point& wakeTime);
+
+private:
+    boost::chrono::microseconds jitterBudget;
+    size_t                      maxCubemapsCount;
+    bool                        waitForAllFaces;
+};
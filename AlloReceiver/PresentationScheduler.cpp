@@ -0,0 +1,67 @@
+#include "PresentationScheduler.hpp"
+
+const boost::chrono::seconds MAX_SCHEDULING_ERROR(1); // targets further ahead than the latency budget plus this are implausible
+
+PresentationScheduler::PresentationScheduler(boost::chrono::microseconds latencyBudget,
+                                             boost::chrono::microseconds clockOffset)
+    :
+    latencyBudget(latencyBudget.count()), clockOffset(clockOffset.count()), clockOffsetEstimator(nullptr)
+{
+}
+
+void PresentationScheduler::setLatencyBudget(boost::chrono::microseconds latencyBudget)
+{
+    this->latencyBudget = latencyBudget.count();
+}
+
+void PresentationScheduler::setClockOffset(boost::chrono::microseconds clockOffset)
+{
+    this->clockOffset = clockOffset.count();
+}
+
+boost::chrono::microseconds PresentationScheduler::getLatencyBudget()
+{
+    return boost::chrono::microseconds(latencyBudget);
+}
+
+boost::chrono::microseconds PresentationScheduler::getClockOffset()
+{
+    ClockOffsetEstimator* clockOffsetEstimator = this->clockOffsetEstimator;
+    if (clockOffsetEstimator)
+    {
+        ClockOffsetEstimator::Estimate estimate = clockOffsetEstimator->getEstimate(boost::chrono::system_clock::now());
+        if (estimate.isValid)
+        {
+            return estimate.offset;
+        }
+    }
+    return boost::chrono::microseconds(clockOffset);
+}
+
+void PresentationScheduler::setClockOffsetEstimator(ClockOffsetEstimator* clockOffsetEstimator)
+{
+    this->clockOffsetEstimator = clockOffsetEstimator;
+}
+
+bool PresentationScheduler::getTargetTime(int64_t                                  pts,
+                                          boost::chrono::system_clock::time_point  now,
+                                          boost::chrono::system_clock::time_point& targetTime)
+{
+    boost::chrono::microseconds latencyBudget(this->latencyBudget);
+    if (latencyBudget.count() <= 0)
+    {
+        return false;
+    }
+
+    // The pts is on the server's clock
+    targetTime = boost::chrono::system_clock::time_point(boost::chrono::microseconds(pts) +
+                                                         latencyBudget -
+                                                         getClockOffset());
+
+    if (targetTime - now > latencyBudget + MAX_SCHEDULING_ERROR)
+    {
+        // Waiting that long would stall the stream
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+#include <boost/chrono/system_clocks.hpp>
+
+#include "AlloReceiver.h"
+#include "ClockOffsetEstimator.hpp"
+
+// Decides when a cubemap is shown.
+//
+// The server stamps every frame with its presentation time (pts) on the server's clock.
+// Showing a cubemap latencyBudget after its pts lets all render nodes release the same
+// cubemap at the same moment, no matter how long their own pipelines took. Otherwise
+// the seams between projectors driven by different nodes tear.
+// The projectors of the cluster are genlocked, so the nodes then show the cubemap
+// in the same refresh interval as long as their skews are below that interval.
+// clockOffset is how far the server's clock is ahead of the local one
+// (0 if the clocks of the cluster are synchronized, e.g. with PTP).
+// An estimator measures it continuously instead.
+class ALLORECEIVER_API PresentationScheduler
+{
+public:
+    // A latency budget of 0 releases cubemaps as soon as they are complete
+    PresentationScheduler(boost::chrono::microseconds latencyBudget,
+                          boost::chrono::microseconds clockOffset);
+
+    // May be called from any thread
+    void setLatencyBudget(boost::chrono::microseconds latencyBudget);
+    void setClockOffset  (boost::chrono::microseconds clockOffset);
+    boost::chrono::microseconds getLatencyBudget();
+    boost::chrono::microseconds getClockOffset();
+    // Takes precedence over the clock offset once it has samples; NULL to use the clock offset again
+    void setClockOffsetEstimator(ClockOffsetEstimator* clockOffsetEstimator);
+
+    // Local time at which the cubemap with the pts (in microseconds since the epoch) is shown.
+    // Returns false if the cubemap should be shown right away: no latency budget, or a target
+    // too far in the future to be plausible (e.g. the pts is not on the server's clock yet).
+    bool getTargetTime(int64_t                                  pts,
+                       boost::chrono::system_clock::time_point  now,
+                       boost::chrono::system_clock::time_point& targetTime);
+
+private:
+    std::atomic<int64_t> latencyBudget; // microseconds
+    std::atomic<int64_t> clockOffset;   // microseconds
+    std::atomic<ClockOffsetEstimator*> clockOffsetEstimator;
+};
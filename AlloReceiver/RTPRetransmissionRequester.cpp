@@ -0,0 +1,253 @@
+#include <GroupsockHelper.hh>
+
+#include "AlloShared/RTCPFeedback.hpp"
+#include "RTPRetransmissionRequester.hpp"
+
+namespace bc = boost::chrono;
+
+const int64_t MAX_MISSING_PACKETS_PER_GAP = 256; // bigger gaps are treated as a stream restart
+const int     MAX_REQUESTS_PER_PACKET     = 3;
+const size_t  MAX_RTCP_PACKET_SIZE        = 1450;
+
+RTPRetransmissionRequester::RTPRetransmissionRequester(MediaSubsession*    subsession,
+                                                       bc::microseconds    deadline)
+    :
+    subsession(subsession), deadline(deadline), retryInterval(deadline / 4),
+    highestSeqNum(-1), mediaSSRC(0), checkTask(NULL), firSeqNum(0)
+{
+    statistics.nacksCount        = 0;
+    statistics.requestedPackets  = 0;
+    statistics.repairedPackets   = 0;
+    statistics.unrepairedPackets = 0;
+    statistics.keyframeRequests  = 0;
+    statistics.repairLatencySum  = bc::microseconds(0);
+    statistics.maxRepairLatency  = bc::microseconds(0);
+
+    subsession->rtpSource()->setAuxilliaryReadHandler(&RTPRetransmissionRequester::incomingRTPHandler, this);
+}
+
+RTPRetransmissionRequester::~RTPRetransmissionRequester()
+{
+    subsession->rtpSource()->setAuxilliaryReadHandler(NULL, NULL);
+    subsession->rtpSource()->envir().taskScheduler().unscheduleDelayedTask(checkTask);
+}
+
+RTPRetransmissionRequester::Statistics RTPRetransmissionRequester::getStatistics()
+{
+    boost::mutex::scoped_lock lock(mutex);
+    return statistics;
+}
+
+void RTPRetransmissionRequester::setMediaSSRC(u_int32_t ssrc)
+{
+    boost::mutex::scoped_lock lock(mutex);
+    mediaSSRC = ssrc;
+}
+
+void RTPRetransmissionRequester::incomingRTPHandler(void* clientData, unsigned char* packet, unsigned& packetSize)
+{
+    ((RTPRetransmissionRequester*)clientData)->incomingRTPHandler1(packet, packetSize);
+}
+
+void RTPRetransmissionRequester::incomingRTPHandler1(unsigned char* packet, unsigned packetSize)
+{
+    if (packetSize < RTCPFeedback::RTP_HEADER_SIZE || (packet[0] & 0xC0) != 0x80)
+    {
+        // not a RTP packet
+        return;
+    }
+
+    u_int16_t seqNum = RTCPFeedback::rtpSeqNum(packet);
+    u_int32_t ssrc   = RTCPFeedback::rtpSSRC(packet);
+    bc::steady_clock::time_point now = bc::steady_clock::now();
+
+    if (highestSeqNum == -1 || ssrc != mediaSSRC)
+    {
+        // first packet of the stream
+        missingPackets.clear();
+        highestSeqNum = seqNum;
+
+        boost::mutex::scoped_lock lock(mutex);
+        mediaSSRC = ssrc;
+        return;
+    }
+
+    int16_t delta          = (int16_t)(seqNum - (u_int16_t)highestSeqNum);
+    int64_t extendedSeqNum = highestSeqNum + delta;
+
+    if (delta > 0)
+    {
+        if (delta > 1 && delta - 1 <= MAX_MISSING_PACKETS_PER_GAP)
+        {
+            // There is a gap -> request the missing packets right away
+            std::vector<u_int16_t> seqNums;
+            for (int64_t missingSeqNum = highestSeqNum + 1; missingSeqNum < extendedSeqNum; missingSeqNum++)
+            {
+                MissingPacket& missingPacket  = missingPackets[missingSeqNum];
+                missingPacket.detectionTime   = now;
+                missingPacket.lastRequestTime = now;
+                missingPacket.requestsCount   = 1;
+                seqNums.push_back((u_int16_t)missingSeqNum);
+            }
+            requestPackets(seqNums, ssrc);
+
+            boost::mutex::scoped_lock lock(mutex);
+            statistics.requestedPackets += seqNums.size();
+        }
+        highestSeqNum = extendedSeqNum;
+    }
+    else
+    {
+        // Late packet. Maybe it's one we have asked for.
+        auto missingPacketIter = missingPackets.find(extendedSeqNum);
+        if (missingPacketIter != missingPackets.end())
+        {
+            bc::microseconds latency = bc::duration_cast<bc::microseconds>(now - missingPacketIter->second.detectionTime);
+            missingPackets.erase(missingPacketIter);
+
+            boost::mutex::scoped_lock lock(mutex);
+            statistics.repairedPackets++;
+            statistics.repairLatencySum += latency;
+            statistics.maxRepairLatency = (std::max)(statistics.maxRepairLatency, latency);
+        }
+    }
+
+    if (!missingPackets.empty() && checkTask == NULL)
+    {
+        checkTask = subsession->rtpSource()->envir().taskScheduler().scheduleDelayedTask(retryInterval.count() / 2,
+                                                                                         (TaskFunc*)&RTPRetransmissionRequester::checkMissingPackets,
+                                                                                         this);
+    }
+}
+
+void RTPRetransmissionRequester::checkMissingPackets(void* clientData)
+{
+    ((RTPRetransmissionRequester*)clientData)->checkMissingPackets1();
+}
+
+void RTPRetransmissionRequester::checkMissingPackets1()
+{
+    checkTask = NULL;
+
+    bc::steady_clock::time_point now = bc::steady_clock::now();
+    std::vector<u_int16_t> seqNums;
+    unsigned unrepairedPackets = 0;
+
+    for (auto iter = missingPackets.begin(); iter != missingPackets.end();)
+    {
+        MissingPacket& missingPacket = iter->second;
+        if (now - missingPacket.detectionTime >= deadline)
+        {
+            // Too late. The reordering buffer has already skipped this packet.
+            unrepairedPackets++;
+            iter = missingPackets.erase(iter);
+            continue;
+        }
+        else if (now - missingPacket.lastRequestTime >= retryInterval &&
+                 missingPacket.requestsCount < MAX_REQUESTS_PER_PACKET)
+        {
+            // Request or repair got lost -> ask again
+            missingPacket.lastRequestTime = now;
+            missingPacket.requestsCount++;
+            seqNums.push_back((u_int16_t)iter->first);
+        }
+        ++iter;
+    }
+
+    if (!seqNums.empty())
+    {
+        requestPackets(seqNums, mediaSSRC);
+    }
+
+    if (unrepairedPackets > 0)
+    {
+        {
+            boost::mutex::scoped_lock lock(mutex);
+            statistics.unrepairedPackets += unrepairedPackets;
+        }
+        requestKeyframe(false);
+    }
+
+    if (!missingPackets.empty())
+    {
+        checkTask = subsession->rtpSource()->envir().taskScheduler().scheduleDelayedTask(retryInterval.count() / 2,
+                                                                                         (TaskFunc*)&RTPRetransmissionRequester::checkMissingPackets,
+                                                                                         this);
+    }
+}
+
+void RTPRetransmissionRequester::requestPackets(const std::vector<u_int16_t>& seqNums, u_int32_t mediaSSRC)
+{
+    uint8_t buffer[MAX_RTCP_PACKET_SIZE];
+    size_t size = RTCPFeedback::buildNACK(subsession->rtpSource()->SSRC(),
+                                          mediaSSRC,
+                                          seqNums,
+                                          buffer,
+                                          sizeof(buffer));
+
+    if (size > 0 && sendFeedback(buffer, size))
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        statistics.nacksCount++;
+    }
+}
+
+void RTPRetransmissionRequester::requestKeyframe(bool fullIntraRequest)
+{
+    boost::mutex::scoped_lock lock(mutex);
+
+    bc::steady_clock::time_point now = bc::steady_clock::now();
+    if (mediaSSRC == 0 || now - lastKeyframeRequestTime < deadline)
+    {
+        // Nothing received yet or the last request is still being served
+        return;
+    }
+
+    uint8_t buffer[MAX_RTCP_PACKET_SIZE];
+    size_t size;
+    if (fullIntraRequest)
+    {
+        size = RTCPFeedback::buildFIR(subsession->rtpSource()->SSRC(),
+                                      mediaSSRC,
+                                      firSeqNum++,
+                                      buffer,
+                                      sizeof(buffer));
+    }
+    else
+    {
+        size = RTCPFeedback::buildPLI(subsession->rtpSource()->SSRC(),
+                                      mediaSSRC,
+                                      buffer,
+                                      sizeof(buffer));
+    }
+
+    if (size > 0 && sendFeedback(buffer, size))
+    {
+        lastKeyframeRequestTime = now;
+        statistics.keyframeRequests++;
+    }
+}
+
+bool RTPRetransmissionRequester::sendFeedback(const uint8_t* packet, size_t packetSize)
+{
+    RTCPInstance* rtcpInstance = subsession->rtcpInstance();
+    if (!rtcpInstance)
+    {
+        return false;
+    }
+
+    // Feedback goes to the same group as our receiver reports
+    Groupsock* rtcpGroupsock = rtcpInstance->RTCPgs();
+    struct sockaddr_in destination;
+    memset(&destination, 0, sizeof(destination));
+    destination.sin_family      = AF_INET;
+    destination.sin_addr.s_addr = rtcpGroupsock->groupAddress().s_addr;
+    destination.sin_port        = rtcpGroupsock->port().num();
+
+    return sendto(rtcpGroupsock->socketNum(),
+                  (const char*)packet,
+                  packetSize,
+                  0,
+                  (struct sockaddr*)&destination,
+                  sizeof(destination)) == (int)packetSize;
+}
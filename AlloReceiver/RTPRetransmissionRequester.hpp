@@ -0,0 +1,80 @@
+#pragma once
+
+#include <liveMedia.hh>
+#include <map>
+#include <boost/chrono/system_clocks.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "AlloReceiver.h"
+
+// Detects sequence number gaps in the RTP packets of a subsession
+// and asks the server for the missing packets with RTCP generic NACKs.
+//
+// A packet that didn't arrive within the deadline is given up since its
+// cubemap has been shown without the face by then (the playout deadline).
+// The deadline must not exceed the RTP source's reordering threshold either.
+// The decoder can't recover from that before the next IDR frame,
+// so a keyframe is requested from the server right away (PLI).
+// Runs in the thread of the subsession's environment.
+class ALLORECEIVER_API RTPRetransmissionRequester
+{
+public:
+    struct Statistics
+    {
+        unsigned                    nacksCount;          // NACK packets sent
+        unsigned                    requestedPackets;    // missing packets that were requested
+        unsigned                    repairedPackets;     // requested packets that arrived in time
+        unsigned                    unrepairedPackets;   // requested packets that didn't arrive in time
+        unsigned                    keyframeRequests;    // PLI and FIR packets sent
+        boost::chrono::microseconds repairLatencySum;
+        boost::chrono::microseconds maxRepairLatency;
+    };
+
+    RTPRetransmissionRequester(MediaSubsession*            subsession,
+                               boost::chrono::microseconds deadline);
+    ~RTPRetransmissionRequester();
+
+    Statistics getStatistics();
+
+    // Asks the server for an IDR frame. A decoder that has not decoded
+    // anything yet (e.g. joined in the middle of a GOP) asks with a FIR,
+    // a decoder that lost its reference pictures with a PLI.
+    // Rate-limited to one request per deadline. May be called from any thread.
+    void requestKeyframe(bool fullIntraRequest);
+    
+    // For receivers that read the RTP packets without the subsession's RTP source.
+    // Packets are not seen then, so nothing is requested except for keyframes.
+    // May be called from any thread.
+    void setMediaSSRC(u_int32_t ssrc);
+
+private:
+    struct MissingPacket
+    {
+        boost::chrono::steady_clock::time_point detectionTime;
+        boost::chrono::steady_clock::time_point lastRequestTime;
+        int                                     requestsCount;
+    };
+
+    static void incomingRTPHandler(void* clientData, unsigned char* packet, unsigned& packetSize);
+    static void checkMissingPackets(void* clientData);
+    void incomingRTPHandler1(unsigned char* packet, unsigned packetSize);
+    void checkMissingPackets1();
+
+    void requestPackets(const std::vector<u_int16_t>& seqNums, u_int32_t mediaSSRC);
+    bool sendFeedback(const uint8_t* packet, size_t packetSize);
+
+    MediaSubsession*            subsession;
+    boost::chrono::microseconds deadline;
+    boost::chrono::microseconds retryInterval;
+
+    // Extended (wrap-around free) sequence numbers
+    std::map<int64_t, MissingPacket> missingPackets;
+    int64_t                          highestSeqNum;
+    u_int32_t                        mediaSSRC;
+    TaskToken                        checkTask;
+
+    boost::mutex                            mutex;
+    Statistics                              statistics;
+    boost::chrono::steady_clock::time_point lastKeyframeRequestTime;
+    u_int8_t                                firSeqNum;
+};
@@ -1,17 +1,178 @@
     #include <boost/algorithm/string.hpp>
 #include <boost/algorithm/string_regex.hpp>
+#include <set>
 
+#include "AlloShared/config.h"
+#include "AlloShared/to_human_readable_byte_count.hpp"
+#include "AlloShared/CubemapMailbox.hpp"
 #include "H264NALUSink.hpp"
 #include "H264CubemapSource.h"
+#include "RTPRetransmissionRequester.hpp"
 #include "RTSPCubemapSourceClient.hpp"
 
+const boost::chrono::milliseconds PACKET_ARRIVAL_CHECK_INTERVAL(500);
+const boost::chrono::seconds      STREAM_TIMEOUT(3);  // no packets for this long -> the server is gone
+const boost::chrono::seconds      CONNECT_TIMEOUT(5); // for a whole connection attempt
+const boost::chrono::milliseconds MIN_RECONNECT_DELAY(250);
+const boost::chrono::seconds      MAX_RECONNECT_DELAY(8);
+
+boost::chrono::microseconds RTSPCubemapSourceClient::getConnectDuration()
+{
+    return connectDuration;
+}
+
+int RTSPCubemapSourceClient::getReconnectsCount()
+{
+    return reconnectsCount;
+}
+
+ClockOffsetEstimator* RTSPCubemapSourceClient::getClockOffsetEstimator()
+{
+    return &clockOffsetEstimator;
+}
+
 void RTSPCubemapSourceClient::setOnDidConnect(const std::function<void (RTSPCubemapSourceClient*, CubemapSource*)>& onDidConnect)
 {
     this->onDidConnect = onDidConnect;
 }
 
+void RTSPCubemapSourceClient::setOnWillDestroyCubemapSource(const std::function<void (RTSPCubemapSourceClient*, CubemapSource*)>& onWillDestroyCubemapSource)
+{
+    this->onWillDestroyCubemapSource = onWillDestroyCubemapSource;
+}
+
 void RTSPCubemapSourceClient::shutdown(int exitCode)
 {
+    if (isReconnectScheduled)
+    {
+        return;
+    }
+    
+    boost::chrono::microseconds reconnectDelay = reconnectionPolicy.closeSession();
+    closeSession();
+    
+    std::cout << "Client: reconnecting in " << reconnectDelay.count() / 1000 << " ms" << std::endl;
+    isReconnectScheduled = true;
+    envir().taskScheduler().scheduleDelayedTask(reconnectDelay.count(), (TaskFunc*)RTSPCubemapSourceClient::reconnect, this);
+}
+
+void RTSPCubemapSourceClient::closeSession()
+{
+    // Stop the faces' event loops. They look at the watch variable at least every 10 ms.
+    stopSessionLoops = 1;
+    for (auto thread : sessionThreads)
+    {
+        thread->join();
+    }
+    sessionThreads.clear();
+    stopSessionLoops = 0;
+    
+    delete batchedRTPReceiver;
+    batchedRTPReceiver = nullptr;
+    
+    // The sinks keep their decoders and frames for the next session.
+    // Clearing the error callback waits until a keyframe request in progress is done,
+    // so the retransmission requesters and subsessions can go afterwards.
+    for (H264NALUSink* sink : h264Sinks)
+    {
+        if (sink)
+        {
+            sink->stopPlaying();
+            sink->setOnDecodingError(nullptr);
+            sink->flush();
+        }
+    }
+    {
+        // The faces of the other servers start over as well
+        boost::mutex::scoped_lock lock(primary->cubemapSourceMutex);
+        if (primary->cubemapSource)
+        {
+            primary->cubemapSource->restart(reconnectionPolicy.getOutageStartTime());
+        }
+    }
+    
+    for (auto requester : retransmissionRequesters)
+    {
+        delete requester.second;
+    }
+    retransmissionRequesters.clear();
+    
+    std::set<MediaSession*> sessions;
+    for (MediaSubsession* subsession : subsessions)
+    {
+        subsession->sink = NULL;
+        sessions.insert(&subsession->parentSession());
+    }
+    for (MediaSession* session : sessions)
+    {
+        Medium::close(session);
+    }
+    for (BasicUsageEnvironment* env : envs)
+    {
+        // Only deletes itself once all media and sockets are gone
+        if (env->liveMediaPriv == NULL && env->groupsockPriv == NULL)
+        {
+            TaskScheduler* scheduler = &env->taskScheduler();
+            env->reclaim();
+            delete scheduler;
+        }
+    }
+    
+    envs.clear();
+    subsessions.clear();
+    subsessionFaces.clear();
+    subsessionInterfaces.clear();
+    unsentSetups.clear();
+    pendingSetups.clear();
+    isSessionOpen = false;
+    
+    lastTotalKBytes          = 0.0;
+    lastTotalPacketsReceived = 0;
+    lastTotalPacketsExpected = 0;
+    lastInterfaceKBytes.clear();
+    lastRetransmissionStatistics = {0, 0, 0, 0, 0, boost::chrono::microseconds(0), boost::chrono::microseconds(0)};
+}
+
+void RTSPCubemapSourceClient::reconnect(void* self_)
+{
+    RTSPCubemapSourceClient* self = (RTSPCubemapSourceClient*)self_;
+    self->isReconnectScheduled = false;
+    
+    // Start over with a new connection to the server
+    std::string url = self->url();
+    self->reset();
+    self->setBaseURL(url.c_str());
+    
+    self->connectStartTime = boost::chrono::steady_clock::now();
+    self->reconnectionPolicy.startConnecting(self->connectStartTime);
+    self->sendOptionsCommand(continueAfterOPTIONS);
+}
+
+unsigned int RTSPCubemapSourceClient::getReceivedPacketsCount()
+{
+    if (batchedRTPReceiver)
+    {
+        // The RTP sources don't see any packets
+        return (unsigned int)batchedRTPReceiver->getStatistics().packetsCount;
+    }
+    
+    unsigned int packetsCount = 0;
+    for (MediaSubsession* subsession : subsessions)
+    {
+        RTPSource* src = subsession->rtpSource();
+        if (src == NULL)
+        {
+            continue;
+        }
+        
+        RTPReceptionStatsDB::Iterator statsIter(src->receptionStatsDB());
+        RTPReceptionStats* stats;
+        while ((stats = statsIter.next(True)) != NULL)
+        {
+            packetsCount += stats->totNumPacketsReceived();
+        }
+    }
+    return packetsCount;
 }
 
 void RTSPCubemapSourceClient::subsessionAfterPlaying(void* clientData)
@@ -35,45 +196,29 @@ void RTSPCubemapSourceClient::subsessionAfterPlaying(void* clientData)
 
 void RTSPCubemapSourceClient::checkForPacketArrival(void* self_)
 {
- //   RTSPCubemapSourceClient* self = (RTSPCubemapSourceClient*)self_;
- //   
-	//// Check each subsession, to see whether it has received data packets:
-	//unsigned numSubsessionsChecked = 0;
-	//unsigned numSubsessionsWithReceivedData = 0;
-	//unsigned numSubsessionsThatHaveBeenSynced = 0;
-
-	//MediaSubsessionIterator iter(*self->session);
-	//MediaSubsession* subsession;
-	//while ((subsession = iter.next()) != NULL)
-	//{
-	//	RTPSource* src = subsession->rtpSource();
-	//	if (src == NULL) continue;
-	//	++numSubsessionsChecked;
-
-	//	if (src->receptionStatsDB().numActiveSourcesSinceLastReset() > 0)
-	//	{
-	//		// At least one data packet has arrived
-	//		++numSubsessionsWithReceivedData;
-	//	}
-	//	if (src->hasBeenSynchronizedUsingRTCP())
-	//	{
-	//		++numSubsessionsThatHaveBeenSynced;
-	//	}
-	//}
-
-	//unsigned numSubsessionsToCheck = numSubsessionsChecked;
-
-	//	struct timeval timeNow;
-	//	gettimeofday(&timeNow, NULL);
-	//	char timestampStr[100];
-	//	sprintf(timestampStr, "%ld%03ld", timeNow.tv_sec, (long)(timeNow.tv_usec / 1000));
-	//	self->envir() << "Data packets have begun arriving [" << timestampStr << "]\007\n";
-	//	return;
-
-	//// No luck, so reschedule this check again, after a delay:
-	//int uSecsToDelay = 100000; // 100 ms
-	//TaskToken arrivalCheckTimerTask = self->session->envir().taskScheduler().scheduleDelayedTask(uSecsToDelay,
-	//	(TaskFunc*)checkForPacketArrival, self);
+    RTSPCubemapSourceClient* self = (RTSPCubemapSourceClient*)self_;
+    boost::chrono::steady_clock::time_point now = boost::chrono::steady_clock::now();
+    
+    if (!self->isReconnectScheduled)
+    {
+        bool isPlaying = self->reconnectionPolicy.isPlaying();
+        unsigned int packetsCount = (isPlaying) ? self->getReceivedPacketsCount() : 0;
+        if (self->reconnectionPolicy.isServerGone(packetsCount, now))
+        {
+            if (isPlaying)
+            {
+                std::cout << "Client: no packets for " << STREAM_TIMEOUT.count() << " s; the server seems to be gone" << std::endl;
+            }
+            else
+            {
+                std::cout << "Client: connecting timed out" << std::endl;
+            }
+            self->shutdown();
+        }
+    }
+    
+    self->envir().taskScheduler().scheduleDelayedTask(boost::chrono::microseconds(PACKET_ARRIVAL_CHECK_INTERVAL).count(),
+                                                      (TaskFunc*)RTSPCubemapSourceClient::checkForPacketArrival, self);
 }
 
 void RTSPCubemapSourceClient::continueAfterDESCRIBE2(RTSPClient* self_, int resultCode, char* resultString)
@@ -106,6 +251,15 @@ void RTSPCubemapSourceClient::continueAfterPLAY(RTSPClient* self_, int resultCod
 		self->envir() << "Started playing session\n";
 	}
 	delete[] resultString;
+    
+    boost::chrono::steady_clock::time_point now = boost::chrono::steady_clock::now();
+    self->connectDuration = boost::chrono::duration_cast<boost::chrono::microseconds>(now - self->connectStartTime);
+    std::cout << "Client: connected in " << std::setprecision(1) << std::setiosflags(std::ios::fixed) <<
+        self->connectDuration.count() / 1000.0 << " ms (OPTIONS + DESCRIBE: " <<
+        boost::chrono::duration_cast<boost::chrono::microseconds>(self->describeDoneTime - self->connectStartTime).count() / 1000.0 << " ms; " <<
+        self->subsessions.size() << " SETUPs: " <<
+        boost::chrono::duration_cast<boost::chrono::microseconds>(self->setupDoneTime - self->describeDoneTime).count() / 1000.0 << " ms; PLAY: " <<
+        boost::chrono::duration_cast<boost::chrono::microseconds>(now - self->setupDoneTime).count() / 1000.0 << " ms)" << std::endl;
 
 	// Figure out how long to delay (if at all) before shutting down, or
 	// repeating the playing
@@ -113,8 +267,15 @@ void RTSPCubemapSourceClient::continueAfterPLAY(RTSPClient* self_, int resultCod
 	char const* actionString = "Data is being streamed";
 	self->envir() << actionString << "...\n";
 
-	// Watch for incoming packets (if desired):
-	checkForPacketArrival(self);
+	// checkForPacketArrival() watches for incoming packets from now on
+	boost::chrono::steady_clock::time_point outageStartTime = self->reconnectionPolicy.startPlaying(self->getReceivedPacketsCount(), now);
+	
+	if (outageStartTime != boost::chrono::steady_clock::time_point())
+	{
+	    self->reconnectsCount++;
+	    std::cout << "Client: reconnected after " << self->reconnectionPolicy.getFailedAttemptsCount() << " failed attempt(s); the stream was lost " <<
+	        boost::chrono::duration_cast<boost::chrono::milliseconds>(now - outageStartTime).count() << " ms ago" << std::endl;
+	}
 	//checkInterPacketGaps(NULL);
 
 	//ourClient->sendDescribeCommand(continueAfterDESCRIBE2);
@@ -123,9 +284,15 @@ void RTSPCubemapSourceClient::continueAfterPLAY(RTSPClient* self_, int resultCod
 void RTSPCubemapSourceClient::periodicQOSMeasurement(void* self_)
 {
     RTSPCubemapSourceClient* self = (RTSPCubemapSourceClient*)self_;
+    if (self->primary->servers.size() > 1)
+    {
+        std::cout << "Client: server " << self->url() << ":" << std::endl;
+    }
+    
     double totalKBytes = 0.0;
     unsigned int totalPacketsReceived = 0;
     unsigned int totalPacketsExpected = 0;
+    std::vector<double> interfaceKBytes(self->interfaceAddresses.size(), 0.0);
     for (MediaSubsession* subsession : self->subsessions)
     {
         RTPSource* src = subsession->rtpSource();
@@ -134,11 +301,27 @@ void RTSPCubemapSourceClient::periodicQOSMeasurement(void* self_)
         while ((stats = statsIter.next(True)) != NULL)
         {
             totalKBytes += stats->totNumKBytesReceived();
+            interfaceKBytes[self->subsessionInterfaces[subsession]] += stats->totNumKBytesReceived();
             totalPacketsReceived += stats->totNumPacketsReceived();
             totalPacketsExpected += stats->totNumPacketsExpected();
         }
     }
     
+    if (self->batchedRTPReceiver)
+    {
+        // The RTP sources don't see any packets
+        BatchedRTPReceiver::Statistics statistics = self->batchedRTPReceiver->getStatistics();
+        totalKBytes          = statistics.bytesCount / 1000.0;
+        totalPacketsReceived = statistics.packetsCount;
+        totalPacketsExpected = statistics.packetsCount + statistics.lostPacketsCount;
+        
+        std::cout << "Client: batched ingest: " << statistics.packetsCount << " packets in " << statistics.batchesCount << " batches (" <<
+            std::setprecision(1) << std::setiosflags(std::ios::fixed) <<
+            ((statistics.batchesCount > 0) ? (double)statistics.packetsCount / statistics.batchesCount : 0.0) << " per batch)" <<
+            "; late packets: " << statistics.latePacketsCount << "; incomplete NALUs: " << statistics.abortedNALUsCount <<
+            " (since start)" << std::endl;
+    }
+    
     double totalKBytesInInterval = totalKBytes - self->lastTotalKBytes;
     unsigned int totalPacketsReceivedInInterval = totalPacketsReceived - self->lastTotalPacketsReceived;
     unsigned int totalPacketsExpectedInInterval = totalPacketsExpected - self->lastTotalPacketsExpected;
@@ -153,6 +336,89 @@ void RTSPCubemapSourceClient::periodicQOSMeasurement(void* self_)
         " packets received: " << totalPacketsReceivedInInterval << "; packets lost: " << totalPacketsLostInInterval <<
         "; packet loss: " << std::setprecision(2) << (double)totalPacketsLostInInterval / totalPacketsReceivedInInterval * 100.0 << "%" << std::endl;
     
+    if (self->interfaceAddresses.size() > 1)
+    {
+        self->lastInterfaceKBytes.resize(self->interfaceAddresses.size(), 0.0);
+        for (int i = 0; i < self->interfaceAddresses.size(); i++)
+        {
+            char interfaceAddressStr[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &(self->interfaceAddresses[i]), interfaceAddressStr, sizeof(interfaceAddressStr));
+            std::cout << "Client: interface " << interfaceAddressStr << ": " << std::setprecision(1) <<
+                (interfaceKBytes[i] - self->lastInterfaceKBytes[i]) / 10 * 8 / 1000 << " MBit/s" << std::endl;
+        }
+        self->lastInterfaceKBytes = interfaceKBytes;
+    }
+    
+    RTPRetransmissionRequester::Statistics retransmissionStatistics = {0, 0, 0, 0, 0, boost::chrono::microseconds(0), boost::chrono::microseconds(0)};
+    for (auto requester : self->retransmissionRequesters)
+    {
+        RTPRetransmissionRequester::Statistics statistics = requester.second->getStatistics();
+        retransmissionStatistics.nacksCount        += statistics.nacksCount;
+        retransmissionStatistics.requestedPackets  += statistics.requestedPackets;
+        retransmissionStatistics.repairedPackets   += statistics.repairedPackets;
+        retransmissionStatistics.unrepairedPackets += statistics.unrepairedPackets;
+        retransmissionStatistics.keyframeRequests  += statistics.keyframeRequests;
+        retransmissionStatistics.repairLatencySum  += statistics.repairLatencySum;
+        retransmissionStatistics.maxRepairLatency   = (std::max)(retransmissionStatistics.maxRepairLatency, statistics.maxRepairLatency);
+    }
+    
+    RTPRetransmissionRequester::Statistics& lastStatistics = self->lastRetransmissionStatistics;
+    unsigned int requestedPacketsInInterval  = retransmissionStatistics.requestedPackets  - lastStatistics.requestedPackets;
+    unsigned int repairedPacketsInInterval   = retransmissionStatistics.repairedPackets   - lastStatistics.repairedPackets;
+    unsigned int unrepairedPacketsInInterval = retransmissionStatistics.unrepairedPackets - lastStatistics.unrepairedPackets;
+    boost::chrono::microseconds repairLatencySumInInterval = retransmissionStatistics.repairLatencySum - lastStatistics.repairLatencySum;
+    
+    std::cout << "Client: NACKs sent: " << retransmissionStatistics.nacksCount - lastStatistics.nacksCount <<
+        "; retransmissions requested: " << requestedPacketsInInterval <<
+        " (" << std::setprecision(2) << (double)requestedPacketsInInterval / totalPacketsReceivedInInterval * 100.0 << "%)" <<
+        "; repaired: " << repairedPacketsInInterval << "; unrepaired: " << unrepairedPacketsInInterval <<
+        "; avg repair latency: " << std::setprecision(2) <<
+        ((repairedPacketsInInterval > 0) ? repairLatencySumInInterval.count() / 1000.0 / repairedPacketsInInterval : 0.0) << " ms" <<
+        "; max repair latency since start: " << retransmissionStatistics.maxRepairLatency.count() / 1000.0 << " ms" <<
+        "; keyframe requests: " << retransmissionStatistics.keyframeRequests - lastStatistics.keyframeRequests << std::endl;
+    
+    lastStatistics = retransmissionStatistics;
+    
+    for (MediaSubsession* subsession : self->subsessions)
+    {
+        H264NALUSink* sink = dynamic_cast<H264NALUSink*>(subsession->sink);
+        if (!sink)
+        {
+            continue;
+        }
+        
+        H264NALUSink::MemoryReport report = sink->getMemoryReport();
+        size_t totalSize = report.naluBufferSize + report.pktBuffersSize +
+                           report.decodedFrameBuffersSize + report.convertedFrameBuffersSize;
+        std::cout << "Client: face " << self->subsessionFaces[subsession] << " memory: " <<
+            to_human_readable_byte_count(totalSize, false, false) <<
+            " (NALU buffer: " << to_human_readable_byte_count(report.naluBufferSize, false, false) <<
+            "; " << report.pktsCount << " pkts: " << to_human_readable_byte_count(report.pktBuffersSize, false, false) <<
+            "; largest access unit: " << to_human_readable_byte_count(report.largestAccessUnitSize, false, false) <<
+            "; " << report.decodedFrameBuffersCount << " decoded frames: " <<
+            to_human_readable_byte_count(report.decodedFrameBuffersSize, false, false) <<
+            "; " << report.convertedFrameBuffersCount << " converted frames: " <<
+            to_human_readable_byte_count(report.convertedFrameBuffersSize, false, false) <<
+            "; frames queued: " << report.queuedFramesCount << "/" << report.framesCount <<
+            "; frames dropped: " << report.droppedFramesCount << ")" << std::endl;
+    }
+    
+    if (self->framesMemoryBudget)
+    {
+        std::cout << "Client: frames memory budget: " <<
+            to_human_readable_byte_count(self->framesMemoryBudget->getReservedSize(), false, false) << " of " <<
+            to_human_readable_byte_count(self->framesMemoryBudget->getLimit(), false, false) << " in use" << std::endl;
+    }
+    
+    ClockOffsetEstimator::Estimate clockOffset = self->clockOffsetEstimator.getEstimate(boost::chrono::system_clock::now());
+    if (clockOffset.isValid)
+    {
+        std::cout << "Client: server clock offset: " << std::setprecision(2) << clockOffset.offset.count() / 1000.0 << " ms" <<
+            "; drift: " << clockOffset.drift << " ppm" <<
+            "; residual error: " << clockOffset.residualError.count() / 1000.0 << " ms" <<
+            " (" << clockOffset.samplesCount << " sender reports)" << std::endl;
+    }
+    
     self->envir().taskScheduler().scheduleDelayedTask(10000000, (TaskFunc*)RTSPCubemapSourceClient::periodicQOSMeasurement, self);
 }
 
@@ -162,12 +428,177 @@ void RTSPCubemapSourceClient::subsessionByeHandler(void* clientData)
 	gettimeofday(&timeNow, NULL);
 
 	MediaSubsession* subsession = (MediaSubsession*)clientData;
-	subsession->sink->envir() << "Received RTCP \"BYE\" on \"" << subsession->mediumName()
+	RTSPCubemapSourceClient* self = (RTSPCubemapSourceClient*)subsession->miscPtr;
+	self->envir() << "Received RTCP \"BYE\" on \"" << subsession->mediumName()
 		<< "/" << subsession->codecName()
 		<< "\" subsession\n";
 
-	// Act now as if the subsession had closed:
-	subsessionAfterPlaying(subsession);
+	// We are in the face's event loop -> the session is closed in the client's one
+	self->envir().taskScheduler().triggerEvent(self->byeTrigger, self);
+}
+
+void RTSPCubemapSourceClient::subsessionSRHandler(void* clientData)
+{
+    MediaSubsession* subsession = (MediaSubsession*)clientData;
+    RTSPCubemapSourceClient* self = (RTSPCubemapSourceClient*)subsession->miscPtr;
+    
+    // The handler doesn't tell which sender the report came from -> take the newest report
+    RTPReceptionStatsDB::Iterator statsIter(subsession->rtpSource()->receptionStatsDB());
+    RTPReceptionStats* stats;
+    RTPReceptionStats* newestStats = NULL;
+    while ((stats = statsIter.next(True)) != NULL)
+    {
+        if (!newestStats || timercmp(&stats->lastReceivedSR_time(), &newestStats->lastReceivedSR_time(), >))
+        {
+            newestStats = stats;
+        }
+    }
+    if (!newestStats)
+    {
+        return;
+    }
+    
+    // The server takes the NTP time from its system clock just like the pts
+    const int64_t NTP_TO_UNIX_EPOCH = 2208988800LL;
+    int64_t serverTime = ((int64_t)newestStats->lastReceivedSR_NTPmsw() - NTP_TO_UNIX_EPOCH) * 1000000 +
+                         (((int64_t)newestStats->lastReceivedSR_NTPlsw() * 1000000) >> 32);
+    timeval arrivalTime = newestStats->lastReceivedSR_time();
+    int64_t localTime = (int64_t)arrivalTime.tv_sec * 1000000 + arrivalTime.tv_usec;
+    self->clockOffsetEstimator.addSample(serverTime, localTime);
+}
+
+void RTSPCubemapSourceClient::handleBye(void* self_)
+{
+    RTSPCubemapSourceClient* self = (RTSPCubemapSourceClient*)self_;
+    
+    // Every face says goodbye
+    if (self->reconnectionPolicy.isPlaying())
+    {
+        std::cout << "Client: the server ended the stream" << std::endl;
+        self->shutdown();
+    }
+}
+
+void RTSPCubemapSourceClient::createSinks()
+{
+    for (MediaSubsession* subsession : subsessions)
+    {
+        if (strcmp(subsession->mediumName(), "video") != 0 ||
+            strcmp(subsession->codecName(), "H264") != 0)
+        {
+            return;
+        }
+    }
+    
+    // Faces that are not received keep a NULL sink so that face indices stay the same
+    size_t sinkSlotsCount = (std::min)(facesCount, (size_t)(StereoCubemap::MAX_EYES_COUNT * Cubemap::MAX_FACES_COUNT));
+    
+    std::map<int, std::string> parameterSets;
+    for (MediaSubsession* subsession : subsessions)
+    {
+        int face = subsessionFaces[subsession];
+        if (face < sinkSlotsCount)
+        {
+            const char* spropParameterSets = subsession->fmtp_spropparametersets();
+            parameterSets[face] = (spropParameterSets) ? spropParameterSets : "";
+        }
+    }
+    
+    boost::mutex::scoped_lock lock(primary->cubemapSourceMutex);
+    
+    // After a reconnection the decoders, their frames and the cubemap source
+    // (and with it the application's textures) are kept if the stream didn't change
+    bool reuseSinks = !h264Sinks.empty() && h264Sinks.size() == sinkSlotsCount && parameterSets == sinksParameterSets;
+    if (reuseSinks)
+    {
+        std::cout << "Client: stream parameters unchanged; reusing the decoders" << std::endl;
+    }
+    else
+    {
+        if (!h264Sinks.empty())
+        {
+            // The old sinks' frames are referenced by the old cubemap source's cubemaps
+            // -> take those back from the application before the sinks go
+            std::cout << "Client: stream parameters changed; creating new decoders" << std::endl;
+            primary->destroyCubemapSource();
+            for (H264NALUSink* sink : h264Sinks)
+            {
+                if (sink)
+                {
+                    Medium::close(sink);
+                }
+            }
+        }
+        h264Sinks.assign(sinkSlotsCount, nullptr);
+        sinksParameterSets = parameterSets;
+    }
+    
+    // The decoders share the thread budget evenly. Each server gets the same share of it.
+    int sinksCount = (int)parameterSets.size();
+    int decoderThreadsCount = (std::max)(1, decoderThreadsBudget / (int)primary->servers.size() / (std::max)(1, sinksCount));
+    std::cout << "Client: " << decoderThreadsCount << " decoder thread(s) per face" << std::endl;
+    
+    if (batchedIngestThreads > 0)
+    {
+        if (BatchedRTPReceiver::isSupported())
+        {
+            batchedRTPReceiver = new BatchedRTPReceiver(batchedIngestThreads);
+            std::cout << "Client: reading all faces with " << batchedIngestThreads << " batched ingest thread(s)" << std::endl;
+        }
+        else
+        {
+            std::cout << "Client: batched ingest is not supported on this platform" << std::endl;
+        }
+    }
+    
+    for (MediaSubsession* subsession : subsessions)
+    {
+        int face = subsessionFaces[subsession];
+        if (face >= h264Sinks.size())
+        {
+            continue;
+        }
+        
+        H264NALUSink* sink;
+        if (reuseSinks)
+        {
+            sink = h264Sinks[face];
+            sink->setSubsession(subsession);
+        }
+        else
+        {
+            sink = H264NALUSink::createNew(envir(),
+                                           format,
+                                           subsession,
+                                           robustSyncing,
+                                           sinkFramesCount,
+                                           framesMemoryBudget,
+                                           backpressurePolicy,
+                                           decoderThreading,
+                                           decoderThreadsCount);
+            sink->setClockOffsetEstimator(&clockOffsetEstimator);
+        }
+        subsession->sink = sink;
+        
+        // Ask the server for a keyframe when the decoder fails instead of decoding garbage until the next IDR frame
+        auto requesterIter = retransmissionRequesters.find(subsession);
+        if (requesterIter != retransmissionRequesters.end())
+        {
+            RTPRetransmissionRequester* requester = requesterIter->second;
+            sink->setOnDecodingError([requester](H264NALUSink*, bool hasDecodedFrames)
+                                     {
+                                         requester->requestKeyframe(!hasDecodedFrames);
+                                     });
+        }
+        
+        if (batchedRTPReceiver)
+        {
+            RTPRetransmissionRequester* requester = (requesterIter != retransmissionRequesters.end()) ? requesterIter->second : nullptr;
+            batchedRTPReceiver->addSubsession(subsession, sink, requester);
+        }
+        
+        h264Sinks[face] = sink;
+    }
 }
 
 void RTSPCubemapSourceClient::createOutputFiles(char const* periodicFilenameSuffix)
@@ -193,44 +624,9 @@ void RTSPCubemapSourceClient::createOutputFiles(char const* periodicFilenameSuff
         subsessions.push_back(subsession);
     }*/
     
-    // Create CubemapSource based on discovered stream
-    bool isH264 = true;
-    for (MediaSubsession* subsession : subsessions)
-    {
-        if (strcmp(subsession->mediumName(), "video") != 0 ||
-            strcmp(subsession->codecName(), "H264") != 0)
-        {
-            isH264 = false;
-        }
-    }
-    
-    if (isH264)
-    {
-        std::vector<H264NALUSink*> h264Sinks;
-        std::vector<MediaSink*> sinks;
-        for (int i = 0; i < (std::min)(subsessions.size(), (size_t)(StereoCubemap::MAX_EYES_COUNT * Cubemap::MAX_FACES_COUNT)); i++)
-        {
-            H264NALUSink* sink = H264NALUSink::createNew(envir(),
-                                                         sinkBufferSize,
-                                                         format,
-                                                         subsessions[i],
-                                                         robustSyncing);
-            subsessions[i]->sink = sink;
-            
-            h264Sinks.push_back(sink);
-            sinks.push_back(sink);
-        }
-        
-        if (onDidConnect)
-        {
-            onDidConnect(this,
-                         new H264CubemapSource(h264Sinks,
-                                               format,
-                                               matchStereoPairs,
-                                               robustSyncing,
-                                               maxFrameMapSize));
-        }
-    }
+    // Create CubemapSource based on discovered stream.
+    // Its sinks were created while the streams were being set up.
+    primary->assembleCubemapSource();
     
     for (MediaSubsession* subsession : subsessions)
     {
@@ -245,121 +641,228 @@ void RTSPCubemapSourceClient::createOutputFiles(char const* periodicFilenameSuff
 				<< "/" << subsession->codecName()
 				<< "\" subsession to \"" << outFileName << "\"\n";
 
-			subsession->sink->startPlaying(*(subsession->readSource()),
-				subsessionAfterPlaying,
-				subsession);
+			if (!batchedRTPReceiver)
+			{
+				subsession->sink->startPlaying(*(subsession->readSource()),
+					subsessionAfterPlaying,
+					subsession);
+			}
 
 			// Also set a handler to be called if a RTCP "BYE" arrives
 			// for this subsession:
 			if (subsession->rtcpInstance() != NULL)
 			{
 				subsession->rtcpInstance()->setByeHandler(subsessionByeHandler, subsession);
+				subsession->rtcpInstance()->setSRHandler(subsessionSRHandler, subsession);
 			}
 		}
 	}
+    
+    if (batchedRTPReceiver)
+    {
+        batchedRTPReceiver->start();
+    }
 }
 
 
 
-void RTSPCubemapSourceClient::setupStreams()
+void RTSPCubemapSourceClient::assembleCubemapSource()
 {
-	//static MediaSubsessionIterator* setupIter = NULL;
-	static std::vector<MediaSubsession*>::iterator setupIter = subsessions.begin();
-	//if (setupIter == NULL) setupIter = new MediaSubsessionIterator(*session);
-
-	//for (MediaSubsession* subsession : subsessions)
-//	{
-		while (setupIter != subsessions.end())
-		{
-			subsession = *setupIter;
-		// We have another subsession left to set up:
-		if (subsession->clientPortNum() == 0) continue; // port # was not set
-
-		//this->subsession = subsession;
-		sendSetupCommand(*subsession, continueAfterSETUP);
-			
-		setupIter++;
-
-			return;
-		}
-
-		// We're done setting up subsessions.
-		//delete setupIter;
-
-//	}
+    boost::mutex::scoped_lock lock(cubemapSourceMutex);
+    
+    // After a reconnection with unchanged sinks the application keeps the one it has
+    if (cubemapSource || !onDidConnect)
+    {
+        return;
+    }
+    
+    // Sinks of all servers by cubemap face
+    std::vector<H264NALUSink*> sinks;
+    std::vector<int> sinkServers;
+    for (int i = 0; i < servers.size(); i++)
+    {
+        const std::vector<H264NALUSink*>& serverSinks = servers[i]->h264Sinks;
+        if (serverSinks.empty())
+        {
+            // Not connected yet; the cubemap source is created when the last server is
+            return;
+        }
+        
+        if (serverSinks.size() > sinks.size())
+        {
+            sinks.resize(serverSinks.size(), nullptr);
+            sinkServers.resize(serverSinks.size(), 0);
+        }
+        for (int face = 0; face < serverSinks.size(); face++)
+        {
+            if (!serverSinks[face])
+            {
+                continue;
+            }
+            if (sinks[face])
+            {
+                std::cout << "Client: face " << face << " is sent by several servers; using the one from " <<
+                    servers[sinkServers[face]]->url() << std::endl;
+                continue;
+            }
+            sinks[face]       = serverSinks[face];
+            sinkServers[face] = i;
+        }
+    }
+    
+    // The sinks of servers whose stream didn't change are reused. The previous source has given
+    // their frames back (see destroyCubemapSource()) and the new one collects what they queued since.
+    cubemapSource = new H264CubemapSource(sinks,
+                                          format,
+                                          matchStereoPairs,
+                                          robustSyncing,
+                                          maxFrameMapSize,
+                                          jitterBudget,
+                                          partialCubemapPolicy,
+                                          sinkServers);
+    onDidConnect(this, cubemapSource);
+}
 
-			// Create output files:
-			createOutputFiles("");
+void RTSPCubemapSourceClient::destroyCubemapSource()
+{
+    if (!cubemapSource)
+    {
+        return;
+    }
+    
+    cubemapSource->stop();
+    if (onWillDestroyCubemapSource)
+    {
+        onWillDestroyCubemapSource(this, cubemapSource);
+    }
+    // Gives the frames back to the sinks, so the ones of the other servers can be reused
+    CubemapSource::destroy(cubemapSource);
+    cubemapSource = nullptr;
+}
 
-			for (MediaSubsession* subsession : subsessions)
-			{
-				// Finally, start playing each subsession, to start the data flow:
-				double initialSeekTime = 0.0f;
-				double duration = subsession->parentSession().playEndTime() - initialSeekTime; // use SDP end time
+void RTSPCubemapSourceClient::setupStreams()
+{
+    for (MediaSubsession* subsession : subsessions)
+    {
+        // Subsessions without a port were not initiated
+        if (subsession->clientPortNum() != 0)
+        {
+            unsentSetups.push_back(subsession);
+        }
+    }
+    
+    if (unsentSetups.empty())
+    {
+        startStreams();
+        return;
+    }
+    
+    // The first SETUP opens the RTSP session.
+    // The others can only join it once we know its ID.
+    sendNextSetups(false);
+}
 
-				double endTime;
-				endTime = initialSeekTime;
-				endTime = -1.0f;
+void RTSPCubemapSourceClient::sendNextSetups(bool pipeline)
+{
+    while (!unsentSetups.empty())
+    {
+        MediaSubsession* subsession = unsentSetups.front();
+        unsentSetups.pop_front();
+        pendingSetups.push_back(subsession);
+        sendSetupCommand(*subsession, continueAfterSETUP);
+        
+        if (!pipeline)
+        {
+            break;
+        }
+    }
+}
 
-				char* initialAbsoluteSeekTime = NULL;
-				char const* absStartTime = initialAbsoluteSeekTime != NULL ? initialAbsoluteSeekTime : subsession->parentSession().absStartTime();
-				if (absStartTime != NULL)
-				{
-					// Either we or the server have specified that seeking should be done by 'absolute' time:
-					sendPlayCommand(subsession->parentSession(), continueAfterPLAY, absStartTime, subsession->parentSession().absEndTime(), 1.0);
-				}
-				else
-				{
-					// Normal case: Seek by relative time (NPT):
-					sendPlayCommand(subsession->parentSession(), continueAfterPLAY, initialSeekTime, endTime, 1.0);
-				}
-			}
+void RTSPCubemapSourceClient::startStreams()
+{
+    setupDoneTime = boost::chrono::steady_clock::now();
+    
+    // Create output files:
+    createOutputFiles("");
+    
+    if (subsessions.empty())
+    {
+        return;
+    }
+    
+    // All subsessions are part of one RTSP session
+    // -> a single PLAY for the session starts all of them
+    MediaSession& session = subsessions.front()->parentSession();
+    double initialSeekTime = 0.0f;
+    double endTime = -1.0f;
+    
+    char* initialAbsoluteSeekTime = NULL;
+    char const* absStartTime = initialAbsoluteSeekTime != NULL ? initialAbsoluteSeekTime : session.absStartTime();
+    if (absStartTime != NULL)
+    {
+        // Either we or the server have specified that seeking should be done by 'absolute' time:
+        sendPlayCommand(session, continueAfterPLAY, absStartTime, session.absEndTime(), 1.0);
+    }
+    else
+    {
+        // Normal case: Seek by relative time (NPT):
+        sendPlayCommand(session, continueAfterPLAY, initialSeekTime, endTime, 1.0);
+    }
 }
 
 void RTSPCubemapSourceClient::continueAfterSETUP(RTSPClient* self_, int resultCode, char* resultString)
 {
-	static int setups = 0;
-	setups++;
-
     RTSPCubemapSourceClient* self = (RTSPCubemapSourceClient*)self_;
     
+    // Responses come in the order of the requests
+    MediaSubsession* subsession = self->pendingSetups.front();
+    self->pendingSetups.pop_front();
+    
 	if (resultCode == 0)
 	{
-		self->envir() << "Setup \"" << self->subsession->mediumName()
-			<< "/" << self->subsession->codecName()
+		self->isSessionOpen = true;
+		self->envir() << "Setup \"" << subsession->mediumName()
+			<< "/" << subsession->codecName()
 			<< "\" subsession (";
-		if (self->subsession->rtcpIsMuxed())
+		if (subsession->rtcpIsMuxed())
 		{
-			self->envir() << "client port " << self->subsession->clientPortNum();
+			self->envir() << "client port " << subsession->clientPortNum();
 		}
 		else
 		{
-			self->envir() << "client ports " << self->subsession->clientPortNum()
-				<< "-" << self->subsession->clientPortNum() + 1;
+			self->envir() << "client ports " << subsession->clientPortNum()
+				<< "-" << subsession->clientPortNum() + 1;
 		}
 		self->envir() << ")\n";
 	}
 	else
 	{
-        self->envir() << "Failed to setup \"" << self->subsession->mediumName()
-			<< "/" << self->subsession->codecName()
+        self->envir() << "Failed to setup \"" << subsession->mediumName()
+			<< "/" << subsession->codecName()
 			<< "\" subsession: " << resultString << "\n";
 	}
 	delete[] resultString;
 	
-	// Set up the next subsession, if any:
-	self->setupStreams();
+	// Once the session is open, the remaining subsessions are set up all at once
+	self->sendNextSetups(self->isSessionOpen);
+    
+    if (self->pendingSetups.empty())
+    {
+        self->startStreams();
+    }
 }
 
 void RTSPCubemapSourceClient::continueAfterDESCRIBE(RTSPClient* self_, int resultCode, char* resultString)
 {
     RTSPCubemapSourceClient* self = (RTSPCubemapSourceClient*)self_;
+    self->describeDoneTime = boost::chrono::steady_clock::now();
     
 	if (resultCode != 0)
 	{
 		self->envir() << "Failed to get a SDP description for the URL \"" << self->url() << "\": " << resultString << "\n";
 		delete[] resultString;
 		self->shutdown();
+		return;
 	}
 
 	char* sdpDescription = resultString;
@@ -373,8 +876,39 @@ void RTSPCubemapSourceClient::continueAfterDESCRIBE(RTSPClient* self_, int resul
 	std::transform(sdpLines.begin(), sdpLines.end(), sdpLines.begin(), [](std::string &subsession){ return "m=" + subsession + "\n"; });
 	delete[] sdpDescription;
 
+	// Sinks are indexed by cubemap face
+	self->facesCount = 0;
+	for (int i = 0; i < sdpLines.size(); i++)
+	{
+		int face = (self->serverFaces.empty()) ? i : ((i < self->serverFaces.size()) ? self->serverFaces[i] : -1);
+		self->facesCount = (std::max)(self->facesCount, (size_t)(face + 1));
+	}
+
 	for (int i = 0; i < sdpLines.size(); i++)
 	{
+		int face = (self->serverFaces.empty()) ? i : ((i < self->serverFaces.size()) ? self->serverFaces[i] : -1);
+		if (face < 0)
+		{
+			std::cout << "face " << i << " of " << self->url() << " has no cubemap face; skipped" << std::endl;
+			continue;
+		}
+
+		// Every face is sent to its own multicast group (or group of a few faces).
+		// Not creating a receiver for a face keeps us from joining its group.
+		if (!self->faces.empty() && std::find(self->faces.begin(), self->faces.end(), face) == self->faces.end())
+		{
+			std::cout << "skipped face " << face << std::endl;
+			continue;
+		}
+
+		// The server tells us which of its interfaces the face is sent from.
+		// We join the face's group on our interface with the same index.
+		int interfaceIndex = 0;
+		boost::smatch interfaceMatch;
+		if (boost::regex_search(sdpLines[i], interfaceMatch, boost::regex("a=" SDP_INTERFACE_ATTRIBUTE ":(\\d+)")))
+		{
+			interfaceIndex = std::stoi(interfaceMatch[1]) % self->interfaceAddresses.size();
+		}
 
 		// Create a media session object from this SDP description:
 		TaskScheduler* scheduler = BasicTaskScheduler::createNew();
@@ -389,11 +923,14 @@ void RTSPCubemapSourceClient::continueAfterDESCRIBE(RTSPClient* self_, int resul
 			self->envir() << "Failed to create a MediaSession object from the SDP description: "
 				<< env->getResultMsg() << "\n";
 			self->shutdown();
+			return;
 		}
 		else if (!session->hasSubsessions())
 		{
 			self->envir() << "This session has no media subsessions (i.e., no \"m=\" lines)\n";
+			Medium::close(session);
 			self->shutdown();
+			return;
 		}
 
 		// Then, setup the "RTPSource"s for the session:
@@ -403,8 +940,17 @@ void RTSPCubemapSourceClient::continueAfterDESCRIBE(RTSPClient* self_, int resul
 		while ((subsession = iter.next()) != NULL)
 		{
 			self->subsessions.push_back(subsession);
+			self->subsessionFaces[subsession] = face;
+			subsession->miscPtr = self; // for the "BYE" handler
+			self->subsessionInterfaces[subsession] = interfaceIndex;
+
+			// live555 joins multicast groups on the interface in this global
+			netAddressBits defaultInterfaceAddress = ReceivingInterfaceAddr;
+			ReceivingInterfaceAddr = self->interfaceAddresses[interfaceIndex];
+			Boolean initiated = subsession->initiate();
+			ReceivingInterfaceAddr = defaultInterfaceAddress;
 
-			if (!subsession->initiate())
+			if (!initiated)
 			{
 				self->envir() << "Unable to create receiver for \"" << subsession->mediumName()
 					<< "/" << subsession->codecName()
@@ -430,21 +976,23 @@ void RTSPCubemapSourceClient::continueAfterDESCRIBE(RTSPClient* self_, int resul
 
 				if (subsession->rtpSource() != NULL)
 				{
-					// Because we're saving the incoming data, rather than playing
-					// it in real time, allow an especially large time threshold
-					// (1 second) for reordering misordered incoming packets:
-					unsigned const thresh = 100000; // 1 second
+					// Allow a time threshold (100 ms) for reordering misordered
+					// or retransmitted incoming packets:
+					unsigned const thresh = 100000; // 100 ms
 					subsession->rtpSource()->setPacketReorderingThresholdTime(thresh);
 
-					// Set the RTP source's OS socket buffer size as appropriate - either if we were explicitly asked (using -B),
-					// or if the desired FileSink buffer size happens to be larger than the current OS socket buffer size.
-					// (The latter case is a heuristic, on the assumption that if the user asked for a large FileSink buffer size,
-					// then the input data rate may be large enough to justify increasing the OS socket buffer size also.)
+					// Lost packets are worth asking for as long as their cubemap waits for the face,
+					// and no longer than the reordering buffer waits for them
+					boost::chrono::microseconds nackDeadline = (std::min)(self->jitterBudget, boost::chrono::microseconds(thresh));
+					self->retransmissionRequesters[subsession] = new RTPRetransmissionRequester(subsession, nackDeadline);
+
+					// Give the OS socket enough room to absorb bursts while the event loop is busy.
+					// The sinks size their own buffers after the stream.
 					int socketNum = subsession->rtpSource()->RTPgs()->socketNum();
 					unsigned curBufferSize = getReceiveBufferSize(*env, socketNum);
-					if (self->sinkBufferSize > curBufferSize)
+					if (self->socketBufferSize > curBufferSize)
 					{
-						unsigned newBufferSize = self->sinkBufferSize;
+						unsigned newBufferSize = self->socketBufferSize;
 						newBufferSize = setReceiveBufferTo(*env, socketNum, newBufferSize);
 					}
 				}
@@ -472,11 +1020,13 @@ void RTSPCubemapSourceClient::continueAfterDESCRIBE(RTSPClient* self_, int resul
 	// Perform additional 'setup' on each subsession, before playing them:
 	self->setupStreams();
     
-    self->envir().taskScheduler().scheduleDelayedTask(10000000, (TaskFunc*)RTSPCubemapSourceClient::periodicQOSMeasurement, self);
+    // Opening the decoders takes a while -> do it while the SETUPs are in flight
+    self->createSinks();
 
 	for (int i = 0; i < self->envs.size(); i++)
 	{
-		boost::thread* abc = new boost::thread(boost::bind(&TaskScheduler::doEventLoop, &self->envs[i]->taskScheduler(), nullptr));
+		// closeSession() stops the loops through the watch variable
+		boost::thread* abc = new boost::thread(boost::bind(&TaskScheduler::doEventLoop, &self->envs[i]->taskScheduler(), &self->stopSessionLoops));
 		self->sessionThreads.push_back(boost::shared_ptr<boost::thread>(abc));
 	}
 }
@@ -495,66 +1045,125 @@ void RTSPCubemapSourceClient::networkLoop()
     // Begin by sending an "OPTIONS" command:
     sendOptionsCommand(continueAfterOPTIONS);
     
+    // Reconnects when the server stops sending or doesn't respond
+    envir().taskScheduler().scheduleDelayedTask(boost::chrono::microseconds(PACKET_ARRIVAL_CHECK_INTERVAL).count(),
+                                                (TaskFunc*)RTSPCubemapSourceClient::checkForPacketArrival, this);
+    envir().taskScheduler().scheduleDelayedTask(10000000, (TaskFunc*)RTSPCubemapSourceClient::periodicQOSMeasurement, this);
+    
 	// All subsequent activity takes place within the event loop:
 	envir().taskScheduler().doEventLoop(); // does not return
 }
 
 void RTSPCubemapSourceClient::connect()
 {
+    connectStartTime = boost::chrono::steady_clock::now();
+    reconnectionPolicy.startConnecting(connectStartTime);
     networkThread = boost::thread(boost::bind(&RTSPCubemapSourceClient::networkLoop, this));
+    
+    // Every server has its own connection, event loop and reconnection
+    for (RTSPCubemapSourceClient* server : servers)
+    {
+        if (server != this)
+        {
+            server->connect();
+        }
+    }
+}
+
+void RTSPCubemapSourceClient::addServer(char const* rtspURL, const std::vector<int>& serverFaces)
+{
+    TaskScheduler* scheduler = BasicTaskScheduler::createNew();
+    BasicUsageEnvironment* env = BasicUsageEnvironment::createNew(*scheduler);
+    
+    // The frames of all servers end up in the same cubemaps -> the server shares our memory budget
+    Options serverOptions = options;
+    serverOptions.framesMemoryBudget = 0;
+    
+    RTSPCubemapSourceClient* server = new RTSPCubemapSourceClient(*env,
+                                                                  rtspURL,
+                                                                  serverOptions,
+                                                                  fVerbosityLevel,
+                                                                  NULL,
+                                                                  0,
+                                                                  -1);
+    server->interfaceAddresses = interfaceAddresses;
+    server->framesMemoryBudget = framesMemoryBudget;
+    server->primary            = this;
+    server->serverFaces        = serverFaces;
+    servers.push_back(server);
+}
+
+RTSPCubemapSourceClient::Options::Options()
+    :
+    socketBufferSize(DEFAULT_SOCKET_BUFFER_SIZE), format(NATIVE_PIX_FMT), matchStereoPairs(false), robustSyncing(false),
+    maxFrameMapSize(2), jitterBudget(50000), partialCubemapPolicy(H264CubemapSource::REUSE_PREVIOUS_FACES),
+    framesMemoryBudget(DEFAULT_FRAMES_MEMORY_BUDGET), sinkFramesCount(DEFAULT_SINK_FRAMES_COUNT),
+    backpressurePolicy(H264NALUSink::DROP_OLDEST), decoderThreading(H264NALUSink::SLICE_THREADING),
+    decoderThreadsBudget(0), batchedIngestThreads(0), interfaceAddress("0.0.0.0")
+{
 }
 
 RTSPCubemapSourceClient* RTSPCubemapSourceClient::create(char const* rtspURL,
-                                                         unsigned int sinkBufferSize,
-                                                         AVPixelFormat format,
-                                                         bool matchStereoPairs,
-                                                         bool robustSyncing,
-                                                         size_t maxFrameMapSize,
-                                                         const char* interfaceAddress,
+                                                         const Options& options,
                                                          int verbosityLevel,
                                                          char const* applicationName,
                                                          portNumBits tunnelOverHTTPPortNum,
                                                          int socketNumToServer)
 {
-    NetAddressList addresses(interfaceAddress);
-    if (addresses.numAddresses() == 0)
+    std::vector<std::string> interfaceAddressStrs;
+    boost::split(interfaceAddressStrs, options.interfaceAddress, boost::is_any_of(","));
+    std::vector<netAddressBits> interfaceAddresses;
+    for (const std::string& interfaceAddressStr : interfaceAddressStrs)
     {
-        std::cout << "Inteface \"" << interfaceAddress << "\" does not exist" << std::endl;
-        return nullptr;
+        NetAddressList addresses(interfaceAddressStr.c_str());
+        if (addresses.numAddresses() == 0)
+        {
+            std::cout << "Inteface \"" << interfaceAddressStr << "\" does not exist" << std::endl;
+            return nullptr;
+        }
+        interfaceAddresses.push_back(*(unsigned*)(addresses.firstAddress()->data()));
     }
-    ReceivingInterfaceAddr = *(unsigned*)(addresses.firstAddress()->data());
+    ReceivingInterfaceAddr = interfaceAddresses[0];
     
     // Begin by setting up our usage environment:
     TaskScheduler* scheduler = BasicTaskScheduler::createNew();
     BasicUsageEnvironment* env = BasicUsageEnvironment::createNew(*scheduler);
     
-    return new RTSPCubemapSourceClient(*env,
-                                       rtspURL,
-                                       sinkBufferSize,
-                                       format,
-                                       matchStereoPairs,
-                                       robustSyncing,
-                                       maxFrameMapSize,
-                                       verbosityLevel,
-                                       applicationName,
-                                       tunnelOverHTTPPortNum,
-                                       socketNumToServer);
+    RTSPCubemapSourceClient* client = new RTSPCubemapSourceClient(*env,
+                                                                  rtspURL,
+                                                                  options,
+                                                                  verbosityLevel,
+                                                                  applicationName,
+                                                                  tunnelOverHTTPPortNum,
+                                                                  socketNumToServer);
+    client->interfaceAddresses = interfaceAddresses;
+    return client;
 }
 
 RTSPCubemapSourceClient::RTSPCubemapSourceClient(UsageEnvironment& env,
                                                  char const* rtspURL,
-                                                 unsigned int sinkBufferSize,
-                                                 AVPixelFormat format,
-                                                 bool matchStereoPairs,
-                                                 bool robustSyncing,
-                                                 size_t maxFrameMapSize,
+                                                 const Options& options,
                                                  int verbosityLevel,
                                                  char const* applicationName,
                                                  portNumBits tunnelOverHTTPPortNum,
                                                  int socketNumToServer)
     :
-    RTSPClient(env, rtspURL, verbosityLevel, applicationName, tunnelOverHTTPPortNum, socketNumToServer),
-    sinkBufferSize(sinkBufferSize), format(format), lastTotalKBytes(0.0), lastTotalPacketsReceived(0), lastTotalPacketsExpected(0),
-    matchStereoPairs(matchStereoPairs), robustSyncing(robustSyncing), maxFrameMapSize(maxFrameMapSize)
+    RTSPClient(env, rtspURL, verbosityLevel, applicationName, tunnelOverHTTPPortNum, socketNumToServer), options(options),
+    facesCount(0), isSessionOpen(false), socketBufferSize(options.socketBufferSize), format(options.format), lastTotalKBytes(0.0), lastTotalPacketsReceived(0), lastTotalPacketsExpected(0),
+    matchStereoPairs(options.matchStereoPairs), robustSyncing(options.robustSyncing), maxFrameMapSize(options.maxFrameMapSize), faces(options.faces),
+    jitterBudget(options.jitterBudget), partialCubemapPolicy(options.partialCubemapPolicy),
+    framesMemoryBudget((options.framesMemoryBudget > 0) ? new FrameMemoryBudget(options.framesMemoryBudget) : nullptr),
+    // A sink needs a frame for every cubemap in the playout buffer, one for every cubemap
+    // the consumer's mailbox keeps alive (each holds a frame of every face) and one to decode into
+    sinkFramesCount((std::max)(options.sinkFramesCount, options.maxFrameMapSize + CubemapMailbox::SLOTS_COUNT + 1)), backpressurePolicy(options.backpressurePolicy),
+    decoderThreading(options.decoderThreading),
+    decoderThreadsBudget((options.decoderThreadsBudget > 0) ? options.decoderThreadsBudget : boost::thread::hardware_concurrency()),
+    batchedIngestThreads(options.batchedIngestThreads), batchedRTPReceiver(nullptr),
+    connectDuration(0), cubemapSource(nullptr), stopSessionLoops(0),
+    reconnectionPolicy(STREAM_TIMEOUT, CONNECT_TIMEOUT, MIN_RECONNECT_DELAY, MAX_RECONNECT_DELAY), isReconnectScheduled(false),
+    reconnectsCount(0), primary(this)
 {
+    servers.push_back(this);
+    lastRetransmissionStatistics = {0, 0, 0, 0, 0, boost::chrono::microseconds(0), boost::chrono::microseconds(0)};
+    byeTrigger = env.taskScheduler().createEventTrigger((TaskFunc*)RTSPCubemapSourceClient::handleBye);
 }
@@ -4,21 +4,51 @@
 #include <GroupsockHelper.hh>
 #include <liveMedia.hh>
 #include <boost/thread.hpp>
+#include <deque>
 
 #include "AlloReceiver.h"
+#include "RTPRetransmissionRequester.hpp"
+#include "H264CubemapSource.h"
+#include "FrameMemoryBudget.hpp"
+#include "BatchedRTPReceiver.hpp"
+#include "ClockOffsetEstimator.hpp"
+#include "ReconnectionPolicy.hpp"
+
+// Memory for the frames that the sinks of a client have handed out and that are not shown yet (0 means no limit)
+const size_t DEFAULT_FRAMES_MEMORY_BUDGET = 512 * 1024 * 1024;
+// OS receive buffer of each RTP socket. The OS may cap it (net.core.rmem_max on Linux).
+const unsigned int DEFAULT_SOCKET_BUFFER_SIZE = 200000000;
 
 class ALLORECEIVER_API RTSPCubemapSourceClient : public RTSPClient
 {
 public:
+    // How the streams are received. The defaults are set by the constructor;
+    // change the ones you need before passing the options to create().
+    struct ALLORECEIVER_API Options
+    {
+        unsigned int                            socketBufferSize;     // OS receive buffer of each RTP socket
+        AVPixelFormat                           format;               // NATIVE_PIX_FMT skips color conversion
+        bool                                    matchStereoPairs;
+        bool                                    robustSyncing;
+        size_t                                  maxFrameMapSize;
+        std::vector<int>                        faces;                // faces to receive; empty means all
+        boost::chrono::microseconds             jitterBudget;
+        H264CubemapSource::PartialCubemapPolicy partialCubemapPolicy;
+        size_t                                  framesMemoryBudget;   // 0 means no limit
+        size_t                                  sinkFramesCount;      // raised so that the playout buffer can fill up
+        H264NALUSink::BackpressurePolicy        backpressurePolicy;
+        H264NALUSink::DecoderThreading          decoderThreading;
+        int                                     decoderThreadsBudget; // shared by the decoders of all faces; 0 means one per CPU core
+        int                                     batchedIngestThreads; // read all faces with recvmmsg on this many threads (Linux only); 0 means one live555 event loop per face
+        std::string                             interfaceAddress;     // comma-separated if the server stripes faces over several interfaces
+        
+        Options();
+    };
+    
     void connect();
 
     static RTSPCubemapSourceClient* create(char const* rtspURL,
-                                           unsigned int sinkBufferSize,
-                                           AVPixelFormat format,
-                                           bool matchStereoPairs,
-                                           bool robustSyncing,
-                                           size_t maxFrameMapSize,
-                                           const char* interfaceAddress = "0.0.0.0",
+                                           const Options& options = Options(),
                                            int verbosityLevel = 0,
                                            char const* applicationName = NULL,
                                            portNumBits tunnelOverHTTPPortNum = 0,
@@ -26,14 +56,30 @@ public:
     
     void setOnDidConnect(const std::function<void (RTSPCubemapSourceClient*, CubemapSource*)>& onDidConnect);
     
+    // Called when the stream parameters changed and the cubemap source given to onDidConnect is replaced.
+    // The source doesn't hand out cubemaps anymore. The application must stop using all of its cubemaps
+    // before returning; the source is destroyed afterwards. onDidConnect is called with the new one later.
+    void setOnWillDestroyCubemapSource(const std::function<void (RTSPCubemapSourceClient*, CubemapSource*)>& onWillDestroyCubemapSource);
+    
+    // Receives more faces of the same cubemaps from another server, e.g. one eye per render machine.
+    // The server's faces become the given cubemap faces in the order of its SDP. The faces
+    // of all servers are assembled by pts, so the servers must stamp their frames alike
+    // (see robustSyncing). Must be called before connect().
+    void addServer(char const* rtspURL, const std::vector<int>& serverFaces);
+    
+    // Time from connect() (or the last reconnection attempt) until the server started streaming; 0 until then
+    boost::chrono::microseconds getConnectDuration();
+    
+    // Server restarts survived so far
+    int getReconnectsCount();
+    
+    // Fed with the server's RTCP sender reports. Kept across reconnections.
+    ClockOffsetEstimator* getClockOffsetEstimator();
+    
 protected:
     RTSPCubemapSourceClient(UsageEnvironment& env,
                             char const* rtspURL,
-                            unsigned int sinkBufferSize,
-                            AVPixelFormat format,
-                            bool matchStereoPairs,
-                            bool robustSyncing,
-                            size_t maxFrameMapSize,
+                            const Options& options,
                             int verbosityLevel,
                             char const* applicationName,
                             portNumBits tunnelOverHTTPPortNum,
@@ -56,30 +102,88 @@ protected:
                                         char* resultString);
     
     static void subsessionByeHandler   (void* self);
+    static void subsessionSRHandler    (void* self);
     static void subsessionAfterPlaying (void* self);
     static void checkForPacketArrival  (void* self);
     static void periodicQOSMeasurement (void* self);
+    static void reconnect              (void* self);
+    static void handleBye              (void* self);
     
     void networkLoop            ();
+    // Gives up the session and connects again after a backoff.
+    // Sinks and the cubemap source are reused if the stream parameters don't change.
     void shutdown               (int exitCode = 1);
+    void closeSession           ();
+    unsigned int getReceivedPacketsCount();
     
+    void createSinks            ();
     void createOutputFiles      (char const* periodicFilenameSuffix);
     void setupStreams           ();
+    void sendNextSetups         (bool pipeline);
+    void startStreams           ();
+    // Creates the cubemap source once every server has its sinks. Only called on the primary client.
+    void assembleCubemapSource  ();
+    // Takes the cubemap source back from the application. Only called on the primary client
+    // with cubemapSourceMutex locked.
+    void destroyCubemapSource   ();
     
     std::function<void (RTSPCubemapSourceClient*, CubemapSource*)> onDidConnect;
+    std::function<void (RTSPCubemapSourceClient*, CubemapSource*)> onWillDestroyCubemapSource;
     
 private:
+    Options options; // as given to create(); for the servers added later
 	std::vector<BasicUsageEnvironment*> envs;
 	std::vector<boost::shared_ptr<boost::thread>> sessionThreads;
     boost::thread networkThread;
 	std::vector<MediaSubsession*> subsessions;
-    MediaSubsession* subsession;
-    unsigned int sinkBufferSize;
+    std::map<MediaSubsession*, int> subsessionFaces; // face index of each subsession in the SDP
+    size_t facesCount;
+    std::vector<netAddressBits> interfaceAddresses;
+    std::map<MediaSubsession*, int> subsessionInterfaces; // index into interfaceAddresses
+    std::vector<double> lastInterfaceKBytes;
+    std::deque<MediaSubsession*> unsentSetups;
+    std::deque<MediaSubsession*> pendingSetups; // SETUPs sent, in the order of their responses
+    bool isSessionOpen; // a SETUP succeeded; later SETUPs join its RTSP session
+    std::vector<H264NALUSink*> h264Sinks;
+    unsigned int socketBufferSize;
     AVPixelFormat format;
     double lastTotalKBytes;
     unsigned int lastTotalPacketsReceived;
     unsigned int lastTotalPacketsExpected;
+    std::map<MediaSubsession*, RTPRetransmissionRequester*> retransmissionRequesters;
+    RTPRetransmissionRequester::Statistics lastRetransmissionStatistics;
     bool matchStereoPairs;
     bool robustSyncing;
     size_t maxFrameMapSize;
+    std::vector<int> faces; // faces to receive; empty means all
+    boost::chrono::microseconds jitterBudget;
+    H264CubemapSource::PartialCubemapPolicy partialCubemapPolicy;
+    FrameMemoryBudget* framesMemoryBudget; // NULL if there is no limit
+    size_t sinkFramesCount;
+    H264NALUSink::BackpressurePolicy backpressurePolicy;
+    H264NALUSink::DecoderThreading decoderThreading;
+    int decoderThreadsBudget;
+    int batchedIngestThreads;
+    BatchedRTPReceiver* batchedRTPReceiver; // NULL if the RTP sources read the packets
+    boost::chrono::steady_clock::time_point connectStartTime;
+    boost::chrono::steady_clock::time_point describeDoneTime;
+    boost::chrono::steady_clock::time_point setupDoneTime;
+    boost::chrono::microseconds connectDuration;
+    
+    // Reconnection
+    H264CubemapSource* cubemapSource;
+    std::map<int, std::string> sinksParameterSets; // sprop-parameter-sets of each face the sinks were created for
+    char stopSessionLoops; // watch variable of the faces' event loops
+    EventTriggerId byeTrigger;
+    ReconnectionPolicy reconnectionPolicy;
+    bool isReconnectScheduled;
+    int reconnectsCount;
+    
+    ClockOffsetEstimator clockOffsetEstimator;
+    
+    // Several servers
+    RTSPCubemapSourceClient* primary; // creates the cubemap source; this unless the client was made by addServer()
+    std::vector<RTSPCubemapSourceClient*> servers; // the primary's: itself and the ones added
+    std::vector<int> serverFaces; // cubemap face of each of the server's faces; empty means the same index
+    boost::mutex cubemapSourceMutex; // the primary's; guards its cubemap source and the sinks of all servers
 };
\ No newline at end of file
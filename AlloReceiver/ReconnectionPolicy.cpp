@@ -0,0 +1,81 @@
+#include <algorithm>
+
+#include "ReconnectionPolicy.hpp"
+
+ReconnectionPolicy::ReconnectionPolicy(boost::chrono::microseconds streamTimeout,
+                                       boost::chrono::microseconds connectTimeout,
+                                       boost::chrono::microseconds minDelay,
+                                       boost::chrono::microseconds maxDelay)
+    :
+    streamTimeout(streamTimeout), connectTimeout(connectTimeout), minDelay(minDelay), maxDelay(maxDelay),
+    delay(minDelay), isPlaying_(false), lastPacketsCount(0), failedAttemptsCount(0)
+{
+}
+
+void ReconnectionPolicy::startConnecting(boost::chrono::steady_clock::time_point now)
+{
+    attemptStartTime = now;
+}
+
+boost::chrono::steady_clock::time_point ReconnectionPolicy::startPlaying(unsigned int                            packetsCount,
+                                                                         boost::chrono::steady_clock::time_point now)
+{
+    isPlaying_            = true;
+    lastPacketsCount      = packetsCount;
+    lastPacketArrivalTime = now;
+    delay                 = minDelay;
+
+    boost::chrono::steady_clock::time_point outageStartTime = this->outageStartTime;
+    this->outageStartTime = boost::chrono::steady_clock::time_point();
+    return outageStartTime;
+}
+
+bool ReconnectionPolicy::isPlaying()
+{
+    return isPlaying_;
+}
+
+bool ReconnectionPolicy::isServerGone(unsigned int packetsCount, boost::chrono::steady_clock::time_point now)
+{
+    if (!isPlaying_)
+    {
+        return now - attemptStartTime > connectTimeout;
+    }
+
+    if (packetsCount != lastPacketsCount)
+    {
+        lastPacketsCount      = packetsCount;
+        lastPacketArrivalTime = now;
+        return false;
+    }
+    return now - lastPacketArrivalTime > streamTimeout;
+}
+
+boost::chrono::microseconds ReconnectionPolicy::closeSession()
+{
+    if (isPlaying_)
+    {
+        // The stream was lost just now
+        outageStartTime     = lastPacketArrivalTime;
+        failedAttemptsCount = 0;
+    }
+    else
+    {
+        failedAttemptsCount++;
+    }
+    isPlaying_ = false;
+
+    boost::chrono::microseconds delay = this->delay;
+    this->delay = (std::min)(this->delay * 2, maxDelay);
+    return delay;
+}
+
+boost::chrono::steady_clock::time_point ReconnectionPolicy::getOutageStartTime()
+{
+    return outageStartTime;
+}
+
+int ReconnectionPolicy::getFailedAttemptsCount()
+{
+    return failedAttemptsCount;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <boost/chrono/system_clocks.hpp>
+
+#include "AlloReceiver.h"
+
+// Decides when a client has lost its server and how long it waits before reconnecting.
+//
+// A stream is lost when no packets arrived for streamTimeout. A connection attempt has
+// failed when the server hasn't started streaming connectTimeout after the attempt began.
+// The delay before the next attempt doubles with every failed attempt, from minDelay up
+// to maxDelay, so that a server that is down isn't flooded with requests. It starts over
+// as soon as the server streams again.
+// Runs in the thread of the client's environment.
+class ALLORECEIVER_API ReconnectionPolicy
+{
+public:
+    ReconnectionPolicy(boost::chrono::microseconds streamTimeout,
+                       boost::chrono::microseconds connectTimeout,
+                       boost::chrono::microseconds minDelay,
+                       boost::chrono::microseconds maxDelay);
+
+    // A connection attempt begins
+    void startConnecting(boost::chrono::steady_clock::time_point now);
+    // The server started streaming. packetsCount: packets received so far.
+    // Returns when the stream was lost before or time_point() if this is no reconnection.
+    boost::chrono::steady_clock::time_point startPlaying(unsigned int                            packetsCount,
+                                                         boost::chrono::steady_clock::time_point now);
+    bool isPlaying();
+
+    // Called periodically with the packets received so far.
+    // Returns true if the server seems to be gone: the client should close the session.
+    bool isServerGone(unsigned int packetsCount, boost::chrono::steady_clock::time_point now);
+
+    // The session was closed, because the server is gone or an attempt failed.
+    // Returns how long to wait before the next attempt.
+    boost::chrono::microseconds closeSession();
+
+    // When the stream was lost; time_point() while it plays
+    boost::chrono::steady_clock::time_point getOutageStartTime();
+    // Since the stream was lost
+    int getFailedAttemptsCount();
+
+private:
+    boost::chrono::microseconds             streamTimeout;
+    boost::chrono::microseconds             connectTimeout;
+    boost::chrono::microseconds             minDelay;
+    boost::chrono::microseconds             maxDelay;
+    boost::chrono::microseconds             delay;
+    bool                                    isPlaying_;
+    boost::chrono::steady_clock::time_point attemptStartTime;
+    unsigned int                            lastPacketsCount;
+    boost::chrono::steady_clock::time_point lastPacketArrivalTime;
+    boost::chrono::steady_clock::time_point outageStartTime;
+    int                                     failedAttemptsCount;
+};
@@ -1,5 +1,7 @@
 #include <boost/thread/mutex.hpp>
 #include <boost/bind.hpp>
+#include <deque>
+#include <map>
 
 #include "CubemapSource.hpp"
 #include "Source.hpp"
@@ -20,19 +22,8 @@ public:
                 return face_->getContent()->getHeight();
             }
             virtual int stride() {
-                ::AVPixelFormat fmt = face_->getContent()->getFormat();
-                if(fmt == AV_PIX_FMT_RGB24)
-                {
-                    return face_->getContent()->getWidth() * 3;
-                }
-                else if(fmt == AV_PIX_FMT_RGBA)
-                {
-                    return face_->getContent()->getWidth() * 4;
-                }
-                else
-                {
-                    return 0;
-                }
+                // The pixels are the receiver's frames, whose lines may be padded
+                return face_->getContent()->getLineSize(0);
             }
             virtual void* pixels() {
                 return face_->getContent()->getPixels();
@@ -43,35 +34,14 @@ public:
             virtual ~CubemapPixelData() { }
         };
 
-        CubemapStereoFrame(StereoCubemap* cubemap) : cubemap_(cubemap) {
+        // Created once per cubemap of the receiver and reused with it
+        CubemapStereoFrame(StereoCubemap* cubemap) : cubemap_(cubemap), leases_(0) {
             Cubemap* left = cubemap_->getEye(0);
-            Cubemap* right = cubemap_->getEye(1);
-            if(cubemap_->getEyesCount() == 2) {
-                faces[0][0] = new CubemapPixelData(left->getFace(0));
-                faces[0][1] = new CubemapPixelData(left->getFace(1));
-                faces[0][2] = new CubemapPixelData(left->getFace(2));
-                faces[0][3] = new CubemapPixelData(left->getFace(3));
-                faces[0][4] = new CubemapPixelData(left->getFace(4));
-                faces[0][5] = new CubemapPixelData(left->getFace(5));
-                faces[1][0] = new CubemapPixelData(right->getFace(0));
-                faces[1][1] = new CubemapPixelData(right->getFace(1));
-                faces[1][2] = new CubemapPixelData(right->getFace(2));
-                faces[1][3] = new CubemapPixelData(right->getFace(3));
-                faces[1][4] = new CubemapPixelData(right->getFace(4));
-                faces[1][5] = new CubemapPixelData(right->getFace(5));
-            } else {
-                faces[0][0] = new CubemapPixelData(left->getFace(0));
-                faces[0][1] = new CubemapPixelData(left->getFace(1));
-                faces[0][2] = new CubemapPixelData(left->getFace(2));
-                faces[0][3] = new CubemapPixelData(left->getFace(3));
-                faces[0][4] = new CubemapPixelData(left->getFace(4));
-                faces[0][5] = new CubemapPixelData(left->getFace(5));
-                faces[1][0] = new CubemapPixelData(left->getFace(0));
-                faces[1][1] = new CubemapPixelData(left->getFace(1));
-                faces[1][2] = new CubemapPixelData(left->getFace(2));
-                faces[1][3] = new CubemapPixelData(left->getFace(3));
-                faces[1][4] = new CubemapPixelData(left->getFace(4));
-                faces[1][5] = new CubemapPixelData(left->getFace(5));
+            Cubemap* right = (cubemap_->getEyesCount() == 2) ? cubemap_->getEye(1) : left;
+            for(int i = 0; i < Cubemap::MAX_FACES_COUNT; i++) {
+                // Faces keep their content when they don't get a new frame
+                faces[0][i] = (i < left->getFacesCount()) ? new CubemapPixelData(left->getFace(i, true)) : nullptr;
+                faces[1][i] = (i < right->getFacesCount()) ? new CubemapPixelData(right->getFace(i, true)) : nullptr;
             }
         }
 
@@ -81,7 +51,7 @@ public:
 
         virtual int getSubImageCount() {
 			int count = 0;
-			for (int i = 0; cubemap_->getEyesCount(); i++)
+			for (int i = 0; i < cubemap_->getEyesCount(); i++)
 			{
 				count += cubemap_->getEye(i)->getFacesCount();
 			}
@@ -90,10 +60,16 @@ public:
         virtual bool isStereo() { return true; }
 
         virtual ~CubemapStereoFrame() {
-            StereoCubemap::destroy(cubemap_);
+            for(int j = 0; j < StereoCubemap::MAX_EYES_COUNT; j++) {
+                for(int i = 0; i < Cubemap::MAX_FACES_COUNT; i++) {
+                    delete faces[j][i];
+                }
+            }
+            // The cubemap belongs to the receiver's source
         }
         StereoCubemap* cubemap_;
         CubemapPixelData* faces[StereoCubemap::MAX_EYES_COUNT][Cubemap::MAX_FACES_COUNT];
+        int leases_; // guarded by the source's mutex
     };
 
 
@@ -104,6 +80,7 @@ public:
         }
         source_ = CubemapSource::createFromRTSP(url, flags.buffer_size, avpf);
         cached_frame_ = 0;
+        has_new_frame_ = false;
         
 		std::function<StereoCubemap* (CubemapSource*, StereoCubemap*)> callback = boost::bind(&CubemapVideoSource::onNextCubemap,
                                                                                               this,
@@ -114,13 +91,23 @@ public:
 
 	StereoCubemap* onNextCubemap(CubemapSource* source, StereoCubemap* cubemap)
     {
-        CubemapStereoFrame* new_frame_ = new CubemapStereoFrame(cubemap);
-        
-        lockFrame();
-        if(cached_frame_) delete cached_frame_;
-        cached_frame_ = new_frame_;
-        unlockFrame();
-		return nullptr;
+        boost::mutex::scoped_lock lock(mutex);
+
+        CubemapStereoFrame*& frame = frames_[cubemap];
+        if(!frame) frame = new CubemapStereoFrame(cubemap);
+
+        // The previous frame can be refilled unless somebody holds it
+        if(cached_frame_ && cached_frame_->leases_ == 0) {
+            free_frames_.push_back(cached_frame_);
+        }
+        cached_frame_ = frame;
+        has_new_frame_ = true;
+
+        // Without a free frame the receiver creates a new cubemap
+        if(free_frames_.empty()) return nullptr;
+        CubemapStereoFrame* free_frame = free_frames_.front();
+        free_frames_.pop_front();
+		return free_frame->cubemap_;
     }
     
     virtual Frame* getCurrentFrame() {
@@ -134,23 +121,38 @@ public:
     }
     virtual bool nextFrame() {
         lockFrame();
-        bool result;
-        if (cached_frame_) {
-            result = true;
-        }
-        else {
-            result = false;
-        }
+        bool result = has_new_frame_;
+        has_new_frame_ = false;
         unlockFrame();
 
         return result;
     }
 
+    virtual Frame* leaseCurrentFrame() {
+        boost::mutex::scoped_lock lock(mutex);
+        if(cached_frame_) cached_frame_->leases_++;
+        return cached_frame_;
+    }
+    virtual void releaseFrame(Frame* frame) {
+        boost::mutex::scoped_lock lock(mutex);
+        CubemapStereoFrame* cubemap_frame = (CubemapStereoFrame*)frame;
+        cubemap_frame->leases_--;
+        if(cubemap_frame->leases_ == 0 && cubemap_frame != cached_frame_) {
+            free_frames_.push_back(cubemap_frame);
+        }
+    }
+
     ~CubemapVideoSource() {
         CubemapSource::destroy(source_);
+        for(auto& frame : frames_) {
+            delete frame.second;
+        }
     }
 
     CubemapStereoFrame* cached_frame_;
+    bool has_new_frame_;
+    std::map<StereoCubemap*, CubemapStereoFrame*> frames_; // every frame ever created
+    std::deque<CubemapStereoFrame*> free_frames_;          // neither current, leased nor being filled
     CubemapSource* source_;
 
     boost::mutex mutex;
@@ -163,3 +165,7 @@ VideoSource::PixelData::~PixelData() { }
 VideoSource* VideoSource::CreateFromRTSP(const char* url, const CreateFlags& flags) {
     return new CubemapVideoSource(url, flags);
 }
+
+void VideoSource::Destroy(VideoSource* source) {
+    delete source;
+}
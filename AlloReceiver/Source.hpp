@@ -34,12 +34,21 @@ public:
 
     // Get the current frame.
     // If there's currently no frame, this returns null.
+    // Only valid between lockFrame() and unlockFrame().
     virtual Frame* getCurrentFrame() = 0;
     // Move to the next frame, return true if frame updated.
     virtual bool nextFrame() = 0;
     virtual void lockFrame() = 0;
     virtual void unlockFrame() = 0;
 
+    // Lease the current frame. It and its pixels stay valid and unchanged until
+    // the lease is released; the source recycles frames nobody holds.
+    // Every leased frame holds a decoded picture of each face, so keep leases short.
+    // If there's currently no frame, this returns null. Thread-safe.
+    virtual Frame* leaseCurrentFrame() = 0;
+    // Release a lease from leaseCurrentFrame(). Thread-safe.
+    virtual void releaseFrame(Frame* frame) = 0;
+
     struct CreateFlags {
         int resolution;
         PixelFormat pixel_format;
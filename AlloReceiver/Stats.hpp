@@ -5,12 +5,19 @@
 #include <boost/accumulators/statistics/min.hpp>
 #include <boost/accumulators/statistics/mean.hpp>
 #include <boost/any.hpp>
+#include <limits>
 
 #include "AlloShared/StatsUtils.hpp"
 
 namespace AlloReceiver
 {
 	const int FACE_COUNT = 12;
+    
+    // Upper bounds of the decoding time histogram's bins in ms. The last bin has no upper bound.
+    const std::vector<double> DECODING_TIME_BINS = {2.0, 4.0, 8.0, 16.0, 33.0};
+    
+    // Servers whose skew is listed when the faces come from several servers
+    const int LISTED_SERVERS_COUNT = 4;
 
 	Stats::StatValsMaker statValsMaker = [](boost::chrono::microseconds             window,
 	                                        boost::chrono::steady_clock::time_point now)
@@ -21,7 +28,257 @@ namespace AlloReceiver
 		{
 			StatsUtils::cubemapsCount("cubemapsCount",
 			window,
-			now)/*,
+			now),
+            Stats::StatVal::makeStatVal(StatsUtils::andFilter(
+                {
+                    StatsUtils::timeFilter(window,
+                                           now),
+                    StatsUtils::typeFilter(typeid(StatsUtils::CollectedFrame))
+                }),
+                [](Stats::TimeValueDatum datum)
+                {
+                    return boost::any_cast<StatsUtils::CollectedFrame>(datum.value).latency.count() / 1000.0;
+                },
+                boost::accumulators::tag::mean(),
+                "frameCollectionLatencyMean"),
+            Stats::StatVal::makeStatVal(StatsUtils::andFilter(
+                {
+                    StatsUtils::timeFilter(window,
+                                           now),
+                    StatsUtils::typeFilter(typeid(StatsUtils::CollectedFrame))
+                }),
+                [](Stats::TimeValueDatum datum)
+                {
+                    return boost::any_cast<StatsUtils::CollectedFrame>(datum.value).latency.count() / 1000.0;
+                },
+                boost::accumulators::tag::max(),
+                "frameCollectionLatencyMax"),
+            Stats::StatVal::makeStatVal(StatsUtils::andFilter(
+                {
+                    StatsUtils::timeFilter(window,
+                                           now),
+                    StatsUtils::typeFilter(typeid(StatsUtils::CollectorIdle))
+                }),
+                [](Stats::TimeValueDatum datum)
+                {
+                    return boost::any_cast<StatsUtils::CollectorIdle>(datum.value).duration.count() / 1000000.0;
+                },
+                boost::accumulators::tag::sum(),
+                "collectorIdleSum"),
+            Stats::StatVal::makeStatVal(StatsUtils::andFilter(
+                {
+                    StatsUtils::timeFilter(window,
+                                           now),
+                    StatsUtils::typeFilter(typeid(StatsUtils::ReleasedCubemap)),
+                    [](Stats::TimeValueDatum datum)
+                    {
+                        return boost::any_cast<StatsUtils::ReleasedCubemap>(datum.value).status == StatsUtils::ReleasedCubemap::COMPLETE;
+                    }
+                }),
+                [](Stats::TimeValueDatum datum)
+                {
+                    return 0.0;
+                },
+                boost::accumulators::tag::count(),
+                "completeCubemapsCount"),
+            Stats::StatVal::makeStatVal(StatsUtils::andFilter(
+                {
+                    StatsUtils::timeFilter(window,
+                                           now),
+                    StatsUtils::typeFilter(typeid(StatsUtils::ReleasedCubemap)),
+                    [](Stats::TimeValueDatum datum)
+                    {
+                        return boost::any_cast<StatsUtils::ReleasedCubemap>(datum.value).status == StatsUtils::ReleasedCubemap::PARTIAL;
+                    }
+                }),
+                [](Stats::TimeValueDatum datum)
+                {
+                    return 0.0;
+                },
+                boost::accumulators::tag::count(),
+                "partialCubemapsCount"),
+            Stats::StatVal::makeStatVal(StatsUtils::andFilter(
+                {
+                    StatsUtils::timeFilter(window,
+                                           now),
+                    StatsUtils::typeFilter(typeid(StatsUtils::ReleasedCubemap)),
+                    [](Stats::TimeValueDatum datum)
+                    {
+                        return boost::any_cast<StatsUtils::ReleasedCubemap>(datum.value).status == StatsUtils::ReleasedCubemap::DROPPED;
+                    }
+                }),
+                [](Stats::TimeValueDatum datum)
+                {
+                    return 0.0;
+                },
+                boost::accumulators::tag::count(),
+                "droppedCubemapsCount"),
+            Stats::StatVal::makeStatVal(StatsUtils::andFilter(
+                {
+                    StatsUtils::timeFilter(window,
+                                           now),
+                    StatsUtils::typeFilter(typeid(StatsUtils::LateFrame))
+                }),
+                [](Stats::TimeValueDatum datum)
+                {
+                    return 0.0;
+                },
+                boost::accumulators::tag::count(),
+                "lateFramesCount"),
+            Stats::StatVal::makeStatVal(StatsUtils::andFilter(
+                {
+                    StatsUtils::timeFilter(window,
+                                           now),
+                    StatsUtils::typeFilter(typeid(StatsUtils::DroppedFrame))
+                }),
+                [](Stats::TimeValueDatum datum)
+                {
+                    return 0.0;
+                },
+                boost::accumulators::tag::count(),
+                "droppedFramesCount"),
+            Stats::StatVal::makeStatVal(StatsUtils::andFilter(
+                {
+                    StatsUtils::timeFilter(window,
+                                           now),
+                    StatsUtils::typeFilter(typeid(StatsUtils::DegradationLevelChange)),
+                    [](Stats::TimeValueDatum datum)
+                    {
+                        StatsUtils::DegradationLevelChange change = boost::any_cast<StatsUtils::DegradationLevelChange>(datum.value);
+                        return change.newLevel > change.oldLevel;
+                    }
+                }),
+                [](Stats::TimeValueDatum datum)
+                {
+                    return 0.0;
+                },
+                boost::accumulators::tag::count(),
+                "degradationStepsCount"),
+            Stats::StatVal::makeStatVal(StatsUtils::andFilter(
+                {
+                    StatsUtils::timeFilter(window,
+                                           now),
+                    StatsUtils::typeFilter(typeid(StatsUtils::DegradationLevelChange)),
+                    [](Stats::TimeValueDatum datum)
+                    {
+                        StatsUtils::DegradationLevelChange change = boost::any_cast<StatsUtils::DegradationLevelChange>(datum.value);
+                        return change.newLevel < change.oldLevel;
+                    }
+                }),
+                [](Stats::TimeValueDatum datum)
+                {
+                    return 0.0;
+                },
+                boost::accumulators::tag::count(),
+                "restorationStepsCount"),
+            Stats::StatVal::makeStatVal(StatsUtils::andFilter(
+                {
+                    StatsUtils::timeFilter(window,
+                                           now),
+                    StatsUtils::typeFilter(typeid(StatsUtils::DegradationLevelChange))
+                }),
+                [](Stats::TimeValueDatum datum)
+                {
+                    return (double)boost::any_cast<StatsUtils::DegradationLevelChange>(datum.value).newLevel;
+                },
+                boost::accumulators::tag::max(),
+                "maxDegradationLevel"),
+            Stats::StatVal::makeStatVal(StatsUtils::andFilter(
+                {
+                    StatsUtils::timeFilter(window,
+                                           now),
+                    StatsUtils::typeFilter(typeid(StatsUtils::Recovery))
+                }),
+                [](Stats::TimeValueDatum datum)
+                {
+                    return 0.0;
+                },
+                boost::accumulators::tag::count(),
+                "recoveriesCount"),
+            Stats::StatVal::makeStatVal(StatsUtils::andFilter(
+                {
+                    StatsUtils::timeFilter(window,
+                                           now),
+                    StatsUtils::typeFilter(typeid(StatsUtils::Recovery))
+                }),
+                [](Stats::TimeValueDatum datum)
+                {
+                    return boost::any_cast<StatsUtils::Recovery>(datum.value).timeToPicture.count() / 1000.0;
+                },
+                boost::accumulators::tag::max(),
+                "timeToPictureMax"),
+            Stats::StatVal::makeStatVal(StatsUtils::andFilter(
+                {
+                    StatsUtils::timeFilter(window,
+                                           now),
+                    StatsUtils::typeFilter(typeid(StatsUtils::PresentationSkew))
+                }),
+                [](Stats::TimeValueDatum datum)
+                {
+                    return boost::any_cast<StatsUtils::PresentationSkew>(datum.value).skew.count() / 1000.0;
+                },
+                boost::accumulators::tag::mean(),
+                "presentationSkewMean"),
+            Stats::StatVal::makeStatVal(StatsUtils::andFilter(
+                {
+                    StatsUtils::timeFilter(window,
+                                           now),
+                    StatsUtils::typeFilter(typeid(StatsUtils::PresentationSkew))
+                }),
+                [](Stats::TimeValueDatum datum)
+                {
+                    return boost::any_cast<StatsUtils::PresentationSkew>(datum.value).skew.count() / 1000.0;
+                },
+                boost::accumulators::tag::max(),
+                "presentationSkewMax"),
+            Stats::StatVal::makeStatVal(StatsUtils::andFilter(
+                {
+                    StatsUtils::timeFilter(window,
+                                           now),
+                    StatsUtils::typeFilter(typeid(StatsUtils::CubemapLatency))
+                }),
+                [](Stats::TimeValueDatum datum)
+                {
+                    return boost::any_cast<StatsUtils::CubemapLatency>(datum.value).latency.count() / 1000.0;
+                },
+                boost::accumulators::tag::mean(),
+                "cubemapLatencyMean"),
+            Stats::StatVal::makeStatVal(StatsUtils::andFilter(
+                {
+                    StatsUtils::timeFilter(window,
+                                           now),
+                    StatsUtils::typeFilter(typeid(StatsUtils::CubemapLatency))
+                }),
+                [](Stats::TimeValueDatum datum)
+                {
+                    return boost::any_cast<StatsUtils::CubemapLatency>(datum.value).latency.count() / 1000.0;
+                },
+                boost::accumulators::tag::max(),
+                "cubemapLatencyMax"),
+            Stats::StatVal::makeStatVal(StatsUtils::andFilter(
+                {
+                    StatsUtils::timeFilter(window,
+                                           now),
+                    StatsUtils::typeFilter(typeid(StatsUtils::TextureUpload))
+                }),
+                [](Stats::TimeValueDatum datum)
+                {
+                    return boost::any_cast<StatsUtils::TextureUpload>(datum.value).duration.count() / 1000.0;
+                },
+                boost::accumulators::tag::mean(),
+                "textureUploadTimeMean"),
+            Stats::StatVal::makeStatVal(StatsUtils::andFilter(
+                {
+                    StatsUtils::timeFilter(window,
+                                           now),
+                    StatsUtils::typeFilter(typeid(StatsUtils::TextureUpload))
+                }),
+                [](Stats::TimeValueDatum datum)
+                {
+                    return boost::any_cast<StatsUtils::TextureUpload>(datum.value).duration.count() / 1000.0;
+                },
+                boost::accumulators::tag::max(),
+                "textureUploadTimeMax")/*,
 			StatsUtils::nalusBitSum("droppedNALUsBitSum",
 			-1,
 			StatsUtils::NALU::DROPPED,
@@ -158,6 +415,89 @@ namespace AlloReceiver
 				now)*/
 			});
 		}
+        
+        for (int face = 0; face < FACE_COUNT; face++)
+        {
+            std::string faceStr = std::to_string(face);
+            auto faceFilter = StatsUtils::andFilter(
+                {
+                    StatsUtils::timeFilter(window,
+                                           now),
+                    StatsUtils::typeFilter(typeid(StatsUtils::DecodingTime)),
+                    [face](Stats::TimeValueDatum datum)
+                    {
+                        return boost::any_cast<StatsUtils::DecodingTime>(datum.value).face == face;
+                    }
+                });
+            auto durationAccessor = [](Stats::TimeValueDatum datum)
+            {
+                return boost::any_cast<StatsUtils::DecodingTime>(datum.value).duration.count() / 1000.0;
+            };
+            
+            statVals.insert(statVals.end(),
+            {
+                Stats::StatVal::makeStatVal(faceFilter,
+                    durationAccessor,
+                    boost::accumulators::tag::mean(),
+                    "decodingTimeMean" + faceStr),
+                Stats::StatVal::makeStatVal(faceFilter,
+                    durationAccessor,
+                    boost::accumulators::tag::max(),
+                    "decodingTimeMax" + faceStr)
+            });
+            
+            for (int bin = 0; bin <= DECODING_TIME_BINS.size(); bin++)
+            {
+                double lowerBound = (bin > 0) ? DECODING_TIME_BINS[bin - 1] : 0.0;
+                double upperBound = (bin < DECODING_TIME_BINS.size()) ? DECODING_TIME_BINS[bin] : std::numeric_limits<double>::infinity();
+                statVals.push_back(Stats::StatVal::makeStatVal(StatsUtils::andFilter(
+                    {
+                        faceFilter,
+                        [durationAccessor, lowerBound, upperBound](Stats::TimeValueDatum datum)
+                        {
+                            double duration = durationAccessor(datum);
+                            return duration >= lowerBound && duration < upperBound;
+                        }
+                    }),
+                    [](Stats::TimeValueDatum datum)
+                    {
+                        return 0.0;
+                    },
+                    boost::accumulators::tag::count(),
+                    "decodingTimeBin" + faceStr + "_" + std::to_string(bin)));
+            }
+        }
+        
+        for (int server = 0; server < LISTED_SERVERS_COUNT; server++)
+        {
+            std::string serverStr = std::to_string(server);
+            auto serverFilter = StatsUtils::andFilter(
+                {
+                    StatsUtils::timeFilter(window,
+                                           now),
+                    StatsUtils::typeFilter(typeid(StatsUtils::ServerSkew)),
+                    [server](Stats::TimeValueDatum datum)
+                    {
+                        return boost::any_cast<StatsUtils::ServerSkew>(datum.value).server == server;
+                    }
+                });
+            auto skewAccessor = [](Stats::TimeValueDatum datum)
+            {
+                return boost::any_cast<StatsUtils::ServerSkew>(datum.value).skew.count() / 1000.0;
+            };
+            
+            statVals.insert(statVals.end(),
+            {
+                Stats::StatVal::makeStatVal(serverFilter,
+                    skewAccessor,
+                    boost::accumulators::tag::mean(),
+                    "serverSkewMean" + serverStr),
+                Stats::StatVal::makeStatVal(serverFilter,
+                    skewAccessor,
+                    boost::accumulators::tag::max(),
+                    "serverSkewMax" + serverStr)
+            });
+        }
 
 		return statVals;
 	};
@@ -170,6 +510,12 @@ namespace AlloReceiver
 			unsigned long seconds = boost::chrono::duration_cast<boost::chrono::seconds>(window).count();
 
 			results["fps"] = results["cubemapsCount"] / seconds;
+			results["collectorIdlePercent"] = results["collectorIdleSum"] / seconds * 100.0;
+			results["completeCubemapsPS"] = results["completeCubemapsCount"] / seconds;
+			results["partialCubemapsPS"]  = results["partialCubemapsCount"]  / seconds;
+			results["droppedCubemapsPS"]  = results["droppedCubemapsCount"]  / seconds;
+			results["lateFramesPS"]       = results["lateFramesCount"]       / seconds;
+			results["droppedFramesPS"]    = results["droppedFramesCount"]    / seconds;
 
 			//results.insert(
 			//{
@@ -309,6 +655,31 @@ namespace AlloReceiver
             stream << ";" << std::endl;
         }
         
+        stream << "-------------------------------------------------------------------------------" << std::endl;
+        stream << "Decoding time in ms (avg, max and frames per bin):" << std::endl;
+        stream << "face\tavg\tmax";
+        for (int bin = 0; bin <= DECODING_TIME_BINS.size(); bin++)
+        {
+            if (bin < DECODING_TIME_BINS.size())
+            {
+                stream << "\t<" << DECODING_TIME_BINS[bin];
+            }
+            else
+            {
+                stream << "\t>=" << DECODING_TIME_BINS.back();
+            }
+        }
+        stream << std::endl;
+        for (int face = 0; face < FACE_COUNT; face++)
+        {
+            stream << face << ":\t{decodingTimeMean" << face << ":0.2f}\t{decodingTimeMax" << face << ":0.2f}";
+            for (int bin = 0; bin <= DECODING_TIME_BINS.size(); bin++)
+            {
+                stream << "\t{decodingTimeBin" << face << "_" << bin << ":0.0f}";
+            }
+            stream << std::endl;
+        }
+        
         stream << "-------------------------------------------------------------------------------" << std::endl;
         stream << "Color converted frames/s:" << std::endl;
         for (int j = 0; j < (std::min) (2, FACE_COUNT); j++)
@@ -367,6 +738,19 @@ namespace AlloReceiver
         }
         stream << ";" << std::endl;
         stream << "fps: {fps:0.1f}" << std::endl;
+        stream << "frame collection latency: avg {frameCollectionLatencyMean:0.2f} ms; max {frameCollectionLatencyMax:0.2f} ms; collector idle: {collectorIdlePercent:0.1f}%" << std::endl;
+        stream << "released cubemaps/s: complete {completeCubemapsPS:0.1f}; partial {partialCubemapsPS:0.1f}; dropped {droppedCubemapsPS:0.1f}; late frames/s: {lateFramesPS:0.1f}; dropped frames/s: {droppedFramesPS:0.1f}" << std::endl;
+        stream << "decoding quality: degraded {degradationStepsCount:0.0f} steps; restored {restorationStepsCount:0.0f} steps; max level {maxDegradationLevel:0.0f}" << std::endl;
+        stream << "stream recoveries: {recoveriesCount:0.0f}; time to picture: max {timeToPictureMax:0.1f} ms" << std::endl;
+        stream << "presentation skew: avg {presentationSkewMean:0.2f} ms; max {presentationSkewMax:0.2f} ms" << std::endl;
+        stream << "cubemap latency: avg {cubemapLatencyMean:0.2f} ms; max {cubemapLatencyMax:0.2f} ms" << std::endl;
+        stream << "server skew in ms (avg/max):";
+        for (int server = 0; server < LISTED_SERVERS_COUNT; server++)
+        {
+            stream << "\t" << server << ": {serverSkewMean" << server << ":0.2f}/{serverSkewMax" << server << ":0.2f}";
+        }
+        stream << std::endl;
+        stream << "texture upload per frame: avg {textureUploadTimeMean:0.2f} ms; max {textureUploadTimeMax:0.2f} ms" << std::endl;
 
 		return stream.str();
 	};
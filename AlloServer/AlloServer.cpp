@@ -1,3 +1,4 @@
+#include <iomanip>
 #include <boost/interprocess/managed_shared_memory.hpp>
 #include <boost/filesystem/path.hpp>
 #include <boost/program_options.hpp>
@@ -25,14 +26,32 @@ extern "C"
 #include "AlloServer.h"
 #include "AlloReceiver/Stats.hpp"
 #include "DiscreteFlowControlFilter.hpp"
+#include "RTPRetransmitter.hpp"
+#include "BitRateController.hpp"
+#include "MulticastServerMediaSubsession.hpp"
+#include "H264AccessUnitFramer.hpp"
 
 static Stats stats;
 
 struct FrameStreamState
 {
-    RTPSink*      sink;
-    Frame*        content;
-    FramedSource* source;
+    RTPSink*           sink;
+    Frame*             content;
+    FramedSource*      source;
+    H264NALUSource*    naluSource;
+    RTCPInstance*      rtcpInstance;
+    RTPRetransmitter*  retransmitter;
+    BitRateController* bitRateController;
+    int                interfaceIndex;
+    unsigned           lastRequestedPacketsCount;
+    unsigned           lastRetransmittedPacketsCount;
+    unsigned           lastKeyframeRequestsCount;
+    unsigned           lastForcedKeyframesCount;
+    uint64_t           lastSentBytesCount;
+    // state of the last bit rate update
+    unsigned           lastControlSentPacketsCount;
+    unsigned           lastControlRequestedPacketsCount;
+    struct timeval     lastControlTime;
 };
 
 static UsageEnvironment* env;
@@ -44,9 +63,17 @@ static boost::interprocess::managed_shared_memory* shm;
 static boost::barrier stopStreamingBarrier(3);
 static boost::uint16_t rtspPort;
 static int avgBitRate;
+static int facesPerGroup;
+static std::vector<netAddressBits> interfaceAddresses;
+static std::vector<double> measuredFaceBitRates; // bit/s of every face measured during the last stats interval
+static bool adaptiveBitRate = false;
+static int minBitRate;
+static int maxBitRate;
 
 static size_t bufferSize = 2000000000;
 static bool robustSyncing = false;
+static size_t statsInterval;
+static unsigned char CNAME[101];
 
 // Cubemap related
 static StereoCubemap*                cubemap;
@@ -82,8 +109,55 @@ void onEncodedFrame(H264NALUSource*, int eye, int face)
 	stats.store(StatsUtils::CubemapFace(eye * 6 + face, StatsUtils::CubemapFace::DISPLAYED));
 }
 
+// Faces are spread over consecutive multicast groups starting at destinationAddress
+// so that receivers only have to join the groups of the faces they render.
+static struct in_addr faceGroupAddress(int faceIndex)
+{
+    struct in_addr address;
+    address.s_addr = htonl(ntohl(destinationAddress.s_addr) + faceIndex / facesPerGroup);
+    return address;
+}
+
+// Distributes the faces over the network interfaces so that every interface carries
+// about the same bit rate (largest face first onto the least loaded interface).
+// Uses the bit rates measured while the faces were last streamed.
+static std::vector<int> assignFacesToInterfaces(int facesCount)
+{
+    std::vector<int> faceInterfaces(facesCount, 0);
+    measuredFaceBitRates.resize(facesCount, avgBitRate);
+
+    std::vector<int> faces(facesCount);
+    for (int i = 0; i < facesCount; i++)
+    {
+        faces[i] = i;
+    }
+    std::stable_sort(faces.begin(), faces.end(), [](int a, int b)
+    {
+        return measuredFaceBitRates[a] > measuredFaceBitRates[b];
+    });
+
+    std::vector<double> interfaceLoads(interfaceAddresses.size(), 0.0);
+    for (int face : faces)
+    {
+        int interfaceIndex = std::min_element(interfaceLoads.begin(), interfaceLoads.end()) - interfaceLoads.begin();
+        faceInterfaces[face] = interfaceIndex;
+        interfaceLoads[interfaceIndex] += measuredFaceBitRates[face];
+    }
+
+    return faceInterfaces;
+}
+
+static std::string interfaceAddressString(int interfaceIndex)
+{
+    char interfaceAddressStr[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &(interfaceAddresses[interfaceIndex]), interfaceAddressStr, sizeof(interfaceAddressStr));
+    return interfaceAddressStr;
+}
+
 void addFaceSubstreams0(void*)
 {
+	std::vector<int> faceInterfaces = assignFacesToInterfaces(cubemap->getEyesCount() * cubemap->getEye(0)->getFacesCount());
+
 	int portCounter = 0;
 	for (int j = 0; j < cubemap->getEyesCount(); j++)
 	{
@@ -96,9 +170,20 @@ void addFaceSubstreams0(void*)
 
 			state->content = eye->getFace(i)->getContent();
 
+			struct in_addr groupAddress = faceGroupAddress(j * eye->getFacesCount() + i);
 			Port rtpPort(FACE0_RTP_PORT_NUM + portCounter);
+			Port rtcpPort(FACE0_RTP_PORT_NUM + portCounter + 1);
 			portCounter += 2;
-			Groupsock* rtpGroupsock = new Groupsock(*env, destinationAddress, rtpPort, TTL);
+
+			// live555 sends from and joins on the interface in these globals when a groupsock is created
+			state->interfaceIndex = faceInterfaces[j * eye->getFacesCount() + i];
+			netAddressBits defaultInterfaceAddress = ReceivingInterfaceAddr;
+			SendingInterfaceAddr   = interfaceAddresses[state->interfaceIndex];
+			ReceivingInterfaceAddr = interfaceAddresses[state->interfaceIndex];
+			Groupsock* rtpGroupsock = new Groupsock(*env, groupAddress, rtpPort, TTL);
+			Groupsock* rtcpGroupsock = new Groupsock(*env, groupAddress, rtcpPort, TTL);
+			SendingInterfaceAddr   = defaultInterfaceAddress;
+			ReceivingInterfaceAddr = defaultInterfaceAddress;
 			//rtpGroupsock->multicastSendOnly(); // we're a SSM source
 
 			setReceiveBufferTo(*env, rtpGroupsock->socketNum(), bufferSize);
@@ -106,7 +191,36 @@ void addFaceSubstreams0(void*)
 			// Create a 'H264 Video RTP' sink from the RTP 'groupsock':
 			state->sink = H264VideoRTPSink::createNew(*env, rtpGroupsock, 96);
 
-			ServerMediaSubsession* subsession = PassiveServerMediaSubsession::createNew(*state->sink);
+			// RTCP is needed for receiving NACKs
+			state->rtcpInstance = RTCPInstance::createNew(*env,
+				                                          rtcpGroupsock,
+				                                          avgBitRate / 1000,
+				                                          CNAME,
+				                                          state->sink,
+				                                          NULL);
+
+			state->retransmitter = RTPRetransmitter::createNew(*env,
+				                                               state->sink,
+				                                               rtpGroupsock,
+				                                               state->rtcpInstance,
+				                                               RTP_PACKET_HISTORY_SIZE);
+			state->lastRequestedPacketsCount     = 0;
+			state->lastRetransmittedPacketsCount = 0;
+			state->lastKeyframeRequestsCount     = 0;
+			state->lastForcedKeyframesCount      = 0;
+			state->lastSentBytesCount            = 0;
+
+			state->bitRateController = new BitRateController(avgBitRate,
+				                                             minBitRate,
+				                                             maxBitRate,
+				                                             BITRATE_HISTORY_SIZE);
+			state->lastControlSentPacketsCount      = 0;
+			state->lastControlRequestedPacketsCount = 0;
+			gettimeofday(&state->lastControlTime, NULL);
+
+			ServerMediaSubsession* subsession = MulticastServerMediaSubsession::createNew(*state->sink,
+				                                                                          state->rtcpInstance,
+				                                                                          state->interfaceIndex);
 
 			cubemapSMS->addSubsession(subsession);
 
@@ -118,16 +232,24 @@ void addFaceSubstreams0(void*)
 			source->setOnSentNALU    (boost::bind(&onSentNALU,     _1, _2, _3, j, i));
 			source->setOnEncodedFrame(boost::bind(&onEncodedFrame, _1, j, i));
 
+			// Only this face's encoder has to emit an IDR frame
+			state->naluSource = source;
+			state->retransmitter->setOnRequestedKeyframe(boost::bind(&H264NALUSource::requestKeyframe, source));
+
 			DiscreteFlowControlFilter* flowControlFilter = DiscreteFlowControlFilter::createNew(*env,
 				                                                                                source,
 																								bandwidth);
 
-			state->source = H264VideoStreamDiscreteFramer::createNew(*env,
-				flowControlFilter);
+			state->source = H264AccessUnitFramer::createNew(*env,
+			                                                flowControlFilter,
+			                                                source);
 
 			state->sink->startPlaying(*state->source, NULL, NULL);
 
-			std::cout << "Streaming face " << i << " (" << ((j == 0) ? "left" : "right") << ") on port " << ntohs(rtpPort.num()) << " ..." << std::endl;
+			char groupAddressStr[INET_ADDRSTRLEN];
+			inet_ntop(AF_INET, &(groupAddress.s_addr), groupAddressStr, sizeof(groupAddressStr));
+			std::cout << "Streaming face " << i << " (" << ((j == 0) ? "left" : "right") << ") to " << groupAddressStr << " on port " << ntohs(rtpPort.num()) <<
+				" from " << interfaceAddressString(state->interfaceIndex) << " ..." << std::endl;
 		}
 	}
     
@@ -143,8 +265,11 @@ void removeFaceSubstreams0(void*)
         {
             FrameStreamState stream = faceStreams[i];
             stream.sink->stopPlaying();
+            Medium::close(stream.retransmitter);
+            Medium::close(stream.rtcpInstance);
             Medium::close(stream.sink);
             Medium::close(stream.source);
+            delete stream.bitRateController;
             std::cout << "removed face " << i << std::endl;
         }
         faceStreams.clear();
@@ -198,6 +323,157 @@ void removeBinocularsSubstream0(void*)
     boost::thread(boost::bind(&boost::barrier::wait, &stopStreamingBarrier));
 }
 
+void periodicQOSMeasurement(void*)
+{
+    unsigned requestedPacketsInInterval     = 0;
+    unsigned retransmittedPacketsInInterval = 0;
+    unsigned keyframeRequestsInInterval     = 0;
+    unsigned forcedKeyframesInInterval      = 0;
+    for (FrameStreamState& state : faceStreams)
+    {
+        unsigned requestedPackets     = state.retransmitter->getRequestedPacketsCount();
+        unsigned retransmittedPackets = state.retransmitter->getRetransmittedPacketsCount();
+        unsigned keyframeRequests     = state.retransmitter->getKeyframeRequestsCount();
+        unsigned forcedKeyframes      = state.naluSource->getForcedKeyframesCount();
+        requestedPacketsInInterval     += requestedPackets     - state.lastRequestedPacketsCount;
+        retransmittedPacketsInInterval += retransmittedPackets - state.lastRetransmittedPacketsCount;
+        keyframeRequestsInInterval     += keyframeRequests     - state.lastKeyframeRequestsCount;
+        forcedKeyframesInInterval      += forcedKeyframes      - state.lastForcedKeyframesCount;
+        state.lastRequestedPacketsCount     = requestedPackets;
+        state.lastRetransmittedPacketsCount = retransmittedPackets;
+        state.lastKeyframeRequestsCount     = keyframeRequests;
+        state.lastForcedKeyframesCount      = forcedKeyframes;
+    }
+    
+    if (faceStreams.size() > 0)
+    {
+        std::vector<double>           interfaceBitRates(interfaceAddresses.size(), 0.0);
+        std::vector<std::vector<int> > interfaceFaces(interfaceAddresses.size());
+        for (int i = 0; i < faceStreams.size(); i++)
+        {
+            FrameStreamState& state = faceStreams[i];
+            uint64_t sentBytes = state.retransmitter->getSentBytesCount();
+            measuredFaceBitRates[i] = (sentBytes - state.lastSentBytesCount) * 8.0 / statsInterval;
+            state.lastSentBytesCount = sentBytes;
+
+            interfaceBitRates[state.interfaceIndex] += measuredFaceBitRates[i];
+            interfaceFaces[state.interfaceIndex].push_back(i);
+        }
+
+        for (int i = 0; i < interfaceAddresses.size(); i++)
+        {
+            std::cout << "Server: interface " << interfaceAddressString(i) << ": " <<
+                std::setprecision(1) << std::setiosflags(std::ios::fixed) <<
+                interfaceBitRates[i] / 1000000.0 << " MBit/s (faces:";
+            for (int face : interfaceFaces[i])
+            {
+                std::cout << " " << face;
+            }
+            std::cout << ")" << std::endl;
+        }
+    }
+
+    if (faceStreams.size() > 0 && adaptiveBitRate)
+    {
+        size_t samplesCount = (std::max)((size_t)1, statsInterval * 1000 / BITRATE_CONTROL_INTERVAL);
+        for (int i = 0; i < faceStreams.size(); i++)
+        {
+            const std::deque<BitRateController::Sample>& history = faceStreams[i].bitRateController->getHistory();
+            if (history.empty())
+            {
+                continue;
+            }
+
+            // Loss and jitter since the last measurement, bit rate range over the whole history
+            double lossRatio = 0.0;
+            double jitter    = 0.0;
+            size_t count     = (std::min)(samplesCount, history.size());
+            for (size_t k = history.size() - count; k < history.size(); k++)
+            {
+                lossRatio += history[k].lossRatio / count;
+                jitter    += history[k].jitter    / count;
+            }
+
+            int lowestBitRate  = history.front().bitRate;
+            int highestBitRate = history.front().bitRate;
+            for (const BitRateController::Sample& sample : history)
+            {
+                lowestBitRate  = (std::min)(lowestBitRate,  sample.bitRate);
+                highestBitRate = (std::max)(highestBitRate, sample.bitRate);
+            }
+
+            std::cout << "Server: face " << i % 6 << " (" << ((i < 6) ? "left" : "right") << "): " <<
+                std::setprecision(1) << std::setiosflags(std::ios::fixed) <<
+                faceStreams[i].bitRateController->getBitRate() / 1000000.0 << " MBit/s" <<
+                " (" << lowestBitRate / 1000000.0 << "-" << highestBitRate / 1000000.0 << " MBit/s over last " <<
+                history.size() * BITRATE_CONTROL_INTERVAL / 1000 << " s)" <<
+                "; loss: " << std::setprecision(2) << lossRatio * 100.0 << "%" <<
+                "; jitter: " << std::setprecision(1) << jitter << " ms" << std::endl;
+        }
+    }
+
+    if (faceStreams.size() > 0)
+    {
+        std::cout << "Server: retransmission requests: " << requestedPacketsInInterval <<
+            "; retransmitted packets: " << retransmittedPacketsInInterval <<
+            " (" << std::setprecision(1) << std::setiosflags(std::ios::fixed) <<
+            (double)retransmittedPacketsInInterval / statsInterval << " packets/s)" <<
+            "; keyframe requests: " << keyframeRequestsInInterval <<
+            "; forced IDR frames: " << forcedKeyframesInInterval << std::endl;
+    }
+    
+    env->taskScheduler().scheduleDelayedTask(statsInterval * 1000000, (TaskFunc*)periodicQOSMeasurement, NULL);
+}
+
+void periodicBitRateControl(void*)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    for (FrameStreamState& state : faceStreams)
+    {
+        RTPTransmissionStatsDB& transmissionStatsDB = state.sink->transmissionStatsDB();
+        if (transmissionStatsDB.numReceivers() == 0)
+        {
+            // Nobody is watching -> nothing to adapt to
+            continue;
+        }
+
+        // Receiver reports are only sent every few seconds.
+        // Their loss is taken into account once, their jitter until the next report arrives.
+        double rrLossRatio = 0.0;
+        double jitter      = 0.0;
+        RTPTransmissionStatsDB::Iterator iter(transmissionStatsDB);
+        while (RTPTransmissionStats* receiverStats = iter.next())
+        {
+            struct timeval rrTime = receiverStats->lastTimeReceived();
+            if (rrTime.tv_sec > state.lastControlTime.tv_sec ||
+                (rrTime.tv_sec == state.lastControlTime.tv_sec && rrTime.tv_usec > state.lastControlTime.tv_usec))
+            {
+                rrLossRatio = (std::max)(rrLossRatio, receiverStats->packetLossRatio() / 256.0);
+            }
+            jitter = (std::max)(jitter, receiverStats->jitter() * 1000.0 / state.sink->rtpTimestampFrequency());
+        }
+
+        // NACKs show the loss before it was repaired and arrive much faster than receiver reports
+        unsigned sentPackets      = state.retransmitter->getSentPacketsCount();
+        unsigned requestedPackets = state.retransmitter->getRequestedPacketsCount();
+        unsigned sentPacketsInInterval      = sentPackets      - state.lastControlSentPacketsCount;
+        unsigned requestedPacketsInInterval = requestedPackets - state.lastControlRequestedPacketsCount;
+        double nackLossRatio = (sentPacketsInInterval > 0) ?
+            (std::min)(1.0, (double)requestedPacketsInInterval / sentPacketsInInterval) : 0.0;
+
+        state.lastControlSentPacketsCount      = sentPackets;
+        state.lastControlRequestedPacketsCount = requestedPackets;
+        state.lastControlTime                  = now;
+
+        int bitRate = state.bitRateController->update((std::max)(rrLossRatio, nackLossRatio), jitter);
+        state.naluSource->setAvgBitRate(bitRate);
+    }
+
+    env->taskScheduler().scheduleDelayedTask(BITRATE_CONTROL_INTERVAL * 1000, (TaskFunc*)periodicBitRateControl, NULL);
+}
+
 void networkLoop()
 {
     env->taskScheduler().doEventLoop(); // does not return
@@ -238,7 +514,7 @@ void setupRTSP()
                                                cubemapStreamName.c_str(),
                                                cubemapStreamName.c_str(),
                                                descriptionString,
-                                               True);
+                                               interfaceAddresses.size() <= 1); // the SSM source filter can only name one source address
     rtspServer->addServerMediaSession(cubemapSMS);
     
     binocularsSMS = ServerMediaSession::createNew(*env,
@@ -252,6 +528,16 @@ void setupRTSP()
     removeFaceSubstreamsTriggerId = env->taskScheduler().createEventTrigger(&removeFaceSubstreams0);
     addBinularsSubstreamTriggerId = env->taskScheduler().createEventTrigger(&addBinocularsSubstream0);
     removeBinularsSubstreamTriggerId = env->taskScheduler().createEventTrigger(&removeBinocularsSubstream0);
+
+    gethostname((char*)CNAME, sizeof(CNAME) - 1);
+    CNAME[sizeof(CNAME) - 1] = '\0';
+
+    env->taskScheduler().scheduleDelayedTask(statsInterval * 1000000, (TaskFunc*)periodicQOSMeasurement, NULL);
+
+    if (adaptiveBitRate)
+    {
+        env->taskScheduler().scheduleDelayedTask(BITRATE_CONTROL_INTERVAL * 1000, (TaskFunc*)periodicBitRateControl, NULL);
+    }
 }
 
 void startStreaming()
@@ -300,9 +586,13 @@ int main(int argc, char* argv[])
     boost::program_options::options_description desc("");
 	desc.add_options()
 		("multicast-address", boost::program_options::value<std::string>(),     "")
-		("interface",         boost::program_options::value<std::string>(),     "")
+		("faces-per-group",   boost::program_options::value<int>(),             "")
+		("interface",         boost::program_options::value<std::vector<std::string> >()->composing(), "")
 		("rtsp-port",         boost::program_options::value<boost::uint16_t>(), "")
 		("avg-bit-rate",      boost::program_options::value<int>(),             "")
+		("adaptive-bit-rate", "")
+		("min-bit-rate",      boost::program_options::value<int>(),             "")
+		("max-bit-rate",      boost::program_options::value<int>(),             "")
 		("buffer-size",       boost::program_options::value<size_t>(),          "")
 	    ("stats-interval",    boost::program_options::value<size_t>(),          "")
 		("robust-syncing",    "")
@@ -315,19 +605,28 @@ int main(int argc, char* argv[])
 
     if (vm.count("interface"))
     {
-        std::string interfaceAddress = vm["interface"].as<std::string>();
-        NetAddressList addresses(interfaceAddress.c_str());
-        if (addresses.numAddresses() == 0)
+        // Faces are striped over all given interfaces
+        for (const std::string& interfaceAddress : vm["interface"].as<std::vector<std::string> >())
         {
-            std::cout << "Failed to find network address for \"" << interfaceAddress << "\"" << std::endl;
-            return -1;
+            NetAddressList addresses(interfaceAddress.c_str());
+            if (addresses.numAddresses() == 0)
+            {
+                std::cout << "Failed to find network address for \"" << interfaceAddress << "\"" << std::endl;
+                return -1;
+            }
+            interfaceAddresses.push_back(*(unsigned*)(addresses.firstAddress()->data()));
         }
-        ReceivingInterfaceAddr = *(unsigned*)(addresses.firstAddress()->data());
+        ReceivingInterfaceAddr = interfaceAddresses[0];
+    }
+    else
+    {
+        interfaceAddresses.push_back(ReceivingInterfaceAddr);
     }
     
-    char sourceAddressStr[INET_ADDRSTRLEN];
-    inet_ntop(AF_INET, &(ReceivingInterfaceAddr), sourceAddressStr, sizeof(sourceAddressStr));
-    std::cout << "Using source address " << sourceAddressStr << std::endl;
+    for (int i = 0; i < interfaceAddresses.size(); i++)
+    {
+        std::cout << "Using source address " << interfaceAddressString(i) << std::endl;
+    }
     
     if (vm.count("rtsp-port"))
     {
@@ -349,6 +648,16 @@ int main(int argc, char* argv[])
         inet_pton(AF_INET, "224.0.67.67", &(destinationAddress.s_addr));
     }
 
+	if (vm.count("faces-per-group"))
+	{
+		facesPerGroup = (std::max)(1, vm["faces-per-group"].as<int>());
+	}
+	else
+	{
+		facesPerGroup = DEFAULT_FACES_PER_GROUP;
+	}
+	std::cout << "Using one multicast group per " << facesPerGroup << " face(s)" << std::endl;
+
 	if (vm.count("avg-bit-rate"))
 	{
 		avgBitRate = vm["avg-bit-rate"].as<int>();
@@ -360,6 +669,35 @@ int main(int argc, char* argv[])
     std::string bitRateString = to_human_readable_byte_count(avgBitRate, true, false);
 	std::cout << "Using an average encoding bit rate of " << bitRateString << "/s per face" << std::endl;
 
+	if (vm.count("adaptive-bit-rate"))
+	{
+		adaptiveBitRate = true;
+	}
+
+	if (vm.count("min-bit-rate"))
+	{
+		minBitRate = vm["min-bit-rate"].as<int>();
+	}
+	else
+	{
+		minBitRate = avgBitRate / 4;
+	}
+
+	if (vm.count("max-bit-rate"))
+	{
+		maxBitRate = vm["max-bit-rate"].as<int>();
+	}
+	else
+	{
+		maxBitRate = avgBitRate * 2;
+	}
+
+	if (adaptiveBitRate)
+	{
+		std::cout << "Adapting the bit rate between " << to_human_readable_byte_count(minBitRate, true, false) <<
+			"/s and " << to_human_readable_byte_count(maxBitRate, true, false) << "/s per face" << std::endl;
+	}
+
 	if (vm.count("buffer-size"))
 	{
 		bufferSize = vm["buffer-size"].as<size_t>();
@@ -371,7 +709,6 @@ int main(int argc, char* argv[])
 	std::string bufferSizeString = to_human_readable_byte_count(bufferSize, false, false);
 	std::cout << "Using a buffer size of " << bufferSizeString << std::endl;
 
-	size_t statsInterval;
 	if (vm.count("stats-interval"))
 	{
 		statsInterval = vm["stats-interval"].as<size_t>();
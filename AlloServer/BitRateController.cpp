@@ -0,0 +1,68 @@
+#include <algorithm>
+
+#include "config.h"
+#include "BitRateController.hpp"
+
+BitRateController::BitRateController(int    initialBitRate,
+                                     int    minBitRate,
+                                     int    maxBitRate,
+                                     size_t historySize)
+    :
+    bitRate((std::min)((std::max)(initialBitRate, minBitRate), maxBitRate)),
+    minBitRate(minBitRate), maxBitRate(maxBitRate), minJitter(-1.0), historySize(historySize)
+{
+}
+
+int BitRateController::update(double lossRatio, double jitter)
+{
+    if (minJitter < 0.0 || jitter < minJitter)
+    {
+        minJitter = jitter;
+    }
+
+    if (lossRatio > BITRATE_LOSS_HIGH)
+    {
+        // Congestion -> back off
+        bitRate = (int)(bitRate * (1.0 - 0.5 * lossRatio));
+    }
+    else if (lossRatio < BITRATE_LOSS_LOW && jitter <= minJitter + BITRATE_JITTER_TOLERANCE)
+    {
+        // Clean network -> probe
+        bitRate = (int)(bitRate * BITRATE_PROBE_FACTOR);
+    }
+    // else: moderate loss or queues building up -> hold
+
+    bitRate = (std::min)((std::max)(bitRate, minBitRate), maxBitRate);
+
+    Sample sample;
+    sample.bitRate   = bitRate;
+    sample.lossRatio = lossRatio;
+    sample.jitter    = jitter;
+    history.push_back(sample);
+    while (history.size() > historySize)
+    {
+        history.pop_front();
+    }
+
+    return bitRate;
+}
+
+int BitRateController::getBitRate()
+{
+    return bitRate;
+}
+
+int BitRateController::getMinBitRate()
+{
+    return minBitRate;
+}
+
+int BitRateController::getMaxBitRate()
+{
+    return maxBitRate;
+}
+
+const std::deque<BitRateController::Sample>& BitRateController::getHistory()
+{
+    return history;
+}
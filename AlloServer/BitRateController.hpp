@@ -0,0 +1,46 @@
+#pragma once
+
+#include <deque>
+
+// Loss-based bit rate control for a single face stream.
+//
+// Fed once per control interval with the worst loss and jitter the receivers
+// reported for the stream. The bit rate is cut in proportion to the loss when
+// the network is congested, held while the loss is moderate and probed upwards
+// in small steps when the network is clean (thresholds as in Google Congestion Control).
+// Rising jitter means that queues are building up somewhere on the path,
+// so the bit rate is not probed upwards then either.
+class BitRateController
+{
+public:
+    struct Sample
+    {
+        int    bitRate;   // bit rate chosen after this update
+        double lossRatio; // loss that was reported
+        double jitter;    // jitter that was reported in ms
+    };
+
+    BitRateController(int initialBitRate,
+                      int minBitRate,
+                      int maxBitRate,
+                      size_t historySize);
+
+    // Returns the new bit rate
+    int update(double lossRatio, double jitter);
+
+    int getBitRate();
+    int getMinBitRate();
+    int getMaxBitRate();
+
+    // Most recent update is at the back
+    const std::deque<Sample>& getHistory();
+
+private:
+    int    bitRate;
+    int    minBitRate;
+    int    maxBitRate;
+    double minJitter;
+
+    std::deque<Sample> history;
+    size_t             historySize;
+};
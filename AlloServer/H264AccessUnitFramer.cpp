@@ -0,0 +1,63 @@
+#include "H264AccessUnitFramer.hpp"
+
+H264AccessUnitFramer* H264AccessUnitFramer::createNew(UsageEnvironment& env,
+                                                      FramedSource*     inputSource,
+                                                      H264NALUSource*   naluSource)
+{
+    return new H264AccessUnitFramer(env, inputSource, naluSource);
+}
+
+H264AccessUnitFramer::H264AccessUnitFramer(UsageEnvironment& env,
+                                           FramedSource*     inputSource,
+                                           H264NALUSource*   naluSource)
+    :
+    H264VideoStreamDiscreteFramer(env, inputSource), naluSource(naluSource)
+{
+}
+
+void H264AccessUnitFramer::doGetNextFrame()
+{
+    fInputSource->getNextFrame(fTo,
+                               fMaxSize,
+                               afterGettingFrame,
+                               this,
+                               FramedSource::handleClosure,
+                               this);
+}
+
+void H264AccessUnitFramer::afterGettingFrame(void*          clientData,
+                                             unsigned       frameSize,
+                                             unsigned       numTruncatedBytes,
+                                             struct timeval presentationTime,
+                                             unsigned       durationInMicroseconds)
+{
+    ((H264AccessUnitFramer*)clientData)->afterGettingFrame1(frameSize,
+                                                            numTruncatedBytes,
+                                                            presentationTime,
+                                                            durationInMicroseconds);
+}
+
+void H264AccessUnitFramer::afterGettingFrame1(unsigned       frameSize,
+                                              unsigned       numTruncatedBytes,
+                                              struct timeval presentationTime,
+                                              unsigned       durationInMicroseconds)
+{
+    u_int8_t nal_unit_type = (frameSize == 0) ? 0xFF : fTo[0] & 0x1F;
+    if (nal_unit_type == 7) // SPS
+    {
+        saveCopyOfSPS(fTo, frameSize);
+    }
+    else if (nal_unit_type == 8) // PPS
+    {
+        saveCopyOfPPS(fTo, frameSize);
+    }
+
+    // The sink puts this into the marker bit of the NAL unit's last RTP packet
+    fPictureEndMarker = naluSource->isLastNALUOfFrame();
+
+    fFrameSize              = frameSize;
+    fNumTruncatedBytes      = numTruncatedBytes;
+    fPresentationTime       = presentationTime;
+    fDurationInMicroseconds = durationInMicroseconds;
+    afterGetting(this);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <H264VideoStreamDiscreteFramer.hh>
+
+#include "H264NALUSource.hpp"
+
+// Discrete framer that sets the RTP marker bit only on the last NAL unit of a frame.
+//
+// H264VideoStreamDiscreteFramer guesses that every VCL NAL unit ends the access unit,
+// which is wrong for our encoder since it splits frames into many slices.
+// Receivers use the marker bit to hand a frame to the decoder as soon as its
+// last slice arrives, so it has to be correct.
+class H264AccessUnitFramer : public H264VideoStreamDiscreteFramer
+{
+public:
+    static H264AccessUnitFramer* createNew(UsageEnvironment& env,
+                                           FramedSource*     inputSource,
+                                           H264NALUSource*   naluSource);
+
+protected:
+    H264AccessUnitFramer(UsageEnvironment& env,
+                         FramedSource*     inputSource,
+                         H264NALUSource*   naluSource);
+
+    virtual void doGetNextFrame();
+
+private:
+    static void afterGettingFrame(void*          clientData,
+                                  unsigned       frameSize,
+                                  unsigned       numTruncatedBytes,
+                                  struct timeval presentationTime,
+                                  unsigned       durationInMicroseconds);
+    void afterGettingFrame1(unsigned       frameSize,
+                            unsigned       numTruncatedBytes,
+                            struct timeval presentationTime,
+                            unsigned       durationInMicroseconds);
+
+    // Source at the beginning of the filter chain. Knows where frames end.
+    H264NALUSource* naluSource;
+};
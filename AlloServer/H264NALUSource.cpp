@@ -12,6 +12,10 @@
 
 namespace bc = boost::chrono;
 
+// Private AVPacket flag marking the last NAL unit of an encoded frame.
+// Our NAL unit packets never reach libavcodec.
+const int PKT_FLAG_LAST_NALU_OF_FRAME = 0x40000000;
+
 boost::mutex H264NALUSource::triggerEventMutex;
 std::vector<H264NALUSource*> H264NALUSource::sourcesReadyForDelivery;
 
@@ -62,7 +66,9 @@ H264NALUSource::H264NALUSource(UsageEnvironment& env,
 							   int avgBitRate,
 							   bool robustSyncing)
 	:
-	FramedSource(env), img_convert_ctx(NULL), content(content), /*encodeBarrier(2),*/ destructing(false), lastPTS(0), robustSyncing(robustSyncing)
+	FramedSource(env), img_convert_ctx(NULL), content(content), /*encodeBarrier(2),*/ destructing(false), lastPTS(0), robustSyncing(robustSyncing),
+	keyframeRequested(false), forcedKeyframesCount(0), avgBitRate(avgBitRate),
+	lastNALUOfFrame(false)
 {
 
 	gettimeofday(&prevtime, NULL); // If you have a more accurate time - e.g., from an encoder - then use that instead.
@@ -140,6 +146,7 @@ H264NALUSource::H264NALUSource(UsageEnvironment& env,
 	av_opt_set(codecContext->priv_data, "preset", PRESET_VAL, 0);
 	av_opt_set(codecContext->priv_data, "tune", TUNE_VAL, 0);
 	av_opt_set(codecContext->priv_data, "slice-max-size", "2000", 0);
+	av_opt_set(codecContext->priv_data, "forced-idr", "1", 0); // frames with pict_type I become IDR frames
 
 	/* open it */
 	if (avcodec_open2(codecContext, codec, NULL) < 0)
@@ -214,6 +221,38 @@ void H264NALUSource::setOnEncodedFrame(const OnEncodedFrame& callback)
 	onEncodedFrame = callback;
 }
 
+void H264NALUSource::requestKeyframe()
+{
+	boost::mutex::scoped_lock lock(keyframeMutex);
+	if (bc::steady_clock::now() - lastForcedKeyframeTime >= bc::milliseconds(KEYFRAME_REQUEST_HOLDOFF))
+	{
+		keyframeRequested = true;
+	}
+}
+
+unsigned H264NALUSource::getForcedKeyframesCount()
+{
+	boost::mutex::scoped_lock lock(keyframeMutex);
+	return forcedKeyframesCount;
+}
+
+void H264NALUSource::setAvgBitRate(int avgBitRate)
+{
+	boost::mutex::scoped_lock lock(bitRateMutex);
+	this->avgBitRate = avgBitRate;
+}
+
+int H264NALUSource::getAvgBitRate()
+{
+	boost::mutex::scoped_lock lock(bitRateMutex);
+	return avgBitRate;
+}
+
+bool H264NALUSource::isLastNALUOfFrame()
+{
+	return lastNALUOfFrame;
+}
+
 void H264NALUSource::frameContentLoop()
 {
 
@@ -372,6 +411,27 @@ void H264NALUSource::encodeFrameLoop()
 				yuv420pFrame = xFrame;
 			}
 
+			{
+				boost::mutex::scoped_lock lock(keyframeMutex);
+				if (keyframeRequested)
+				{
+					yuv420pFrame->pict_type = AV_PICTURE_TYPE_I;
+					keyframeRequested       = false;
+					lastForcedKeyframeTime  = bc::steady_clock::now();
+					forcedKeyframesCount++;
+				}
+				else
+				{
+					yuv420pFrame->pict_type = AV_PICTURE_TYPE_NONE;
+				}
+			}
+
+			{
+				// libx264 reconfigures itself when the bit rate changes between two frames
+				boost::mutex::scoped_lock lock(bitRateMutex);
+				codecContext->bit_rate = avgBitRate;
+			}
+
 			av_init_packet(&pkt);
 			pkt.data = NULL; // packet data will be allocated by the encoder
 			pkt.size = 0;
@@ -462,6 +522,10 @@ void H264NALUSource::encodeFrameLoop()
 				}
 				//std::cout << *((int64_t*)(naluPkt.data + naluPos.second - naluPos.first + 1)) << std::endl;
 				naluPkt.pts = pts;
+				if (i == naluCount - 1)
+				{
+					naluPkt.flags |= PKT_FLAG_LAST_NALU_OF_FRAME;
+				}
 
 				pktBuffer.push(naluPkt);
 
@@ -614,6 +678,9 @@ void H264NALUSource::deliverFrame()
 
 	memmove(fTo, newFrameDataStart, fFrameSize);
 
+	// Read by H264AccessUnitFramer while we call afterGetting()
+	lastNALUOfFrame = (pkt.flags & PKT_FLAG_LAST_NALU_OF_FRAME) != 0;
+
 
 	av_free_packet(&pkt);
 	//pktPool.push(pkt);
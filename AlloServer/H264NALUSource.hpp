@@ -36,6 +36,19 @@ public:
 	void setOnSentNALU    (const OnSentNALU&     callback);
 	void setOnEncodedFrame(const OnEncodedFrame& callback);
 
+	// Makes the encoder emit an IDR frame as soon as possible.
+	// Requests arriving shortly after a forced IDR are ignored
+	// since they were most likely caused by the same loss.
+	void requestKeyframe();
+	unsigned getForcedKeyframesCount();
+
+	// The new bit rate is applied to the encoder with the next frame
+	void setAvgBitRate(int avgBitRate);
+	int  getAvgBitRate();
+
+	// Whether the NAL unit that was delivered last is the last one of its frame
+	bool isLastNALUOfFrame();
+
 protected:
 	H264NALUSource(UsageEnvironment& env,
                    Frame* content,
@@ -88,4 +101,14 @@ private:
 
 	int_least64_t lastPTS;
 	bool robustSyncing;
+
+	boost::mutex keyframeMutex;
+	bool keyframeRequested;
+	boost::chrono::steady_clock::time_point lastForcedKeyframeTime;
+	unsigned forcedKeyframesCount;
+
+	boost::mutex bitRateMutex;
+	int avgBitRate;
+
+	bool lastNALUOfFrame;
 };
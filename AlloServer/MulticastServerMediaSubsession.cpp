@@ -0,0 +1,33 @@
+#include <string>
+
+#include "AlloShared/config.h"
+#include "MulticastServerMediaSubsession.hpp"
+
+MulticastServerMediaSubsession* MulticastServerMediaSubsession::createNew(RTPSink&      rtpSink,
+                                                                          RTCPInstance* rtcpInstance,
+                                                                          int           interfaceIndex)
+{
+    return new MulticastServerMediaSubsession(rtpSink, rtcpInstance, interfaceIndex);
+}
+
+MulticastServerMediaSubsession::MulticastServerMediaSubsession(RTPSink&      rtpSink,
+                                                               RTCPInstance* rtcpInstance,
+                                                               int           interfaceIndex)
+    :
+    PassiveServerMediaSubsession(rtpSink, rtcpInstance), interfaceIndex(interfaceIndex)
+{
+}
+
+char const* MulticastServerMediaSubsession::sdpLines()
+{
+    if (fSDPLines == NULL)
+    {
+        PassiveServerMediaSubsession::sdpLines();
+
+        std::string sdpLines = std::string(fSDPLines) +
+            "a=" SDP_INTERFACE_ATTRIBUTE ":" + std::to_string(interfaceIndex) + "\r\n";
+        delete[] fSDPLines;
+        fSDPLines = strDup(sdpLines.c_str());
+    }
+    return fSDPLines;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <liveMedia.hh>
+
+// PassiveServerMediaSubsession that also advertises which of the server's
+// network interfaces the stream is sent from (a=x-alloserver-interface:<index>).
+// Receivers with several interfaces use it to join the stream's group on the matching one.
+class MulticastServerMediaSubsession : public PassiveServerMediaSubsession
+{
+public:
+    static MulticastServerMediaSubsession* createNew(RTPSink&      rtpSink,
+                                                     RTCPInstance* rtcpInstance,
+                                                     int           interfaceIndex);
+
+protected:
+    MulticastServerMediaSubsession(RTPSink&      rtpSink,
+                                   RTCPInstance* rtcpInstance,
+                                   int           interfaceIndex);
+
+    virtual char const* sdpLines();
+
+private:
+    int interfaceIndex;
+};
@@ -0,0 +1,169 @@
+#include <GroupsockHelper.hh>
+
+#include "AlloShared/RTCPFeedback.hpp"
+#include "RTPRetransmitter.hpp"
+
+const size_t MAX_RTP_PACKET_SIZE = 65536;
+
+RTPRetransmitter* RTPRetransmitter::createNew(UsageEnvironment& env,
+                                              RTPSink*          sink,
+                                              Groupsock*        rtpGroupsock,
+                                              RTCPInstance*     rtcpInstance,
+                                              size_t            historySize)
+{
+    return new RTPRetransmitter(env, sink, rtpGroupsock, rtcpInstance, historySize);
+}
+
+RTPRetransmitter::RTPRetransmitter(UsageEnvironment& env,
+                                   RTPSink*          sink,
+                                   Groupsock*        rtpGroupsock,
+                                   RTCPInstance*     rtcpInstance,
+                                   size_t            historySize)
+    :
+    Medium(env), sink(sink), rtpGroupsock(rtpGroupsock), rtcpInstance(rtcpInstance),
+    history(historySize), ssrc(0), readBuffer(new unsigned char[MAX_RTP_PACKET_SIZE]),
+    sentPacketsCount(0), sentBytesCount(0), requestedPacketsCount(0), retransmittedPacketsCount(0), keyframeRequestsCount(0)
+{
+    for (Packet& packet : history)
+    {
+        packet.isValid = false;
+    }
+
+    // Our multicast packets are looped back to us -> record them
+    env.taskScheduler().turnOnBackgroundReadHandling(rtpGroupsock->socketNum(),
+                                                     &RTPRetransmitter::incomingRTPHandler,
+                                                     this);
+
+    rtcpInstance->setAuxilliaryReadHandler(&RTPRetransmitter::incomingRTCPHandler, this);
+}
+
+RTPRetransmitter::~RTPRetransmitter()
+{
+    envir().taskScheduler().turnOffBackgroundReadHandling(rtpGroupsock->socketNum());
+    rtcpInstance->setAuxilliaryReadHandler(NULL, NULL);
+    delete[] readBuffer;
+}
+
+unsigned RTPRetransmitter::getSentPacketsCount()
+{
+    return sentPacketsCount;
+}
+
+uint64_t RTPRetransmitter::getSentBytesCount()
+{
+    return sentBytesCount;
+}
+
+unsigned RTPRetransmitter::getRequestedPacketsCount()
+{
+    return requestedPacketsCount;
+}
+
+unsigned RTPRetransmitter::getRetransmittedPacketsCount()
+{
+    return retransmittedPacketsCount;
+}
+
+unsigned RTPRetransmitter::getKeyframeRequestsCount()
+{
+    return keyframeRequestsCount;
+}
+
+void RTPRetransmitter::setOnRequestedKeyframe(const OnRequestedKeyframe& callback)
+{
+    onRequestedKeyframe = callback;
+}
+
+void RTPRetransmitter::incomingRTPHandler(void* clientData, int)
+{
+    ((RTPRetransmitter*)clientData)->incomingRTPHandler1();
+}
+
+void RTPRetransmitter::incomingRTPHandler1()
+{
+    int size = recv(rtpGroupsock->socketNum(), (char*)readBuffer, MAX_RTP_PACKET_SIZE, 0);
+    if (size < (int)RTCPFeedback::RTP_HEADER_SIZE)
+    {
+        return;
+    }
+
+    // Only our sink sends to this group
+    ssrc = RTCPFeedback::rtpSSRC(readBuffer);
+
+    u_int16_t seqNum = RTCPFeedback::rtpSeqNum(readBuffer);
+    Packet& packet = history[seqNum % history.size()];
+    packet.data.assign(readBuffer, readBuffer + size);
+    packet.seqNum  = seqNum;
+    packet.isValid = true;
+
+    sentPacketsCount++;
+    sentBytesCount += size;
+}
+
+void RTPRetransmitter::incomingRTCPHandler(void* clientData, unsigned char* packet, unsigned& packetSize)
+{
+    ((RTPRetransmitter*)clientData)->incomingRTCPHandler1(packet, packetSize);
+}
+
+void RTPRetransmitter::incomingRTCPHandler1(unsigned char* packet, unsigned packetSize)
+{
+    for (const RTCPFeedback::Message& message : RTCPFeedback::parse(packet, packetSize))
+    {
+        if (message.mediaSSRC != ssrc)
+        {
+            continue;
+        }
+
+        switch (message.type)
+        {
+        case RTCPFeedback::Message::NACK:
+            for (u_int16_t seqNum : message.seqNums)
+            {
+                requestedPacketsCount++;
+                retransmit(seqNum);
+            }
+            break;
+        case RTCPFeedback::Message::FIR:
+        {
+            auto firSeqNumIter = firSeqNums.find(message.senderSSRC);
+            if (firSeqNumIter != firSeqNums.end() && firSeqNumIter->second == message.firSeqNum)
+            {
+                // repeated request
+                break;
+            }
+            firSeqNums[message.senderSSRC] = message.firSeqNum;
+        }
+            // fall through
+        case RTCPFeedback::Message::PLI:
+            keyframeRequestsCount++;
+            if (onRequestedKeyframe) onRequestedKeyframe(this);
+            break;
+        }
+    }
+}
+
+void RTPRetransmitter::retransmit(u_int16_t seqNum)
+{
+    Packet& packet = history[seqNum % history.size()];
+    if (!packet.isValid || packet.seqNum != seqNum)
+    {
+        // packet is too old
+        return;
+    }
+
+    struct sockaddr_in destination;
+    memset(&destination, 0, sizeof(destination));
+    destination.sin_family      = AF_INET;
+    destination.sin_addr.s_addr = rtpGroupsock->groupAddress().s_addr;
+    destination.sin_port        = rtpGroupsock->port().num();
+
+    if (sendto(rtpGroupsock->socketNum(),
+               (const char*)packet.data.data(),
+               packet.data.size(),
+               0,
+               (struct sockaddr*)&destination,
+               sizeof(destination)) == (int)packet.data.size())
+    {
+        retransmittedPacketsCount++;
+    }
+}
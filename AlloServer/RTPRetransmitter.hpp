@@ -0,0 +1,80 @@
+#pragma once
+
+#include <liveMedia.hh>
+#include <functional>
+#include <map>
+#include <vector>
+
+// Keeps a short history of the RTP packets sent by a RTPSink and
+// resends them when a receiver asks for them with a RTCP generic NACK.
+//
+// The history is filled from the packets that are looped back to us on the
+// sink's multicast groupsock, so the sink itself doesn't have to be modified.
+// Repairs are resent as they are on the original stream (same SSRC and sequence number).
+// The receivers' reordering buffers put them back in place as long as they arrive
+// within the reordering threshold.
+//
+// Keyframe requests (PLI/FIR) for the stream are passed on to the encoder
+// through the OnRequestedKeyframe callback.
+class RTPRetransmitter : public Medium
+{
+public:
+    static RTPRetransmitter* createNew(UsageEnvironment& env,
+                                       RTPSink*          sink,
+                                       Groupsock*        rtpGroupsock,
+                                       RTCPInstance*     rtcpInstance,
+                                       size_t            historySize);
+
+    unsigned getSentPacketsCount();
+    uint64_t getSentBytesCount();
+    unsigned getRequestedPacketsCount();
+    unsigned getRetransmittedPacketsCount();
+    unsigned getKeyframeRequestsCount();
+
+    typedef std::function<void (RTPRetransmitter*)> OnRequestedKeyframe;
+
+    void setOnRequestedKeyframe(const OnRequestedKeyframe& callback);
+
+protected:
+    RTPRetransmitter(UsageEnvironment& env,
+                     RTPSink*          sink,
+                     Groupsock*        rtpGroupsock,
+                     RTCPInstance*     rtcpInstance,
+                     size_t            historySize);
+    // called only by createNew(), or by subclass constructors
+    virtual ~RTPRetransmitter();
+
+    OnRequestedKeyframe onRequestedKeyframe;
+
+private:
+    struct Packet
+    {
+        std::vector<unsigned char> data;
+        u_int16_t                  seqNum;
+        bool                       isValid;
+    };
+
+    static void incomingRTPHandler(void* clientData, int mask);
+    static void incomingRTCPHandler(void* clientData, unsigned char* packet, unsigned& packetSize);
+    void incomingRTPHandler1();
+    void incomingRTCPHandler1(unsigned char* packet, unsigned packetSize);
+
+    void retransmit(u_int16_t seqNum);
+
+    RTPSink*      sink;
+    Groupsock*    rtpGroupsock;
+    RTCPInstance* rtcpInstance;
+
+    std::vector<Packet> history;
+    u_int32_t           ssrc;
+    unsigned char*      readBuffer;
+
+    // Last FIR sequence number of each receiver. Repeated FIRs must not be honored twice.
+    std::map<u_int32_t, u_int8_t> firSeqNums;
+
+    unsigned sentPacketsCount;
+    uint64_t sentBytesCount;
+    unsigned requestedPacketsCount;
+    unsigned retransmittedPacketsCount;
+    unsigned keyframeRequestsCount;
+};
@@ -4,6 +4,8 @@
 #define FACE0_RTP_PORT_NUM      18888
 #define BINOCULARS_RTP_PORT_NUM 18988
 #define TTL                     255
+#define DEFAULT_FACES_PER_GROUP 1    // faces sharing a multicast group; groups are consecutive from --multicast-address
+#define RTP_PACKET_HISTORY_SIZE 1024 // sent RTP packets kept per face for retransmissions
 
 // Encoder params
 #define DEFAULT_AVG_BIT_RATE    15000000
@@ -12,3 +14,12 @@
 #define PRESET_VAL				"ultrafast"
 #define TUNE_VAL				"zerolatency:fastdecode"
 #define FPS						60
+#define KEYFRAME_REQUEST_HOLDOFF 100 // ms after a forced IDR in which further keyframe requests are ignored
+
+// Adaptive bit rate params
+#define BITRATE_CONTROL_INTERVAL 1000  // ms between two bit rate updates
+#define BITRATE_HISTORY_SIZE     60    // bit rate updates kept per face for stats
+#define BITRATE_LOSS_HIGH        0.10  // loss ratio above which the bit rate is decreased
+#define BITRATE_LOSS_LOW         0.02  // loss ratio below which the bit rate is increased
+#define BITRATE_PROBE_FACTOR     1.05
+#define BITRATE_JITTER_TOLERANCE (1000.0 / FPS) // ms of jitter above the lowest seen jitter that prevent probing
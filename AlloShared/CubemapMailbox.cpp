@@ -0,0 +1,63 @@
+#include "CubemapMailbox.hpp"
+
+CubemapMailbox::CubemapMailbox()
+    :
+    pending(1), produced(0), consumed(2), overwrittenCount(0)
+{
+    slots.fill(nullptr);
+}
+
+StereoCubemap* CubemapMailbox::publish(StereoCubemap* cubemap)
+{
+    slots[produced] = cubemap;
+    int previous = pending.exchange(produced | FRESH_FLAG, std::memory_order_acq_rel);
+    if (previous & FRESH_FLAG)
+    {
+        overwrittenCount++;
+    }
+    produced = previous & INDEX_MASK;
+
+    {
+        // A waiting consumer checks the flag under the lock, so it can't miss the notification
+        boost::mutex::scoped_lock lock(mutex);
+    }
+    condition.notify_one();
+    return slots[produced];
+}
+
+StereoCubemap* CubemapMailbox::take()
+{
+    if (!(pending.load(std::memory_order_relaxed) & FRESH_FLAG))
+    {
+        return nullptr;
+    }
+
+    // Only the producer sets the flag -> it is still set
+    consumed = pending.exchange(consumed, std::memory_order_acq_rel) & INDEX_MASK;
+    return slots[consumed];
+}
+
+StereoCubemap* CubemapMailbox::waitAndTake(boost::chrono::microseconds timeout)
+{
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        condition.wait_for(lock, timeout, [this]()
+        {
+            return (pending.load(std::memory_order_relaxed) & FRESH_FLAG) != 0;
+        });
+    }
+    return take();
+}
+
+size_t CubemapMailbox::getOverwrittenCount()
+{
+    return overwrittenCount;
+}
+
+void CubemapMailbox::reset()
+{
+    slots.fill(nullptr);
+    pending  = 1;
+    produced = 0;
+    consumed = 2;
+}
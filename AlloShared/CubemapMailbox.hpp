@@ -0,0 +1,53 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include "Cubemap.hpp"
+
+// Triple buffer between the thread that produces cubemaps and the one that shows them.
+// The producer always publishes its newest cubemap and never waits for the consumer to show one.
+// The consumer always gets the newest cubemap published and keeps it until it takes the next one.
+// Handing the cubemaps over is lock-free; only waking a waiting consumer takes a lock.
+class CubemapMailbox
+{
+public:
+    // Cubemaps that the producer and the consumer keep alive together
+    enum { SLOTS_COUNT = 3 };
+    
+    CubemapMailbox();
+
+    // Producer. Returns the cubemap to fill next, i.e. either one the consumer is done with
+    // or the previously published one if the consumer hasn't taken it (nullptr until there are three).
+    StereoCubemap* publish(StereoCubemap* cubemap);
+
+    // Consumer. Returns the newest cubemap if one has been published since the last call and
+    // hands the previous one back; returns nullptr otherwise. The returned cubemap belongs to
+    // the consumer until the next successful call.
+    StereoCubemap* take();
+    // Like take() but waits up to timeout for a cubemap to be published
+    StereoCubemap* waitAndTake(boost::chrono::microseconds timeout);
+
+    // Cubemaps published but replaced before the consumer took them
+    size_t getOverwrittenCount();
+    
+    // Forgets all cubemaps, e.g. before they are destroyed. Neither side may use the mailbox meanwhile.
+    void reset();
+
+private:
+    enum
+    {
+        INDEX_MASK = 0x3,
+        FRESH_FLAG = 0x4  // the pending slot has not been taken yet
+    };
+
+    std::array<StereoCubemap*, SLOTS_COUNT> slots;
+    std::atomic<int>                        pending;  // index of the slot in between | FRESH_FLAG
+    int                                     produced; // slot owned by the producer
+    int                                     consumed; // slot owned by the consumer
+    std::atomic<size_t>                     overwrittenCount;
+    boost::mutex                            mutex;    // only guards the consumer's wait
+    boost::condition_variable               condition;
+};
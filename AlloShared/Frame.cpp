@@ -4,17 +4,47 @@ Frame::Frame(boost::uint32_t                         width,
              boost::uint32_t                         height,
              AVPixelFormat                           format,
              boost::chrono::system_clock::time_point presentationTime,
-             Allocator&                              allocator)
+             Allocator&                              allocator,
+             bool                                    ownPixels)
     :
     allocator(allocator), width(width), height(height), format(format),
-	presentationTime(presentationTime), pixels(allocator.allocate(width * height * 4)), // for RGBA
-	barrier(2)
+	presentationTime(presentationTime), pixels(ownPixels ? allocator.allocate(width * height * 4) : nullptr), // for RGBA
+	ownPixels(ownPixels), barrier(2)
 {
+    for (int i = 0; i < MAX_PLANES_COUNT; i++)
+    {
+        planes[i]    = nullptr;
+        lineSizes[i] = 0;
+    }
+    
+    if (ownPixels)
+    {
+        planes[0] = pixels;
+        if (format == AV_PIX_FMT_YUV420P)
+        {
+            lineSizes[0] = width;
+            lineSizes[1] = width / 2;
+            lineSizes[2] = width / 2;
+            planes[1]    = (boost::uint8_t*)pixels.get() + width * height;
+            planes[2]    = (boost::uint8_t*)planes[1].get() + (width / 2) * (height / 2);
+        }
+        else if (format == AV_PIX_FMT_RGB24)
+        {
+            lineSizes[0] = width * 3;
+        }
+        else
+        {
+            lineSizes[0] = width * 4;
+        }
+    }
 }
 
 Frame::~Frame()
 {
-	allocator.deallocate(pixels.get(), width * height * 4);
+    if (ownPixels)
+    {
+        allocator.deallocate(pixels.get(), width * height * 4);
+    }
 }
 
 boost::uint32_t Frame::getWidth()
@@ -39,7 +69,27 @@ boost::chrono::system_clock::time_point Frame::getPresentationTime()
 
 void* Frame::getPixels()
 {
-    return pixels.get();
+    return planes[0].get();
+}
+
+void* Frame::getPlane(int index)
+{
+    return planes[index].get();
+}
+
+boost::int32_t Frame::getLineSize(int index)
+{
+    return lineSizes[index];
+}
+
+void Frame::setPixels(boost::uint8_t* const planes[MAX_PLANES_COUNT],
+                      const int             lineSizes[MAX_PLANES_COUNT])
+{
+    for (int i = 0; i < MAX_PLANES_COUNT; i++)
+    {
+        this->planes[i]    = planes[i];
+        this->lineSizes[i] = lineSizes[i];
+    }
 }
 
 Barrier& Frame::getBarrier()
@@ -61,10 +111,11 @@ Frame* Frame::create(boost::uint32_t                         width,
                      boost::uint32_t                         height,
                      AVPixelFormat                           format,
                      boost::chrono::system_clock::time_point presentationTime,
-                     Allocator&                              allocator)
+                     Allocator&                              allocator,
+                     bool                                    ownPixels)
 {
     void* addr = allocator.allocate(sizeof(Frame));
-    return new (addr) Frame(width, height, format, presentationTime, allocator);
+    return new (addr) Frame(width, height, format, presentationTime, allocator, ownPixels);
 }
 
 void Frame::destroy(Frame* frame)
@@ -15,22 +15,33 @@ class Frame
 
 public:
 	typedef boost::interprocess::offset_ptr<Frame> Ptr;
+    
+    enum { MAX_PLANES_COUNT = 4 };
 
     boost::uint32_t                              getWidth();
     boost::uint32_t                              getHeight();
     AVPixelFormat                                getFormat();
     boost::chrono::system_clock::time_point      getPresentationTime();
-	void*                                        getPixels();
+	void*                                        getPixels(); // first plane
+    void*                                        getPlane(int index);
+    boost::int32_t                               getLineSize(int index);
 	Barrier&                                     getBarrier();
 	boost::interprocess::interprocess_mutex&     getMutex();
     
     void setPresentationTime(boost::chrono::system_clock::time_point presentationTime);
     
+    // Makes a frame without pixels of its own show pixels owned by someone else
+    // (e.g. a decoder's buffer pool). The owner must keep them alive until they are replaced.
+    void setPixels(boost::uint8_t* const planes[MAX_PLANES_COUNT],
+                   const int             lineSizes[MAX_PLANES_COUNT]);
+    
+    // Frames that own their pixels have them tightly packed
     static Frame* create(boost::uint32_t                         width,
                          boost::uint32_t                         height,
                          AVPixelFormat                           format,
                          boost::chrono::system_clock::time_point presentationTime,
-                         Allocator&                              allocator);
+                         Allocator&                              allocator,
+                         bool                                    ownPixels = true);
     static void   destroy(Frame* Frame);
     
 protected:
@@ -38,7 +49,8 @@ protected:
           boost::uint32_t                         height,
           AVPixelFormat                           format,
           boost::chrono::system_clock::time_point presentationTime,
-          Allocator&                              allocator);
+          Allocator&                              allocator,
+          bool                                    ownPixels);
     ~Frame();
     
     Allocator&                                  allocator;
@@ -47,6 +59,9 @@ protected:
     AVPixelFormat                               format;
     boost::chrono::system_clock::time_point     presentationTime;
 	boost::interprocess::offset_ptr<void>       pixels;
+    bool                                        ownPixels;
+    boost::interprocess::offset_ptr<void>       planes[MAX_PLANES_COUNT];
+    boost::int32_t                              lineSizes[MAX_PLANES_COUNT];
 	Barrier                                     barrier;
 	boost::interprocess::interprocess_mutex     mutex;
 };
\ No newline at end of file
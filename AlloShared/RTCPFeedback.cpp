@@ -0,0 +1,240 @@
+#include <algorithm>
+
+#include "RTCPFeedback.hpp"
+
+namespace
+{
+    const uint8_t RTCP_PT_RR    = 201;
+    const uint8_t RTCP_PT_RTPFB = 205;
+    const uint8_t RTCP_PT_PSFB  = 206;
+    const uint8_t RTCP_FMT_NACK = 1;
+    const uint8_t RTCP_FMT_PLI  = 1;
+    const uint8_t RTCP_FMT_FIR  = 4;
+
+    void write16(uint8_t* buffer, uint16_t value)
+    {
+        buffer[0] = (uint8_t)(value >> 8);
+        buffer[1] = (uint8_t)(value);
+    }
+
+    void write32(uint8_t* buffer, uint32_t value)
+    {
+        buffer[0] = (uint8_t)(value >> 24);
+        buffer[1] = (uint8_t)(value >> 16);
+        buffer[2] = (uint8_t)(value >> 8);
+        buffer[3] = (uint8_t)(value);
+    }
+
+    uint16_t read16(const uint8_t* buffer)
+    {
+        return (uint16_t)((buffer[0] << 8) | buffer[1]);
+    }
+
+    uint32_t read32(const uint8_t* buffer)
+    {
+        return ((uint32_t)buffer[0] << 24) | ((uint32_t)buffer[1] << 16) |
+               ((uint32_t)buffer[2] << 8)  |  (uint32_t)buffer[3];
+    }
+
+    // Writes the RTCP common header. length is the size of the whole packet in bytes.
+    void writeHeader(uint8_t* buffer, uint8_t count, uint8_t payloadType, size_t length)
+    {
+        buffer[0] = 0x80 | (count & 0x1F);
+        buffer[1] = payloadType;
+        write16(buffer + 2, (uint16_t)(length / 4 - 1));
+    }
+
+    // Empty receiver report so that the compound packet starts with a RR
+    size_t writeEmptyRR(uint8_t* buffer, uint32_t senderSSRC)
+    {
+        writeHeader(buffer, 0, RTCP_PT_RR, 8);
+        write32(buffer + 4, senderSSRC);
+        return 8;
+    }
+}
+
+size_t RTCPFeedback::buildNACK(uint32_t                     senderSSRC,
+                               uint32_t                     mediaSSRC,
+                               const std::vector<uint16_t>& seqNums,
+                               uint8_t*                     buffer,
+                               size_t                       bufferSize)
+{
+    if (seqNums.empty())
+    {
+        return 0;
+    }
+
+    // Pack the sequence numbers into PID + BLP pairs.
+    // Each pair covers the PID and the 16 following sequence numbers.
+    std::vector<uint16_t> sortedSeqNums(seqNums);
+    std::sort(sortedSeqNums.begin(), sortedSeqNums.end(),
+              [&seqNums](uint16_t a, uint16_t b)
+              {
+                  // Sort relative to the first requested seq num so that wrap-arounds are handled
+                  return (uint16_t)(a - seqNums.front()) < (uint16_t)(b - seqNums.front());
+              });
+
+    std::vector<std::pair<uint16_t, uint16_t> > fcis;
+    for (uint16_t seqNum : sortedSeqNums)
+    {
+        if (!fcis.empty())
+        {
+            uint16_t distance = seqNum - fcis.back().first;
+            if (distance == 0)
+            {
+                continue;
+            }
+            else if (distance <= 16)
+            {
+                fcis.back().second |= 1 << (distance - 1);
+                continue;
+            }
+        }
+        fcis.push_back(std::make_pair(seqNum, 0));
+    }
+
+    size_t nackSize = 12 + 4 * fcis.size();
+    if (8 + nackSize > bufferSize)
+    {
+        return 0;
+    }
+
+    size_t size = writeEmptyRR(buffer, senderSSRC);
+
+    uint8_t* nack = buffer + size;
+    writeHeader(nack, RTCP_FMT_NACK, RTCP_PT_RTPFB, nackSize);
+    write32(nack + 4, senderSSRC);
+    write32(nack + 8, mediaSSRC);
+    for (size_t i = 0; i < fcis.size(); i++)
+    {
+        write16(nack + 12 + 4 * i,     fcis[i].first);
+        write16(nack + 12 + 4 * i + 2, fcis[i].second);
+    }
+
+    return size + nackSize;
+}
+
+size_t RTCPFeedback::buildPLI(uint32_t senderSSRC,
+                              uint32_t mediaSSRC,
+                              uint8_t* buffer,
+                              size_t   bufferSize)
+{
+    if (8 + 12 > bufferSize)
+    {
+        return 0;
+    }
+
+    size_t size = writeEmptyRR(buffer, senderSSRC);
+
+    uint8_t* pli = buffer + size;
+    writeHeader(pli, RTCP_FMT_PLI, RTCP_PT_PSFB, 12);
+    write32(pli + 4, senderSSRC);
+    write32(pli + 8, mediaSSRC);
+
+    return size + 12;
+}
+
+size_t RTCPFeedback::buildFIR(uint32_t senderSSRC,
+                              uint32_t mediaSSRC,
+                              uint8_t  firSeqNum,
+                              uint8_t* buffer,
+                              size_t   bufferSize)
+{
+    if (8 + 20 > bufferSize)
+    {
+        return 0;
+    }
+
+    size_t size = writeEmptyRR(buffer, senderSSRC);
+
+    // The media source is named in the FCI (RFC 5104, section 4.3.1)
+    uint8_t* fir = buffer + size;
+    writeHeader(fir, RTCP_FMT_FIR, RTCP_PT_PSFB, 20);
+    write32(fir + 4,  senderSSRC);
+    write32(fir + 8,  0);
+    write32(fir + 12, mediaSSRC);
+    write32(fir + 16, (uint32_t)firSeqNum << 24);
+
+    return size + 20;
+}
+
+std::vector<RTCPFeedback::Message> RTCPFeedback::parse(const uint8_t* packet,
+                                                       size_t         packetSize)
+{
+    std::vector<Message> messages;
+
+    while (packetSize >= 4)
+    {
+        if ((packet[0] & 0xC0) != 0x80)
+        {
+            // not RTP version 2
+            break;
+        }
+
+        uint8_t count       = packet[0] & 0x1F;
+        uint8_t payloadType = packet[1];
+        size_t  length      = (read16(packet + 2) + 1) * 4;
+
+        if (length > packetSize)
+        {
+            break;
+        }
+
+        if (payloadType == RTCP_PT_RTPFB && count == RTCP_FMT_NACK && length >= 12)
+        {
+            Message message;
+            message.type       = Message::NACK;
+            message.senderSSRC = read32(packet + 4);
+            message.mediaSSRC  = read32(packet + 8);
+            for (size_t offset = 12; offset + 4 <= length; offset += 4)
+            {
+                uint16_t pid = read16(packet + offset);
+                uint16_t blp = read16(packet + offset + 2);
+                message.seqNums.push_back(pid);
+                for (int i = 0; i < 16; i++)
+                {
+                    if (blp & (1 << i))
+                    {
+                        message.seqNums.push_back(pid + i + 1);
+                    }
+                }
+            }
+            messages.push_back(message);
+        }
+        else if (payloadType == RTCP_PT_PSFB && count == RTCP_FMT_PLI && length >= 12)
+        {
+            Message message;
+            message.type       = Message::PLI;
+            message.senderSSRC = read32(packet + 4);
+            message.mediaSSRC  = read32(packet + 8);
+            messages.push_back(message);
+        }
+        else if (payloadType == RTCP_PT_PSFB && count == RTCP_FMT_FIR && length >= 12)
+        {
+            for (size_t offset = 12; offset + 8 <= length; offset += 8)
+            {
+                Message message;
+                message.type       = Message::FIR;
+                message.senderSSRC = read32(packet + 4);
+                message.mediaSSRC  = read32(packet + offset);
+                message.firSeqNum  = packet[offset + 4];
+                messages.push_back(message);
+            }
+        }
+
+        packet     += length;
+        packetSize -= length;
+    }
+
+    return messages;
+}
+
+uint16_t RTCPFeedback::rtpSeqNum(const uint8_t* packet)
+{
+    return read16(packet + 2);
+}
+
+uint32_t RTCPFeedback::rtpSSRC(const uint8_t* packet)
+{
+    return read32(packet + 8);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Builds and parses the RTCP feedback messages (RFC 4585, RFC 5104) that receivers send
+// to AlloServer in addition to the regular sender and receiver reports.
+// Messages are built as compound packets (empty RR + feedback message) so that
+// RTCP implementations that don't know about feedback messages still accept them.
+class RTCPFeedback
+{
+public:
+    class Message
+    {
+    public:
+        enum Type {NACK, PLI, FIR};
+
+        Type                  type;
+        uint32_t              senderSSRC;
+        uint32_t              mediaSSRC;
+        std::vector<uint16_t> seqNums;   // NACK only
+        uint8_t               firSeqNum; // FIR only
+    };
+
+    // Returns the size of the built packet or 0 if the buffer is too small
+    static size_t buildNACK(uint32_t                     senderSSRC,
+                            uint32_t                     mediaSSRC,
+                            const std::vector<uint16_t>& seqNums,
+                            uint8_t*                     buffer,
+                            size_t                       bufferSize);
+
+    static size_t buildPLI (uint32_t                     senderSSRC,
+                            uint32_t                     mediaSSRC,
+                            uint8_t*                     buffer,
+                            size_t                       bufferSize);
+    static size_t buildFIR (uint32_t                     senderSSRC,
+                            uint32_t                     mediaSSRC,
+                            uint8_t                      firSeqNum,
+                            uint8_t*                     buffer,
+                            size_t                       bufferSize);
+
+    // Returns all feedback messages contained in a (compound) RTCP packet
+    static std::vector<Message> parse(const uint8_t* packet,
+                                      size_t         packetSize);
+
+    // RTP header helpers
+    static uint16_t rtpSeqNum(const uint8_t* packet);
+    static uint32_t rtpSSRC  (const uint8_t* packet);
+
+    static const size_t RTP_HEADER_SIZE = 12;
+};
@@ -44,6 +44,96 @@ public:
     {
     };
     
+    class CollectedFrame
+    {
+    public:
+        CollectedFrame(int face, boost::chrono::microseconds latency) : face(face), latency(latency) {}
+        int                         face;
+        boost::chrono::microseconds latency; // from the frame being available until it was collected
+    };
+    
+    class CollectorIdle
+    {
+    public:
+        CollectorIdle(boost::chrono::microseconds duration) : duration(duration) {}
+        boost::chrono::microseconds duration;
+    };
+    
+    class ReleasedCubemap
+    {
+    public:
+        enum Status {COMPLETE, PARTIAL, DROPPED};
+        
+        ReleasedCubemap(Status status) : status(status) {}
+        Status status;
+    };
+    
+    class LateFrame
+    {
+    public:
+        LateFrame(int face) : face(face) {}
+        int face; // arrived after its cubemap had been released
+    };
+    
+    class DroppedFrame
+    {
+    public:
+        DroppedFrame(int face) : face(face) {}
+        int face; // decoded, but not collected in time
+    };
+    
+    class DecodingTime
+    {
+    public:
+        DecodingTime(int face, boost::chrono::microseconds duration) : face(face), duration(duration) {}
+        int                         face;
+        boost::chrono::microseconds duration;
+    };
+    
+    class DegradationLevelChange
+    {
+    public:
+        DegradationLevelChange(int oldLevel, int newLevel) : oldLevel(oldLevel), newLevel(newLevel) {}
+        int oldLevel; // decoding quality the receiver gave up before
+        int newLevel; // and after the change; 0 is full quality
+    };
+    
+    class Recovery
+    {
+    public:
+        Recovery(boost::chrono::microseconds timeToPicture) : timeToPicture(timeToPicture) {}
+        boost::chrono::microseconds timeToPicture; // from losing the stream until the first cubemap of the new one
+    };
+    
+    class PresentationSkew
+    {
+    public:
+        PresentationSkew(boost::chrono::microseconds skew) : skew(skew) {}
+        boost::chrono::microseconds skew; // how much later than its target time a cubemap was handed out
+    };
+    
+    class CubemapLatency
+    {
+    public:
+        CubemapLatency(boost::chrono::microseconds latency) : latency(latency) {}
+        boost::chrono::microseconds latency; // from the pts (on our clock) until the cubemap was handed out
+    };
+    
+    class ServerSkew
+    {
+    public:
+        ServerSkew(int server, boost::chrono::microseconds skew) : server(server), skew(skew) {}
+        int                         server;
+        boost::chrono::microseconds skew; // how much later than a cubemap's first face the server's first face of it arrived
+    };
+    
+    class TextureUpload
+    {
+    public:
+        TextureUpload(boost::chrono::microseconds duration) : duration(duration) {}
+        boost::chrono::microseconds duration; // spent by the render thread in a frame
+    };
+    
     // STAT VALS
 	static Stats::StatVal nalusBitSum  (const std::string&                      name,
                                         int                                     face,
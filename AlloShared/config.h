@@ -1,3 +1,6 @@
 #pragma once
 
 #define SHM_NAME "AlloUnitySHM"
+
+// SDP attribute telling receivers which of the server's network interfaces a face is sent from
+#define SDP_INTERFACE_ATTRIBUTE "x-alloserver-interface"
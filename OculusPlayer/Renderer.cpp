@@ -366,7 +366,13 @@ void Renderer::renderLoop()
 			}
 
 			
-			memcpy(pixels, content->getPixels(), content->getHeight() * content->getWidth() * 4);
+			// The decoder pads its lines and SDL may pad the texture's lines differently
+			for (int y = 0; y < content->getHeight(); y++)
+			{
+				memcpy((char*)pixels + y * pitch,
+				       (const char*)content->getPixels() + y * content->getLineSize(0),
+				       content->getWidth() * 4);
+			}
 
 			SDL_UnlockTexture(texture);
 
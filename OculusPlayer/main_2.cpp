@@ -7,11 +7,10 @@
 #include "AlloReceiver/AlloReceiver.h"
 #include "AlloReceiver/Stats.hpp"
 #include "AlloReceiver/H264CubemapSource.h"
+#include "AlloReceiver/RTSPCubemapSourceClient.hpp"
 
 #include "Renderer.hpp"
 
-const unsigned int DEFAULT_SINK_BUFFER_SIZE = 200000000;
-
 Stats stats;
 static boost::barrier barrier(2);
 static CubemapSource* cubemapSource;
@@ -112,7 +111,11 @@ int main(int argc, char* argv[])
         _interface = "0.0.0.0";
     }
 
-	rtspClient = RTSPCubemapSourceClient::create(vm["url"].as<std::string>().c_str(), DEFAULT_SINK_BUFFER_SIZE, AV_PIX_FMT_RGBA, false, false, 10, _interface);
+	RTSPCubemapSourceClient::Options options;
+	options.format           = AV_PIX_FMT_RGBA;
+	options.maxFrameMapSize  = 10;
+	options.interfaceAddress = _interface;
+	rtspClient = RTSPCubemapSourceClient::create(vm["url"].as<std::string>().c_str(), options);
 	std::function<void(RTSPCubemapSourceClient*, CubemapSource*)> callback(boost::bind(&onDidConnect, _1, _2));
 	rtspClient->setOnDidConnect(callback);
 	rtspClient->connect();
@@ -0,0 +1,124 @@
+#define BOOST_TEST_MODULE ClockOffsetEstimator
+#include <boost/test/unit_test.hpp>
+
+#include "AlloReceiver/ClockOffsetEstimator.hpp"
+
+const int64_t START_TIME      = 1500000000000000LL; // microseconds since the epoch
+const int64_t REPORT_INTERVAL = 100000;             // microseconds between two sender reports
+const int64_t MIN_DELAY       = 200;                // microseconds
+
+// Simulated server whose clock is offset by initialOffset and drifts by drift ppm
+class Server
+{
+public:
+    Server(int64_t initialOffset, double drift)
+        :
+        initialOffset(initialOffset), drift(drift), reportsCount(0)
+    {
+    }
+
+    int64_t offsetAt(int64_t localTime)
+    {
+        return initialOffset + (int64_t)(drift * (localTime - START_TIME) / 1000000.0);
+    }
+
+    // Sends a report at localTime. The estimator sees it after a delay between
+    // MIN_DELAY and 10 * MIN_DELAY; every tenth report gets through with MIN_DELAY.
+    void sendReport(ClockOffsetEstimator& estimator, int64_t localTime)
+    {
+        int64_t delay = MIN_DELAY + (reportsCount % 10) * (reportsCount * 7919 % 9) * MIN_DELAY / 8;
+        estimator.addSample(localTime + offsetAt(localTime), localTime + delay);
+        reportsCount++;
+    }
+
+    int64_t initialOffset;
+    double  drift;
+    int     reportsCount;
+};
+
+static ClockOffsetEstimator::Estimate estimateAt(ClockOffsetEstimator& estimator, int64_t localTime)
+{
+    return estimator.getEstimate(boost::chrono::system_clock::time_point(boost::chrono::microseconds(localTime)));
+}
+
+// Feeds reports from startTime on for duration and returns the local time of the last one
+static int64_t sendReports(Server& server, ClockOffsetEstimator& estimator, int64_t startTime, int64_t duration)
+{
+    int64_t time = startTime;
+    for (; time < startTime + duration; time += REPORT_INTERVAL)
+    {
+        server.sendReport(estimator, time);
+    }
+    return time - REPORT_INTERVAL;
+}
+
+BOOST_AUTO_TEST_CASE(NoSamples)
+{
+    ClockOffsetEstimator estimator;
+    ClockOffsetEstimator::Estimate estimate = estimateAt(estimator, START_TIME);
+    BOOST_CHECK(!estimate.isValid);
+    BOOST_CHECK_EQUAL(estimate.offset.count(), 0);
+    BOOST_CHECK_EQUAL(estimate.samplesCount, 0);
+}
+
+BOOST_AUTO_TEST_CASE(Offset)
+{
+    ClockOffsetEstimator estimator;
+    Server server(-3000000, 0.0);
+
+    // The first sample gives the offset minus its delay
+    server.sendReport(estimator, START_TIME);
+    ClockOffsetEstimator::Estimate estimate = estimateAt(estimator, START_TIME);
+    BOOST_CHECK(estimate.isValid);
+    BOOST_CHECK_EQUAL(estimate.samplesCount, 1);
+    BOOST_CHECK_EQUAL(estimate.offset.count(), -3000000 - MIN_DELAY);
+
+    // The least delayed reports win over the jitter
+    int64_t lastTime = sendReports(server, estimator, START_TIME + REPORT_INTERVAL, 60000000);
+    estimate = estimateAt(estimator, lastTime);
+    BOOST_CHECK_SMALL(estimate.offset.count() - (-3000000 - MIN_DELAY), (int64_t)5);
+    BOOST_CHECK_SMALL(estimate.drift, 0.1);
+    BOOST_CHECK_LE(estimate.residualError.count(), 5);
+}
+
+BOOST_AUTO_TEST_CASE(Drift)
+{
+    ClockOffsetEstimator estimator;
+    Server server(250000, 40.0);
+
+    int64_t lastTime = sendReports(server, estimator, START_TIME, 120000000);
+    ClockOffsetEstimator::Estimate estimate = estimateAt(estimator, lastTime);
+    BOOST_CHECK_SMALL(estimate.drift - 40.0, 1.0);
+    BOOST_CHECK_SMALL(estimate.offset.count() - (server.offsetAt(lastTime) - MIN_DELAY), (int64_t)100);
+
+    // The fitted line also predicts the offset a bit into the future
+    int64_t laterTime = lastTime + 10000000;
+    BOOST_CHECK_SMALL(estimateAt(estimator, laterTime).offset.count() - (server.offsetAt(laterTime) - MIN_DELAY), (int64_t)100);
+}
+
+BOOST_AUTO_TEST_CASE(ClockStep)
+{
+    ClockOffsetEstimator estimator;
+    Server server(0, 20.0);
+
+    int64_t lastTime = sendReports(server, estimator, START_TIME, 60000000);
+    BOOST_CHECK_SMALL(estimateAt(estimator, lastTime).drift - 20.0, 1.0);
+
+    // Someone sets the server's clock. The next report already gives the new offset.
+    server.initialOffset += 2000000;
+    int64_t stepTime = lastTime + REPORT_INTERVAL;
+    server.sendReport(estimator, stepTime);
+    ClockOffsetEstimator::Estimate estimate = estimateAt(estimator, stepTime);
+    BOOST_CHECK_EQUAL(estimate.samplesCount, 1);
+    BOOST_CHECK_SMALL(estimate.offset.count() - (server.offsetAt(stepTime) - MIN_DELAY), 10 * MIN_DELAY);
+    BOOST_CHECK_EQUAL(estimate.drift, 0.0);
+
+    // And the drift is found again once there are enough windows
+    lastTime = sendReports(server, estimator, stepTime + REPORT_INTERVAL, 60000000);
+    estimate = estimateAt(estimator, lastTime);
+    BOOST_CHECK_SMALL(estimate.drift - 20.0, 1.0);
+    BOOST_CHECK_SMALL(estimate.offset.count() - (server.offsetAt(lastTime) - MIN_DELAY), (int64_t)100);
+
+    // Jitter alone doesn't reset the estimator
+    BOOST_CHECK_GT(estimate.samplesCount, 500);
+}
@@ -0,0 +1,172 @@
+#define BOOST_TEST_MODULE CubemapMailbox
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+#include "AlloShared/CubemapMailbox.hpp"
+
+// The mailbox only passes the pointers around, so these stand in for cubemaps
+static char cubemapsStorage[4];
+
+static StereoCubemap* fakeCubemap(int index)
+{
+    return reinterpret_cast<StereoCubemap*>(&cubemapsStorage[index]);
+}
+
+static int fakeCubemapIndex(StereoCubemap* cubemap)
+{
+    return (int)(reinterpret_cast<char*>(cubemap) - cubemapsStorage);
+}
+
+BOOST_AUTO_TEST_CASE(Empty)
+{
+    CubemapMailbox mailbox;
+    BOOST_CHECK(mailbox.take() == nullptr);
+    BOOST_CHECK_EQUAL(mailbox.getOverwrittenCount(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(PublishThenTake)
+{
+    CubemapMailbox mailbox;
+    StereoCubemap* a = fakeCubemap(0);
+    StereoCubemap* b = fakeCubemap(1);
+
+    // No cubemap to hand back to the producer yet
+    BOOST_CHECK(mailbox.publish(a) == nullptr);
+    BOOST_CHECK(mailbox.take() == a);
+    // Taken cubemaps are not delivered twice
+    BOOST_CHECK(mailbox.take() == nullptr);
+
+    BOOST_CHECK(mailbox.publish(b) == nullptr);
+    BOOST_CHECK(mailbox.take() == b);
+    BOOST_CHECK(mailbox.take() == nullptr);
+
+    // a is back in the free slot now
+    BOOST_CHECK(mailbox.publish(fakeCubemap(2)) == a);
+    BOOST_CHECK_EQUAL(mailbox.getOverwrittenCount(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(Overwrite)
+{
+    CubemapMailbox mailbox;
+    StereoCubemap* a = fakeCubemap(0);
+    StereoCubemap* b = fakeCubemap(1);
+    StereoCubemap* c = fakeCubemap(2);
+    StereoCubemap* d = fakeCubemap(3);
+
+    BOOST_CHECK(mailbox.publish(a) == nullptr);
+    BOOST_CHECK(mailbox.take() == a);
+
+    // The consumer doesn't take b, so publishing c hands b back to the producer
+    BOOST_CHECK(mailbox.publish(b) == nullptr);
+    BOOST_CHECK(mailbox.publish(c) == b);
+    BOOST_CHECK_EQUAL(mailbox.getOverwrittenCount(), 1);
+
+    // The consumer gets the newest one and hands a back
+    BOOST_CHECK(mailbox.take() == c);
+    BOOST_CHECK(mailbox.publish(b) == a);
+    BOOST_CHECK(mailbox.publish(d) == b);
+    BOOST_CHECK_EQUAL(mailbox.getOverwrittenCount(), 2);
+    BOOST_CHECK(mailbox.take() == d);
+    BOOST_CHECK(mailbox.take() == nullptr);
+    BOOST_CHECK_EQUAL(mailbox.getOverwrittenCount(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(Reset)
+{
+    CubemapMailbox mailbox;
+    mailbox.publish(fakeCubemap(0));
+    mailbox.publish(fakeCubemap(1));
+    mailbox.take();
+    mailbox.publish(fakeCubemap(2));
+
+    mailbox.reset();
+    BOOST_CHECK(mailbox.take() == nullptr);
+    BOOST_CHECK(mailbox.publish(fakeCubemap(3)) == nullptr);
+    BOOST_CHECK(mailbox.take() == fakeCubemap(3));
+}
+
+// Producer and consumer on their own threads. The producer numbers each cubemap it publishes.
+// The consumer must see the numbers in order, never one twice, and every number that it
+// doesn't see must be counted as overwritten.
+BOOST_AUTO_TEST_CASE(Concurrent)
+{
+    const int PUBLISHES_COUNT = 200000;
+
+    CubemapMailbox mailbox;
+    int            numbers[3];
+    int            takenCount = 0;
+    int            outOfOrderCount = 0;
+    bool           isProducing = true;
+    boost::mutex   mutex;
+
+    boost::thread producer([&]()
+    {
+        int            freshCubemapsCount = 1;
+        StereoCubemap* cubemap = fakeCubemap(0);
+        for (int number = 1; number <= PUBLISHES_COUNT; number++)
+        {
+            numbers[fakeCubemapIndex(cubemap)] = number;
+            cubemap = mailbox.publish(cubemap);
+            if (!cubemap)
+            {
+                cubemap = fakeCubemap(freshCubemapsCount++);
+            }
+        }
+        boost::mutex::scoped_lock lock(mutex);
+        isProducing = false;
+    });
+
+    int lastNumber = 0;
+    while (true)
+    {
+        bool wasProducing;
+        {
+            boost::mutex::scoped_lock lock(mutex);
+            wasProducing = isProducing;
+        }
+
+        StereoCubemap* cubemap = mailbox.take();
+        if (cubemap)
+        {
+            int number = numbers[fakeCubemapIndex(cubemap)];
+            if (number <= lastNumber)
+            {
+                outOfOrderCount++;
+            }
+            lastNumber = number;
+            takenCount++;
+        }
+        else if (!wasProducing)
+        {
+            break;
+        }
+    }
+    producer.join();
+
+    BOOST_CHECK_EQUAL(outOfOrderCount, 0);
+    BOOST_CHECK_EQUAL(lastNumber, PUBLISHES_COUNT);
+    BOOST_CHECK_EQUAL(takenCount + (int)mailbox.getOverwrittenCount(), PUBLISHES_COUNT);
+}
+
+BOOST_AUTO_TEST_CASE(WaitAndTake)
+{
+    CubemapMailbox mailbox;
+
+    // Nothing published: gives up after the timeout
+    BOOST_CHECK(mailbox.waitAndTake(boost::chrono::milliseconds(10)) == nullptr);
+
+    // Already published: returns right away
+    mailbox.publish(fakeCubemap(0));
+    BOOST_CHECK(mailbox.waitAndTake(boost::chrono::seconds(10)) == fakeCubemap(0));
+
+    // Published while waiting: wakes up long before the timeout
+    boost::thread producer([&]()
+    {
+        boost::this_thread::sleep_for(boost::chrono::milliseconds(20));
+        mailbox.publish(fakeCubemap(1));
+    });
+    boost::chrono::steady_clock::time_point start = boost::chrono::steady_clock::now();
+    BOOST_CHECK(mailbox.waitAndTake(boost::chrono::seconds(10)) == fakeCubemap(1));
+    BOOST_CHECK_LT(boost::chrono::steady_clock::now() - start, boost::chrono::seconds(5));
+    producer.join();
+}
@@ -0,0 +1,64 @@
+#define BOOST_TEST_MODULE FaceSelection
+#include <boost/test/unit_test.hpp>
+
+#include "AlloReceiver/FaceSelection.hpp"
+
+static FaceSelection::Frustum frustum(double yaw, double pitch, double horizontalFOV, double verticalFOV)
+{
+    FaceSelection::Frustum frustum;
+    frustum.yaw           = yaw;
+    frustum.pitch         = pitch;
+    frustum.horizontalFOV = horizontalFOV;
+    frustum.verticalFOV   = verticalFOV;
+    return frustum;
+}
+
+static std::vector<int> facesInFrustum(const FaceSelection::Frustum& frustum, int eyesCount = 1)
+{
+    return FaceSelection::facesInFrusta(std::vector<FaceSelection::Frustum>(1, frustum), eyesCount);
+}
+
+BOOST_AUTO_TEST_CASE(SingleFace)
+{
+    // A 90° frustum looking straight at a face only touches the neighbours with its edges
+    BOOST_CHECK(facesInFrustum(frustum(   0,   0, 90, 90)) == std::vector<int>({ 2 }));
+    BOOST_CHECK(facesInFrustum(frustum(  90,   0, 90, 90)) == std::vector<int>({ 0 }));
+    BOOST_CHECK(facesInFrustum(frustum( -90,   0, 90, 90)) == std::vector<int>({ 1 }));
+    BOOST_CHECK(facesInFrustum(frustum( 180,   0, 90, 90)) == std::vector<int>({ 3 }));
+    BOOST_CHECK(facesInFrustum(frustum(   0,  90, 30, 30)) == std::vector<int>({ 4 }));
+    BOOST_CHECK(facesInFrustum(frustum(   0, -90, 30, 30)) == std::vector<int>({ 5 }));
+}
+
+BOOST_AUTO_TEST_CASE(SeveralFaces)
+{
+    // Looking at the edge between front and right
+    BOOST_CHECK(facesInFrustum(frustum(45,  0,  90,  60)) == std::vector<int>({ 0, 2 }));
+    // Slightly more than a face covers the neighbours too
+    BOOST_CHECK(facesInFrustum(frustum( 0,  0, 100,  60)) == std::vector<int>({ 0, 1, 2 }));
+    BOOST_CHECK(facesInFrustum(frustum( 0,  0,  60, 100)) == std::vector<int>({ 2, 4, 5 }));
+    // Looking up at the edge between front and top
+    BOOST_CHECK(facesInFrustum(frustum( 0, 45,  60,  90)) == std::vector<int>({ 2, 4 }));
+}
+
+BOOST_AUTO_TEST_CASE(SeveralFrusta)
+{
+    std::vector<FaceSelection::Frustum> frusta;
+    BOOST_CHECK(FaceSelection::facesInFrusta(frusta, 1).empty());
+
+    frusta.push_back(frustum(  0, 0, 90, 90));
+    frusta.push_back(frustum(180, 0, 90, 90));
+    BOOST_CHECK(FaceSelection::facesInFrusta(frusta, 1) == std::vector<int>({ 2, 3 }));
+
+    // Overlapping frusta don't add faces twice
+    frusta.push_back(frustum(10, 0, 60, 60));
+    BOOST_CHECK(FaceSelection::facesInFrusta(frusta, 1) == std::vector<int>({ 2, 3 }));
+}
+
+BOOST_AUTO_TEST_CASE(Eyes)
+{
+    // The right eye's faces follow the left eye's
+    BOOST_CHECK(facesInFrustum(frustum(45, 0, 90, 60), 2) == std::vector<int>({ 0, 2, 6, 8 }));
+    // A cubemap has two eyes at most
+    BOOST_CHECK(facesInFrustum(frustum(45, 0, 90, 60), 3) == std::vector<int>({ 0, 2, 6, 8 }));
+    BOOST_CHECK(facesInFrustum(frustum(45, 0, 90, 60), 0).empty());
+}
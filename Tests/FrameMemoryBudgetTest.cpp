@@ -0,0 +1,119 @@
+#define BOOST_TEST_MODULE FrameMemoryBudget
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+#include "AlloShared/CubemapMailbox.hpp"
+#include "AlloReceiver/FrameMemoryBudget.hpp"
+
+// The budget only tells frames apart by their address
+static char framesStorage[128];
+
+static const void* fakeFrame(int index)
+{
+    return &framesStorage[index];
+}
+
+BOOST_AUTO_TEST_CASE(ReserveAndRelease)
+{
+    FrameMemoryBudget budget(100);
+    BOOST_CHECK(budget.reserve(fakeFrame(0), 60, false));
+    BOOST_CHECK(!budget.reserve(fakeFrame(1), 60, false));
+    BOOST_CHECK(budget.reserve(fakeFrame(1), 40, false));
+    BOOST_CHECK_EQUAL(budget.getReservedSize(), 100);
+
+    budget.release(fakeFrame(0));
+    BOOST_CHECK_EQUAL(budget.getReservedSize(), 40);
+    // Releasing twice or releasing an unknown frame changes nothing
+    budget.release(fakeFrame(0));
+    budget.release(fakeFrame(2));
+    BOOST_CHECK_EQUAL(budget.getReservedSize(), 40);
+}
+
+BOOST_AUTO_TEST_CASE(OversizedFrame)
+{
+    FrameMemoryBudget budget(100);
+    // Granted since nothing else is reserved, otherwise the face could never be shown
+    BOOST_CHECK(budget.reserve(fakeFrame(0), 150, false));
+    BOOST_CHECK(!budget.reserve(fakeFrame(1), 1, false));
+    budget.release(fakeFrame(0));
+    BOOST_CHECK(budget.reserve(fakeFrame(1), 1, false));
+}
+
+BOOST_AUTO_TEST_CASE(KeptFrames)
+{
+    FrameMemoryBudget budget(100);
+    BOOST_CHECK(budget.reserve(fakeFrame(0), 80, false));
+    budget.keep(fakeFrame(0));
+    BOOST_CHECK_EQUAL(budget.getReservedSize(), 0);
+    BOOST_CHECK(budget.reserve(fakeFrame(1), 80, false));
+
+    // Returning the kept frame later doesn't release anything
+    budget.release(fakeFrame(0));
+    BOOST_CHECK_EQUAL(budget.getReservedSize(), 80);
+}
+
+BOOST_AUTO_TEST_CASE(WaitForRelease)
+{
+    FrameMemoryBudget budget(100);
+    BOOST_CHECK(budget.reserve(fakeFrame(0), 100, false));
+
+    bool isReserved = false;
+    boost::thread decoder([&]()
+    {
+        isReserved = budget.reserve(fakeFrame(1), 100, true);
+    });
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(20));
+    budget.keep(fakeFrame(0));
+    decoder.join();
+    BOOST_CHECK(isReserved);
+    BOOST_CHECK_EQUAL(budget.getReservedSize(), 100);
+}
+
+// The way the sinks and the cubemap source use the budget: every face of every cubemap
+// in the consumer's mailbox holds a frame until a newer frame of its face replaces it.
+// Those frames alone need more than the budget (e.g. 4K YUV420P faces: 3 × 12 × 25 MB > 512 MB).
+// The stream must keep going anyway instead of dropping every new frame for good.
+BOOST_AUTO_TEST_CASE(CubemapsHoldingMoreThanTheBudget)
+{
+    const int    FACES_COUNT  = 12;
+    const int    ROUNDS_COUNT = 20;
+    const size_t FRAME_SIZE   = 25;
+    const size_t LIMIT        = 512;
+    BOOST_REQUIRE_GT(CubemapMailbox::SLOTS_COUNT * FACES_COUNT * FRAME_SIZE, LIMIT);
+
+    FrameMemoryBudget budget(LIMIT);
+    // Frames of each face; one more than the cubemaps hold so that one can be decoded into
+    const int FRAMES_PER_FACE = CubemapMailbox::SLOTS_COUNT + 1;
+    BOOST_REQUIRE_LE(FACES_COUNT * FRAMES_PER_FACE, (int)sizeof(framesStorage));
+
+    std::vector<std::vector<const void*>> cubemaps(CubemapMailbox::SLOTS_COUNT,
+                                                   std::vector<const void*>(FACES_COUNT, nullptr));
+    int shownFramesCount = 0;
+    for (int round = 0; round < ROUNDS_COUNT; round++)
+    {
+        // The source refills the cubemaps in turn
+        std::vector<const void*>& cubemap = cubemaps[round % CubemapMailbox::SLOTS_COUNT];
+        for (int face = 0; face < FACES_COUNT; face++)
+        {
+            const void* frame = fakeFrame(face * FRAMES_PER_FACE + round % FRAMES_PER_FACE);
+
+            // Sink: makes the frame available
+            if (!budget.reserve(frame, FRAME_SIZE, false))
+            {
+                continue;
+            }
+
+            // Source: the face shows the new frame and returns the one it showed before
+            budget.keep(frame);
+            if (cubemap[face])
+            {
+                budget.release(cubemap[face]);
+            }
+            cubemap[face] = frame;
+            shownFramesCount++;
+        }
+    }
+
+    BOOST_CHECK_EQUAL(shownFramesCount, ROUNDS_COUNT * FACES_COUNT);
+    BOOST_CHECK_EQUAL(budget.getReservedSize(), 0);
+}
@@ -0,0 +1,236 @@
+#define BOOST_TEST_MODULE H264RTPDepacketizer
+#include <boost/test/unit_test.hpp>
+
+#include "AlloReceiver/H264RTPDepacketizer.hpp"
+
+typedef std::vector<unsigned char> Bytes;
+
+const uint32_t SSRC      = 0x12345678;
+const unsigned FREQUENCY = 90000;
+
+// Keeps the NALUs that the depacketizer finishes
+class RecordingSink : public H264RTPDepacketizer::NALUSink
+{
+public:
+    RecordingSink() : isCollecting(false), abortedCount(0)
+    {
+    }
+
+    void startNALU()
+    {
+        current.clear();
+        isCollecting = true;
+    }
+
+    void appendToNALU(const unsigned char* data, size_t size)
+    {
+        BOOST_REQUIRE(isCollecting);
+        current.insert(current.end(), data, data + size);
+    }
+
+    void finishNALU(timeval presentationTime, bool isLastNALUOfFrame)
+    {
+        BOOST_REQUIRE(isCollecting);
+        nalus.push_back(current);
+        presentationTimes.push_back(presentationTime.tv_sec * 1000000LL + presentationTime.tv_usec);
+        lastNALUsOfFrames.push_back(isLastNALUOfFrame);
+        isCollecting = false;
+    }
+
+    void abortNALU()
+    {
+        isCollecting = false;
+        abortedCount++;
+    }
+
+    Bytes                current;
+    bool                 isCollecting;
+    int                  abortedCount;
+    std::vector<Bytes>   nalus;
+    std::vector<int64_t> presentationTimes; // microseconds
+    std::vector<bool>    lastNALUsOfFrames;
+};
+
+static Bytes rtpPacket(uint16_t seqNum, uint32_t timestamp, bool marker, const Bytes& payload, uint32_t ssrc = SSRC)
+{
+    Bytes packet = {
+        0x80, (unsigned char)((marker ? 0x80 : 0x00) | 96),
+        (unsigned char)(seqNum >> 8), (unsigned char)seqNum,
+        (unsigned char)(timestamp >> 24), (unsigned char)(timestamp >> 16), (unsigned char)(timestamp >> 8), (unsigned char)timestamp,
+        (unsigned char)(ssrc >> 24), (unsigned char)(ssrc >> 16), (unsigned char)(ssrc >> 8), (unsigned char)ssrc
+    };
+    packet.insert(packet.end(), payload.begin(), payload.end());
+    return packet;
+}
+
+static bool handle(H264RTPDepacketizer& depacketizer, Bytes packet)
+{
+    return depacketizer.handlePacket(packet.data(), packet.size());
+}
+
+// FU-A fragment of a NALU whose header is 0x65 (IDR slice, nal_ref_idc 3)
+static Bytes fuA(bool isStart, bool isEnd, const Bytes& data)
+{
+    Bytes payload = {0x7C, (unsigned char)((isStart ? 0x80 : 0x00) | (isEnd ? 0x40 : 0x00) | 0x05)};
+    payload.insert(payload.end(), data.begin(), data.end());
+    return payload;
+}
+
+BOOST_AUTO_TEST_CASE(SingleNALU)
+{
+    RecordingSink sink;
+    H264RTPDepacketizer depacketizer(&sink, FREQUENCY);
+
+    BOOST_CHECK(handle(depacketizer, rtpPacket(1, 90000, true, {0x41, 1, 2, 3})));
+    BOOST_REQUIRE_EQUAL(sink.nalus.size(), 1);
+    BOOST_CHECK(sink.nalus[0] == Bytes({0x41, 1, 2, 3}));
+    BOOST_CHECK(sink.lastNALUsOfFrames[0]);
+    // Presentation times come from the RTP timestamps
+    BOOST_CHECK_EQUAL(sink.presentationTimes[0], 1000000);
+    BOOST_CHECK_EQUAL(depacketizer.getSSRC(), SSRC);
+
+    // Not RTP
+    Bytes notRTP = {0x40, 0, 0, 1};
+    BOOST_CHECK(!handle(depacketizer, notRTP));
+}
+
+BOOST_AUTO_TEST_CASE(STAPA)
+{
+    RecordingSink sink;
+    H264RTPDepacketizer depacketizer(&sink, FREQUENCY);
+
+    // SPS, PPS and a slice in one packet
+    handle(depacketizer, rtpPacket(1, 0, true, {0x18,
+                                                0x00, 0x03, 0x67, 0xAA, 0xBB,
+                                                0x00, 0x02, 0x68, 0xCC,
+                                                0x00, 0x02, 0x65, 0xDD}));
+    BOOST_REQUIRE_EQUAL(sink.nalus.size(), 3);
+    BOOST_CHECK(sink.nalus[0] == Bytes({0x67, 0xAA, 0xBB}));
+    BOOST_CHECK(sink.nalus[1] == Bytes({0x68, 0xCC}));
+    BOOST_CHECK(sink.nalus[2] == Bytes({0x65, 0xDD}));
+    // Only the last NALU of the packet ends the frame
+    BOOST_CHECK(!sink.lastNALUsOfFrames[0]);
+    BOOST_CHECK(!sink.lastNALUsOfFrames[1]);
+    BOOST_CHECK(sink.lastNALUsOfFrames[2]);
+
+    // A size running past the packet ends the aggregate
+    handle(depacketizer, rtpPacket(2, 3000, true, {0x18, 0x00, 0x01, 0x41, 0x00, 0x09, 0x41}));
+    BOOST_CHECK_EQUAL(sink.nalus.size(), 4);
+    BOOST_CHECK(sink.nalus[3] == Bytes({0x41}));
+}
+
+BOOST_AUTO_TEST_CASE(FUA)
+{
+    RecordingSink sink;
+    H264RTPDepacketizer depacketizer(&sink, FREQUENCY);
+
+    handle(depacketizer, rtpPacket(1, 0, false, fuA(true,  false, {1, 2})));
+    handle(depacketizer, rtpPacket(2, 0, false, fuA(false, false, {3, 4})));
+    BOOST_CHECK(sink.nalus.empty());
+    handle(depacketizer, rtpPacket(3, 0, true,  fuA(false, true,  {5})));
+
+    // The NALU header is rebuilt from the FU indicator and the FU header
+    BOOST_REQUIRE_EQUAL(sink.nalus.size(), 1);
+    BOOST_CHECK(sink.nalus[0] == Bytes({0x65, 1, 2, 3, 4, 5}));
+    BOOST_CHECK(sink.lastNALUsOfFrames[0]);
+    BOOST_CHECK_EQUAL(depacketizer.getStatistics().packetsCount, 3);
+}
+
+BOOST_AUTO_TEST_CASE(LostFragment)
+{
+    RecordingSink sink;
+    H264RTPDepacketizer depacketizer(&sink, FREQUENCY);
+
+    // The middle fragment is lost -> the NALU is aborted, not handed on with a hole
+    handle(depacketizer, rtpPacket(1, 0, false, fuA(true,  false, {1, 2})));
+    handle(depacketizer, rtpPacket(3, 0, true,  fuA(false, true,  {5})));
+    BOOST_CHECK(sink.nalus.empty());
+    BOOST_CHECK_EQUAL(sink.abortedCount, 1);
+
+    // The start of the next NALU is lost -> its other fragments are skipped
+    handle(depacketizer, rtpPacket(5, 3000, true, fuA(false, true, {6})));
+    BOOST_CHECK(sink.nalus.empty());
+
+    // The next complete NALU gets through
+    handle(depacketizer, rtpPacket(6, 6000, false, fuA(true,  false, {7})));
+    handle(depacketizer, rtpPacket(7, 6000, true,  fuA(false, true,  {8})));
+    BOOST_REQUIRE_EQUAL(sink.nalus.size(), 1);
+    BOOST_CHECK(sink.nalus[0] == Bytes({0x65, 7, 8}));
+
+    H264RTPDepacketizer::Statistics statistics = depacketizer.getStatistics();
+    BOOST_CHECK_EQUAL(statistics.lostPacketsCount, 2);
+    BOOST_CHECK_EQUAL(statistics.abortedNALUsCount, 1);
+}
+
+BOOST_AUTO_TEST_CASE(LostEnd)
+{
+    RecordingSink sink;
+    H264RTPDepacketizer depacketizer(&sink, FREQUENCY);
+
+    // A new start while a NALU is still open without a gap in between:
+    // the sender cut the NALU short, so it is aborted
+    handle(depacketizer, rtpPacket(1, 0, false, fuA(true, false, {1})));
+    handle(depacketizer, rtpPacket(2, 0, true,  fuA(true, true,  {2})));
+    BOOST_CHECK_EQUAL(sink.abortedCount, 1);
+    BOOST_REQUIRE_EQUAL(sink.nalus.size(), 1);
+    BOOST_CHECK(sink.nalus[0] == Bytes({0x65, 2}));
+}
+
+BOOST_AUTO_TEST_CASE(LatePacket)
+{
+    RecordingSink sink;
+    H264RTPDepacketizer depacketizer(&sink, FREQUENCY);
+
+    handle(depacketizer, rtpPacket(10, 0, true, {0x41, 1}));
+    handle(depacketizer, rtpPacket(12, 0, true, {0x41, 3}));
+    // There is no reordering buffer
+    handle(depacketizer, rtpPacket(11, 0, true, {0x41, 2}));
+    BOOST_CHECK_EQUAL(sink.nalus.size(), 2);
+
+    H264RTPDepacketizer::Statistics statistics = depacketizer.getStatistics();
+    BOOST_CHECK_EQUAL(statistics.latePacketsCount, 1);
+    BOOST_CHECK_EQUAL(statistics.lostPacketsCount, 1);
+    BOOST_CHECK_EQUAL(statistics.packetsCount, 2);
+}
+
+BOOST_AUTO_TEST_CASE(WrapAround)
+{
+    RecordingSink sink;
+    H264RTPDepacketizer depacketizer(&sink, FREQUENCY);
+
+    // Sequence numbers and timestamps both wrap around
+    handle(depacketizer, rtpPacket(65535, 0xFFFFFFFF - 2999, true, {0x41, 1}));
+    handle(depacketizer, rtpPacket(0,     0x00000000 + 1,    true, {0x41, 2}));
+    BOOST_REQUIRE_EQUAL(sink.nalus.size(), 2);
+    BOOST_CHECK_EQUAL(depacketizer.getStatistics().lostPacketsCount, 0);
+    BOOST_CHECK_EQUAL(sink.presentationTimes[1] - sink.presentationTimes[0], 3001 * 1000000LL / FREQUENCY);
+}
+
+BOOST_AUTO_TEST_CASE(NewStream)
+{
+    RecordingSink sink;
+    H264RTPDepacketizer depacketizer(&sink, FREQUENCY);
+
+    handle(depacketizer, rtpPacket(1000, 0, true, {0x41, 1}));
+    // The server restarted with a new SSRC and sequence numbers
+    handle(depacketizer, rtpPacket(5, 0, true, {0x41, 2}, 0xCAFE));
+    BOOST_CHECK_EQUAL(sink.nalus.size(), 2);
+    BOOST_CHECK_EQUAL(depacketizer.getSSRC(), 0xCAFE);
+    BOOST_CHECK_EQUAL(depacketizer.getStatistics().latePacketsCount, 0);
+}
+
+BOOST_AUTO_TEST_CASE(HeaderExtensionAndPadding)
+{
+    RecordingSink sink;
+    H264RTPDepacketizer depacketizer(&sink, FREQUENCY);
+
+    // One CSRC, a one-word header extension and two bytes of padding
+    Bytes packet = rtpPacket(1, 0, true, {0xDE, 0xAD, 0xBE, 0xEF,
+                                          0xBE, 0xDE, 0x00, 0x01, 0x11, 0x22, 0x33, 0x44,
+                                          0x41, 7, 8,
+                                          0x00, 0x02});
+    packet[0] |= 0x10 | 0x20 | 0x01;
+    BOOST_CHECK(handle(depacketizer, packet));
+    BOOST_REQUIRE_EQUAL(sink.nalus.size(), 1);
+    BOOST_CHECK(sink.nalus[0] == Bytes({0x41, 7, 8}));
+}
@@ -0,0 +1,76 @@
+#define BOOST_TEST_MODULE PlayoutDeadline
+#include <boost/test/unit_test.hpp>
+
+#include "AlloReceiver/PlayoutDeadline.hpp"
+
+namespace bc = boost::chrono;
+
+const bc::microseconds JITTER_BUDGET(50000);
+const size_t           MAX_CUBEMAPS_COUNT = 2;
+const size_t           FACES_COUNT        = 12;
+
+static const bc::steady_clock::time_point START_TIME = bc::steady_clock::time_point(bc::seconds(1000));
+
+BOOST_AUTO_TEST_CASE(Deadline)
+{
+    PlayoutDeadline playoutDeadline(JITTER_BUDGET, MAX_CUBEMAPS_COUNT, false);
+    BOOST_CHECK(playoutDeadline.getDeadline(START_TIME) == START_TIME + JITTER_BUDGET);
+}
+
+BOOST_AUTO_TEST_CASE(CompleteCubemap)
+{
+    PlayoutDeadline playoutDeadline(JITTER_BUDGET, MAX_CUBEMAPS_COUNT, false);
+    bc::steady_clock::time_point deadline = playoutDeadline.getDeadline(START_TIME);
+    bc::steady_clock::time_point wakeTime;
+
+    // Released as soon as the last face arrives, long before the deadline
+    BOOST_CHECK(!playoutDeadline.isDue(FACES_COUNT - 1, FACES_COUNT, deadline, 1, START_TIME + bc::milliseconds(1), wakeTime));
+    BOOST_CHECK(playoutDeadline.isDue(FACES_COUNT, FACES_COUNT, deadline, 1, START_TIME + bc::milliseconds(1), wakeTime));
+}
+
+BOOST_AUTO_TEST_CASE(PartialCubemap)
+{
+    PlayoutDeadline playoutDeadline(JITTER_BUDGET, MAX_CUBEMAPS_COUNT, false);
+    bc::steady_clock::time_point deadline = playoutDeadline.getDeadline(START_TIME);
+    bc::steady_clock::time_point wakeTime;
+
+    // A face is missing: wait for it until the deadline at most
+    BOOST_CHECK(!playoutDeadline.isDue(FACES_COUNT - 1, FACES_COUNT, deadline, 1, START_TIME + bc::milliseconds(10), wakeTime));
+    BOOST_CHECK(wakeTime == deadline);
+
+    // Then the cubemap goes out without it
+    BOOST_CHECK(playoutDeadline.isDue(FACES_COUNT - 1, FACES_COUNT, deadline, 1, deadline, wakeTime));
+    BOOST_CHECK(playoutDeadline.isDue(1, FACES_COUNT, deadline, 1, deadline + bc::milliseconds(1), wakeTime));
+}
+
+BOOST_AUTO_TEST_CASE(FullBuffer)
+{
+    PlayoutDeadline playoutDeadline(JITTER_BUDGET, MAX_CUBEMAPS_COUNT, false);
+    bc::steady_clock::time_point deadline = playoutDeadline.getDeadline(START_TIME);
+    bc::steady_clock::time_point wakeTime;
+
+    // A newer cubemap than the buffer holds releases the oldest before its deadline
+    BOOST_CHECK(!playoutDeadline.isDue(1, FACES_COUNT, deadline, MAX_CUBEMAPS_COUNT, START_TIME, wakeTime));
+    BOOST_CHECK(playoutDeadline.isDue(1, FACES_COUNT, deadline, MAX_CUBEMAPS_COUNT + 1, START_TIME, wakeTime));
+}
+
+BOOST_AUTO_TEST_CASE(WaitForAllFaces)
+{
+    PlayoutDeadline playoutDeadline(JITTER_BUDGET, MAX_CUBEMAPS_COUNT, true);
+    bc::steady_clock::time_point deadline = playoutDeadline.getDeadline(START_TIME);
+    bc::steady_clock::time_point wakeTime;
+
+    // The deadline doesn't matter, only another face or a full buffer do
+    BOOST_CHECK(!playoutDeadline.isDue(FACES_COUNT - 1, FACES_COUNT, deadline, 1, deadline + bc::seconds(10), wakeTime));
+    BOOST_CHECK(wakeTime == bc::steady_clock::time_point::max());
+    BOOST_CHECK(playoutDeadline.isDue(FACES_COUNT, FACES_COUNT, deadline, 1, deadline + bc::seconds(10), wakeTime));
+    BOOST_CHECK(playoutDeadline.isDue(1, FACES_COUNT, deadline, MAX_CUBEMAPS_COUNT + 1, START_TIME, wakeTime));
+}
+
+BOOST_AUTO_TEST_CASE(NoJitterBudget)
+{
+    // Partial cubemaps go out right away
+    PlayoutDeadline playoutDeadline(bc::microseconds(0), MAX_CUBEMAPS_COUNT, false);
+    bc::steady_clock::time_point wakeTime;
+    BOOST_CHECK(playoutDeadline.isDue(1, FACES_COUNT, playoutDeadline.getDeadline(START_TIME), 1, START_TIME, wakeTime));
+}
@@ -0,0 +1,84 @@
+#define BOOST_TEST_MODULE PresentationScheduler
+#include <boost/test/unit_test.hpp>
+
+#include "AlloReceiver/PresentationScheduler.hpp"
+
+namespace bc = boost::chrono;
+
+const int64_t PTS = 1500000000000000LL; // microseconds since the epoch on the server's clock
+
+static bc::system_clock::time_point localTime(int64_t microseconds)
+{
+    return bc::system_clock::time_point(bc::microseconds(microseconds));
+}
+
+BOOST_AUTO_TEST_CASE(NoLatencyBudget)
+{
+    // Cubemaps are shown as soon as they are complete
+    PresentationScheduler scheduler(bc::microseconds(0), bc::microseconds(0));
+    bc::system_clock::time_point targetTime;
+    BOOST_CHECK(!scheduler.getTargetTime(PTS, localTime(PTS), targetTime));
+}
+
+BOOST_AUTO_TEST_CASE(LatencyBudget)
+{
+    PresentationScheduler scheduler(bc::microseconds(100000), bc::microseconds(0));
+    bc::system_clock::time_point targetTime;
+    BOOST_CHECK(scheduler.getTargetTime(PTS, localTime(PTS + 30000), targetTime));
+    BOOST_CHECK(targetTime == localTime(PTS + 100000));
+
+    // Every node shows the cubemap at the same time no matter when it got it
+    bc::system_clock::time_point slowNodeTargetTime;
+    BOOST_CHECK(scheduler.getTargetTime(PTS, localTime(PTS + 90000), slowNodeTargetTime));
+    BOOST_CHECK(slowNodeTargetTime == targetTime);
+
+    scheduler.setLatencyBudget(bc::microseconds(0));
+    BOOST_CHECK(!scheduler.getTargetTime(PTS, localTime(PTS + 30000), targetTime));
+}
+
+BOOST_AUTO_TEST_CASE(ClockOffset)
+{
+    // The server's clock is 2 s ahead of ours
+    PresentationScheduler scheduler(bc::microseconds(100000), bc::microseconds(2000000));
+    bc::system_clock::time_point targetTime;
+    BOOST_CHECK(scheduler.getTargetTime(PTS, localTime(PTS - 2000000 + 30000), targetTime));
+    BOOST_CHECK(targetTime == localTime(PTS - 2000000 + 100000));
+}
+
+BOOST_AUTO_TEST_CASE(ImplausibleTarget)
+{
+    // Without the offset the target is 10 s ahead, which would stall the stream
+    PresentationScheduler scheduler(bc::microseconds(100000), bc::microseconds(0));
+    bc::system_clock::time_point targetTime;
+    BOOST_CHECK(!scheduler.getTargetTime(PTS, localTime(PTS - 10000000), targetTime));
+
+    scheduler.setClockOffset(bc::microseconds(10000000));
+    BOOST_CHECK(scheduler.getTargetTime(PTS, localTime(PTS - 10000000), targetTime));
+}
+
+BOOST_AUTO_TEST_CASE(LateCubemap)
+{
+    // A target in the past is still returned; the cubemap is then shown right away
+    PresentationScheduler scheduler(bc::microseconds(100000), bc::microseconds(0));
+    bc::system_clock::time_point targetTime;
+    BOOST_CHECK(scheduler.getTargetTime(PTS, localTime(PTS + 500000), targetTime));
+    BOOST_CHECK(targetTime < localTime(PTS + 500000));
+}
+
+BOOST_AUTO_TEST_CASE(ClockOffsetEstimate)
+{
+    PresentationScheduler scheduler(bc::microseconds(100000), bc::microseconds(5000000));
+    ClockOffsetEstimator estimator;
+    scheduler.setClockOffsetEstimator(&estimator);
+
+    // No samples yet: the configured offset still counts
+    BOOST_CHECK_EQUAL(scheduler.getClockOffset().count(), 5000000);
+
+    // The estimate takes over once there are samples
+    int64_t now = bc::duration_cast<bc::microseconds>(bc::system_clock::now().time_since_epoch()).count();
+    estimator.addSample(now + 3000000, now);
+    BOOST_CHECK_EQUAL(scheduler.getClockOffset().count(), 3000000);
+
+    scheduler.setClockOffsetEstimator(nullptr);
+    BOOST_CHECK_EQUAL(scheduler.getClockOffset().count(), 5000000);
+}
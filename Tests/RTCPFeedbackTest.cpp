@@ -0,0 +1,116 @@
+#define BOOST_TEST_MODULE RTCPFeedback
+#include <boost/test/unit_test.hpp>
+
+#include "AlloShared/RTCPFeedback.hpp"
+
+const uint32_t SENDER_SSRC = 0x11223344;
+const uint32_t MEDIA_SSRC  = 0xAABBCCDD;
+
+static std::vector<uint16_t> nackRoundTrip(const std::vector<uint16_t>& seqNums)
+{
+    uint8_t buffer[1500];
+    size_t size = RTCPFeedback::buildNACK(SENDER_SSRC, MEDIA_SSRC, seqNums, buffer, sizeof(buffer));
+    BOOST_CHECK(size > 0);
+
+    std::vector<RTCPFeedback::Message> messages = RTCPFeedback::parse(buffer, size);
+    BOOST_REQUIRE_EQUAL(messages.size(), 1);
+    BOOST_CHECK_EQUAL(messages[0].type,       RTCPFeedback::Message::NACK);
+    BOOST_CHECK_EQUAL(messages[0].senderSSRC, SENDER_SSRC);
+    BOOST_CHECK_EQUAL(messages[0].mediaSSRC,  MEDIA_SSRC);
+    return messages[0].seqNums;
+}
+
+BOOST_AUTO_TEST_CASE(NACK)
+{
+    // Out of order, relative to the first one. 101, 105 and 116 fit into the bitmask of 100,
+    // 117 needs its own entry.
+    std::vector<uint16_t> seqNums         = { 100, 117, 105, 116, 101, 200 };
+    std::vector<uint16_t> expectedSeqNums = { 100, 101, 105, 116, 117, 200 };
+    std::vector<uint16_t> parsedSeqNums   = nackRoundTrip(seqNums);
+    BOOST_CHECK_EQUAL_COLLECTIONS(parsedSeqNums.begin(), parsedSeqNums.end(), expectedSeqNums.begin(), expectedSeqNums.end());
+}
+
+BOOST_AUTO_TEST_CASE(NACKWrapAround)
+{
+    std::vector<uint16_t> seqNums         = { 65534, 1, 65535, 0 };
+    std::vector<uint16_t> expectedSeqNums = { 65534, 65535, 0, 1 };
+    std::vector<uint16_t> parsedSeqNums   = nackRoundTrip(seqNums);
+    BOOST_CHECK_EQUAL_COLLECTIONS(parsedSeqNums.begin(), parsedSeqNums.end(), expectedSeqNums.begin(), expectedSeqNums.end());
+}
+
+BOOST_AUTO_TEST_CASE(NACKDuplicates)
+{
+    std::vector<uint16_t> seqNums         = { 7, 7, 8, 7 };
+    std::vector<uint16_t> expectedSeqNums = { 7, 8 };
+    std::vector<uint16_t> parsedSeqNums   = nackRoundTrip(seqNums);
+    BOOST_CHECK_EQUAL_COLLECTIONS(parsedSeqNums.begin(), parsedSeqNums.end(), expectedSeqNums.begin(), expectedSeqNums.end());
+}
+
+BOOST_AUTO_TEST_CASE(NACKInvalid)
+{
+    uint8_t buffer[1500];
+    BOOST_CHECK_EQUAL(RTCPFeedback::buildNACK(SENDER_SSRC, MEDIA_SSRC, std::vector<uint16_t>(), buffer, sizeof(buffer)), 0);
+
+    // Empty RR (8 bytes) + NACK header (12 bytes) + one FCI (4 bytes)
+    std::vector<uint16_t> seqNums(1, 42);
+    BOOST_CHECK_EQUAL(RTCPFeedback::buildNACK(SENDER_SSRC, MEDIA_SSRC, seqNums, buffer, 23), 0);
+    BOOST_CHECK_EQUAL(RTCPFeedback::buildNACK(SENDER_SSRC, MEDIA_SSRC, seqNums, buffer, 24), 24);
+}
+
+BOOST_AUTO_TEST_CASE(PLI)
+{
+    uint8_t buffer[1500];
+    size_t size = RTCPFeedback::buildPLI(SENDER_SSRC, MEDIA_SSRC, buffer, sizeof(buffer));
+    BOOST_CHECK_EQUAL(size, 20);
+    BOOST_CHECK_EQUAL(RTCPFeedback::buildPLI(SENDER_SSRC, MEDIA_SSRC, buffer, 19), 0);
+
+    std::vector<RTCPFeedback::Message> messages = RTCPFeedback::parse(buffer, size);
+    BOOST_REQUIRE_EQUAL(messages.size(), 1);
+    BOOST_CHECK_EQUAL(messages[0].type,       RTCPFeedback::Message::PLI);
+    BOOST_CHECK_EQUAL(messages[0].senderSSRC, SENDER_SSRC);
+    BOOST_CHECK_EQUAL(messages[0].mediaSSRC,  MEDIA_SSRC);
+}
+
+BOOST_AUTO_TEST_CASE(FIR)
+{
+    uint8_t buffer[1500];
+    size_t size = RTCPFeedback::buildFIR(SENDER_SSRC, MEDIA_SSRC, 213, buffer, sizeof(buffer));
+    BOOST_CHECK_EQUAL(size, 28);
+    BOOST_CHECK_EQUAL(RTCPFeedback::buildFIR(SENDER_SSRC, MEDIA_SSRC, 213, buffer, 27), 0);
+
+    std::vector<RTCPFeedback::Message> messages = RTCPFeedback::parse(buffer, size);
+    BOOST_REQUIRE_EQUAL(messages.size(), 1);
+    BOOST_CHECK_EQUAL(messages[0].type,       RTCPFeedback::Message::FIR);
+    BOOST_CHECK_EQUAL(messages[0].senderSSRC, SENDER_SSRC);
+    BOOST_CHECK_EQUAL(messages[0].mediaSSRC,  MEDIA_SSRC);
+    BOOST_CHECK_EQUAL(messages[0].firSeqNum,  213);
+}
+
+BOOST_AUTO_TEST_CASE(Compound)
+{
+    // Two compound packets sent as one, e.g. by a server that batches feedback
+    uint8_t buffer[1500];
+    size_t size = RTCPFeedback::buildPLI(SENDER_SSRC, MEDIA_SSRC, buffer, sizeof(buffer));
+    size += RTCPFeedback::buildNACK(SENDER_SSRC, MEDIA_SSRC + 1, std::vector<uint16_t>(1, 9), buffer + size, sizeof(buffer) - size);
+
+    std::vector<RTCPFeedback::Message> messages = RTCPFeedback::parse(buffer, size);
+    BOOST_REQUIRE_EQUAL(messages.size(), 2);
+    BOOST_CHECK_EQUAL(messages[0].type,           RTCPFeedback::Message::PLI);
+    BOOST_CHECK_EQUAL(messages[1].type,           RTCPFeedback::Message::NACK);
+    BOOST_CHECK_EQUAL(messages[1].mediaSSRC,      MEDIA_SSRC + 1);
+    BOOST_REQUIRE_EQUAL(messages[1].seqNums.size(), 1);
+    BOOST_CHECK_EQUAL(messages[1].seqNums[0],     9);
+
+    // A truncated feedback message is dropped, the RR before it is still read
+    BOOST_CHECK(RTCPFeedback::parse(buffer, 16).empty());
+    // Not RTP version 2
+    buffer[0] &= 0x3F;
+    BOOST_CHECK(RTCPFeedback::parse(buffer, size).empty());
+}
+
+BOOST_AUTO_TEST_CASE(RTPHeader)
+{
+    uint8_t packet[RTCPFeedback::RTP_HEADER_SIZE] = { 0x80, 96, 0x12, 0x34, 0, 0, 0, 0, 0xDE, 0xAD, 0xBE, 0xEF };
+    BOOST_CHECK_EQUAL(RTCPFeedback::rtpSeqNum(packet), 0x1234);
+    BOOST_CHECK_EQUAL(RTCPFeedback::rtpSSRC(packet),   0xDEADBEEF);
+}
@@ -0,0 +1,105 @@
+#define BOOST_TEST_MODULE ReconnectionPolicy
+#include <boost/test/unit_test.hpp>
+
+#include "AlloReceiver/ReconnectionPolicy.hpp"
+
+namespace bc = boost::chrono;
+
+const bc::seconds      STREAM_TIMEOUT(3);
+const bc::seconds      CONNECT_TIMEOUT(5);
+const bc::milliseconds MIN_DELAY(250);
+const bc::seconds      MAX_DELAY(8);
+
+static const bc::steady_clock::time_point START_TIME = bc::steady_clock::time_point(bc::seconds(1000));
+
+static ReconnectionPolicy createPolicy()
+{
+    return ReconnectionPolicy(STREAM_TIMEOUT, CONNECT_TIMEOUT, MIN_DELAY, MAX_DELAY);
+}
+
+BOOST_AUTO_TEST_CASE(ConnectTimeout)
+{
+    ReconnectionPolicy policy = createPolicy();
+    policy.startConnecting(START_TIME);
+    BOOST_CHECK(!policy.isPlaying());
+    BOOST_CHECK(!policy.isServerGone(0, START_TIME + CONNECT_TIMEOUT));
+    BOOST_CHECK(policy.isServerGone(0, START_TIME + CONNECT_TIMEOUT + bc::milliseconds(1)));
+}
+
+BOOST_AUTO_TEST_CASE(StreamTimeout)
+{
+    ReconnectionPolicy policy = createPolicy();
+    policy.startConnecting(START_TIME);
+    BOOST_CHECK(policy.startPlaying(100, START_TIME) == bc::steady_clock::time_point());
+    BOOST_CHECK(policy.isPlaying());
+
+    // Packets keep coming in: the connect timeout doesn't matter anymore
+    bc::steady_clock::time_point time = START_TIME;
+    for (unsigned int packetsCount = 200; packetsCount < 2000; packetsCount += 100)
+    {
+        time += bc::seconds(1);
+        BOOST_CHECK(!policy.isServerGone(packetsCount, time));
+    }
+
+    // Then they stop
+    BOOST_CHECK(!policy.isServerGone(1900, time + STREAM_TIMEOUT));
+    BOOST_CHECK(policy.isServerGone(1900, time + STREAM_TIMEOUT + bc::milliseconds(1)));
+}
+
+BOOST_AUTO_TEST_CASE(Backoff)
+{
+    ReconnectionPolicy policy = createPolicy();
+    policy.startConnecting(START_TIME);
+
+    // The server is down: each failed attempt waits twice as long up to the maximum
+    bc::microseconds expectedDelay = MIN_DELAY;
+    for (int i = 0; i < 10; i++)
+    {
+        BOOST_CHECK_EQUAL(policy.closeSession().count(), expectedDelay.count());
+        expectedDelay = (std::min)(expectedDelay * 2, bc::microseconds(MAX_DELAY));
+    }
+    BOOST_CHECK_EQUAL(policy.closeSession().count(), bc::microseconds(MAX_DELAY).count());
+
+    // Streaming again starts the backoff over
+    policy.startPlaying(0, START_TIME);
+    BOOST_CHECK_EQUAL(policy.closeSession().count(), bc::microseconds(MIN_DELAY).count());
+    BOOST_CHECK_EQUAL(policy.closeSession().count(), bc::microseconds(MIN_DELAY * 2).count());
+}
+
+BOOST_AUTO_TEST_CASE(Outage)
+{
+    ReconnectionPolicy policy = createPolicy();
+    policy.startConnecting(START_TIME);
+    policy.startPlaying(0, START_TIME);
+
+    bc::steady_clock::time_point lastPacketTime = START_TIME + bc::seconds(10);
+    policy.isServerGone(500, lastPacketTime);
+    bc::steady_clock::time_point detectionTime = lastPacketTime + STREAM_TIMEOUT + bc::milliseconds(500);
+    BOOST_CHECK(policy.isServerGone(500, detectionTime));
+
+    // The outage started with the last packet, not when it was noticed
+    policy.closeSession();
+    BOOST_CHECK(!policy.isPlaying());
+    BOOST_CHECK(policy.getOutageStartTime() == lastPacketTime);
+    BOOST_CHECK_EQUAL(policy.getFailedAttemptsCount(), 0);
+
+    // Two attempts fail, each after the connect timeout
+    for (int i = 0; i < 2; i++)
+    {
+        bc::steady_clock::time_point attemptTime = detectionTime + bc::seconds(10 * (i + 1));
+        policy.startConnecting(attemptTime);
+        BOOST_CHECK(policy.isServerGone(0, attemptTime + CONNECT_TIMEOUT + bc::milliseconds(1)));
+        policy.closeSession();
+    }
+    BOOST_CHECK_EQUAL(policy.getFailedAttemptsCount(), 2);
+    BOOST_CHECK(policy.getOutageStartTime() == lastPacketTime);
+
+    // The third one gets through
+    bc::steady_clock::time_point reconnectTime = detectionTime + bc::seconds(30);
+    policy.startConnecting(reconnectTime);
+    BOOST_CHECK(policy.startPlaying(0, reconnectTime) == lastPacketTime);
+    BOOST_CHECK(policy.getOutageStartTime() == bc::steady_clock::time_point());
+
+    // The packet count of the new session starts over; the stream is still alive
+    BOOST_CHECK(!policy.isServerGone(0, reconnectTime + bc::seconds(1)));
+}
@@ -1,19 +1,16 @@
 #include "Renderer.hpp"
 
+const boost::chrono::milliseconds MAILBOX_WAIT_TIMEOUT(100); // how often the render thread checks whether it is stopped
+
 Renderer::Renderer(CubemapSource* cubemapSource)
     :
-	cubemapSource(cubemapSource), renderer(nullptr)
+	cubemapSource(cubemapSource), renderer(nullptr), isStopped(false)
 {
 	std::function<StereoCubemap* (CubemapSource*, StereoCubemap*)> callback = boost::bind(&Renderer::onNextCubemap,
                                                                                           this,
                                                                                           _1,
                                                                                           _2);
 
-	for (int i = 0; i < 1; i++)
-	{
-		cubemapPool.push(nullptr);
-	}
-
 	if (SDL_Init(SDL_INIT_VIDEO))
 	{
 		fprintf(stderr, "Could not initialize SDL - %s\n", SDL_GetError());
@@ -34,8 +31,7 @@ Renderer::Renderer(CubemapSource* cubemapSource)
 
 Renderer::~Renderer()
 {
-	cubemapBuffer.close();
-	cubemapPool.close();
+	isStopped = true;
 	renderThread.join();
 
 	//Clean up our objects and quit
@@ -50,21 +46,7 @@ Renderer::~Renderer()
 
 StereoCubemap* Renderer::onNextCubemap(CubemapSource* source, StereoCubemap* cubemap)
 {
-	StereoCubemap* oldCubemap;
-	if (!cubemapPool.tryPop(oldCubemap))
-	{
-		if (cubemapPool.isClosed())
-		{
-			return nullptr;
-		}
-		else
-		{
-			return cubemap;
-		}
-	}
-
-	cubemapBuffer.push(cubemap);
-	return oldCubemap;
+	return cubemapMailbox.publish(cubemap);
 }
 
 void Renderer::setOnDisplayedFrame(const std::function<void (Renderer*)>& callback)
@@ -101,19 +83,10 @@ void Renderer::createTextures(StereoCubemap* cubemap)
 			CubemapFace* face = eye->getFace(i);
 			if (face)
 			{
-				SDL_Texture* texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ABGR8888, SDL_TEXTUREACCESS_STREAMING, face->getContent()->getWidth(), face->getContent()->getHeight());
-				if (texture == nullptr)
-				{
-					SDL_DestroyRenderer(renderer);
-					SDL_DestroyWindow(window);
-					std::cerr << "SDL_CreateTextureFromSurface Error: " << SDL_GetError() << std::endl;
-					SDL_Quit();
-					abort();
-				}
-
-				textures.push_back(texture);
+				textures.push_back(createTexture(face->getContent()));
 			}
 			else {
+				// Created once the face shows up
 				textures.push_back(nullptr);
 			}
 			
@@ -121,6 +94,20 @@ void Renderer::createTextures(StereoCubemap* cubemap)
 	}
 }
 
+SDL_Texture* Renderer::createTexture(Frame* content)
+{
+	SDL_Texture* texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_IYUV, SDL_TEXTUREACCESS_STREAMING, content->getWidth(), content->getHeight());
+	if (texture == nullptr)
+	{
+		SDL_DestroyRenderer(renderer);
+		SDL_DestroyWindow(window);
+		std::cerr << "SDL_CreateTexture Error: " << SDL_GetError() << std::endl;
+		SDL_Quit();
+		abort();
+	}
+	return texture;
+}
+
 void Renderer::start()
 {
 	renderThread = boost::thread(boost::bind(&Renderer::renderLoop, this));
@@ -140,13 +127,13 @@ void Renderer::renderLoop()
 {
 	static int counter = 0;
 
-	while (true)
+	while (!isStopped)
 	{
-		StereoCubemap* cubemap;
-
-		if (!cubemapBuffer.waitAndPop(cubemap))
+		// Only the faces that changed since the last cubemap are drawn
+		StereoCubemap* cubemap = cubemapMailbox.waitAndTake(MAILBOX_WAIT_TIMEOUT);
+		if (!cubemap)
 		{
-			return;
+			continue;
 		}
 
 		if (!renderer)
@@ -170,14 +157,15 @@ void Renderer::renderLoop()
 					if (face)
 					{
 						Frame* content = eye->getFace(i)->getContent();
+						if (!textures[textureIndex])
+						{
+							textures[textureIndex] = createTexture(content);
+						}
 						SDL_Texture* texture = textures[textureIndex];
 
 						// Show cubemap
 
 
-						void* pixels;
-						int   pitch;
-
 						int width;
 						int height;
 						SDL_GetRendererOutputSize(renderer, &width, &height);
@@ -231,14 +219,17 @@ void Renderer::renderLoop()
 							dstrect.y += height / 2;
 						}
 
-						if (SDL_LockTexture(texture, NULL, &pixels, &pitch) < 0)
+						// The decoder's planes go in as they are, padded lines included.
+						// 1.5 bytes per pixel instead of 4 with RGBA.
+						if (SDL_UpdateYUVTexture(texture, NULL,
+						                         (const Uint8*)content->getPlane(0), content->getLineSize(0),
+						                         (const Uint8*)content->getPlane(1), content->getLineSize(1),
+						                         (const Uint8*)content->getPlane(2), content->getLineSize(2)) < 0)
 						{
-							SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Couldn't lock texture: %s\n", SDL_GetError());
+							SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Couldn't update texture: %s\n", SDL_GetError());
 							SDL_Quit();
 							abort();
 						}
-						memcpy(pixels, content->getPixels(), content->getHeight() * content->getWidth() * 4);
-						SDL_UnlockTexture(texture);
 
 						//Draw the texture
 						if (SDL_RenderCopy(renderer, texture, NULL, &dstrect) < 0)
@@ -262,7 +253,14 @@ void Renderer::renderLoop()
 			if (onDisplayedFrame) onDisplayedFrame(this);
 		}
 
-		cubemapPool.push(cubemap);
+		for (int j = 0; j < cubemap->getEyesCount(); j++)
+		{
+			Cubemap* eye = cubemap->getEye(j);
+			for (int i = 0; i < eye->getFacesCount(); i++)
+			{
+				eye->getFace(i, true)->setNewFaceFlag(false);
+			}
+		}
 		counter++;
 	}
 }
\ No newline at end of file
@@ -4,7 +4,8 @@
 #include <SDL.h>
 #undef main
 #include <boost/thread.hpp>
-#include "AlloShared/ConcurrentQueue.hpp"
+#include <atomic>
+#include "AlloShared/CubemapMailbox.hpp"
 #include "AlloReceiver/AlloReceiver.h"
 
 class Renderer
@@ -26,11 +27,13 @@ private:
 	StereoCubemap* onNextCubemap(CubemapSource* source, StereoCubemap* cubemap);
 	void renderLoop();
 	void createTextures(StereoCubemap* cubemap);
+	// Planar YUV420P texture the face's planes can be copied into as they are
+	SDL_Texture* createTexture(Frame* content);
 
 	boost::thread                    renderThread;
 	CubemapSource*                   cubemapSource;
-	ConcurrentQueue<StereoCubemap*> cubemapBuffer;
-	ConcurrentQueue<StereoCubemap*> cubemapPool;
+	CubemapMailbox                   cubemapMailbox;
+	std::atomic<bool>                isStopped;
 	SDL_Window*                      window;
 	SDL_Renderer*                    renderer;
 	std::vector<SDL_Texture*>        textures;
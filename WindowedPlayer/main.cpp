@@ -13,8 +13,6 @@
 
 #include "Renderer.hpp"
 
-const unsigned int DEFAULT_SINK_BUFFER_SIZE = 200000000;
-
 static Stats stats;
 static boost::barrier barrier(2);
 static CubemapSource* cubemapSource;
@@ -50,6 +48,46 @@ void onColorConvertedFrame(CubemapSource* source, u_int8_t type, size_t size, in
     stats.store(StatsUtils::Frame(type, size, face, StatsUtils::Frame::COLOR_CONVERTED));
 }
 
+void onCollectedFrame(CubemapSource* source, int face, boost::chrono::microseconds latency)
+{
+    stats.store(StatsUtils::CollectedFrame(face, latency));
+}
+
+void onCollectorIdle(CubemapSource* source, boost::chrono::microseconds duration)
+{
+    stats.store(StatsUtils::CollectorIdle(duration));
+}
+
+void onReleasedCubemap(CubemapSource* source, H264CubemapSource::ReleaseStatus status)
+{
+    stats.store(StatsUtils::ReleasedCubemap((StatsUtils::ReleasedCubemap::Status)status));
+}
+
+void onLateFrame(CubemapSource* source, int face)
+{
+    stats.store(StatsUtils::LateFrame(face));
+}
+
+void onDroppedFrame(CubemapSource* source, int face)
+{
+    stats.store(StatsUtils::DroppedFrame(face));
+}
+
+void onDecodingTime(CubemapSource* source, int face, boost::chrono::microseconds duration)
+{
+    stats.store(StatsUtils::DecodingTime(face, duration));
+}
+
+void onDegradationLevelChanged(CubemapSource* source, DecodeOverloadController::Level oldLevel, DecodeOverloadController::Level newLevel)
+{
+    stats.store(StatsUtils::DegradationLevelChange(oldLevel, newLevel));
+}
+
+void onRecovered(CubemapSource* source, boost::chrono::microseconds timeToPicture)
+{
+    stats.store(StatsUtils::Recovery(timeToPicture));
+}
+
 void onDisplayedCubemapFace(Renderer* renderer, int face)
 {
 	stats.store(StatsUtils::CubemapFace(face, StatsUtils::CubemapFace::DISPLAYED));
@@ -70,6 +108,14 @@ void onDidConnect(RTSPCubemapSourceClient* client, CubemapSource* cubemapSource)
         h264CubemapSource->setOnReceivedFrame      (boost::bind(&onReceivedFrame,       _1, _2, _3, _4));
         h264CubemapSource->setOnDecodedFrame       (boost::bind(&onDecodedFrame,        _1, _2, _3, _4));
         h264CubemapSource->setOnColorConvertedFrame(boost::bind(&onColorConvertedFrame, _1, _2, _3, _4));
+        h264CubemapSource->setOnCollectedFrame     (boost::bind(&onCollectedFrame,      _1, _2, _3));
+        h264CubemapSource->setOnCollectorIdle      (boost::bind(&onCollectorIdle,       _1, _2));
+        h264CubemapSource->setOnReleasedCubemap    (boost::bind(&onReleasedCubemap,     _1, _2));
+        h264CubemapSource->setOnLateFrame          (boost::bind(&onLateFrame,           _1, _2));
+        h264CubemapSource->setOnDroppedFrame       (boost::bind(&onDroppedFrame,        _1, _2));
+        h264CubemapSource->setOnDecodingTime       (boost::bind(&onDecodingTime,        _1, _2, _3));
+        h264CubemapSource->setOnDegradationLevelChanged(boost::bind(&onDegradationLevelChanged, _1, _2, _3));
+        h264CubemapSource->setOnRecovered          (boost::bind(&onRecovered,           _1, _2));
     }
     
     stats.autoSummary(boost::chrono::seconds(10),
@@ -123,12 +169,17 @@ int main(int argc, char* argv[])
 	}
 	else
 	{
-		bufferSize = DEFAULT_SINK_BUFFER_SIZE;
+		bufferSize = DEFAULT_SOCKET_BUFFER_SIZE;
 	}
 
-	std::cout << "Buffer size " << to_human_readable_byte_count(bufferSize, false, false) << std::endl;
+	std::cout << "Socket buffer size " << to_human_readable_byte_count(bufferSize, false, false) << std::endl;
 
-	rtspClient = RTSPCubemapSourceClient::create(vm["url"].as<std::string>().c_str(), bufferSize, AV_PIX_FMT_RGBA, false, false, 5, interfaceAddress);
+	RTSPCubemapSourceClient::Options options;
+	options.socketBufferSize = bufferSize;
+	options.format           = NATIVE_PIX_FMT; // YUV420P straight from the decoder
+	options.maxFrameMapSize  = 5;
+	options.interfaceAddress = interfaceAddress;
+	rtspClient = RTSPCubemapSourceClient::create(vm["url"].as<std::string>().c_str(), options);
     std::function<void (RTSPCubemapSourceClient*, CubemapSource*)> callback(boost::bind(&onDidConnect, _1, _2));
     rtspClient->setOnDidConnect(callback);
     rtspClient->connect();
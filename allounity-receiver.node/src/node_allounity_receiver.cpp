@@ -5,9 +5,108 @@
 
 #include <uv.h>
 #include <pthread.h>
+#include <vector>
 
 using namespace v8;
 
+// A frame leased from a VideoSource. Its faces' pixels are exposed as external
+// ArrayBuffers without copying. The lease is released by release() or when the
+// object is garbage collected. Either way the ArrayBuffers are detached.
+class NODE_FrameLease : public node::ObjectWrap {
+public:
+    static void Init() {
+        NanScope();
+
+        v8::Local<v8::FunctionTemplate> tpl = NanNew<v8::FunctionTemplate>();
+        tpl->SetClassName(NanNew<v8::String>("FrameLease"));
+        tpl->InstanceTemplate()->SetInternalFieldCount(1);
+
+        NODE_SET_PROTOTYPE_METHOD(tpl, "getFace", NODE_getFace);
+        NODE_SET_PROTOTYPE_METHOD(tpl, "release", NODE_release);
+
+        NanAssignPersistent(constructor, tpl->GetFunction());
+    }
+
+    // source_handle is kept alive as long as the lease exists
+    static Handle<Object> NewInstance(VideoSource* source, VideoSource::Frame* frame, Handle<Object> source_handle) {
+        NanEscapableScope();
+        Local<Object> instance = NanNew<v8::Function>(constructor)->NewInstance();
+        NODE_FrameLease* lease = new NODE_FrameLease(source, frame);
+        NanAssignPersistent(lease->source_handle_, source_handle);
+        lease->Wrap(instance);
+        return NanEscapeScope(instance);
+    }
+
+private:
+    NODE_FrameLease(VideoSource* source, VideoSource::Frame* frame)
+    : source_(source), frame_(frame) { }
+
+    ~NODE_FrameLease() {
+        release();
+        NanDisposePersistent(source_handle_);
+    }
+
+    void release() {
+        if(!frame_) return;
+        NanScope();
+        for(Persistent<ArrayBuffer>* buffer : buffers_) {
+            NanNew(*buffer)->Neuter();
+            NanDisposePersistent(*buffer);
+            delete buffer;
+        }
+        buffers_.clear();
+        source_->releaseFrame(frame_);
+        frame_ = nullptr;
+    }
+
+    VideoSource* source_;
+    VideoSource::Frame* frame_;
+    Persistent<Object> source_handle_;
+    std::vector<Persistent<ArrayBuffer>*> buffers_; // handed out for this lease
+
+    static NAN_METHOD(NODE_getFace);
+    static NAN_METHOD(NODE_release);
+
+    static v8::Persistent<v8::Function> constructor;
+};
+
+v8::Persistent<v8::Function> NODE_FrameLease::constructor;
+
+NAN_METHOD(NODE_FrameLease::NODE_getFace) {
+    NanScope();
+    NODE_FrameLease* obj = node::ObjectWrap::Unwrap<NODE_FrameLease>(args.This());
+    if(!obj->frame_) {
+        return NanThrowError("FrameLease::getFace: the frame has been released.");
+    }
+
+    int subimage_id = args[0]->IntegerValue();
+    int eye_id = args[1]->IntegerValue();
+
+    VideoSource::PixelData* pixels = obj->frame_->getSubImage(subimage_id, eye_id);
+    if(!pixels) NanReturnUndefined();
+
+    // Backed by the leased frame's memory
+    Local<ArrayBuffer> buffer = ArrayBuffer::New(v8::Isolate::GetCurrent(), pixels->pixels(), pixels->height() * pixels->stride());
+    Persistent<ArrayBuffer>* persistent = new Persistent<ArrayBuffer>();
+    NanAssignPersistent(*persistent, buffer);
+    obj->buffers_.push_back(persistent);
+
+    Handle<Object> ret = NanNew<Object>();
+    ret->Set(NanNew<String>("pixels"), buffer);
+    ret->Set(NanNew<String>("width"), NanNew<Integer>(pixels->width()));
+    ret->Set(NanNew<String>("height"), NanNew<Integer>(pixels->height()));
+    ret->Set(NanNew<String>("stride"), NanNew<Integer>(pixels->stride()));
+
+    NanReturnValue(ret);
+}
+
+NAN_METHOD(NODE_FrameLease::NODE_release) {
+    NanScope();
+    NODE_FrameLease* obj = node::ObjectWrap::Unwrap<NODE_FrameLease>(args.This());
+    obj->release();
+    NanReturnUndefined();
+}
+
 class NODE_VideoSource : public node::ObjectWrap {
 public:
     static void Init(v8::Handle<v8::Object> exports) {
@@ -20,6 +119,7 @@ public:
 
         // Prototype.
         NODE_SET_PROTOTYPE_METHOD(tpl, "getCurrentFrame", NODE_getCurrentFrame);
+        NODE_SET_PROTOTYPE_METHOD(tpl, "leaseFrame", NODE_leaseFrame);
         NODE_SET_PROTOTYPE_METHOD(tpl, "onFrame", NODE_onFrame);
         NODE_SET_PROTOTYPE_METHOD(tpl, "stop", NODE_stop);
 
@@ -44,6 +144,8 @@ private:
     }
     ~NODE_VideoSource() {
         stop();
+        // Not before now since leases may still be released after stop()
+        if(source_) VideoSource::Destroy(source_);
         uv_unref((uv_handle_t*)&async_);
         uv_mutex_destroy(&mutex_);
         NanDisposePersistent(on_frame_callback_);
@@ -82,7 +184,6 @@ private:
                     uv_async_send(&async_);
                 }
             }
-            VideoSource::Destroy(source_);
         } catch(...) {
         }
     }
@@ -101,6 +202,7 @@ private:
 
     static NAN_METHOD(NODE_onFrame);
     static NAN_METHOD(NODE_getCurrentFrame);
+    static NAN_METHOD(NODE_leaseFrame);
     static NAN_METHOD(NODE_stop);
 
     static v8::Persistent<v8::Function> constructor;
@@ -165,7 +267,7 @@ NAN_METHOD(NODE_VideoSource::NODE_getCurrentFrame) {
 
     VideoSource::PixelData* pixels = frame->getSubImage(subimage_id, eye_id);
 
-    Handle<Value> buffer = NanNewBufferHandle((char*)pixels->pixels(), pixels->height() * pixels->stride() * 3, do_nothing_free_callback, NULL);
+    Handle<Value> buffer = NanNewBufferHandle((char*)pixels->pixels(), pixels->height() * pixels->stride(), do_nothing_free_callback, NULL);
     Handle<Object> ret = NanNew<Object>();
 
     ret->Set(NanNew<String>("pixels"), buffer);
@@ -176,6 +278,18 @@ NAN_METHOD(NODE_VideoSource::NODE_getCurrentFrame) {
     NanReturnValue(ret);
 }
 
+NAN_METHOD(NODE_VideoSource::NODE_leaseFrame) {
+    NanScope();
+    NODE_VideoSource* obj = node::ObjectWrap::Unwrap<NODE_VideoSource>(args.This());
+    if(!obj->source_) NanReturnUndefined();
+
+    VideoSource::Frame* frame = obj->source_->leaseCurrentFrame();
+
+    if(!frame) NanReturnUndefined();
+
+    NanReturnValue(NODE_FrameLease::NewInstance(obj->source_, frame, args.This()));
+}
+
 NAN_METHOD(NODE_VideoSource::NODE_stop) {
     NanScope();
     NODE_VideoSource* obj = node::ObjectWrap::Unwrap<NODE_VideoSource>(args.This());
@@ -184,6 +298,7 @@ NAN_METHOD(NODE_VideoSource::NODE_stop) {
 }
 
 void NODE_init(v8::Handle<v8::Object> exports) {
+    NODE_FrameLease::Init();
     NODE_VideoSource::Init(exports);
     exports->Set(NanNew<String>("kPixelFormat_RGB24"), NanNew<Uint32>((int32_t)VideoSource::kPixelFormat_RGB24));
     exports->Set(NanNew<String>("kFrameType_Cubemap"), NanNew<Uint32>((int32_t)VideoSource::kFrameType_Cubemap));